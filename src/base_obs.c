@@ -19,7 +19,6 @@
 #include <libswiftnav/constants.h>
 #include <libswiftnav/ephemeris.h>
 #include <libswiftnav/coord_system.h>
-#include <libswiftnav/linear_algebra.h>
 
 #include "board/leds.h"
 #include "position.h"
@@ -33,6 +32,7 @@
 #include "timing.h"
 #include "base_obs.h"
 #include "ephemeris.h"
+#include "matrix_fixed.h"
 
 extern bool disable_raim;
 
@@ -169,8 +169,8 @@ static void update_obss(obss_t *new_obss)
   if (base_obss.has_pos) {
     for (u8 i=0; i < base_obss.n; i++) {
       double dx[3];
-      vector_subtract(3, base_obss.nm[i].sat_pos, base_obss.pos_ecef, dx);
-      base_obss.sat_dists[i] = vector_norm(3, dx);
+      vec3_sub(base_obss.nm[i].sat_pos, base_obss.pos_ecef, dx);
+      base_obss.sat_dists[i] = vec3_norm(dx);
     }
   }
   /* Unlock base_obss mutex. */
@@ -11,18 +11,25 @@
  * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#ifndef NAP_EMULATOR
 #include <libopencm3/stm32/f4/gpio.h>
 #include <libopencm3/stm32/f4/rcc.h>
+#endif
 #include <libsbp/sbp.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "../../error.h"
 #include "../../peripherals/spi.h"
 #include "../../sbp.h"
+#include "../../sbp_ext.h"
 #include "../../init.h"
 #include "../max2769.h"
 #include "nap_conf.h"
 #include "nap_common.h"
+#include "nap_emu.h"
 #include "nap_exti.h"
+#include "nap_xfer.h"
 
 #include <ch.h>
 
@@ -39,13 +46,30 @@ BinarySemaphore timing_strobe_sem;
  * functions for interacting with the SwiftNAP internal register interface.
  * \{ */
 
+/** Start the DWT cycle counter from zero.
+ * Only called from nap_setup(), once the STM's clock comes from the NAP.
+ * Resetting it later would break the timebase latched by
+ * nap_timing_count_read(), code timing itself should take the difference
+ * of two reads instead.
+ */
+static void nap_cycle_counter_setup(void)
+{
+  SCS_DEMCR |= 0x01000000;
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= 1;
+}
+
 /** Set up peripherals and parts of receiver related to or depended on by NAP.
  * Sets up GPIOs associated with NAP, waits for NAP to finish configuring, sets
  * up SPI, sets up MAX2769 Frontend, sets up NAP interrupt, sets up NAP
  * callbacks, gets NAP configuration parameters from FPGA flash.
+ *
+ * When built with NAP_EMULATOR there is no FPGA or frontend, the register
+ * interface is served by the NAP emulator instead, see nap_emu.c.
  */
 void nap_setup()
 {
+#ifndef NAP_EMULATOR
   /* Setup the FPGA conf done line. */
   RCC_AHB1ENR |= RCC_AHB1ENR_IOPCEN;
   gpio_mode_setup(GPIOC, GPIO_MODE_INPUT, GPIO_PUPD_NONE, GPIO1);
@@ -84,6 +108,13 @@ void nap_setup()
 
   /* Switch the STM's clock to use the Frontend clock from the NAP */
   rcc_clock_setup_hse_3v3(&hse_16_368MHz_in_130_944MHz_out_3v3);
+#else
+  nap_emu_setup();
+#endif
+
+  /* Enable the cycle counter, now locked to the NAP sample clock. It is used
+   * to extrapolate the NAP timing count and for measuring thread CPU time. */
+  nap_cycle_counter_setup();
 
   /* Set up the NAP interrupt line. */
   nap_exti_setup();
@@ -94,8 +125,13 @@ void nap_setup()
   nap_conf_rd_parameters();
 
   chBSemInit(&timing_strobe_sem, TRUE);
+
+  /* Start queueing non-tracking register accesses. */
+  nap_xfer_setup();
 }
 
+#ifndef NAP_EMULATOR
+
 /** Check if NAP configuration is finished.
  *
  * \return 1 if configuration is finished (line high), 0 if not finished (line
@@ -141,6 +177,17 @@ u8 nap_hash_rd_done(void)
   return gpio_get(GPIOA, GPIO3) ? 0 : 1;
 }
 
+#else
+
+/* The emulated NAP is always configured. */
+u8 nap_conf_done(void) { return 1; }
+void nap_conf_b_setup(void) {}
+void nap_conf_b_set(void) {}
+void nap_conf_b_clear(void) {}
+u8 nap_hash_rd_done(void) { return 1; }
+
+#endif
+
 /** Return status of NAP authentication hash comparison.
  *
  * \return Status of NAP authentication hash comparison.
@@ -184,33 +231,101 @@ void nap_callbacks_setup(void)
                    &nap_dna_node);
 }
 
-/** Do an SPI transfer to/from one of the NAP's internal registers.
+/** CPU cycles per NAP sample clock. Once nap_setup() has switched the STM32
+ * over to the frontend clock the DWT cycle counter and the NAP timing count
+ * are derived from the same oscillator, 130.944 MHz / 16.368 MHz = 8.
+ * This relies on the idle thread not stopping the core clock with WFI. */
+#define NAP_CYCLES_PER_SAMPLE 8
+
+/** Maximum age of the timebase latch before the timing count is read again.
+ * Must be well inside the 32.8 s DWT_CYCCNT wrap period. */
+#define NAP_TIMEBASE_REFRESH_MS 1000
+
+/** Transfers taking longer than this were preempted and give a poor latch.
+ * The latch is taken at the midpoint of the transfer, so it can be off by up
+ * to half of this: 2000 / 2 / 8 = 125 samples, about 7.6 us. */
+#define NAP_TIMEBASE_MAX_XFER_CYCLES 2000
+
+/** Last SPI read of the NAP timing count and the cycle count it was read at.
+ * Protected by the system lock. */
+static struct {
+  bool valid;
+  u64 count;
+  u32 cycles;
+  systime_t time;
+} timebase;
+
+static struct {
+  systime_t start;
+  u32 reads;
+  u32 saved;
+  u32 residual_max;
+} timebase_stats;
+
+/** Extrapolate the timebase latch to a given DWT cycle count.
+ * Must be called from within a system lock zone. */
+static u64 timebase_extrapolate(u32 cycles)
+{
+  return timebase.count + (s32)(cycles - timebase.cycles) / NAP_CYCLES_PER_SAMPLE;
+}
+
+/** Check whether the timebase latch can be extrapolated from.
+ * Must be called from within a system lock zone. */
+static bool timebase_fresh(void)
+{
+  return timebase.valid &&
+         (chTimeNow() - timebase.time) < MS2ST(NAP_TIMEBASE_REFRESH_MS);
+}
+
+/** Read the current NAP internal sample clock count over SPI.
+ * Also re-latches the timebase used by nap_timing_count(). Rollovers are
+ * resolved against the extrapolated timebase so concurrent readers can't
+ * double count them.
  *
- * \param reg_id   NAP register ID.
- * \param n_bytes  Number of bytes to transfer to/from register.
- * \param data_in  Array of length n_bytes to transfer to NAP register.
- * \param data_out Array of length n_bytes to transfer NAP register data into.
+ * \return NAP's internal count of sample clocks +
+ *               (total number of NAP counter rollovers) * 2^32.
  */
-void nap_xfer_blocking(u8 reg_id, u16 n_bytes, u8 data_in[],
-                       const u8 data_out[])
+u64 nap_timing_count_read(void)
 {
-  spi_slave_select(SPI_SLAVE_FPGA);
-
-  spi_xfer(SPI_BUS_FPGA, reg_id);
-
-  /* Spin for shorter transfers to avoid the overhead of context switching. */
-  if (n_bytes < 8) {
-    /* If data_in is NULL then discard read data. */
-    if (data_in)
-      for (u16 i = 0; i < n_bytes; i++)
-        data_in[i] = spi_xfer(SPI_BUS_FPGA, data_out[i]);
-    else
-      for (u16 i = 0; i < n_bytes; i++)
-        spi_xfer(SPI_BUS_FPGA, data_out[i]);
+  u8 temp[4] = { 0, 0, 0, 0 };
+
+  u32 c0 = DWT_CYCCNT;
+  nap_xfer_blocking(NAP_REG_TIMING_COUNT, 4, temp, temp);
+  u32 c1 = DWT_CYCCNT;
+
+  u32 count = (temp[0] << 24) | (temp[1] << 16) | (temp[2] << 8) | temp[3];
+  u32 cycles = c0 + (c1 - c0) / 2;
+  bool precise = (c1 - c0) < NAP_TIMEBASE_MAX_XFER_CYCLES;
+
+  chSysLock();
+
+  u64 tc;
+  bool fresh = timebase_fresh();
+  if (fresh) {
+    u64 expected = timebase_extrapolate(cycles);
+    s32 residual = count - (u32)expected;
+    tc = expected + residual;
+    if (precise)
+      timebase_stats.residual_max = MAX(timebase_stats.residual_max,
+                                        (u32)abs(residual));
   } else {
-        spi1_xfer_dma(n_bytes, data_in, data_out);
+    /* Fall back to plain rollover detection against the last read. */
+    tc = (timebase.count & 0xFFFFFFFF00000000ULL) | count;
+    if (count < (u32)timebase.count)
+      tc += 1ULL << 32;
+  }
+
+  if (precise || !fresh) {
+    timebase.count = tc;
+    timebase.cycles = cycles;
+    timebase.time = chTimeNow();
+    timebase.valid = true;
   }
-  spi_slave_deselect();
+  timebase_stats.reads++;
+
+  chSysUnlock();
+
+  return tc;
 }
 
 /** Get the current NAP internal sample clock count.
@@ -219,26 +334,45 @@ void nap_xfer_blocking(u8 reg_id, u16 n_bytes, u8 data_in[],
  * 16.368MHz sample clock frequency it rolls over approximately every 262
  * seconds.
  *
+ * Unless the timebase is stale this is extrapolated from the last SPI read
+ * using the DWT cycle counter and doesn't touch the SPI bus. The result can
+ * be off by up to NAP_TIMEBASE_MAX_XFER_CYCLES / 2 cycles, 125 samples or
+ * about 7.6 us, from where in its SPI transfer the timebase was latched. Use
+ * nap_timing_count_read() where the register value is needed.
+ *
  * \return NAP's internal count of sample clocks +
  *               (total number of NAP counter rollovers) * 2^32.
  */
 u64 nap_timing_count(void)
 {
-  static u32 rollover_count = 0;
-  static u32 prev_count = 0;
-
-  u8 temp[4] = { 0, 0, 0, 0 };
-
-  nap_xfer_blocking(NAP_REG_TIMING_COUNT, 4, temp, temp);
-
-  u32 count = (temp[0] << 24) | (temp[1] << 16) | (temp[2] << 8) | temp[3];
-
-  if (count < prev_count)
-    rollover_count++;
+  chSysLock();
+  if (timebase_fresh()) {
+    u64 tc = timebase_extrapolate(DWT_CYCCNT);
+    timebase_stats.saved++;
+    chSysUnlock();
+    return tc;
+  }
+  chSysUnlock();
 
-  prev_count = count;
+  return nap_timing_count_read();
+}
 
-  return (u64)count | ((u64)rollover_count << 32);
+/** Send timing count cache statistics since the last call. */
+void nap_timing_count_stats_send(void)
+{
+  msg_nap_timebase_stats_t msg;
+
+  chSysLock();
+  systime_t now = chTimeNow();
+  msg.period_ms = (now - timebase_stats.start) * 1000 / CH_FREQUENCY;
+  msg.spi_reads = timebase_stats.reads;
+  msg.spi_saved = timebase_stats.saved;
+  msg.residual_max = timebase_stats.residual_max;
+  memset(&timebase_stats, 0, sizeof(timebase_stats));
+  timebase_stats.start = now;
+  chSysUnlock();
+
+  sbp_send_msg(SBP_MSG_NAP_TIMEBASE_STATS, sizeof(msg), (u8 *)&msg);
 }
 
 /** Read and write the NAP's external events register
@@ -88,6 +88,8 @@ void nap_rd_dna(u8 dna[]);
 void nap_callbacks_setup(void);
 
 u64 nap_timing_count(void);
+u64 nap_timing_count_read(void);
+void nap_timing_count_stats_send(void);
 u32 nap_timing_count_latched(void);
 void nap_timing_strobe(u32 falling_edge_count);
 bool nap_timing_strobe_wait(u32 timeout);
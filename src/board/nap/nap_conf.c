@@ -22,6 +22,7 @@
 #include "acq_channel.h"
 #include "nap_conf.h"
 #include "nap_common.h"
+#include "nap_emu.h"
 #include "track_channel.h"
 
 /** \addtogroup nap
@@ -37,6 +38,11 @@
  */
 void nap_conf_rd_parameters(void)
 {
+#ifdef NAP_EMULATOR
+  nap_acq_fft_index_bits = NAP_EMU_ACQ_FFT_INDEX_BITS;
+  nap_acq_downsample_stages = NAP_EMU_ACQ_DOWNSAMPLE_STAGES;
+  nap_track_n_channels = NAP_EMU_TRACK_N_CHANNELS;
+#else
   /* Define parameters that need to be read from FPGA configuration flash.
    * Pointers in the array should be in the same order they're stored in the
    * configuration flash. */
@@ -49,6 +55,7 @@ void nap_conf_rd_parameters(void)
   /* Get parameters from FPGA configuration flash */
   for (u8 i = 0; i < (sizeof(nap_parameters) / sizeof(nap_parameters[0])); i++)
     m25_read(NAP_FLASH_PARAMS_ADDR + i, nap_parameters[i], 1);
+#endif
 
   /* Bound number of channels with used by libswiftnav MAX_CHANNELS parameter. */
   nap_track_n_channels = MIN(nap_track_n_channels, MAX_CHANNELS);
@@ -61,6 +68,10 @@ void nap_conf_rd_parameters(void)
  */
 u8 nap_conf_rd_version_string(char version_string[])
 {
+#ifdef NAP_EMULATOR
+  strcpy(version_string, NAP_EMU_VERSION_STRING);
+  return strlen(version_string) + 1;
+#else
   u8 count = 0;
   char c;
 
@@ -90,6 +101,7 @@ u8 nap_conf_rd_version_string(char version_string[])
   } while (c);
 
   return count;
+#endif
 }
 
 /** Return Piksi serial number from the configuration flash.
@@ -0,0 +1,752 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef NAP_EMULATOR
+
+#include <math.h>
+#include <string.h>
+
+#include <ch.h>
+
+#include <libswiftnav/constants.h>
+#include <libswiftnav/prns.h>
+
+#include "../../main.h"
+#include "acq_channel.h"
+#include "cw_channel.h"
+#include "nap_exti.h"
+#include "track_channel.h"
+#include "nap_emu.h"
+
+/** \addtogroup nap
+ * \{ */
+
+/** \defgroup nap_emu NAP Emulator
+ * Software model of the SwiftNAP register interface.
+ *
+ * When the firmware is built with `NAP_EMULATOR` defined all NAP register
+ * transfers end up in nap_emu_xfer() instead of on the SPI bus. The emulator
+ * keeps its own sample clock, which is advanced by nap_emu_advance(), and
+ * implements the timing strobe, IRQ and error registers and the acquisition,
+ * tracking and CW channels well enough for acq.c, track.c, cw.c and manage.c
+ * to run unmodified.
+ *
+ * Register semantics modelled:
+ *  - Tracking channels start on the timing strobe after an INIT write and
+ *    latch the UPDATE register at the start of every integration period. The
+ *    channel's IRQ bit is set at the end of each period and cleared by reading
+ *    its CORR register. A period ending with no UPDATE write since the last one
+ *    sets the channel's bit in the ERROR register.
+ *  - Acquisition and CW INIT writes are pipelined one deep. Their DONE bits are
+ *    cleared by reading CORR or by a disable write.
+ *  - Sample loads start on the timing strobe when LOAD is enabled. Writing the
+ *    acquisition code RAM also raises ACQ_LOAD_DONE.
+ *  - LOAD_DONE, TIMING_STROBE and EXT_EVENT bits and the ERROR register are
+ *    cleared when read.
+ *
+ * The correlations themselves come from a pluggable signal source, by default
+ * an analytic model of a set of satellites (triangular code correlation, sinc
+ * frequency roll-off, random nav data bits and Gaussian noise scaled by C/N0).
+ * \{ */
+
+/** Sample clock advanced per emulator tick. */
+#define NAP_EMU_TICK_MS 1
+/** RMS of the 2-bit samples, sets the correlation scale. */
+#define NAP_EMU_SAMPLE_RMS 2.0
+/** Mean acquisition tap power reported with noise only. */
+#define NAP_EMU_ACQ_NOISE_POWER 256.0
+/** Samples loaded into the CW channel sample RAM per correlation. */
+#define NAP_EMU_CW_SAMPLES 1024
+/** Default RNG seed. */
+#define NAP_EMU_DEFAULT_SEED 0x5EED5EED5EED5EEDULL
+
+#define CORR_MAX ((1 << 23) - 1)
+
+typedef struct {
+  bool armed;           /**< INIT written, start on next timing strobe. */
+  bool running;
+  bool updated;         /**< UPDATE written since the last period ended. */
+  u8 prn;
+
+  /* Register contents. */
+  u64 init_code_phase;
+  s64 init_carrier_phase;
+  u32 upd_code_phase_rate;
+  s32 upd_carrier_freq;
+  u8 upd_rollover;
+
+  /* NCO for the period in progress. */
+  nap_emu_nco_t nco;
+  u8 rollover;
+
+  /* Latched results. */
+  u8 corr[2*3*3 + 3];
+  u8 phase[9];
+} emu_track_t;
+
+typedef struct {
+  bool busy;
+  bool pending;
+  u64 done_at;
+  s32 cf;
+  s32 cf_pending;
+  u64 load_start;
+  bool load_enabled;
+  u8 result[7];
+} emu_acq_t;
+
+static struct {
+  u64 count;
+  u32 irq;
+  u32 error;
+
+  bool strobe_pending;
+  u32 strobe_compare;
+  u32 strobe_latched;
+
+  emu_track_t track[NAP_MAX_N_TRACK_CHANNELS];
+
+  u8 acq_prn;
+  emu_acq_t acq;
+  bool acq_load_busy;
+  u64 acq_load_done_at;
+
+  emu_acq_t cw;
+  bool cw_load_busy;
+  u64 cw_load_done_at;
+  u64 cw_load_start;
+} emu;
+
+static Mutex emu_mutex;
+static u64 rng_state = NAP_EMU_DEFAULT_SEED;
+/** Advance the sample clock from the emulator thread, see nap_emu_free_run(). */
+static volatile bool free_run = true;
+
+static nap_emu_sat_t sats[NAP_EMU_MAX_SATS];
+static const nap_emu_source_t *source;
+
+static WORKING_AREA_CCM(wa_nap_emu, 2048);
+
+/* ---------- Random numbers ---------- */
+
+/** Seed the emulator's noise generator. The same seed and sequence of
+ * register accesses gives the same correlations. */
+void nap_emu_seed(u64 seed)
+{
+  rng_state = seed ? seed : NAP_EMU_DEFAULT_SEED;
+}
+
+/** xorshift64* uniform in (0, 1). */
+static double rand_uniform(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (((rng_state * 2685821657736338717ULL) >> 11) + 0.5)
+         * (1.0 / 9007199254740992.0);
+}
+
+/** Unit variance Gaussian noise sample. */
+double nap_emu_rand_gaussian(void)
+{
+  return sqrt(-2 * log(rand_uniform())) * cos(2 * M_PI * rand_uniform());
+}
+
+/* ---------- Analytic signal model ---------- */
+
+static double sinc(double x)
+{
+  return (fabs(x) < 1e-9) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+}
+
+static double code_corr(double tau)
+{
+  return MAX(0.0, 1.0 - fabs(tau));
+}
+
+static const nap_emu_sat_t *sat_lookup(u8 prn)
+{
+  if (prn < NAP_EMU_MAX_SATS && sats[prn].visible)
+    return &sats[prn];
+  return NULL;
+}
+
+static double sat_code_phase(const nap_emu_sat_t *s, double t)
+{
+  double rate = GPS_CA_CHIPPING_RATE * (1 + s->doppler / GPS_L1_HZ);
+  return fmod(s->code_phase + t * rate, 1023.0);
+}
+
+/** Nav data bit sent at time t, changing every 20 code epochs. The bits are
+ * random but the same on every run. */
+static double sat_nav_bit(const nap_emu_sat_t *s, double t)
+{
+  double rate = GPS_CA_CHIPPING_RATE * (1 + s->doppler / GPS_L1_HZ);
+  u64 x = (u64)((s->code_phase + t * rate) / (20 * 1023.0))
+          * 0x9E3779B97F4A7C15ULL + s->prn;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  return ((x * 2685821657736338717ULL) >> 63) ? -1.0 : 1.0;
+}
+
+static void analytic_track(void *ctx, u8 prn, const nap_emu_nco_t *nco,
+                           corr_t corrs[3])
+{
+  (void)ctx;
+  double n = nco->n_samples;
+  double sigma = NAP_EMU_SAMPLE_RMS * sqrt(n);
+  double re[3] = {0, 0, 0}, im[3] = {0, 0, 0};
+
+  const nap_emu_sat_t *s = sat_lookup(prn);
+  if (s) {
+    double T = n / SAMPLE_FREQ;
+    double t0 = (double)nco->start / SAMPLE_FREQ;
+
+    /* Code error of the prompt replica at the middle of the period. */
+    double early_mid = (nco->code_phase + (n / 2) * nco->code_phase_rate)
+                       / (double)NAP_TRACK_CODE_PHASE_UNITS_PER_CHIP;
+    double tau = fmod(early_mid - 0.5 - sat_code_phase(s, t0 + T / 2), 1023.0);
+    if (tau > 511.5)
+      tau -= 1023.0;
+    else if (tau < -511.5)
+      tau += 1023.0;
+
+    double df = s->doppler - nco->carrier_freq / NAP_TRACK_CARRIER_FREQ_UNITS_PER_HZ;
+    double dphi = s->carr_phase + s->doppler * t0
+                  - nco->carrier_phase / (double)(1 << 24);
+    double phi = 2 * M_PI * (dphi + df * T / 2);
+
+    double amp = sigma * sqrt(2 * pow(10, s->cn0 / 10) * T) * sinc(df * T)
+                 * sat_nav_bit(s, t0 + T / 2);
+    const double offsets[3] = {0.5, 0, -0.5};
+    for (u8 i = 0; i < 3; i++) {
+      double a = amp * code_corr(tau + offsets[i]);
+      re[i] = a * cos(phi);
+      im[i] = a * sin(phi);
+    }
+  }
+
+  for (u8 i = 0; i < 3; i++) {
+    corrs[i].I = (s32)MAX(-CORR_MAX, MIN(CORR_MAX,
+                   re[i] + sigma * nap_emu_rand_gaussian()));
+    corrs[i].Q = (s32)MAX(-CORR_MAX, MIN(CORR_MAX,
+                   im[i] + sigma * nap_emu_rand_gaussian()));
+  }
+}
+
+static void analytic_acq(void *ctx, u8 prn, u64 load_start, double cf_hz,
+                         u16 *index, u16 *max, float *ave)
+{
+  (void)ctx;
+  u32 n_taps = 1 << nap_acq_fft_index_bits;
+  u32 units = NAP_ACQ_CODE_PHASE_UNITS_PER_CHIP;
+  double T = n_taps / (double)NAP_ACQ_SAMPLE_FREQ;
+
+  /* Largest of n_taps exponentially distributed noise powers. */
+  double gumbel = -log(-log(rand_uniform()));
+  double peak = NAP_EMU_ACQ_NOISE_POWER * (log(n_taps) + gumbel);
+  *index = (u16)(rand_uniform() * 1023 * units) % (1023 * units);
+
+  const nap_emu_sat_t *s = sat_lookup(prn);
+  if (s) {
+    double loss = sinc((cf_hz - s->doppler) * T);
+    double snr = pow(10, s->cn0 / 10) * T * loss * loss;
+    double p = NAP_EMU_ACQ_NOISE_POWER *
+               (1 + snr + sqrt(2 * snr) * nap_emu_rand_gaussian());
+    if (p > peak) {
+      peak = p;
+      double cp = sat_code_phase(s, (double)load_start / SAMPLE_FREQ);
+      *index = (u32)lround((1023.0 - cp) * units) % (1023 * units);
+    }
+  }
+
+  *max = MIN(peak, 65535.0);
+  *ave = NAP_EMU_ACQ_NOISE_POWER;
+}
+
+static void analytic_cw(void *ctx, u64 start, u32 n_samples, double freq_hz,
+                        corr_t *corr)
+{
+  (void)ctx; (void)start; (void)freq_hz;
+  double sigma = NAP_EMU_SAMPLE_RMS * sqrt(n_samples);
+  corr->I = sigma * nap_emu_rand_gaussian();
+  corr->Q = sigma * nap_emu_rand_gaussian();
+}
+
+static const nap_emu_source_t analytic_source = {
+  .track = analytic_track,
+  .acq = analytic_acq,
+  .cw = analytic_cw,
+  .ctx = NULL,
+};
+
+/* ---------- Register packing ---------- */
+
+static void put_be(u8 *p, u32 v, u8 n)
+{
+  for (u8 i = 0; i < n; i++)
+    p[i] = v >> (8 * (n - 1 - i));
+}
+
+static u32 get_be(const u8 *p, u8 n)
+{
+  u32 v = 0;
+  for (u8 i = 0; i < n; i++)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+static s32 sign_extend(u32 v, u8 bits)
+{
+  return (s32)(v << (32 - bits)) >> (32 - bits);
+}
+
+/** Inverse of nap_track_corr_unpack(). */
+static void track_corr_pack(u8 packed[], u32 sample_count, const corr_t corrs[])
+{
+  put_be(&packed[0], sample_count, 3);
+  for (u8 i = 0; i < 3; i++) {
+    put_be(&packed[6 * (3 - i - 1) + 3], corrs[i].Q, 3);
+    put_be(&packed[6 * (3 - i - 1) + 6], corrs[i].I, 3);
+  }
+}
+
+/* ---------- Tracking channels ---------- */
+
+/** Latch the UPDATE register and work out when the new period ends. */
+static void track_period_start(emu_track_t *t, u64 start)
+{
+  t->nco.start = start;
+  t->nco.code_phase_rate = t->upd_code_phase_rate;
+  t->nco.carrier_freq = t->upd_carrier_freq;
+  t->rollover = t->upd_rollover;
+
+  if (t->nco.code_phase_rate == 0) {
+    /* Disabled, see tracking_channel_disable(). */
+    t->running = false;
+    return;
+  }
+
+  u64 target = (u64)(t->rollover + 1) * 1023 * NAP_TRACK_CODE_PHASE_UNITS_PER_CHIP;
+  t->nco.n_samples = (target - t->nco.code_phase + t->nco.code_phase_rate - 1)
+                     / t->nco.code_phase_rate;
+}
+
+static void track_period_end(u8 channel)
+{
+  emu_track_t *t = &emu.track[channel];
+
+  corr_t corrs[3];
+  source->track(source->ctx, t->prn, &t->nco, corrs);
+  track_corr_pack(t->corr, t->nco.n_samples, corrs);
+
+  if (emu.irq & (1 << channel) && !t->updated)
+    emu.error |= 1 << channel;
+  emu.irq |= 1 << channel;
+  t->updated = false;
+
+  u64 target = (u64)(t->rollover + 1) * 1023 * NAP_TRACK_CODE_PHASE_UNITS_PER_CHIP;
+  t->nco.code_phase += (u64)t->nco.n_samples * t->nco.code_phase_rate - target;
+  t->nco.carrier_phase += (s64)t->nco.n_samples * t->nco.carrier_freq;
+
+  put_be(&t->phase[0], t->nco.code_phase >> 16, 4);
+  put_be(&t->phase[4], t->nco.code_phase, 2);
+  put_be(&t->phase[6], t->nco.carrier_phase, 3);
+
+  track_period_start(t, t->nco.start + t->nco.n_samples);
+}
+
+static void track_xfer(u8 channel, u8 reg, u16 n_bytes, u8 data_in[],
+                       const u8 data_out[])
+{
+  emu_track_t *t = &emu.track[channel];
+
+  switch (reg) {
+  case NAP_REG_TRACK_INIT_OFFSET:
+    if (n_bytes < 6)
+      break;
+    t->prn = data_out[5] & 0x1F;
+    t->init_code_phase =
+      (u64)(((data_out[0] & 0x07) << 16 | data_out[1] << 8 |
+             (data_out[2] & 0xE0)) >> 5)
+      * (NAP_TRACK_CODE_PHASE_UNITS_PER_CHIP / NAP_TRACK_INIT_CODE_PHASE_UNITS_PER_CHIP);
+    t->init_carrier_phase = sign_extend(
+      ((data_out[2] & 0x1F) << 24 | data_out[3] << 16 |
+       data_out[4] << 8 | (data_out[5] & 0xE0)) >> 5, 24);
+    t->running = false;
+    t->armed = true;
+    break;
+
+  case NAP_REG_TRACK_UPDATE_OFFSET:
+    if (n_bytes < 8)
+      break;
+    t->upd_code_phase_rate = get_be(data_out, 4) & 0x1FFFFFFF;
+    t->upd_carrier_freq = sign_extend((data_out[4] & 0x01) << 16 |
+                                      data_out[5] << 8 | data_out[6], 17);
+    t->upd_rollover = data_out[7];
+    t->updated = true;
+    break;
+
+  case NAP_REG_TRACK_CORR_OFFSET:
+    if (data_in)
+      memcpy(data_in, t->corr, MIN(n_bytes, sizeof(t->corr)));
+    emu.irq &= ~(1 << channel);
+    break;
+
+  case NAP_REG_TRACK_PHASE_OFFSET:
+    if (data_in)
+      memcpy(data_in, t->phase, MIN(n_bytes, sizeof(t->phase)));
+    break;
+
+  case NAP_REG_TRACK_CODE_OFFSET:
+    /* The INIT register also carries the PRN, no need to decode the code. */
+    break;
+  }
+}
+
+/* ---------- Acquisition and CW channels ---------- */
+
+static u64 acq_search_samples(void)
+{
+  return (1 << nap_acq_fft_index_bits) * 4 * nap_acq_downsample_stages;
+}
+
+static void acq_start(emu_acq_t *a, s32 cf, u64 duration)
+{
+  a->busy = true;
+  a->cf = cf;
+  a->done_at = emu.count + duration;
+}
+
+static void acq_init_write(emu_acq_t *a, bool enable, s32 cf, u32 done_irq,
+                           u64 duration)
+{
+  if (!enable) {
+    a->pending = false;
+    emu.irq &= ~done_irq;
+  } else if (a->busy) {
+    a->cf_pending = cf;
+    a->pending = true;
+  } else {
+    acq_start(a, cf, duration);
+  }
+}
+
+static void acq_done(void)
+{
+  emu_acq_t *a = &emu.acq;
+  u16 index, max;
+  float ave;
+
+  source->acq(source->ctx, emu.acq_prn, a->load_start,
+              a->cf / NAP_ACQ_CARRIER_FREQ_UNITS_PER_HZ, &index, &max, &ave);
+  put_be(&a->result[0], max, 2);
+  put_be(&a->result[2], ave * 256, 3);
+  put_be(&a->result[5], index << (16 - nap_acq_fft_index_bits), 2);
+
+  a->busy = false;
+  emu.irq |= NAP_IRQ_ACQ_DONE;
+  if (a->pending) {
+    a->pending = false;
+    acq_start(a, a->cf_pending, acq_search_samples());
+  }
+}
+
+static void cw_done(void)
+{
+  emu_acq_t *c = &emu.cw;
+  corr_t corr;
+
+  source->cw(source->ctx, emu.cw_load_start, NAP_EMU_CW_SAMPLES,
+             c->cf / NAP_CW_FREQ_UNITS_PER_HZ, &corr);
+  put_be(&c->result[0], corr.Q, 3);
+  put_be(&c->result[3], corr.I, 3);
+
+  c->busy = false;
+  emu.irq |= NAP_IRQ_CW_DONE;
+  if (c->pending) {
+    c->pending = false;
+    acq_start(c, c->cf_pending, NAP_EMU_CW_SAMPLES);
+  }
+}
+
+/* ---------- Timing strobe ---------- */
+
+static void timing_strobe(void)
+{
+  emu.strobe_pending = false;
+  emu.irq |= NAP_IRQ_TIMING_STROBE;
+
+  for (u8 i = 0; i < NAP_MAX_N_TRACK_CHANNELS; i++) {
+    emu_track_t *t = &emu.track[i];
+    if (!t->armed)
+      continue;
+    t->armed = false;
+    t->running = true;
+    t->nco.code_phase = t->init_code_phase;
+    t->nco.carrier_phase = t->init_carrier_phase;
+    track_period_start(t, emu.count);
+  }
+
+  if (emu.acq.load_enabled && !emu.acq_load_busy) {
+    emu.acq.load_start = emu.count;
+    emu.acq_load_busy = true;
+    emu.acq_load_done_at = emu.count + acq_search_samples();
+  }
+
+  if (emu.cw.load_enabled && !emu.cw_load_busy) {
+    emu.cw_load_start = emu.count;
+    emu.cw_load_busy = true;
+    emu.cw_load_done_at = emu.count + NAP_EMU_CW_SAMPLES;
+  }
+}
+
+/* ---------- Public interface ---------- */
+
+/** Emulate an SPI transfer to/from one of the NAP's internal registers.
+ * Same interface as the SPI path of nap_xfer_blocking().
+ */
+void nap_emu_xfer(u8 reg_id, u16 n_bytes, u8 data_in[], const u8 data_out[])
+{
+  u8 out[8] = {0};
+
+  chMtxLock(&emu_mutex);
+
+  if (reg_id >= NAP_REG_TRACK_BASE &&
+      reg_id < NAP_REG_TRACK_BASE + NAP_MAX_N_TRACK_CHANNELS*NAP_TRACK_N_REGS) {
+    u8 offset = reg_id - NAP_REG_TRACK_BASE;
+    track_xfer(offset / NAP_TRACK_N_REGS, offset % NAP_TRACK_N_REGS,
+               n_bytes, data_in, data_out);
+    chMtxUnlock();
+    return;
+  }
+
+  switch (reg_id) {
+  case NAP_REG_IRQ:
+    put_be(out, emu.irq, 4);
+    emu.irq &= ~(NAP_IRQ_ACQ_LOAD_DONE | NAP_IRQ_CW_LOAD_DONE |
+                 NAP_IRQ_TIMING_STROBE | NAP_IRQ_EXT_EVENT);
+    break;
+
+  case NAP_REG_ERROR:
+    put_be(out, emu.error, 4);
+    emu.error = 0;
+    break;
+
+  case NAP_REG_TIMING_COUNT:
+    put_be(out, emu.count, 4);
+    break;
+
+  case NAP_REG_TIMING_COUNT_LATCH:
+    put_be(out, emu.strobe_latched, 4);
+    break;
+
+  case NAP_REG_TIMING_COMPARE:
+    emu.strobe_compare = get_be(data_out, 4);
+    emu.strobe_latched = emu.count;
+    emu.strobe_pending = true;
+    break;
+
+  case NAP_REG_HASH_STATUS:
+    out[0] = NAP_HASH_MATCH;
+    break;
+
+  case NAP_REG_DNA:
+    memcpy(out, "NAP_EMU", 8);
+    break;
+
+  case NAP_REG_ACQ_LOAD:
+    emu.acq.load_enabled = data_out[0] != 0;
+    break;
+
+  case NAP_REG_ACQ_INIT:
+    acq_init_write(&emu.acq, n_bytes == 2, sign_extend(get_be(data_out, 2), 16),
+                   NAP_IRQ_ACQ_DONE, acq_search_samples());
+    break;
+
+  case NAP_REG_ACQ_CORR:
+    memcpy(out, emu.acq.result, sizeof(emu.acq.result));
+    emu.irq &= ~NAP_IRQ_ACQ_DONE;
+    break;
+
+  case NAP_REG_ACQ_CODE:
+    for (u8 prn = 0; prn < 32; prn++)
+      if (memcmp(data_out, ca_code(prn), n_bytes) == 0)
+        emu.acq_prn = prn;
+    emu.irq |= NAP_IRQ_ACQ_LOAD_DONE;
+    break;
+
+  case NAP_REG_CW_LOAD:
+    emu.cw.load_enabled = data_out[0] != 0;
+    emu.irq &= ~NAP_IRQ_CW_LOAD_DONE;
+    break;
+
+  case NAP_REG_CW_INIT:
+    acq_init_write(&emu.cw, data_out[0] & (1 << 3),
+                   sign_extend((data_out[0] & 0x07) << 16 |
+                               data_out[1] << 8 | data_out[2], 19),
+                   NAP_IRQ_CW_DONE, NAP_EMU_CW_SAMPLES);
+    break;
+
+  case NAP_REG_CW_CORR:
+    memcpy(out, emu.cw.result, sizeof(emu.cw.result));
+    emu.irq &= ~NAP_IRQ_CW_DONE;
+    break;
+
+  default:
+    /* External events and anything else read as zero. */
+    break;
+  }
+
+  if (data_in)
+    for (u16 i = 0; i < n_bytes; i++)
+      data_in[i] = (i < sizeof(out)) ? out[i] : 0;
+
+  chMtxUnlock();
+}
+
+/** Check whether the emulated NAP IRQ line is high. */
+bool nap_emu_irq_line(void)
+{
+  return emu.irq != 0;
+}
+
+/** Current emulated sample count. */
+u64 nap_emu_sample_count(void)
+{
+  return emu.count;
+}
+
+/** Advance the emulated sample clock, running all channel events that fall
+ * within the next n_samples.
+ */
+void nap_emu_advance(u32 n_samples)
+{
+  chMtxLock(&emu_mutex);
+
+  u64 end = emu.count + n_samples;
+  while (emu.count < end) {
+    /* Find the next event. */
+    u64 next = end;
+    if (emu.strobe_pending)
+      next = MIN(next, emu.count + (u32)(emu.strobe_compare - (u32)emu.count));
+    if (emu.acq_load_busy)
+      next = MIN(next, emu.acq_load_done_at);
+    if (emu.acq.busy)
+      next = MIN(next, emu.acq.done_at);
+    if (emu.cw_load_busy)
+      next = MIN(next, emu.cw_load_done_at);
+    if (emu.cw.busy)
+      next = MIN(next, emu.cw.done_at);
+    for (u8 i = 0; i < NAP_MAX_N_TRACK_CHANNELS; i++)
+      if (emu.track[i].running)
+        next = MIN(next, emu.track[i].nco.start + emu.track[i].nco.n_samples);
+
+    emu.count = next;
+
+    if (emu.strobe_pending && (u32)emu.count == emu.strobe_compare)
+      timing_strobe();
+    if (emu.acq_load_busy && emu.count >= emu.acq_load_done_at) {
+      emu.acq_load_busy = false;
+      emu.irq |= NAP_IRQ_ACQ_LOAD_DONE;
+    }
+    if (emu.acq.busy && emu.count >= emu.acq.done_at)
+      acq_done();
+    if (emu.cw_load_busy && emu.count >= emu.cw_load_done_at) {
+      emu.cw_load_busy = false;
+      emu.irq |= NAP_IRQ_CW_LOAD_DONE;
+    }
+    if (emu.cw.busy && emu.count >= emu.cw.done_at)
+      cw_done();
+    for (u8 i = 0; i < NAP_MAX_N_TRACK_CHANNELS; i++)
+      while (emu.track[i].running &&
+             emu.count >= emu.track[i].nco.start + emu.track[i].nco.n_samples)
+        track_period_end(i);
+  }
+
+  chMtxUnlock();
+}
+
+/** Set up or replace an emulated satellite for the analytic signal model. */
+void nap_emu_sat_set(const nap_emu_sat_t *sat)
+{
+  if (sat->prn < NAP_EMU_MAX_SATS)
+    sats[sat->prn] = *sat;
+}
+
+/** Replace the source of correlations, NULL restores the analytic model. */
+void nap_emu_source_set(const nap_emu_source_t *s)
+{
+  source = s ? s : &analytic_source;
+}
+
+/** Start or stop the emulator thread advancing the sample clock in step with
+ * the system time. When stopped the clock only moves with nap_emu_advance(),
+ * e.g. for a benchmark to step the channels itself. */
+void nap_emu_free_run(bool enable)
+{
+  free_run = enable;
+}
+
+static msg_t nap_emu_thread(void *arg)
+{
+  (void)arg;
+  chRegSetThreadName("NAP emulator");
+
+  systime_t time = chTimeNow();
+  while (TRUE) {
+    time += MS2ST(NAP_EMU_TICK_MS);
+    chThdSleepUntil(time);
+
+    if (!free_run)
+      continue;
+
+    nap_emu_advance(SAMPLE_FREQ / 1000 * NAP_EMU_TICK_MS);
+    if (nap_emu_irq_line())
+      nap_exti_signal();
+  }
+
+  return 0;
+}
+
+/** Set up the NAP emulator.
+ * Populates a default constellation of eight satellites and starts the thread
+ * that advances the sample clock in step with the system time.
+ */
+void nap_emu_setup(void)
+{
+  chMtxInit(&emu_mutex);
+  memset(&emu, 0, sizeof(emu));
+  source = &analytic_source;
+
+  for (u8 i = 0; i < 8; i++) {
+    nap_emu_sat_t s = {
+      .prn = 3 * i + 1,
+      .visible = true,
+      .cn0 = 40 + i,
+      .doppler = -3500 + 1000 * i,
+      .code_phase = 127.3 * i,
+      .carr_phase = 0,
+    };
+    nap_emu_sat_set(&s);
+  }
+
+  chThdCreateStatic(wa_nap_emu, sizeof(wa_nap_emu), HIGHPRIO,
+                    nap_emu_thread, NULL);
+}
+
+/** \} */
+
+/** \} */
+
+#endif  /* NAP_EMULATOR */
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_NAP_EMU_H
+#define SWIFTNAV_NAP_EMU_H
+
+#include <libswiftnav/common.h>
+
+#include "nap_common.h"
+
+/** \addtogroup nap_emu
+ * \{ */
+
+/** NAP configuration parameters reported by the emulator in place of those
+ * read from the FPGA configuration flash. */
+#define NAP_EMU_ACQ_FFT_INDEX_BITS    12
+#define NAP_EMU_ACQ_DOWNSAMPLE_STAGES 1
+#define NAP_EMU_TRACK_N_CHANNELS      12
+#define NAP_EMU_VERSION_STRING        "v0.16-emu"
+
+/** Maximum number of emulated satellites. */
+#define NAP_EMU_MAX_SATS 32
+
+/** An emulated satellite signal, used by the built-in analytic signal model. */
+typedef struct {
+  u8 prn;             /**< PRN (0-31). */
+  bool visible;       /**< Signal present. */
+  float cn0;          /**< Carrier to noise density [dB-Hz]. */
+  double doppler;     /**< Carrier Doppler [Hz]. */
+  double code_phase;  /**< Code phase at sample count 0 [chips]. */
+  double carr_phase;  /**< Carrier phase at sample count 0 [cycles]. */
+} nap_emu_sat_t;
+
+/** State of a tracking channel NCO over one integration period. Phases and
+ * rates are in NAP register units, see track_channel.h. */
+typedef struct {
+  u64 start;          /**< Sample count at the start of the period. */
+  u32 n_samples;      /**< Length of the period in samples. */
+  u64 code_phase;     /**< Early code phase at start [2^-32 chips]. */
+  u32 code_phase_rate;/**< Code phase increment per sample [2^-32 chips]. */
+  s64 carrier_phase;  /**< Carrier phase at start [2^-24 cycles]. */
+  s32 carrier_freq;   /**< Carrier phase increment per sample [2^-24 cycles]. */
+} nap_emu_nco_t;
+
+/** Source of correlations for the emulator.
+ * The emulator implements the NAP register interface and channel timing and
+ * asks the signal source for the correlation results. The built-in source is
+ * an analytic model of the satellites set with nap_emu_sat_set(), sample
+ * domain sources (e.g. a recorded IF file through a software correlator) can
+ * be swapped in with nap_emu_source_set().
+ */
+typedef struct {
+  /** Early, prompt and late correlations for one tracking period. */
+  void (*track)(void *ctx, u8 prn, const nap_emu_nco_t *nco, corr_t corrs[3]);
+  /** One acquisition FFT over the samples loaded at load_start.
+   * Returns values as read from the ACQ_CORR register. */
+  void (*acq)(void *ctx, u8 prn, u64 load_start, double cf_hz,
+              u16 *index, u16 *max, float *ave);
+  /** CW channel correlation over n_samples starting at start. */
+  void (*cw)(void *ctx, u64 start, u32 n_samples, double freq_hz,
+             corr_t *corr);
+  void *ctx;
+} nap_emu_source_t;
+
+/** \} */
+
+void nap_emu_setup(void);
+void nap_emu_xfer(u8 reg_id, u16 n_bytes, u8 data_in[], const u8 data_out[]);
+bool nap_emu_irq_line(void);
+void nap_emu_advance(u32 n_samples);
+void nap_emu_free_run(bool enable);
+u64 nap_emu_sample_count(void);
+void nap_emu_seed(u64 seed);
+double nap_emu_rand_gaussian(void);
+void nap_emu_sat_set(const nap_emu_sat_t *sat);
+void nap_emu_source_set(const nap_emu_source_t *source);
+
+#endif  /* SWIFTNAV_NAP_EMU_H */
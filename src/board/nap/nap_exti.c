@@ -11,9 +11,11 @@
  * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#ifndef NAP_EMULATOR
 #include <libopencm3/stm32/exti.h>
 #include <libopencm3/stm32/f4/gpio.h>
 #include <libopencm3/stm32/f4/rcc.h>
+#endif
 
 #include <ch.h>
 
@@ -23,9 +25,12 @@
 #include "../../cw.h"
 #include "../../track.h"
 #include "nap_common.h"
+#include "nap_emu.h"
 #include "track_channel.h"
 #include "../../ext_events.h"
+#include "../../sched_stats.h"
 #include "../../system_monitor.h"
+#include "../../trace.h"
 
 /** \addtogroup nap
  * \{ */
@@ -41,6 +46,8 @@ static u32 nap_irq_rd_blocking(void);
 
 static BinarySemaphore nap_exti_sem;
 
+#ifndef NAP_EMULATOR
+
 /** Set up NAP GPIO interrupt.
  * Interrupt alerts STM that a channel in NAP needs to be serviced.
  */
@@ -74,6 +81,8 @@ void exti1_isr(void)
   chSysLockFromIsr();
 
   exti_reset_request(EXTI1);
+  trace_event(TRACE_EVENT_NAP_IRQ, 0);
+  sched_latency_isr(SCHED_LATENCY_NAP_EXTI);
 
   /* Wake up processing thread */
   chBSemSignalI(&nap_exti_sem);
@@ -82,6 +91,39 @@ void exti1_isr(void)
   CH_IRQ_EPILOGUE();
 }
 
+/** Check the level of the NAP IRQ line. */
+static bool nap_irq_line(void)
+{
+  return GPIOA_IDR & GPIO1;
+}
+
+#else
+
+/** Set up servicing of the emulated NAP's IRQ line. */
+void nap_exti_setup(void)
+{
+  chBSemInit(&nap_exti_sem, TRUE);
+  chThdCreateStatic(wa_nap_exti, sizeof(wa_nap_exti), HIGHPRIO-1, nap_exti_thread, NULL);
+}
+
+/** Wake up the NAP ISR thread, called by the emulator when its IRQ line is
+ * high. Takes the place of exti1_isr(). */
+void nap_exti_signal(void)
+{
+  trace_event(TRACE_EVENT_NAP_IRQ, 0);
+  chSysLock();
+  sched_latency_isr(SCHED_LATENCY_NAP_EXTI);
+  chBSemSignalI(&nap_exti_sem);
+  chSchRescheduleS();
+  chSysUnlock();
+}
+
+static bool nap_irq_line(void)
+{
+  return nap_emu_irq_line();
+}
+
+#endif
 
 static void handle_nap_exti(void)
 {
@@ -89,6 +131,8 @@ static void handle_nap_exti(void)
    * serious breakage. */
   extern BinarySemaphore timing_strobe_sem;
 
+  trace_event(TRACE_EVENT_NAP_START, 0);
+
   u32 irq = nap_irq_rd_blocking();
 
   if (irq & NAP_IRQ_ACQ_DONE)
@@ -124,11 +168,15 @@ static void handle_nap_exti(void)
 
     /* Test if the nth tracking irq flag is set, if so service it. */
     if ((irq >> n) & 1) {
+      trace_event(TRACE_EVENT_TRACK_START, n);
       tracking_channel_get_corrs(n);
       tracking_channel_update(n);
+      trace_event(TRACE_EVENT_TRACK_END, n);
     }
   }
 
+  trace_event(TRACE_EVENT_NAP_END, irq);
+
   watchdog_notify(WD_NOTIFY_NAP_ISR);
   nap_exti_count++;
 }
@@ -141,13 +189,17 @@ static msg_t nap_exti_thread(void *arg)
   while (TRUE) {
     /* Waiting for the IRQ to happen.*/
     chBSemWait(&nap_exti_sem);
+    sched_latency_wake(SCHED_LATENCY_NAP_EXTI);
 
     /* We need a level (not edge) sensitive interrupt -
      * if there is another interrupt pending on the Swift
      * NAP then the IRQ line will stay high. Therefore if
      * the line is still high, don't suspend the thread.
      */
-    while (GPIOA_IDR & GPIO1) {
+    while (nap_irq_line()) {
+      /* An interrupt raised since the IRQ register was last read is serviced
+       * now, not after a wake-up. */
+      sched_latency_discard(SCHED_LATENCY_NAP_EXTI);
       handle_nap_exti();
     }
 
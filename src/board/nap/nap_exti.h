@@ -39,6 +39,7 @@
 /** \} */
 
 void nap_exti_setup(void);
+void nap_exti_signal(void);
 u32 last_nap_exti_count(void);
 void wait_for_nap_exti(void);
 
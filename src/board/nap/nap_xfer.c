@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <string.h>
+
+#include <ch.h>
+
+#include "../../peripherals/spi.h"
+#include "../../sbp.h"
+#include "acq_channel.h"
+#include "cw_channel.h"
+#include "nap_common.h"
+#include "nap_emu.h"
+#include "track_channel.h"
+#include "nap_xfer.h"
+
+/** \addtogroup nap
+ * \{ */
+
+/** \defgroup nap_xfer NAP Register Access
+ * Prioritised access to the SwiftNAP register interface.
+ *
+ * Each NAP register belongs to a client (tracking, acquisition, CW or
+ * diagnostics). Tracking transfers are latency critical and are done
+ * directly in the calling thread, as are transfers from any thread above the
+ * NAP SPI thread. The NAP ISR thread also services the acquisition, CW and
+ * external event interrupts, and queueing those would hold up the tracking
+ * updates that follow them in the same pass. All other transfers are put on a
+ * per-client queue and done by the NAP SPI thread, always taking the highest
+ * priority client with work pending. Transfers can't be interrupted once started but
+ * this way a backlog of acquisition or diagnostic traffic only ever holds up
+ * tracking for a single transfer.
+ *
+ * nap_xfer_submit() queues a transaction without waiting for it, completion
+ * is signalled through an optional callback and the transaction's semaphore.
+ * nap_xfer_blocking() keeps its existing semantics on top of this.
+ *
+ * Bus time and queueing delay are accounted per client and reported with
+ * nap_xfer_stats_send().
+ * \{ */
+
+/** DWT cycles per microsecond. */
+#define NAP_XFER_CYCLES_PER_US 130.944
+
+/** Below the NAP ISR (tracking) and solution threads so queued work can't
+ * hold them up, above everything else that talks to the NAP. */
+#define NAP_XFER_THREAD_PRIO (HIGHPRIO-3)
+
+static WORKING_AREA_CCM(wa_nap_xfer, 1024);
+static Thread *nap_xfer_tp;
+
+static Semaphore nap_xfer_pending;
+
+static struct {
+  nap_xfer_t *head;
+  nap_xfer_t *tail;
+} queues[NAP_N_CLIENTS];
+
+static struct {
+  systime_t start;
+  struct {
+    u32 xfers;
+    u32 bytes;
+    u32 busy_cycles;
+    u32 wait_max_cycles;
+  } client[NAP_N_CLIENTS];
+} stats;
+
+/** Find which client a NAP register belongs to.
+ *
+ * \param reg_id NAP register ID.
+ * \return Client the register's transfers are accounted and queued under.
+ */
+nap_client_t nap_xfer_client(u8 reg_id)
+{
+  if (reg_id >= NAP_REG_TRACK_BASE &&
+      reg_id < NAP_REG_TRACK_BASE + NAP_MAX_N_TRACK_CHANNELS*NAP_TRACK_N_REGS)
+    return NAP_CLIENT_TRACK;
+
+  if (reg_id >= NAP_REG_ACQ_BASE && reg_id <= NAP_REG_ACQ_CODE)
+    return NAP_CLIENT_ACQ;
+
+  if (reg_id >= NAP_REG_CW_BASE && reg_id <= NAP_REG_CW_CORR)
+    return NAP_CLIENT_CW;
+
+  switch (reg_id) {
+  case NAP_REG_IRQ:
+  case NAP_REG_TIMING_COMPARE:
+  case NAP_REG_TIMING_COUNT:
+  case NAP_REG_TIMING_COUNT_LATCH:
+    return NAP_CLIENT_TRACK;
+  default:
+    return NAP_CLIENT_DIAG;
+  }
+}
+
+/** Do a NAP register transfer on the SPI bus and account for it. */
+static void nap_xfer_execute(nap_client_t client, u8 reg_id, u16 n_bytes,
+                             u8 data_in[], const u8 data_out[],
+                             u32 wait_cycles)
+{
+#ifdef NAP_EMULATOR
+  u32 start = DWT_CYCCNT;
+  nap_emu_xfer(reg_id, n_bytes, data_in, data_out);
+  u32 busy = DWT_CYCCNT - start;
+#else
+  spi_slave_select(SPI_SLAVE_FPGA);
+  u32 start = DWT_CYCCNT;
+
+  spi_xfer(SPI_BUS_FPGA, reg_id);
+
+  /* Spin for shorter transfers to avoid the overhead of context switching. */
+  if (n_bytes < 8) {
+    /* If data_in is NULL then discard read data. */
+    if (data_in)
+      for (u16 i = 0; i < n_bytes; i++)
+        data_in[i] = spi_xfer(SPI_BUS_FPGA, data_out[i]);
+    else
+      for (u16 i = 0; i < n_bytes; i++)
+        spi_xfer(SPI_BUS_FPGA, data_out[i]);
+  } else {
+    spi1_xfer_dma(n_bytes, data_in, data_out);
+  }
+
+  u32 busy = DWT_CYCCNT - start;
+  spi_slave_deselect();
+#endif
+
+  chSysLock();
+  stats.client[client].xfers++;
+  stats.client[client].bytes += n_bytes + 1;
+  stats.client[client].busy_cycles += busy;
+  stats.client[client].wait_max_cycles =
+    MAX(stats.client[client].wait_max_cycles, wait_cycles);
+  chSysUnlock();
+}
+
+/** Queue a NAP register transaction.
+ * Returns immediately, the transfer is done later by the NAP SPI thread in
+ * order of client priority. On completion the callback (if any) is called from
+ * the NAP SPI thread and then the transaction's semaphore is signalled.
+ *
+ * \param xfer     Transaction to fill in and queue.
+ * \param reg_id   NAP register ID.
+ * \param n_bytes  Number of bytes to transfer to/from register.
+ * \param data_in  Array of length n_bytes to transfer NAP register data into,
+ *                 may be NULL.
+ * \param data_out Array of length n_bytes to transfer to NAP register.
+ * \param cb       Completion callback, may be NULL. Must not itself call
+ *                 nap_xfer_wait().
+ * \param context  Passed through to the callback.
+ */
+void nap_xfer_submit(nap_xfer_t *xfer, u8 reg_id, u16 n_bytes, u8 data_in[],
+                     const u8 data_out[], nap_xfer_cb_t cb, void *context)
+{
+  nap_client_t client = nap_xfer_client(reg_id);
+
+  xfer->next = NULL;
+  xfer->reg_id = reg_id;
+  xfer->n_bytes = n_bytes;
+  xfer->data_in = data_in;
+  xfer->data_out = data_out;
+  xfer->cb = cb;
+  xfer->context = context;
+  chBSemInit(&xfer->done, TRUE);
+
+  chSysLock();
+  xfer->queued_cycles = DWT_CYCCNT;
+  if (queues[client].tail)
+    queues[client].tail->next = xfer;
+  else
+    queues[client].head = xfer;
+  queues[client].tail = xfer;
+  chSemSignalI(&nap_xfer_pending);
+  chSchRescheduleS();
+  chSysUnlock();
+}
+
+/** Wait for a queued transaction to complete.
+ *
+ * \param xfer    Transaction previously passed to nap_xfer_submit().
+ * \param timeout Timeout in system ticks, or TIME_INFINITE.
+ * \return true if the transaction completed, false on timeout.
+ */
+bool nap_xfer_wait(nap_xfer_t *xfer, systime_t timeout)
+{
+  return chBSemWaitTimeout(&xfer->done, timeout) == RDY_OK;
+}
+
+/** Do an SPI transfer to/from one of the NAP's internal registers.
+ * Tracking registers, and any register from a thread that outranks the NAP
+ * SPI thread, are transferred directly. Everything else is queued behind any
+ * higher priority work and this waits for it to complete.
+ *
+ * \param reg_id   NAP register ID.
+ * \param n_bytes  Number of bytes to transfer to/from register.
+ * \param data_in  Array of length n_bytes to transfer NAP register data into.
+ * \param data_out Array of length n_bytes to transfer to NAP register.
+ */
+void nap_xfer_blocking(u8 reg_id, u16 n_bytes, u8 data_in[],
+                       const u8 data_out[])
+{
+  nap_client_t client = nap_xfer_client(reg_id);
+
+  /* Before the NAP SPI thread is running and from within its own callbacks
+   * there is nothing to wait for. A thread above it would only be held up
+   * behind lower priority work. */
+  if (client == NAP_CLIENT_TRACK || nap_xfer_tp == NULL ||
+      chThdGetPriority() >= NAP_XFER_THREAD_PRIO) {
+    nap_xfer_execute(client, reg_id, n_bytes, data_in, data_out, 0);
+    return;
+  }
+
+  nap_xfer_t xfer;
+  nap_xfer_submit(&xfer, reg_id, n_bytes, data_in, data_out, NULL, NULL);
+  nap_xfer_wait(&xfer, TIME_INFINITE);
+}
+
+static msg_t nap_xfer_thread(void *arg)
+{
+  (void)arg;
+  chRegSetThreadName("NAP SPI");
+
+  while (TRUE) {
+    chSemWait(&nap_xfer_pending);
+
+    nap_xfer_t *xfer = NULL;
+    nap_client_t client;
+    chSysLock();
+    for (client = 0; client < NAP_N_CLIENTS; client++) {
+      xfer = queues[client].head;
+      if (xfer) {
+        queues[client].head = xfer->next;
+        if (queues[client].head == NULL)
+          queues[client].tail = NULL;
+        break;
+      }
+    }
+    u32 wait_cycles = DWT_CYCCNT - xfer->queued_cycles;
+    chSysUnlock();
+
+    nap_xfer_execute(client, xfer->reg_id, xfer->n_bytes,
+                     xfer->data_in, xfer->data_out, wait_cycles);
+
+    if (xfer->cb)
+      xfer->cb(xfer);
+    /* May be on the waiting thread's stack, don't touch it after this. */
+    chBSemSignal(&xfer->done);
+  }
+
+  return 0;
+}
+
+/** Start the NAP SPI thread.
+ * Until this has been called all transfers are done directly.
+ */
+void nap_xfer_setup(void)
+{
+  chSemInit(&nap_xfer_pending, 0);
+  stats.start = chTimeNow();
+
+  nap_xfer_tp = chThdCreateStatic(wa_nap_xfer, sizeof(wa_nap_xfer),
+                                  NAP_XFER_THREAD_PRIO, nap_xfer_thread, NULL);
+}
+
+/** Send per-client SPI bus statistics since the last call. */
+void nap_xfer_stats_send(void)
+{
+  msg_nap_spi_stats_t msg;
+
+  chSysLock();
+  systime_t now = chTimeNow();
+  u32 period_ms = (now - stats.start) * 1000 / CH_FREQUENCY;
+  msg.period_ms = period_ms;
+  for (u8 i = 0; i < NAP_N_CLIENTS; i++) {
+    msg.xfers[i] = stats.client[i].xfers;
+    msg.bytes[i] = stats.client[i].bytes;
+    msg.wait_max_us[i] = stats.client[i].wait_max_cycles /
+                         NAP_XFER_CYCLES_PER_US;
+    msg.util[i] = period_ms == 0 ? 0 :
+      (u64)stats.client[i].busy_cycles * 10000 /
+      (u64)(period_ms * NAP_XFER_CYCLES_PER_US * 1000);
+  }
+  memset(&stats, 0, sizeof(stats));
+  stats.start = now;
+  chSysUnlock();
+
+  sbp_send_msg(SBP_MSG_NAP_SPI_STATS, sizeof(msg), (u8 *)&msg);
+}
+
+/** \} */
+
+/** \} */
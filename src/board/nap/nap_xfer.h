@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_NAP_XFER_H
+#define SWIFTNAV_NAP_XFER_H
+
+#include <ch.h>
+
+#include <libswiftnav/common.h>
+
+#include "../../sbp_ext.h"
+
+/** \addtogroup nap_xfer
+ * \{ */
+
+/** NAP register access clients, highest priority first. */
+typedef enum {
+  NAP_CLIENT_TRACK = 0, /**< IRQ, tracking channel and timing registers. */
+  NAP_CLIENT_ACQ,       /**< Acquisition channel registers. */
+  NAP_CLIENT_CW,        /**< CW channel registers. */
+  NAP_CLIENT_DIAG,      /**< Everything else, error/hash/DNA/ext events. */
+  NAP_N_CLIENTS         /**< Must equal NAP_SPI_N_CLIENTS. */
+} nap_client_t;
+
+typedef struct nap_xfer nap_xfer_t;
+
+/** Transaction completion callback, called from the NAP SPI thread. */
+typedef void (*nap_xfer_cb_t)(nap_xfer_t *xfer);
+
+/** A queued NAP register transaction.
+ * The transaction and its data buffers must stay valid until it completes.
+ */
+struct nap_xfer {
+  nap_xfer_t *next;     /**< Queue link, internal. */
+  u32 queued_cycles;    /**< DWT_CYCCNT when submitted, internal. */
+  u8 reg_id;            /**< NAP register ID. */
+  u16 n_bytes;          /**< Number of bytes to transfer. */
+  u8 *data_in;          /**< Read data destination, may be NULL. */
+  const u8 *data_out;   /**< Data to write. */
+  nap_xfer_cb_t cb;     /**< Completion callback, may be NULL. */
+  void *context;        /**< Passed through to the callback. */
+  BinarySemaphore done; /**< Signalled after the callback returns. */
+};
+
+/** \} */
+
+void nap_xfer_setup(void);
+nap_client_t nap_xfer_client(u8 reg_id);
+void nap_xfer_submit(nap_xfer_t *xfer, u8 reg_id, u16 n_bytes, u8 data_in[],
+                     const u8 data_out[], nap_xfer_cb_t cb, void *context);
+bool nap_xfer_wait(nap_xfer_t *xfer, systime_t timeout);
+void nap_xfer_stats_send(void);
+
+#endif  /* SWIFTNAV_NAP_XFER_H */
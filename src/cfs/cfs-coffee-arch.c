@@ -11,7 +11,13 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
+#include <ch.h>
+
+#include <libswiftnav/logging.h>
+
+#include "cfs/cfs-coffee.h"
 #include "cfs/cfs-coffee-arch.h"
 
 /** \addtogroup cfs
@@ -19,31 +25,80 @@
  */
 
 /** \defgroup cfs_arch Local Coffee configuration
+ *
+ * Coffee erases sectors of obsolete pages when a file can't be reserved,
+ * stalling the thread writing the file for the erase. The garbage collection
+ * thread erases sectors full of obsolete pages ahead of them being needed.
+ * The erase still stalls flash reads, and with them the CPU, but not in the
+ * middle of a file being written. The worst time a thread has spent in a
+ * filesystem call, including waiting for the garbage collection, is logged
+ * when it grows.
  * \{
  */
 
+/** Time between looking for a sector to erase. */
+#define COFFEE_GC_PERIOD_MS 2000
+/** Time between erases when several sectors can be erased. */
+#define COFFEE_GC_ERASE_GAP_MS 100
+
+static struct {
+  /** Longest a thread other than the garbage collection has spent in a
+   * filesystem call [ticks]. */
+  systime_t latency_max;
+  /** Sectors erased by threads writing files. */
+  u32 erases;
+} coffee_stats;
+
+static Thread *coffee_gc_tp;
+static WORKING_AREA_CCM(wa_coffee_gc_thread, 1024);
+
 /** Read from the Coffee filesystem area in STM flash.
+ * Copies a word at a time between the unaligned bytes at either end.
  * \param buf Pointer to a buffer where the read values will be stored.
  * \param size Number of bytes to read.
  * \param offset Offset into the filesystem area to read from.
  */
 void coffee_read(u8* buf, u32 size, u32 offset)
 {
-  for (u32 i=0; i<size; i++)
-    buf[i] = ~((u8*)(COFFEE_START+offset))[i];
+  const u8 *src = (const u8 *)(COFFEE_START + offset);
+
+  for (; size && ((u32)src & 3); size--)
+    *buf++ = ~*src++;
+
+  for (; size >= 4; size -= 4, src += 4, buf += 4) {
+    /* buf may not be aligned, memcpy() lets the compiler use an unaligned
+     * store. */
+    u32 w = ~*(const u32 *)src;
+    memcpy(buf, &w, sizeof(w));
+  }
+
+  for (; size; size--)
+    *buf++ = ~*src++;
 }
 
 /** Write to the Coffee filesystem area in STM flash.
+ * Programs a word at a time between the unaligned bytes at either end.
  * \param buf Pointer to a buffer containing the values to be written.
  * \param size Number of bytes to write.
  * \param offset Offset into the filesystem area to write to.
  */
 void coffee_write(u8* buf, u32 size, u32 offset)
 {
+  u32 addr = COFFEE_START + offset;
+
   flash_unlock();
 
-  for (u32 i=0; i<size; i++)
-    flash_program_byte(COFFEE_START+offset+i, ~buf[i]);
+  for (; size && (addr & 3); size--)
+    flash_program_byte(addr++, ~*buf++);
+
+  for (; size >= 4; size -= 4, addr += 4, buf += 4) {
+    u32 w;
+    memcpy(&w, buf, sizeof(w));
+    flash_program_word(addr, ~w);
+  }
+
+  for (; size; size--)
+    flash_program_byte(addr++, ~*buf++);
 
   flash_lock();
 }
@@ -54,11 +109,78 @@ void coffee_write(u8* buf, u32 size, u32 offset)
  */
 void coffee_erase(u8 sector)
 {
+  if (chThdSelf() != coffee_gc_tp)
+    coffee_stats.erases++;
+
   flash_unlock();
   flash_erase_sector(sector+COFFEE_START_SECTOR, FLASH_CR_PROGRAM_X32);
   flash_lock();
 }
 
+static MUTEX_DECL(coffee_mutex);
+static Thread *coffee_owner;
+static u32 coffee_depth;
+static systime_t coffee_lock_time;
+
+/** Take the lock serialising access to the filesystem between threads.
+ * The thread holding it may take it again, each coffee_lock() must be
+ * matched by a coffee_unlock().
+ */
+void coffee_lock(void)
+{
+  if (coffee_owner == chThdSelf()) {
+    coffee_depth++;
+    return;
+  }
+  systime_t t = chTimeNow();
+  chMtxLock(&coffee_mutex);
+  coffee_owner = chThdSelf();
+  coffee_depth = 1;
+  coffee_lock_time = t;
+}
+
+/** Release the lock taken by coffee_lock(). */
+void coffee_unlock(void)
+{
+  if (--coffee_depth == 0) {
+    systime_t latency = chTimeNow() - coffee_lock_time;
+    if ((coffee_owner != coffee_gc_tp) && (latency > coffee_stats.latency_max))
+      coffee_stats.latency_max = latency;
+    coffee_owner = NULL;
+    chMtxUnlock();
+  }
+}
+
+static msg_t coffee_gc_thread(void *arg)
+{
+  (void)arg;
+  chRegSetThreadName("coffee gc");
+
+  systime_t reported = 0;
+  while (TRUE) {
+    chThdSleepMilliseconds(COFFEE_GC_PERIOD_MS);
+    /* Let other threads at the filesystem between erases. */
+    while (cfs_coffee_collect_garbage())
+      chThdSleepMilliseconds(COFFEE_GC_ERASE_GAP_MS);
+
+    if (coffee_stats.latency_max > reported) {
+      reported = coffee_stats.latency_max;
+      log_info("CFS: worst call took %u ms, %u sectors erased by writers",
+               (unsigned int)(reported * 1000 / CH_FREQUENCY),
+               (unsigned int)coffee_stats.erases);
+    }
+  }
+  return 0;
+}
+
+/** Start the garbage collection thread. */
+void coffee_gc_setup(void)
+{
+  coffee_gc_tp = chThdCreateStatic(wa_coffee_gc_thread,
+                                   sizeof(wa_coffee_gc_thread),
+                                   LOWPRIO+2, coffee_gc_thread, NULL);
+}
+
 /** \} */
 
 /** \} */
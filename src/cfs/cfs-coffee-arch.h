@@ -43,6 +43,9 @@ extern u32 _ecoffee_fs_area;
 void coffee_write(u8* buf, u32 size, u32 offset);
 void coffee_read(u8* buf, u32 size, u32 offset);
 void coffee_erase(u8 sector);
+void coffee_lock(void);
+void coffee_unlock(void);
+void coffee_gc_setup(void);
 
 #define COFFEE_WRITE(buf, size, offset) coffee_write((u8*)buf, size, offset)
 #define COFFEE_READ(buf, size, offset)  coffee_read((u8*)buf, size, offset)
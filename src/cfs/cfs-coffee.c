@@ -77,6 +77,18 @@
 #error "Cannot have COFFEE_APPEND_ONLY set when COFFEE_MICRO_LOGS is set."
 #endif
 
+/* Files whose start page is kept in RAM. If there are more, opening or
+   removing a file which isn't in the index falls back to scanning the
+   file headers in flash. */
+#ifndef COFFEE_INDEX_SIZE
+#define COFFEE_INDEX_SIZE	128
+#endif
+#define COFFEE_INDEX_BUCKETS	64
+
+#if COFFEE_INDEX_SIZE >= 255
+#error "COFFEE_INDEX_SIZE must be less than 255."
+#endif
+
 /* I/O semantics can be set on file descriptors in order to optimize 
    file access on certain storage types. */
 #ifndef COFFEE_IO_SEMANTICS
@@ -114,6 +126,9 @@
 #define GC_GREEDY		0
 /* "Reluctant" garbage collection stops after erasing one sector. */
 #define GC_RELUCTANT		1
+/* "Background" garbage collection erases the first full sector of
+   obsolete pages ahead of it being needed. */
+#define GC_BACKGROUND		2
 
 /* File descriptor macros. */
 #define FD_VALID(fd)					\
@@ -219,6 +234,25 @@ static struct file_desc * const coffee_fd_set = protected_mem.coffee_fd_set;
 static coffee_page_t * const next_free = &protected_mem.next_free;
 static char * const gc_wait = &protected_mem.gc_wait;
 
+#define INDEX_NONE		0xff
+
+/* The index of file names to start pages, chained by hash of the name. */
+struct index_entry {
+  coffee_page_t page;
+  uint8_t next;
+  char name[COFFEE_NAME_LENGTH];
+};
+
+static struct {
+  struct index_entry entries[COFFEE_INDEX_SIZE];
+  uint8_t buckets[COFFEE_INDEX_BUCKETS];
+  uint8_t free;
+  /* Set once the index has been built from the file headers. */
+  char built;
+  /* Cleared if a file didn't fit in the index. */
+  char complete;
+} file_index;
+
 /*---------------------------------------------------------------------------*/
 static void
 write_header(struct file_header *hdr, coffee_page_t page)
@@ -364,15 +398,17 @@ isolate_pages(coffee_page_t start, coffee_page_t skip_pages)
 
 }
 /*---------------------------------------------------------------------------*/
-static void
+static int
 collect_garbage(int mode)
 {
   uint16_t sector;
   struct sector_status stats;
   coffee_page_t first_page, isolation_count;
+  int erased = 0;
 
   PRINTF("Coffee: Running the file system garbage collector in %s mode\n",
-	 mode == GC_RELUCTANT ? "reluctant" : "greedy");
+	 mode == GC_GREEDY ? "greedy" :
+	 mode == GC_RELUCTANT ? "reluctant" : "background");
   /*
    * The garbage collector erases as many sectors as possible. A sector is
    * erasable if there are only free or obsolete pages in it.
@@ -387,7 +423,7 @@ collect_garbage(int mode)
       continue;
     }
 
-    if((mode == GC_RELUCTANT && stats.free == 0) ||
+    if((mode != GC_GREEDY && stats.free == 0) ||
        (mode == GC_GREEDY && stats.obsolete > 0)) {
       first_page = sector * COFFEE_PAGES_PER_SECTOR;
       if(first_page < *next_free) {
@@ -400,12 +436,16 @@ collect_garbage(int mode)
 
       COFFEE_ERASE(sector);
       PRINTF("Coffee: Erased sector %d!\n", sector);
+      erased++;
 
-      if(mode == GC_RELUCTANT && isolation_count > 0) {
+      if((mode == GC_RELUCTANT && isolation_count > 0) ||
+         mode == GC_BACKGROUND) {
         break;
       }
     }
   }
+
+  return erased;
 }
 /*---------------------------------------------------------------------------*/
 static coffee_page_t
@@ -429,6 +469,103 @@ next_file(coffee_page_t page, struct file_header *hdr)
   return page + hdr->max_pages;    
 }
 /*---------------------------------------------------------------------------*/
+static uint8_t
+index_bucket(const char *name)
+{
+  /* FNV-1a */
+  uint32_t hash = 2166136261u;
+
+  while(*name) {
+    hash = (hash ^ (uint8_t)*name++) * 16777619u;
+  }
+  return hash % COFFEE_INDEX_BUCKETS;
+}
+/*---------------------------------------------------------------------------*/
+static void
+index_add(const char *name, coffee_page_t page)
+{
+  struct index_entry *entry;
+  uint8_t i, bucket;
+
+  if(file_index.free == INDEX_NONE) {
+    file_index.complete = 0;
+    return;
+  }
+
+  i = file_index.free;
+  entry = &file_index.entries[i];
+  file_index.free = entry->next;
+
+  memcpy(entry->name, name, sizeof(entry->name) - 1);
+  entry->name[sizeof(entry->name) - 1] = '\0';
+  entry->page = page;
+  bucket = index_bucket(entry->name);
+  entry->next = file_index.buckets[bucket];
+  file_index.buckets[bucket] = i;
+}
+/*---------------------------------------------------------------------------*/
+static void
+index_remove(const char *name, coffee_page_t page)
+{
+  uint8_t *link;
+  struct index_entry *entry;
+
+  for(link = &file_index.buckets[index_bucket(name)];
+      *link != INDEX_NONE;
+      link = &entry->next) {
+    entry = &file_index.entries[*link];
+    if(entry->page == page) {
+      uint8_t i = *link;
+      *link = entry->next;
+      entry->next = file_index.free;
+      file_index.free = i;
+      return;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static coffee_page_t
+index_find(const char *name)
+{
+  uint8_t i;
+
+  for(i = file_index.buckets[index_bucket(name)];
+      i != INDEX_NONE;
+      i = file_index.entries[i].next) {
+    if(strcmp(name, file_index.entries[i].name) == 0) {
+      return file_index.entries[i].page;
+    }
+  }
+  return INVALID_PAGE;
+}
+/*---------------------------------------------------------------------------*/
+static void
+index_build(void)
+{
+  struct file_header hdr;
+  coffee_page_t page;
+  int i;
+
+  if(file_index.built) {
+    return;
+  }
+
+  memset(file_index.buckets, INDEX_NONE, sizeof(file_index.buckets));
+  for(i = 0; i < COFFEE_INDEX_SIZE; i++) {
+    file_index.entries[i].next = i + 1 < COFFEE_INDEX_SIZE ? i + 1 : INDEX_NONE;
+  }
+  file_index.free = 0;
+  file_index.complete = 1;
+  file_index.built = 1;
+
+  for(page = 0; page < COFFEE_PAGE_COUNT; page = next_file(page, &hdr)) {
+    read_header(&hdr, page);
+    if(HDR_ACTIVE(hdr) && !HDR_LOG(hdr)) {
+      index_add(hdr.name, page);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
 static struct file *
 load_file(coffee_page_t start, struct file_header *hdr)
 {
@@ -477,28 +614,31 @@ find_file(const char *name)
   int i;
   struct file_header hdr;
   coffee_page_t page;
-  
-  /* First check if the file metadata is cached. */
-  for(i = 0; i < COFFEE_MAX_OPEN_FILES; i++) {
-    if(FILE_FREE(&coffee_files[i])) {
-      continue;
-    }
 
-    read_header(&hdr, coffee_files[i].page);
-    if(HDR_ACTIVE(hdr) && !HDR_LOG(hdr) && strcmp(name, hdr.name) == 0) {
-      return &coffee_files[i];
+  index_build();
+  page = index_find(name);
+  if(page == INVALID_PAGE && !file_index.complete) {
+    /* Scan the flash memory sequentially for a file left out of the index. */
+    for(page = 0; page < COFFEE_PAGE_COUNT; page = next_file(page, &hdr)) {
+      read_header(&hdr, page);
+      if(HDR_ACTIVE(hdr) && !HDR_LOG(hdr) && strcmp(name, hdr.name) == 0) {
+        break;
+      }
     }
   }
-  
-  /* Scan the flash memory sequentially otherwise. */
-  for(page = 0; page < COFFEE_PAGE_COUNT; page = next_file(page, &hdr)) {
-    read_header(&hdr, page);
-    if(HDR_ACTIVE(hdr) && !HDR_LOG(hdr) && strcmp(name, hdr.name) == 0) {
-      return load_file(page, &hdr);
+  if(page >= COFFEE_PAGE_COUNT) {
+    return NULL;
+  }
+
+  /* Check if the file metadata is cached. */
+  for(i = 0; i < COFFEE_MAX_OPEN_FILES; i++) {
+    if(!FILE_FREE(&coffee_files[i]) && coffee_files[i].page == page) {
+      return &coffee_files[i];
     }
   }
 
-  return NULL;
+  read_header(&hdr, page);
+  return load_file(page, &hdr);
 }
 /*---------------------------------------------------------------------------*/
 static cfs_offset_t
@@ -591,6 +731,9 @@ remove_by_page(coffee_page_t page, int remove_log, int close_fds,
 
   hdr.flags |= HDR_FLAG_OBSOLETE;
   write_header(&hdr, page);
+  if(!HDR_LOG(hdr)) {
+    index_remove(hdr.name, page);
+  }
 
   *gc_wait = 0;
 
@@ -635,6 +778,7 @@ reserve(const char *name, coffee_page_t pages,
   coffee_page_t page;
   struct file *file;
 
+  index_build();
   if(!allow_duplicates && find_file(name) != NULL) {
     return NULL;
   }
@@ -657,6 +801,9 @@ reserve(const char *name, coffee_page_t pages,
   hdr.max_pages = pages;
   hdr.flags = HDR_FLAG_ALLOCATED | flags;
   write_header(&hdr, page);
+  if(!HDR_LOG(hdr)) {
+    index_add(hdr.name, page);
+  }
 
   PRINTF("Coffee: Reserved %u pages starting from %u for file %s\n",
       pages, page, name);
@@ -994,8 +1141,8 @@ get_available_fd(void)
   return -1;
 }
 /*---------------------------------------------------------------------------*/
-int
-cfs_open(const char *name, int flags)
+static int
+open_unlocked(const char *name, int flags)
 {
   int fd;
   struct file_desc *fdp;
@@ -1030,8 +1177,8 @@ cfs_open(const char *name, int flags)
   return fd;
 }
 /*---------------------------------------------------------------------------*/
-void
-cfs_close(int fd)
+static void
+close_unlocked(int fd)
 {
   if(FD_VALID(fd)) {
     coffee_fd_set[fd].flags = COFFEE_FD_FREE;
@@ -1040,8 +1187,8 @@ cfs_close(int fd)
   }
 }
 /*---------------------------------------------------------------------------*/
-cfs_offset_t
-cfs_seek(int fd, cfs_offset_t offset, int whence)
+static cfs_offset_t
+seek_unlocked(int fd, cfs_offset_t offset, int whence)
 {
   struct file_desc *fdp;
   cfs_offset_t new_offset;
@@ -1072,8 +1219,8 @@ cfs_seek(int fd, cfs_offset_t offset, int whence)
   return fdp->offset = new_offset;
 }
 /*---------------------------------------------------------------------------*/
-int
-cfs_remove(const char *name)
+static int
+remove_unlocked(const char *name)
 {
   struct file *file;
 
@@ -1091,8 +1238,8 @@ cfs_remove(const char *name)
   return remove_by_page(file->page, REMOVE_LOG, CLOSE_FDS, ALLOW_GC);
 }
 /*---------------------------------------------------------------------------*/
-int
-cfs_read(int fd, void *buf, unsigned size)
+static int
+read_unlocked(int fd, void *buf, unsigned size)
 {
   struct file_desc *fdp;
   struct file *file;
@@ -1148,8 +1295,8 @@ cfs_read(int fd, void *buf, unsigned size)
   return size;
 }
 /*---------------------------------------------------------------------------*/
-int
-cfs_write(int fd, const void *buf, unsigned size)
+static int
+write_unlocked(int fd, const void *buf, unsigned size)
 {
   struct file_desc *fdp;
   struct file *file;
@@ -1257,8 +1404,8 @@ cfs_opendir(struct cfs_dir *dir, const char *name __attribute__((unused)))
   return 0;
 }
 /*---------------------------------------------------------------------------*/
-int
-cfs_readdir(struct cfs_dir *dir, struct cfs_dirent *record)
+static int
+readdir_unlocked(struct cfs_dir *dir, struct cfs_dirent *record)
 {
   struct file_header hdr;
   coffee_page_t page;
@@ -1289,15 +1436,15 @@ cfs_closedir(struct cfs_dir *dir __attribute__((unused)))
   return;
 }
 /*---------------------------------------------------------------------------*/
-int
-cfs_coffee_reserve(const char *name, cfs_offset_t size)
+static int
+reserve_unlocked(const char *name, cfs_offset_t size)
 {
   return reserve(name, page_count(size), 0, 0) == NULL ? -1 : 0;
 }
 /*---------------------------------------------------------------------------*/
-int
-cfs_coffee_configure_log(const char *filename, unsigned log_size,
-			 unsigned log_record_size)
+static int
+configure_log_unlocked(const char *filename, unsigned log_size,
+		       unsigned log_record_size)
 {
   struct file *file;
   struct file_header hdr;
@@ -1339,8 +1486,8 @@ cfs_coffee_set_io_semantics(int fd, unsigned flags)
 }
 #endif
 /*---------------------------------------------------------------------------*/
-int
-cfs_coffee_format(void)
+static int
+format_unlocked(void)
 {
   unsigned i;
 
@@ -1355,15 +1502,141 @@ cfs_coffee_format(void)
 
   /* Formatting invalidates the file information. */
   memset(&protected_mem, 0, sizeof(protected_mem));
+  file_index.built = 0;
 
   PRINTF(" done!\n");
 
   return 0;
 }
 /*---------------------------------------------------------------------------*/
+static int
+collect_garbage_unlocked(void)
+{
+  if(collect_garbage(GC_BACKGROUND) == 0) {
+    return 0;
+  }
+  /* A reservation which failed may succeed now. */
+  *gc_wait = 0;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
 void *
 cfs_coffee_get_protected_mem(unsigned *size)
 {
   *size = sizeof(protected_mem);
   return &protected_mem;
 }
+/*---------------------------------------------------------------------------*/
+/*
+ * The filesystem is used from several threads. Each call into it holds the
+ * Coffee lock, which the thread may already hold as Coffee calls its own API
+ * when merging a micro log.
+ */
+int
+cfs_open(const char *name, int flags)
+{
+  int r;
+  coffee_lock();
+  r = open_unlocked(name, flags);
+  coffee_unlock();
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+void
+cfs_close(int fd)
+{
+  coffee_lock();
+  close_unlocked(fd);
+  coffee_unlock();
+}
+/*---------------------------------------------------------------------------*/
+cfs_offset_t
+cfs_seek(int fd, cfs_offset_t offset, int whence)
+{
+  cfs_offset_t r;
+  coffee_lock();
+  r = seek_unlocked(fd, offset, whence);
+  coffee_unlock();
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_remove(const char *name)
+{
+  int r;
+  coffee_lock();
+  r = remove_unlocked(name);
+  coffee_unlock();
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_read(int fd, void *buf, unsigned size)
+{
+  int r;
+  coffee_lock();
+  r = read_unlocked(fd, buf, size);
+  coffee_unlock();
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_write(int fd, const void *buf, unsigned size)
+{
+  int r;
+  coffee_lock();
+  r = write_unlocked(fd, buf, size);
+  coffee_unlock();
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_readdir(struct cfs_dir *dir, struct cfs_dirent *record)
+{
+  int r;
+  coffee_lock();
+  r = readdir_unlocked(dir, record);
+  coffee_unlock();
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_coffee_reserve(const char *name, cfs_offset_t size)
+{
+  int r;
+  coffee_lock();
+  r = reserve_unlocked(name, size);
+  coffee_unlock();
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_coffee_configure_log(const char *filename, unsigned log_size,
+			 unsigned log_record_size)
+{
+  int r;
+  coffee_lock();
+  r = configure_log_unlocked(filename, log_size, log_record_size);
+  coffee_unlock();
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_coffee_format(void)
+{
+  int r;
+  coffee_lock();
+  r = format_unlocked();
+  coffee_unlock();
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+int
+cfs_coffee_collect_garbage(void)
+{
+  int r;
+  coffee_lock();
+  r = collect_garbage_unlocked();
+  coffee_unlock();
+  return r;
+}
@@ -126,6 +126,17 @@ int cfs_coffee_set_io_semantics(int fd, unsigned flags);
  */
 int cfs_coffee_format(void);
 
+/**
+ * \brief Erase a sector which only holds obsolete pages.
+ * \return 1 if a sector was erased, 0 if none was full of obsolete pages.
+ *
+ * Garbage is otherwise only collected when a reservation can't be
+ * granted, stalling the writer while sectors are erased. Calling this
+ * from a background thread erases sectors ahead of them being needed, one
+ * at a time.
+ */
+int cfs_coffee_collect_garbage(void);
+
 /**
  * \brief Points out a memory region that may not be altered during
  * checkpointing operations that use the file system.
@@ -30,6 +30,12 @@
 
 #include <libswiftnav/common.h>
 #include "../src/error.h"
+#include "../src/trace.h"
+
+#ifdef PIKSI_HOST
+/* Simulator port overrides, must come before the defaults below. */
+#include "../src/host/host.h"
+#endif
 
 /*===========================================================================*/
 /**
@@ -455,7 +461,9 @@
   /* CPU cycle measurement fields, */                                       \
   /* see http://sourceforge.net/p/chibios/feature-requests/23/ .*/          \
   u64 p_ctime;                                                              \
-  u32 p_cref;
+  u32 p_cref;                                                               \
+  /* ID of the thread in the event trace, see trace.c. */                   \
+  u8 p_trace_id;
 #endif
 
 /**
@@ -472,6 +480,7 @@
   /* see http://sourceforge.net/p/chibios/feature-requests/23/ .*/          \
   tp->p_ctime = 0;                                                          \
   tp->p_cref = DWT_CYCCNT;                                                  \
+  tp->p_trace_id = trace_thread_id();                                       \
 }
 #endif
 
@@ -503,6 +512,7 @@ extern u64 g_ctime;
     otp->p_ctime += cnt;                                                    \
     g_ctime += cnt;                                                         \
   }                                                                         \
+  trace_event(TRACE_EVENT_THREAD, ntp->p_trace_id);                         \
 }
 #endif
 
@@ -548,7 +558,17 @@ extern u64 g_ctime;
 /* Change vector table location for compatibility with the bootloader. */
 #define CORTEX_VTOR_INIT 0x08004000
 
+#ifndef PIKSI_HOST
 #define _CCM __attribute__((section (".ccmram")))
+
+/* Mask all interrupts, not just those at or below the kernel priority level
+ * as chSysLock() does. */
+#define irq_disable() __asm__("CPSID i;")
+#define irq_enable()  __asm__("CPSIE i;")
+
+#define breakpoint() __asm__("bkpt")
+#endif
+
 #define WORKING_AREA_CCM(s, n) WORKING_AREA(s, n) _CCM
 
 #endif  /* _CHCONF_H_ */
@@ -21,11 +21,18 @@
 #include "track.h"
 #include "timing.h"
 #include "ephemeris.h"
+#include "nav_store.h"
 
 MUTEX_DECL(es_mutex);
 ephemeris_t es[MAX_SATS] _CCM;
 static ephemeris_t es_candidate[MAX_SATS] _CCM;
 
+/** Ephemerides restored from flash at boot. They were only checked against
+ * the time guess loaded with the last position, which could be off by
+ * however long the receiver was powered down, so they are only used for
+ * acquisition hints and never for solutions. */
+ephemeris_t es_restored[MAX_SATS] _CCM;
+
 static void ephemeris_new(ephemeris_t *e)
 {
   gps_time_t t = get_current_time();
@@ -35,13 +42,17 @@ static void ephemeris_new(ephemeris_t *e)
     chMtxLock(&es_mutex);
     es[e->prn] = es_candidate[e->prn] = *e;
     chMtxUnlock();
+    nav_store_ephemeris_updated(e->prn);
 
   } else if (ephemeris_equal(&es_candidate[e->prn], e)) {
     /* The received ephemeris matches our candidate, so we trust it. */
     log_info("New trusted ephemeris for PRN %02d", e->prn+1);
+    bool changed = !ephemeris_equal(&es[e->prn], e);
     chMtxLock(&es_mutex);
     es[e->prn] = *e;
     chMtxUnlock();
+    if (changed)
+      nav_store_ephemeris_updated(e->prn);
   } else {
     /* This is our first reception of this new ephemeris, so treat it with
      * suspicion and call it the new candidate. */
@@ -76,9 +87,9 @@ static msg_t nav_msg_thread(void *arg)
         continue;
 
       /* Decode ephemeris to temporary struct */
-      __asm__("CPSID i;");
+      irq_disable();
       s8 ret = process_subframe(&ch->nav_msg, &e);
-      __asm__("CPSIE i;");
+      irq_enable();
 
       if (ret <= 0)
         continue;
@@ -126,6 +137,10 @@ void ephemeris_setup(void)
     es[i].prn = i;
   }
 
+  u8 n = nav_store_load_ephemeris(es_restored);
+  if (n > 0)
+    log_info("Restored %u ephemerides from flash for acquisition", n);
+
   static sbp_msg_callbacks_node_t ephemeris_msg_node;
   sbp_register_cbk(
     SBP_MSG_EPHEMERIS,
@@ -18,6 +18,7 @@
 
 extern Mutex es_mutex;
 extern ephemeris_t es[MAX_SATS];
+extern ephemeris_t es_restored[MAX_SATS];
 
 void ephemeris_setup(void);
 
@@ -74,15 +74,13 @@ void ext_event_service(void)
   /* Read the details, and also clear IRQ + set up for next time */
   u32 event_nap_time = nap_rw_ext_event(&event_pin, &event_trig, trigger);
   
-  /* We have to infer the most sig word (i.e. # of 262-second rollovers) */
-  union {
-    u32 half[2];
-    u64 full;
-  } tc;
-  tc.full = nap_timing_count();
-  if (tc.half[0] < event_nap_time)  /* Rollover occurred since event */
-    tc.half[1]--;
-  tc.half[0] = event_nap_time;
+  /* We have to infer the most sig word (i.e. # of 262-second rollovers).
+   * The event happened shortly before now, so step back from the current
+   * count by the (wrapped) difference. nap_timing_count() is extrapolated and
+   * may be off the true count by up to 125 samples, the signed difference
+   * keeps that from being mistaken for a rollover. */
+  u64 now = nap_timing_count();
+  u64 tc = now - (s32)((u32)now - event_nap_time);
 
   /* Prepare the MSG_EXT_EVENT */
   msg_ext_event_t msg;
@@ -92,7 +90,7 @@ void ext_event_service(void)
   msg.pin = event_pin;
 
   /* Convert to the SBP convention of rounded ms + signed ns residual */
-  gps_time_t gpst = rx2gpstime(tc.full);
+  gps_time_t gpst = rx2gpstime(tc);
   msg_gps_time_t mgt;
   sbp_make_gps_time(&mgt, &gpst, 0);
   msg.wn = mgt.wn;
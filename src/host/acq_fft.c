@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "acq_fft.h"
+#include "correlator.h"
+
+/** \addtogroup host
+ * \{ */
+
+/** \defgroup acq_fft FFT Acquisition
+ * Software version of the NAP's FFT acquisition channel.
+ *
+ * A load of samples is mixed down from the IF and decimated as the NAP fills
+ * its sample RAM, then transformed once by acq_fft_load(). Each carrier
+ * frequency bin is a whole number of FFT bins so is searched by rotating that
+ * spectrum, multiplying by the PRN's code spectrum and transforming back,
+ * giving the correlation at every code phase at once.
+ *
+ * The NAP correlates the 4096 taps circularly against the 4092 sample code, so
+ * the transforms are twice as long with the code laid out to give exactly that
+ * correlation at the 4092 code phases. All 32 code spectra are computed by
+ * acq_fft_setup().
+ *
+ * acq_fft_bins() splits the carrier frequencies of a search between threads,
+ * acq_fft_search() reduces them as acq.c does for the NAP.
+ * \{ */
+
+/** Transform length. */
+#define CORR_LEN (2 * ACQ_FFT_LEN)
+#define CORR_LEN_BITS (NAP_EMU_ACQ_FFT_INDEX_BITS + 1)
+/** Code phases searched, one code period. */
+#define N_LAGS (1023 * ACQ_FFT_CODE_PHASE_UNITS_PER_CHIP)
+
+static struct {
+  u32 if_phase_rate;   /**< [2^-32 cycles/sample] */
+  u8 n_threads;
+
+  acq_fft_cpx_t twiddle[CORR_LEN / 2];
+  u16 bit_rev[CORR_LEN];
+  /** Conjugated code spectra, indexed by PRN. */
+  acq_fft_cpx_t code[32][CORR_LEN];
+} fft;
+
+/** In place radix-2 FFT of length CORR_LEN, inverse if inv is set.
+ * Unnormalised, only relative powers are used. */
+static void fft_run(acq_fft_cpx_t x[], bool inv)
+{
+  for (u32 i = 0; i < CORR_LEN; i++) {
+    u32 j = fft.bit_rev[i];
+    if (j > i) {
+      acq_fft_cpx_t t = x[i];
+      x[i] = x[j];
+      x[j] = t;
+    }
+  }
+
+  for (u32 half = 1, stride = CORR_LEN / 2; half < CORR_LEN;
+       half *= 2, stride /= 2) {
+    for (u32 k = 0; k < CORR_LEN; k += 2 * half) {
+      for (u32 j = 0; j < half; j++) {
+        acq_fft_cpx_t w = fft.twiddle[j * stride];
+        if (inv)
+          w.im = -w.im;
+        acq_fft_cpx_t *a = &x[k + j];
+        acq_fft_cpx_t *b = &x[k + j + half];
+        float re = b->re * w.re - b->im * w.im;
+        float im = b->re * w.im + b->im * w.re;
+        b->re = a->re - re;
+        b->im = a->im - im;
+        a->re += re;
+        a->im += im;
+      }
+    }
+  }
+}
+
+/** Code replica for the direct correlation of tap j at code phase lag,
+ * chip ((j - lag) mod N_LAGS) / 4, indexed by (j - lag) mod CORR_LEN. */
+static void code_spectrum(u8 prn, acq_fft_cpx_t spectrum[])
+{
+  correlator_code_t code;
+  correlator_code(prn, &code);
+
+  for (s32 m = 0; m < CORR_LEN; m++) {
+    s32 k = (m < ACQ_FFT_LEN) ? m : m - CORR_LEN;
+    u32 chip = ((k + 2 * N_LAGS) % N_LAGS) / ACQ_FFT_CODE_PHASE_UNITS_PER_CHIP;
+    spectrum[m].re = code.half_chips[2 * chip + 2];
+    spectrum[m].im = 0;
+  }
+  fft_run(spectrum, false);
+  for (u32 m = 0; m < CORR_LEN; m++)
+    spectrum[m].im = -spectrum[m].im;
+}
+
+/** Build the transform tables and code spectra.
+ * Must be called after correlator_setup().
+ *
+ * \param if_freq   Front end IF [Hz].
+ * \param n_threads Threads to search carrier frequencies with, 0 for one per
+ *                  CPU.
+ */
+void acq_fft_setup(double if_freq, u8 n_threads)
+{
+  fft.if_phase_rate = (u32)llround(if_freq / SAMPLE_FREQ * 4294967296.0);
+
+  if (n_threads == 0)
+    n_threads = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1), ACQ_FFT_MAX_THREADS);
+  fft.n_threads = MIN(n_threads, ACQ_FFT_MAX_THREADS);
+
+  for (u32 i = 0; i < CORR_LEN / 2; i++) {
+    fft.twiddle[i].re = cos(-2 * M_PI * i / CORR_LEN);
+    fft.twiddle[i].im = sin(-2 * M_PI * i / CORR_LEN);
+  }
+  for (u32 i = 0; i < CORR_LEN; i++) {
+    u32 r = 0;
+    for (u8 b = 0; b < CORR_LEN_BITS; b++)
+      r |= ((i >> b) & 1) << (CORR_LEN_BITS - 1 - b);
+    fft.bit_rev[i] = r;
+  }
+
+  for (u8 prn = 0; prn < 32; prn++)
+    code_spectrum(prn, fft.code[prn]);
+}
+
+/** Mix down, decimate and transform a load of samples, as the NAP loads its
+ * sample RAM.
+ *
+ * \param load    Spectrum of the load, shared by all later searches over it.
+ * \param samples ACQ_FFT_N_SAMPLES samples.
+ */
+void acq_fft_load(acq_fft_load_t *load, const s8 samples[])
+{
+  s32 *acc_i = malloc((ACQ_FFT_N_SAMPLES + 1) * sizeof(s32));
+  s32 *acc_q = malloc((ACQ_FFT_N_SAMPLES + 1) * sizeof(s32));
+  if (!acc_i || !acc_q) {
+    fprintf(stderr, "acq_fft: out of memory\n");
+    exit(1);
+  }
+
+  correlator_wipeoff(samples, ACQ_FFT_N_SAMPLES, 0, fft.if_phase_rate,
+                     acc_i, acc_q);
+  for (u32 j = 0; j < ACQ_FFT_LEN; j++) {
+    load->spectrum[j].re = acc_i[(j + 1) * ACQ_FFT_DECIM]
+                           - acc_i[j * ACQ_FFT_DECIM];
+    load->spectrum[j].im = acc_q[(j + 1) * ACQ_FFT_DECIM]
+                           - acc_q[j * ACQ_FFT_DECIM];
+    load->spectrum[j + ACQ_FFT_LEN].re = 0;
+    load->spectrum[j + ACQ_FFT_LEN].im = 0;
+  }
+  free(acc_i);
+  free(acc_q);
+
+  fft_run(load->spectrum, false);
+}
+
+/** Correlate at one carrier frequency, cf in FFT bins. */
+static void bin_search(const acq_fft_load_t *load, u8 prn, s32 cf,
+                       acq_fft_cpx_t work[], acq_fft_bin_t *bin)
+{
+  /* Mixing the taps down by cf FFT bins rotates the spectrum, of the zero
+   * padded taps, by 2 cf. */
+  const acq_fft_cpx_t *code = fft.code[prn];
+  u32 shift = (u32)(2 * cf) % CORR_LEN;
+  for (u32 m = 0; m < CORR_LEN; m++) {
+    const acq_fft_cpx_t *y = &load->spectrum[(m + shift) % CORR_LEN];
+    work[m].re = y->re * code[m].re - y->im * code[m].im;
+    work[m].im = y->re * code[m].im + y->im * code[m].re;
+  }
+  fft_run(work, true);
+
+  float p_sum = 0, p_max = 0;
+  u16 i_max = 0;
+  for (u32 lag = 0; lag < N_LAGS; lag++) {
+    float p = work[lag].re * work[lag].re + work[lag].im * work[lag].im;
+    p_sum += p;
+    if (p > p_max) {
+      p_max = p;
+      i_max = lag;
+    }
+  }
+  bin->index = i_max;
+  bin->max = p_max;
+  bin->ave = p_sum / N_LAGS;
+}
+
+typedef struct {
+  pthread_t thread;
+  const acq_fft_load_t *load;
+  u8 prn;
+  s32 cf_min;
+  s32 cf_step;
+  u32 first;
+  u32 n_bins;
+  u32 stride;
+  acq_fft_bin_t *bins;
+} worker_t;
+
+static void *worker_run(void *arg)
+{
+  worker_t *w = arg;
+  acq_fft_cpx_t *work = malloc(CORR_LEN * sizeof(acq_fft_cpx_t));
+  if (!work) {
+    fprintf(stderr, "acq_fft: out of memory\n");
+    exit(1);
+  }
+  for (u32 i = w->first; i < w->n_bins; i += w->stride)
+    bin_search(w->load, w->prn, w->cf_min + (s32)i * w->cf_step, work,
+               &w->bins[i]);
+  free(work);
+  return NULL;
+}
+
+/** Search a load for a PRN at a range of carrier frequencies, the carrier
+ * frequencies split between threads.
+ *
+ * \param load    Load from acq_fft_load().
+ * \param prn     PRN to search for (0-31).
+ * \param cf_min  First carrier frequency [ACQ_FFT_CARRIER_FREQ_UNITS].
+ * \param cf_step Carrier frequency step [ACQ_FFT_CARRIER_FREQ_UNITS].
+ * \param n_bins  Number of carrier frequencies.
+ * \param bins    n_bins results.
+ */
+void acq_fft_bins(const acq_fft_load_t *load, u8 prn, s32 cf_min,
+                  s32 cf_step, u32 n_bins, acq_fft_bin_t bins[])
+{
+  worker_t workers[ACQ_FFT_MAX_THREADS];
+  u8 n_workers = MAX(MIN(fft.n_threads, n_bins), 1);
+
+  for (u8 i = 0; i < n_workers; i++) {
+    workers[i] = (worker_t){
+      .load = load, .prn = prn, .cf_min = cf_min, .cf_step = cf_step,
+      .first = i, .n_bins = n_bins, .stride = n_workers, .bins = bins,
+    };
+  }
+
+  /* The calling thread takes the first share, there are no threads to start
+   * for a single bin. */
+  for (u8 i = 1; i < n_workers; i++) {
+    if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i])) {
+      fprintf(stderr, "acq_fft: can't start thread\n");
+      exit(1);
+    }
+  }
+  worker_run(&workers[0]);
+  for (u8 i = 1; i < n_workers; i++)
+    pthread_join(workers[i].thread, NULL);
+}
+
+/** Acquisition search of a load for a PRN over a carrier frequency range.
+ * Searches the same carrier frequencies as acq_search() and reduces them to
+ * the same results as acq_get_results().
+ *
+ * \param load         Load from acq_fft_load().
+ * \param prn          PRN to search for (0-31).
+ * \param cf_min       Lowest carrier frequency to search. (Hz)
+ * \param cf_max       Highest carrier frequency to search. (Hz)
+ * \param cf_bin_width Step size between each carrier frequency. (Hz)
+ * \param cp           Code phase of the acquisition result. (chips)
+ * \param cf           Carrier frequency of the acquisition result. (Hz)
+ * \param cn0          Estimated CN0 of the acquisition result. (dBHz)
+ */
+void acq_fft_search(const acq_fft_load_t *load, u8 prn, float cf_min,
+                    float cf_max, float cf_bin_width,
+                    float *cp, float *cf, float *cn0)
+{
+  s32 step = cf_bin_width * ACQ_FFT_CARRIER_FREQ_UNITS_PER_HZ;
+  if (step < 1)
+    step = 1;
+  s32 first = step * floor(cf_min * ACQ_FFT_CARRIER_FREQ_UNITS_PER_HZ /
+                           (float)step);
+  s32 last = step * ceil(cf_max * ACQ_FFT_CARRIER_FREQ_UNITS_PER_HZ /
+                         (float)step);
+  u32 n_bins = (last - first) / step + 1;
+
+  acq_fft_bin_t *bins = malloc(n_bins * sizeof(acq_fft_bin_t));
+  if (!bins) {
+    fprintf(stderr, "acq_fft: out of memory\n");
+    exit(1);
+  }
+  acq_fft_bins(load, prn, first, step, n_bins, bins);
+
+  float power_acc = 0;
+  u32 best = 0;
+  for (u32 i = 0; i < n_bins; i++) {
+    power_acc += bins[i].ave;
+    if (bins[i].max > bins[best].max)
+      best = i;
+  }
+
+  *cp = 1023.0 - (float)(bins[best].index % N_LAGS)
+                 / ACQ_FFT_CODE_PHASE_UNITS_PER_CHIP;
+  *cf = (float)(first + (s32)best * step) / ACQ_FFT_CARRIER_FREQ_UNITS_PER_HZ;
+  if (power_acc == 0)
+    *cn0 = 0;
+  else
+    *cn0 = 10 * log10(bins[best].max / (power_acc / n_bins))
+           + 10 * log10(1.0 / ACQ_FFT_CARRIER_FREQ_UNITS_PER_HZ);
+  free(bins);
+}
+
+/** \} */
+
+/** \} */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_HOST_ACQ_FFT_H
+#define SWIFTNAV_HOST_ACQ_FFT_H
+
+#include <libswiftnav/common.h>
+
+#include "../main.h"
+#include "../board/nap/nap_emu.h"
+
+/** \addtogroup acq_fft
+ * \{ */
+
+/** FFT length, as the emulated NAP's acquisition channel. */
+#define ACQ_FFT_LEN (1 << NAP_EMU_ACQ_FFT_INDEX_BITS)
+/** Samples summed into each FFT input. */
+#define ACQ_FFT_DECIM (4 * NAP_EMU_ACQ_DOWNSAMPLE_STAGES)
+/** Samples in one acquisition load. */
+#define ACQ_FFT_N_SAMPLES (ACQ_FFT_LEN * ACQ_FFT_DECIM)
+/** Sample rate of the FFT input [Hz]. */
+#define ACQ_FFT_SAMPLE_FREQ (SAMPLE_FREQ / ACQ_FFT_DECIM)
+/** Code phase units, as NAP_ACQ_CODE_PHASE_UNITS_PER_CHIP. */
+#define ACQ_FFT_CODE_PHASE_UNITS_PER_CHIP (ACQ_FFT_SAMPLE_FREQ / 1023000)
+/** Carrier frequency units, one FFT bin, as
+ * NAP_ACQ_CARRIER_FREQ_UNITS_PER_HZ. */
+#define ACQ_FFT_CARRIER_FREQ_UNITS_PER_HZ \
+  (ACQ_FFT_LEN / (float)ACQ_FFT_SAMPLE_FREQ)
+
+/** Most threads used to search carrier frequency bins. */
+#define ACQ_FFT_MAX_THREADS 16
+
+typedef struct {
+  float re;
+  float im;
+} acq_fft_cpx_t;
+
+/** Spectrum of one load of samples, shared by all PRNs and carrier
+ * frequencies searched over it. */
+typedef struct {
+  acq_fft_cpx_t spectrum[2 * ACQ_FFT_LEN]; /**< Of the zero padded taps. */
+} acq_fft_load_t;
+
+/** Result for one carrier frequency, as read from the NAP's ACQ_CORR
+ * register. */
+typedef struct {
+  u16 index;   /**< Code phase of the peak [ACQ_FFT_CODE_PHASE_UNITS]. */
+  float max;   /**< Power of the peak. */
+  float ave;   /**< Mean power over all code phases. */
+} acq_fft_bin_t;
+
+/** \} */
+
+void acq_fft_setup(double if_freq, u8 n_threads);
+void acq_fft_load(acq_fft_load_t *load, const s8 samples[]);
+void acq_fft_bins(const acq_fft_load_t *load, u8 prn, s32 cf_min,
+                  s32 cf_step, u32 n_bins, acq_fft_bin_t bins[]);
+void acq_fft_search(const acq_fft_load_t *load, u8 prn, float cf_min,
+                    float cf_max, float cf_bin_width,
+                    float *cp, float *cf, float *cn0);
+
+#endif  /* SWIFTNAV_HOST_ACQ_FFT_H */
@@ -0,0 +1,530 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libswiftnav/prns.h>
+
+#include "correlator.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#define CORRELATOR_X86
+#include <immintrin.h>
+#endif
+
+/** \addtogroup host
+ * \{ */
+
+/** \defgroup correlator Software Correlator
+ * Early, prompt and late correlators over 2-bit samples, the software
+ * counterpart of the NAP tracking channel.
+ *
+ * Correlating sample by sample means stepping three code NCOs and a carrier
+ * NCO for every sample. Instead the carrier is wiped off a block at a time
+ * into running sums, which is the only per sample work and is vectorised with
+ * SSE2 or AVX2 where the CPU has them. The code replicas are constant for
+ * runs of about eight samples, between half chip boundaries of the early
+ * replica, so each replica's correlation is a sum over those runs of the
+ * difference of two running sums times the chip. The early and late replicas
+ * change chip on the same boundaries and the prompt on the ones in between.
+ *
+ * The regrouping is exact: correlator_track() returns the same correlations
+ * as correlator_track_ref(), the straightforward per sample version, with
+ * every instruction set. The NCOs use the NAP's fixed point units and
+ * rounding so the phases the firmware reads back from the emulator are those
+ * actually correlated with.
+ * \{ */
+
+#define CORR_MAX ((1 << 23) - 1)
+
+#define HALF_CHIP ((u64)1 << 31)
+
+/** Carrier wipe-off table, cosine in the low half word and minus sine in the
+ * high half word of each entry, so both products come out of one lookup. */
+static s32 carrier_lut[1 << CORRELATOR_CARRIER_LUT_BITS];
+
+/** Kernels for one instruction set. */
+typedef struct {
+  /** See correlator_wipeoff(). */
+  void (*wipeoff)(const s8 x[], u32 n, u32 ph, u32 dph,
+                  s32 acc_i[], s32 acc_q[]);
+  /** Early, prompt and late sums over n runs, see correlator_track(). Run
+   * sums are padded with zeros to a multiple of CORRELATOR_RUN_ALIGN. */
+  void (*runs)(const s32 run_i[], const s32 run_q[], u32 n, const s8 c[],
+               s32 sums[6]);
+} kernels_t;
+
+static kernels_t kernels[CORRELATOR_ISA_N];
+static correlator_isa_t isa_current;
+
+static const char *isa_names[CORRELATOR_ISA_N] = {
+  [CORRELATOR_ISA_SCALAR] = "scalar",
+  [CORRELATOR_ISA_SSE2] = "sse2",
+  [CORRELATOR_ISA_AVX2] = "avx2",
+};
+
+static s16 lut_cos(u32 i)
+{
+  return (s16)carrier_lut[i];
+}
+
+static s16 lut_msin(u32 i)
+{
+  return (s16)(carrier_lut[i] >> 16);
+}
+
+static void wipeoff_scalar(const s8 x[], u32 n, u32 ph, u32 dph,
+                           s32 acc_i[], s32 acc_q[])
+{
+  s32 si = 0, sq = 0;
+  acc_i[0] = acc_q[0] = 0;
+  for (u32 k = 0; k < n; k++) {
+    u32 idx = ph >> (32 - CORRELATOR_CARRIER_LUT_BITS);
+    acc_i[k + 1] = si += x[k] * lut_cos(idx);
+    acc_q[k + 1] = sq += x[k] * lut_msin(idx);
+    ph += dph;
+  }
+}
+
+static void runs_scalar(const s32 run_i[], const s32 run_q[], u32 n,
+                        const s8 c[], s32 sums[6])
+{
+  s32 ei = 0, eq = 0, pi = 0, pq = 0, li = 0, lq = 0;
+  for (u32 j = 0; j < n; j++) {
+    ei += c[j + 2] * run_i[j];
+    eq += c[j + 2] * run_q[j];
+    pi += c[j + 1] * run_i[j];
+    pq += c[j + 1] * run_q[j];
+    li += c[j] * run_i[j];
+    lq += c[j] * run_q[j];
+  }
+  sums[0] = ei; sums[1] = eq;
+  sums[2] = pi; sums[3] = pq;
+  sums[4] = li; sums[5] = lq;
+}
+
+#ifdef CORRELATOR_X86
+
+/* The simulator's thread stacks aren't guaranteed to be 16 byte aligned, let
+ * the vector functions realign their own frames. */
+#define SIMD_FN(isa) __attribute__((target(isa), force_align_arg_pointer))
+
+SIMD_FN("sse2")
+static void wipeoff_sse2(const s8 x[], u32 n, u32 ph, u32 dph,
+                         s32 acc_i[], s32 acc_q[])
+{
+  const __m128i lo = _mm_set1_epi32(0x0000FFFF);
+  __m128i carry_i = _mm_setzero_si128();
+  __m128i carry_q = _mm_setzero_si128();
+
+  acc_i[0] = acc_q[0] = 0;
+  u32 k = 0;
+  for (; k + 4 <= n; k += 4) {
+    /* No gather before AVX2, look the carrier up four at a time. */
+    const u32 shift = 32 - CORRELATOR_CARRIER_LUT_BITS;
+    __m128i lut = _mm_set_epi32(carrier_lut[(ph + 3*dph) >> shift],
+                                carrier_lut[(ph + 2*dph) >> shift],
+                                carrier_lut[(ph + dph) >> shift],
+                                carrier_lut[ph >> shift]);
+    ph += 4*dph;
+
+    /* Sign extend four samples into the low half word of each lane. */
+    s32 packed;
+    memcpy(&packed, &x[k], sizeof(packed));
+    __m128i xs = _mm_cvtsi32_si128(packed);
+    xs = _mm_unpacklo_epi8(xs, xs);
+    xs = _mm_srai_epi32(_mm_unpacklo_epi16(xs, xs), 24);
+
+    __m128i pi = _mm_madd_epi16(_mm_and_si128(xs, lo), lut);
+    __m128i pq = _mm_madd_epi16(_mm_slli_epi32(xs, 16), lut);
+
+    /* Prefix sum across the lanes. */
+    pi = _mm_add_epi32(pi, _mm_slli_si128(pi, 4));
+    pq = _mm_add_epi32(pq, _mm_slli_si128(pq, 4));
+    pi = _mm_add_epi32(pi, _mm_slli_si128(pi, 8));
+    pq = _mm_add_epi32(pq, _mm_slli_si128(pq, 8));
+    pi = _mm_add_epi32(pi, carry_i);
+    pq = _mm_add_epi32(pq, carry_q);
+    carry_i = _mm_shuffle_epi32(pi, 0xFF);
+    carry_q = _mm_shuffle_epi32(pq, 0xFF);
+
+    _mm_storeu_si128((__m128i *)&acc_i[k + 1], pi);
+    _mm_storeu_si128((__m128i *)&acc_q[k + 1], pq);
+  }
+
+  if (k < n) {
+    s32 ci = acc_i[k], cq = acc_q[k];
+    wipeoff_scalar(&x[k], n - k, ph, dph, &acc_i[k], &acc_q[k]);
+    for (u32 j = k; j <= n; j++) {
+      acc_i[j] += ci;
+      acc_q[j] += cq;
+    }
+  }
+}
+
+/** Four +/-1 chips sign extended to 32 bits. */
+SIMD_FN("sse2")
+static __m128i chips_sse2(const s8 c[])
+{
+  s32 packed;
+  memcpy(&packed, c, sizeof(packed));
+  __m128i v = _mm_cvtsi32_si128(packed);
+  v = _mm_unpacklo_epi8(v, v);
+  return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 24);
+}
+
+/** Multiply by +/-1 as a conditional negation, x * c = (x ^ m) - m with m
+ * all ones where c is negative. */
+SIMD_FN("sse2")
+static __m128i sign_sse2(__m128i x, __m128i c)
+{
+  __m128i m = _mm_srai_epi32(c, 31);
+  return _mm_sub_epi32(_mm_xor_si128(x, m), m);
+}
+
+SIMD_FN("sse2")
+static s32 hsum_sse2(__m128i v)
+{
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xB1));
+  return _mm_cvtsi128_si32(v);
+}
+
+SIMD_FN("sse2")
+static void runs_sse2(const s32 run_i[], const s32 run_q[], u32 n,
+                      const s8 c[], s32 sums[6])
+{
+  __m128i acc[6];
+  for (u8 i = 0; i < 6; i++)
+    acc[i] = _mm_setzero_si128();
+
+  for (u32 j = 0; j < n; j += 4) {
+    __m128i ri = _mm_loadu_si128((const __m128i *)&run_i[j]);
+    __m128i rq = _mm_loadu_si128((const __m128i *)&run_q[j]);
+    for (u8 r = 0; r < 3; r++) {
+      __m128i cv = chips_sse2(&c[j + 2 - r]);
+      acc[2*r] = _mm_add_epi32(acc[2*r], sign_sse2(ri, cv));
+      acc[2*r + 1] = _mm_add_epi32(acc[2*r + 1], sign_sse2(rq, cv));
+    }
+  }
+
+  for (u8 i = 0; i < 6; i++)
+    sums[i] = hsum_sse2(acc[i]);
+}
+
+SIMD_FN("avx2")
+static void wipeoff_avx2(const s8 x[], u32 n, u32 ph, u32 dph,
+                         s32 acc_i[], s32 acc_q[])
+{
+  const __m256i lo = _mm256_set1_epi32(0x0000FFFF);
+  const __m256i last = _mm256_set1_epi32(7);
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i vph = _mm256_add_epi32(_mm256_set1_epi32(ph),
+                   _mm256_mullo_epi32(lanes, _mm256_set1_epi32(dph)));
+  const __m256i vdph = _mm256_set1_epi32(8*dph);
+  __m256i carry_i = _mm256_setzero_si256();
+  __m256i carry_q = _mm256_setzero_si256();
+
+  acc_i[0] = acc_q[0] = 0;
+  u32 k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256i idx = _mm256_srli_epi32(vph, 32 - CORRELATOR_CARRIER_LUT_BITS);
+    __m256i lut = _mm256_i32gather_epi32((const int *)carrier_lut, idx, 4);
+    vph = _mm256_add_epi32(vph, vdph);
+
+    __m256i xs = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)&x[k]));
+    __m256i pi = _mm256_madd_epi16(_mm256_and_si256(xs, lo), lut);
+    __m256i pq = _mm256_madd_epi16(_mm256_slli_epi32(xs, 16), lut);
+
+    /* Prefix sum within each 128 bit lane, then carry the low lane's total
+     * into the high lane. */
+    pi = _mm256_add_epi32(pi, _mm256_slli_si256(pi, 4));
+    pq = _mm256_add_epi32(pq, _mm256_slli_si256(pq, 4));
+    pi = _mm256_add_epi32(pi, _mm256_slli_si256(pi, 8));
+    pq = _mm256_add_epi32(pq, _mm256_slli_si256(pq, 8));
+    __m256i ti = _mm256_shuffle_epi32(pi, 0xFF);
+    __m256i tq = _mm256_shuffle_epi32(pq, 0xFF);
+    pi = _mm256_add_epi32(pi, _mm256_permute2x128_si256(ti, ti, 0x08));
+    pq = _mm256_add_epi32(pq, _mm256_permute2x128_si256(tq, tq, 0x08));
+    pi = _mm256_add_epi32(pi, carry_i);
+    pq = _mm256_add_epi32(pq, carry_q);
+    carry_i = _mm256_permutevar8x32_epi32(pi, last);
+    carry_q = _mm256_permutevar8x32_epi32(pq, last);
+
+    _mm256_storeu_si256((__m256i *)&acc_i[k + 1], pi);
+    _mm256_storeu_si256((__m256i *)&acc_q[k + 1], pq);
+  }
+
+  if (k < n) {
+    s32 ci = acc_i[k], cq = acc_q[k];
+    wipeoff_scalar(&x[k], n - k, ph + k*dph, dph, &acc_i[k], &acc_q[k]);
+    for (u32 j = k; j <= n; j++) {
+      acc_i[j] += ci;
+      acc_q[j] += cq;
+    }
+  }
+}
+
+SIMD_FN("avx2")
+static void runs_avx2(const s32 run_i[], const s32 run_q[], u32 n,
+                      const s8 c[], s32 sums[6])
+{
+  __m256i acc[6];
+  for (u8 i = 0; i < 6; i++)
+    acc[i] = _mm256_setzero_si256();
+
+  for (u32 j = 0; j < n; j += 8) {
+    __m256i ri = _mm256_loadu_si256((const __m256i *)&run_i[j]);
+    __m256i rq = _mm256_loadu_si256((const __m256i *)&run_q[j]);
+    for (u8 r = 0; r < 3; r++) {
+      __m256i cv = _mm256_cvtepi8_epi32(
+                     _mm_loadl_epi64((const __m128i *)&c[j + 2 - r]));
+      acc[2*r] = _mm256_add_epi32(acc[2*r], _mm256_sign_epi32(ri, cv));
+      acc[2*r + 1] = _mm256_add_epi32(acc[2*r + 1], _mm256_sign_epi32(rq, cv));
+    }
+  }
+
+  for (u8 i = 0; i < 6; i++) {
+    __m128i v = _mm_add_epi32(_mm256_castsi256_si128(acc[i]),
+                              _mm256_extracti128_si256(acc[i], 1));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xB1));
+    sums[i] = _mm_cvtsi128_si32(v);
+  }
+}
+
+#endif  /* CORRELATOR_X86 */
+
+/** Build the carrier table and pick the widest instruction set the CPU
+ * supports. */
+void correlator_setup(void)
+{
+  for (u32 i = 0; i < (1 << CORRELATOR_CARRIER_LUT_BITS); i++) {
+    double theta = 2 * M_PI * (i + 0.5) / (1 << CORRELATOR_CARRIER_LUT_BITS);
+    s16 c = lround(CORRELATOR_CARRIER_SCALE * cos(theta));
+    s16 s = lround(CORRELATOR_CARRIER_SCALE * sin(theta));
+    carrier_lut[i] = (u16)c | (u32)(u16)-s << 16;
+  }
+
+  kernels[CORRELATOR_ISA_SCALAR] = (kernels_t){wipeoff_scalar, runs_scalar};
+  isa_current = CORRELATOR_ISA_SCALAR;
+#ifdef CORRELATOR_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    kernels[CORRELATOR_ISA_SSE2] = (kernels_t){wipeoff_sse2, runs_sse2};
+    isa_current = CORRELATOR_ISA_SSE2;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    kernels[CORRELATOR_ISA_AVX2] = (kernels_t){wipeoff_avx2, runs_avx2};
+    isa_current = CORRELATOR_ISA_AVX2;
+  }
+#endif
+}
+
+correlator_isa_t correlator_isa(void)
+{
+  return isa_current;
+}
+
+/** Select the instruction set to use.
+ * \return false if the CPU doesn't support it.
+ */
+bool correlator_isa_set(correlator_isa_t isa)
+{
+  if (isa >= CORRELATOR_ISA_N || !kernels[isa].wipeoff)
+    return false;
+  isa_current = isa;
+  return true;
+}
+
+const char *correlator_isa_name(correlator_isa_t isa)
+{
+  return (isa < CORRELATOR_ISA_N) ? isa_names[isa] : "?";
+}
+
+/** Expand a PRN's packed C/A code for the correlators.
+ * The early replica in the half chip run q of a period, counting from a half
+ * chip boundary at the start of chip 0, is chip q / 2 and is found at
+ * code->half_chips[q + 2]. The prompt and late replicas are one and two half
+ * chips behind. Enough of the code is repeated past the end for a block's
+ * worth of runs starting anywhere in the first code period.
+ */
+void correlator_code(u8 prn, correlator_code_t *code)
+{
+  const u8 *packed = ca_code(prn);
+  for (u32 i = 0; i < CORRELATOR_CODE_LEN; i++) {
+    u16 chip = (i / 2 + 1022) % 1023;
+    code->half_chips[i] = (packed[chip / 8] >> (7 - chip % 8)) & 1 ? -1 : 1;
+  }
+}
+
+/** Wipe the carrier off a block of samples.
+ * Outputs running sums of the wiped off samples, acc[k] is the sum over the
+ * first k samples, scaled by CORRELATOR_CARRIER_SCALE.
+ *
+ * \param samples            Input samples.
+ * \param n                  Number of samples, less than 2^23.
+ * \param carrier_phase      Carrier phase at the first sample [2^-32 cycles].
+ * \param carrier_phase_rate Carrier phase increment [2^-32 cycles/sample].
+ * \param acc_i              n + 1 in-phase running sums.
+ * \param acc_q              n + 1 quadrature running sums.
+ */
+void correlator_wipeoff(const s8 samples[], u32 n, u32 carrier_phase,
+                        u32 carrier_phase_rate, s32 acc_i[], s32 acc_q[])
+{
+  kernels[isa_current].wipeoff(samples, n, carrier_phase, carrier_phase_rate,
+                               acc_i, acc_q);
+}
+
+static s32 corr_clamp(s64 x)
+{
+  x /= CORRELATOR_CARRIER_SCALE;
+  return (s32)MAX(-CORR_MAX, MIN(CORR_MAX, x));
+}
+
+/** Early, prompt and late correlations over one integration period.
+ *
+ * \param samples Samples of the period, nco->n_samples of them.
+ * \param code    Code, see correlator_code().
+ * \param nco     Code and carrier NCOs.
+ * \param corrs   Early, prompt and late correlations, as read from the NAP.
+ */
+void correlator_track(const s8 samples[], const correlator_code_t *code,
+                      const correlator_nco_t *nco, corr_t corrs[3])
+{
+  s32 acc_i[CORRELATOR_BLOCK + 1], acc_q[CORRELATOR_BLOCK + 1];
+  u32 ends[CORRELATOR_MAX_RUNS];
+  s32 run_i[CORRELATOR_MAX_RUNS + CORRELATOR_RUN_ALIGN];
+  s32 run_q[CORRELATOR_MAX_RUNS + CORRELATOR_RUN_ALIGN];
+  s64 re[3] = {0, 0, 0}, im[3] = {0, 0, 0};
+
+  const u32 half = HALF_CHIP;
+  const u32 rate = nco->code_phase_rate;
+
+  /* Half chip run the period starts in, within the first code period. */
+  u32 q = (nco->code_phase >> 31) % (2 * 1023);
+
+  /* Runs between half chip boundaries are n_run_max or n_run_max - 1
+   * samples long. Just past a boundary the code phase is frac into the half
+   * chip, with frac < rate, and the next run is the shorter one if frac +
+   * excess reaches rate. This keeps the division out of the loop and the
+   * loop carried dependency short. */
+  const u32 n_run_max = (half + rate - 1) / rate;
+  const u32 excess = n_run_max * rate - half;
+  u32 frac0 = nco->code_phase & (HALF_CHIP - 1);
+  u32 run_end = (half - frac0 + rate - 1) / rate;
+  u32 frac = frac0 + run_end * rate - half;
+
+  /* Sums over the part of the current run in previous blocks. */
+  s32 pend_i = 0, pend_q = 0;
+
+  u32 ph = nco->carrier_phase;
+  for (u32 k0 = 0; k0 < nco->n_samples; k0 += CORRELATOR_BLOCK) {
+    u32 n = MIN(CORRELATOR_BLOCK, nco->n_samples - k0);
+    correlator_wipeoff(&samples[k0], n, ph, nco->carrier_phase_rate,
+                       acc_i, acc_q);
+    ph += n * nco->carrier_phase_rate;
+
+    /* Runs ending in this block. */
+    u32 n_runs = 0;
+    while (run_end - k0 <= n) {
+      ends[n_runs++] = run_end - k0;
+      frac += excess;
+      u32 shorter = frac >= rate;
+      if (shorter)
+        frac -= rate;
+      run_end += n_run_max - shorter;
+    }
+
+    if (n_runs == 0) {
+      pend_i += acc_i[n];
+      pend_q += acc_q[n];
+      continue;
+    }
+
+    u32 start = 0;
+    for (u32 j = 0; j < n_runs; j++) {
+      run_i[j] = acc_i[ends[j]] - acc_i[start];
+      run_q[j] = acc_q[ends[j]] - acc_q[start];
+      start = ends[j];
+    }
+    run_i[0] += pend_i;
+    run_q[0] += pend_q;
+    pend_i = acc_i[n] - acc_i[start];
+    pend_q = acc_q[n] - acc_q[start];
+    for (u32 j = n_runs; j % CORRELATOR_RUN_ALIGN; j++)
+      run_i[j] = run_q[j] = 0;
+
+    /* A block's sums fit in 32 bits, cheaper on the 32 bit host build. */
+    s32 sums[6];
+    kernels[isa_current].runs(run_i, run_q, n_runs, &code->half_chips[q],
+                              sums);
+    for (u8 i = 0; i < 3; i++) {
+      re[i] += sums[2*i];
+      im[i] += sums[2*i + 1];
+    }
+
+    q += n_runs;
+    if (q >= 2 * 1023)
+      q -= 2 * 1023;
+  }
+
+  /* What's left of the run the period ends in. */
+  const s8 *c = &code->half_chips[q];
+  re[0] += c[2] * pend_i;
+  im[0] += c[2] * pend_q;
+  re[1] += c[1] * pend_i;
+  im[1] += c[1] * pend_q;
+  re[2] += c[0] * pend_i;
+  im[2] += c[0] * pend_q;
+
+  for (u8 i = 0; i < 3; i++) {
+    corrs[i].I = corr_clamp(re[i]);
+    corrs[i].Q = corr_clamp(im[i]);
+  }
+}
+
+/** Reference version of correlator_track(), stepping every NCO for every
+ * sample. */
+void correlator_track_ref(const s8 samples[], const correlator_code_t *code,
+                          const correlator_nco_t *nco, corr_t corrs[3])
+{
+  const u64 chip = (u64)1 << 32;
+  /* Keep the late replica's phase from wrapping below zero. */
+  u64 cp = nco->code_phase + 1023 * chip;
+  u32 ph = nco->carrier_phase;
+
+  s64 re[3] = {0, 0, 0}, im[3] = {0, 0, 0};
+  for (u32 k = 0; k < nco->n_samples; k++) {
+    u32 idx = ph >> (32 - CORRELATOR_CARRIER_LUT_BITS);
+    s32 xc = samples[k] * lut_cos(idx);
+    s32 xs = samples[k] * lut_msin(idx);
+    for (u8 i = 0; i < 3; i++) {
+      s8 c = code->half_chips[2 * (((cp - i * chip / 2) >> 32) % 1023) + 2];
+      re[i] += c * xc;
+      im[i] += c * xs;
+    }
+    ph += nco->carrier_phase_rate;
+    cp += nco->code_phase_rate;
+  }
+
+  for (u8 i = 0; i < 3; i++) {
+    corrs[i].I = corr_clamp(re[i]);
+    corrs[i].Q = corr_clamp(im[i]);
+  }
+}
+
+/** \} */
+
+/** \} */
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_HOST_CORRELATOR_H
+#define SWIFTNAV_HOST_CORRELATOR_H
+
+#include <libswiftnav/common.h>
+
+#include "../board/nap/nap_common.h"
+
+/** \addtogroup correlator
+ * \{ */
+
+/** Entries in the carrier wipe-off table, one full cycle. */
+#define CORRELATOR_CARRIER_LUT_BITS 6
+/** Amplitude of the carrier wipe-off table. Correlations are scaled back
+ * down by this so they are in units of samples. */
+#define CORRELATOR_CARRIER_SCALE 64
+
+/** Samples wiped off at a time. */
+#define CORRELATOR_BLOCK 1024
+/** Most half chip runs ending in a block, with the code phase rate less than
+ * an eighth of a chip per sample as for the NAP. */
+#define CORRELATOR_MAX_RUNS (CORRELATOR_BLOCK / 4 + 1)
+/** Runs are correlated this many at a time. */
+#define CORRELATOR_RUN_ALIGN 8
+/** Length of an expanded code, see correlator_code(). */
+#define CORRELATOR_CODE_LEN \
+  (2 + 2 * 1023 + CORRELATOR_MAX_RUNS + CORRELATOR_RUN_ALIGN)
+
+/** A PRN's code expanded to half chips, see correlator_code(). */
+typedef struct {
+  s8 half_chips[CORRELATOR_CODE_LEN];
+} correlator_code_t;
+
+/** Instruction set used for the carrier wipe-off. */
+typedef enum {
+  CORRELATOR_ISA_SCALAR,
+  CORRELATOR_ISA_SSE2,
+  CORRELATOR_ISA_AVX2,
+  CORRELATOR_ISA_N,
+} correlator_isa_t;
+
+/** Code and carrier NCOs over one integration period. Same fixed point
+ * code phase units as the NAP tracking channel, the carrier includes the IF
+ * and is a plain 32 bit phase accumulator. */
+typedef struct {
+  u32 n_samples;
+  u64 code_phase;         /**< Early code phase at start [2^-32 chips]. */
+  u32 code_phase_rate;    /**< [2^-32 chips/sample], less than 2^29. */
+  u32 carrier_phase;      /**< Carrier phase at start [2^-32 cycles]. */
+  u32 carrier_phase_rate; /**< [2^-32 cycles/sample] */
+} correlator_nco_t;
+
+/** \} */
+
+void correlator_setup(void);
+correlator_isa_t correlator_isa(void);
+bool correlator_isa_set(correlator_isa_t isa);
+const char *correlator_isa_name(correlator_isa_t isa);
+void correlator_code(u8 prn, correlator_code_t *code);
+void correlator_wipeoff(const s8 samples[], u32 n, u32 carrier_phase,
+                        u32 carrier_phase_rate, s32 acc_i[], s32 acc_q[]);
+void correlator_track(const s8 samples[], const correlator_code_t *code,
+                      const correlator_nco_t *nco, corr_t corrs[3]);
+void correlator_track_ref(const s8 samples[], const correlator_code_t *code,
+                          const correlator_nco_t *nco, corr_t corrs[3]);
+
+#endif  /* SWIFTNAV_HOST_CORRELATOR_H */
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_HOST_H
+#define SWIFTNAV_HOST_H
+
+/* Included from chconf.h when building for the ChibiOS POSIX simulator port
+ * (PIKSI_HOST defined), stands in for the Cortex-M4 specific parts of the
+ * port that the firmware uses directly. Can't use any ChibiOS types here. */
+
+#include <libswiftnav/common.h>
+
+/** \addtogroup host
+ * \{ */
+
+/** Host threads call into libc (printf, file I/O) which needs far more stack
+ * than the target does, pad every working area by this much. */
+#define PORT_INT_REQUIRED_STACK 32768
+
+/** No linker provided heap, give the core allocator a static area. */
+#define CH_MEMCORE_SIZE (1024*1024)
+
+/** Service the emulated interrupt sources whenever the simulator is idle. */
+#define IDLE_LOOP_HOOK() { ChkIntSources(); }
+
+/* Cortex-M4 cycle counter, emulated from the host's monotonic clock at the
+ * rate the STM32 runs at with the NAP sample clock. */
+#define HOST_CPU_FREQ 130944000
+
+#define DWT_CYCCNT (*host_dwt_cyccnt())
+#define DWT_CTRL   host_dwt_ctrl
+#define SCS_DEMCR  host_scs_demcr
+
+/* Nothing interrupts the simulator asynchronously, interrupt sources are only
+ * serviced from ChkIntSources(). */
+#define _CCM
+#define irq_disable()
+#define irq_enable()
+#define breakpoint() __builtin_trap()
+
+/* ARMCMx port NVIC interface. */
+#define CORTEX_PRIORITY_MASK(n)    (n)
+#define CORTEX_MAX_KERNEL_PRIORITY 0
+
+extern u32 host_dwt_ctrl;
+extern u32 host_scs_demcr;
+
+u32 *host_dwt_cyccnt(void);
+u64 host_cycles(void);
+void nvicEnableVector(u32 n, u32 prio);
+void ChkIntSources(void);
+
+void host_usart_setup(void);
+
+/** \} */
+
+#endif  /* SWIFTNAV_HOST_H */
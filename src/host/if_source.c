@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../main.h"
+#include "../board/nap/nap_emu.h"
+#include "../board/nap/track_channel.h"
+#include "acq_fft.h"
+#include "correlator.h"
+#include "if_source.h"
+#include "sample_source.h"
+
+/** \addtogroup host
+ * \{ */
+
+/** \defgroup if_source IF File Signal Source
+ * NAP emulator signal source correlating a recorded IF capture.
+ *
+ * Set `PIKSI_HOST_IF_FILE` to a raw capture from the MAX2769 to run
+ * acquisition and tracking against real signals instead of the analytic
+ * model. The emulator's sample count is the index into the capture, offset by
+ * `PIKSI_HOST_IF_SKIP` samples. `PIKSI_HOST_IF_FORMAT` is one of `2bit`
+ * (default), `1bit` or `int8`, see sample_source.h, and `PIKSI_HOST_IF_FREQ`
+ * overrides the IF for captures from other front ends.
+ *
+ * Tracking and CW correlations come from the software correlator, see
+ * correlator.c, acquisition from the FFT acquisition engine, see acq_fft.c.
+ * \{ */
+
+/** Mean acquisition tap power reported, as by the analytic source. */
+#define IF_ACQ_NOISE_POWER 256.0
+
+static struct {
+  sample_source_t samples;
+  u64 skip;
+  /** IF in NAP carrier NCO units [2^-24 cycles/sample]. */
+  s64 if_units;
+
+  s8 *buff;
+  u32 buff_len;
+
+  acq_fft_load_t acq_load;
+  u64 acq_load_start;
+  bool acq_load_valid;
+} ifs;
+
+/** Each PRN's code, expanded on first use. */
+static correlator_code_t codes[32];
+static bool code_ready[32];
+
+static const correlator_code_t *code_get(u8 prn)
+{
+  if (!code_ready[prn]) {
+    correlator_code(prn, &codes[prn]);
+    code_ready[prn] = true;
+  }
+  return &codes[prn];
+}
+
+/** Read samples into the shared buffer, growing it as needed. */
+static const s8 *samples_get(u64 start, u32 n)
+{
+  if (n > ifs.buff_len) {
+    ifs.buff = realloc(ifs.buff, n);
+    if (!ifs.buff) {
+      fprintf(stderr, "if_source: out of memory\n");
+      exit(1);
+    }
+    ifs.buff_len = n;
+  }
+  sample_source_read(&ifs.samples, ifs.skip + start, n, ifs.buff);
+  return ifs.buff;
+}
+
+/** Carrier NCO phase at sample count start including the IF, as a 32 bit
+ * phase accumulator [2^-32 cycles], and its increment per sample. */
+static void carrier_nco(u64 start, s64 phase, s64 freq, u32 *ph, u32 *dph)
+{
+  *ph = (u32)((phase + ifs.if_units * (s64)start) << 8);
+  *dph = (u32)((freq + ifs.if_units) << 8);
+}
+
+static void if_track(void *ctx, u8 prn, const nap_emu_nco_t *nco,
+                     corr_t corrs[3])
+{
+  (void)ctx;
+  correlator_nco_t c = {
+    .n_samples = nco->n_samples,
+    .code_phase = nco->code_phase,
+    .code_phase_rate = nco->code_phase_rate,
+  };
+  carrier_nco(nco->start, nco->carrier_phase, nco->carrier_freq,
+              &c.carrier_phase, &c.carrier_phase_rate);
+
+  correlator_track(samples_get(nco->start, nco->n_samples), code_get(prn), &c,
+                   corrs);
+}
+
+static void if_acq(void *ctx, u8 prn, u64 load_start, double cf_hz,
+                   u16 *index, u16 *max, float *ave)
+{
+  (void)ctx;
+  /* acq.c searches many carrier frequencies over each load, transform it
+   * once. */
+  if (!ifs.acq_load_valid || ifs.acq_load_start != load_start) {
+    acq_fft_load(&ifs.acq_load, samples_get(load_start, ACQ_FFT_N_SAMPLES));
+    ifs.acq_load_start = load_start;
+    ifs.acq_load_valid = true;
+  }
+
+  acq_fft_bin_t bin;
+  acq_fft_bins(&ifs.acq_load, prn,
+               lround(cf_hz * ACQ_FFT_CARRIER_FREQ_UNITS_PER_HZ), 1, 1, &bin);
+
+  /* Only the peak to mean ratio matters to acq.c, report it on the same scale
+   * as the NAP. */
+  *index = bin.index;
+  *ave = IF_ACQ_NOISE_POWER;
+  *max = (bin.ave > 0) ? MIN(65535.0, bin.max / bin.ave * IF_ACQ_NOISE_POWER)
+                       : 0;
+}
+
+static void if_cw(void *ctx, u64 start, u32 n_samples, double freq_hz,
+                  corr_t *corr)
+{
+  (void)ctx;
+  s32 *acc_i = malloc((n_samples + 1) * sizeof(s32));
+  s32 *acc_q = malloc((n_samples + 1) * sizeof(s32));
+
+  u32 ph, dph;
+  carrier_nco(start, 0, llround(freq_hz * NAP_TRACK_CARRIER_FREQ_UNITS_PER_HZ),
+              &ph, &dph);
+  correlator_wipeoff(samples_get(start, n_samples), n_samples, ph, dph,
+                     acc_i, acc_q);
+
+  corr->I = acc_i[n_samples] / CORRELATOR_CARRIER_SCALE;
+  corr->Q = acc_q[n_samples] / CORRELATOR_CARRIER_SCALE;
+  free(acc_i);
+  free(acc_q);
+}
+
+static const nap_emu_source_t if_file_source = {
+  .track = if_track,
+  .acq = if_acq,
+  .cw = if_cw,
+  .ctx = NULL,
+};
+
+/** Replace the emulator's analytic signal model with the IF capture named by
+ * `PIKSI_HOST_IF_FILE`, if set. Must be called after nap_setup(). */
+void if_source_setup(void)
+{
+  const char *path = getenv("PIKSI_HOST_IF_FILE");
+  if (!path)
+    return;
+
+  sample_format_t format;
+  if (sample_source_parse_format(getenv("PIKSI_HOST_IF_FORMAT"), &format)) {
+    fprintf(stderr, "if_source: unknown sample format %s\n",
+            getenv("PIKSI_HOST_IF_FORMAT"));
+    exit(1);
+  }
+  if (sample_source_open(&ifs.samples, path, format)) {
+    fprintf(stderr, "if_source: can't open %s\n", path);
+    exit(1);
+  }
+
+  const char *skip = getenv("PIKSI_HOST_IF_SKIP");
+  ifs.skip = skip ? strtoull(skip, NULL, 0) : 0;
+  const char *freq = getenv("PIKSI_HOST_IF_FREQ");
+  double if_freq = freq ? atof(freq) : IF_SOURCE_DEFAULT_IF_FREQ;
+  ifs.if_units = llround(if_freq * NAP_TRACK_CARRIER_FREQ_UNITS_PER_HZ);
+
+  correlator_setup();
+  acq_fft_setup(if_freq, 1);
+  nap_emu_source_set(&if_file_source);
+
+  fprintf(stderr, "Correlating %.1f s of IF samples from %s\n",
+          (ifs.samples.n_samples - MIN(ifs.skip, ifs.samples.n_samples))
+          / (double)SAMPLE_FREQ, path);
+}
+
+/** \} */
+
+/** \} */
@@ -0,0 +1,23 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_HOST_IF_SOURCE_H
+#define SWIFTNAV_HOST_IF_SOURCE_H
+
+#include <libswiftnav/common.h>
+
+/** Nominal IF of the MAX2769 as configured in max2769.c [Hz]. */
+#define IF_SOURCE_DEFAULT_IF_FREQ 4.092e6
+
+void if_source_setup(void);
+
+#endif  /* SWIFTNAV_HOST_IF_SOURCE_H */
@@ -0,0 +1,2 @@
+/* Host build stand-in, see host/opencm3.h. */
+#include "host/opencm3.h"
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libsbp/flash.h>
+#include <libsbp/sbp.h>
+
+#include <libswiftnav/logging.h>
+
+#include <ch.h>
+
+#include "../board/leds.h"
+#include "../board/nap/nap_common.h"
+#include "../board/nap/nap_conf.h"
+#include "../error.h"
+#include "../init.h"
+#include "../sbp.h"
+#include "if_source.h"
+
+/** \addtogroup host
+ * \{ */
+
+/** Reported in place of the STM32 unique device ID. */
+static const u8 host_unique_id[12] = "piksi_host";
+
+static void reset_callback(u16 sender_id, u8 len, u8 msg[], void* context)
+{
+  (void)sender_id; (void)len; (void)msg; (void) context;
+
+  fprintf(stderr, "Reset requested, exiting.\n");
+  exit(0);
+}
+
+static void stm_unique_id_callback(u16 sender_id, u8 len, u8 msg[],
+                                   void* context)
+{
+  (void)sender_id; (void)len; (void)msg; (void) context;
+
+  sbp_send_msg(SBP_MSG_STM_UNIQUE_ID_RESP, sizeof(host_unique_id),
+               (u8 *)host_unique_id);
+}
+
+/** Host counterpart of init.c init(). */
+void init(void)
+{
+  static sbp_msg_callbacks_node_t reset_node;
+  static sbp_msg_callbacks_node_t stm_unique_id_node;
+
+  led_setup();
+
+  /* Before anything can log. */
+  host_usart_setup();
+
+  nap_setup();
+  if_source_setup();
+
+  s32 serial_number = nap_conf_rd_serial_number();
+  if (serial_number <= 0) {
+    serial_number = 0x2222;
+  }
+  sbp_setup(serial_number);
+
+  fault_handling_setup();
+
+  nap_callbacks_setup();
+
+  sbp_register_cbk(SBP_MSG_RESET, &reset_callback, &reset_node);
+  sbp_register_cbk(SBP_MSG_STM_UNIQUE_ID_REQ, &stm_unique_id_callback,
+                   &stm_unique_id_node);
+}
+
+/** The emulated NAP always passes authentication. */
+void check_nap_auth(void)
+{
+}
+
+/** Report a fatal error on stderr and abort, leaving a core dump or the
+ * debugger stopped at the point of failure. */
+void _screaming_death(const char *pos, const char *msg)
+{
+  fprintf(stderr, "ERROR: %s : %s\n", pos, msg);
+  abort();
+}
+
+/** Faults are left to the host OS, run under a debugger to catch them. */
+void fault_handling_setup(void)
+{
+}
+
+/** \} */
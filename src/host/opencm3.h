@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_HOST_OPENCM3_H
+#define SWIFTNAV_HOST_OPENCM3_H
+
+/* The subset of libopencm3 used by the firmware modules that are built
+ * unmodified for the host. The headers under host/include/libopencm3 all
+ * resolve to this one. Peripherals the host build doesn't model are accepted
+ * and ignored, TIM5 is modelled (see timer_host.c) as it paces the solution
+ * thread. */
+
+#include <libswiftnav/common.h>
+
+/** \addtogroup host
+ * \{ */
+
+/* Peripheral "addresses", only used as identifiers. */
+#define GPIOA  0
+#define GPIOB  1
+#define GPIOC  2
+#define SPI1   1
+#define SPI2   2
+#define USART1 1
+#define USART3 3
+#define USART6 6
+#define DMA1   1
+#define DMA2   2
+#define TIM5   5
+
+/* RCC. */
+typedef struct {
+  u8 pllm;
+  u16 plln;
+  u8 pllp;
+  u8 pllq;
+  u32 flash_config;
+  u8 hpre;
+  u8 ppre1;
+  u8 ppre2;
+  u8 power_save;
+  u32 apb1_frequency;
+  u32 apb2_frequency;
+} clock_scale_t;
+
+extern u32 host_rcc_regs[4];
+#define RCC_AHB1ENR host_rcc_regs[0]
+#define RCC_APB1ENR host_rcc_regs[1]
+#define RCC_APB2ENR host_rcc_regs[2]
+#define RCC_CSR     host_rcc_regs[3]
+
+#define RCC_AHB1ENR_IOPAEN   (1 << 0)
+#define RCC_AHB1ENR_IOPBEN   (1 << 1)
+#define RCC_AHB1ENR_IOPCEN   (1 << 2)
+#define RCC_APB1ENR_TIM5EN   (1 << 3)
+#define RCC_APB1ENR_USART3EN (1 << 18)
+#define RCC_APB2ENR_USART1EN (1 << 4)
+#define RCC_APB2ENR_USART6EN (1 << 5)
+
+#define RCC_CSR_LPWRRSTF (1u << 31)
+#define RCC_CSR_WWDGRSTF (1 << 30)
+#define RCC_CSR_IWDGRSTF (1 << 29)
+#define RCC_CSR_SFTRSTF  (1 << 28)
+#define RCC_CSR_PORRSTF  (1 << 27)
+#define RCC_CSR_PINRSTF  (1 << 26)
+#define RCC_CSR_RMVF     (1 << 24)
+
+void rcc_peripheral_enable_clock(volatile u32 *reg, u32 en);
+
+/* GPIO. */
+#define GPIO_MODE_INPUT  0
+#define GPIO_MODE_OUTPUT 1
+#define GPIO_MODE_AF     2
+#define GPIO_PUPD_NONE   0
+#define GPIO_PUPD_PULLUP 1
+#define GPIO_PUPD_PULLDOWN 2
+#define GPIO_AF7         7
+#define GPIO_AF8         8
+#define GPIO(n) (1 << (n))
+#define GPIO1  GPIO(1)
+#define GPIO3  GPIO(3)
+#define GPIO4  GPIO(4)
+#define GPIO5  GPIO(5)
+#define GPIO6  GPIO(6)
+#define GPIO7  GPIO(7)
+#define GPIO8  GPIO(8)
+#define GPIO9  GPIO(9)
+#define GPIO10 GPIO(10)
+#define GPIO11 GPIO(11)
+#define GPIO12 GPIO(12)
+
+void gpio_mode_setup(u32 gpioport, u8 mode, u8 pull_up_down, u16 gpios);
+void gpio_set_af(u32 gpioport, u8 alt_func_num, u16 gpios);
+void gpio_set(u32 gpioport, u16 gpios);
+void gpio_clear(u32 gpioport, u16 gpios);
+void gpio_toggle(u32 gpioport, u16 gpios);
+u16 gpio_get(u32 gpioport, u16 gpios);
+
+/* SPI. */
+u16 spi_xfer(u32 spi, u16 data);
+
+/* USART. */
+#define USART_STOPBITS_1       0
+#define USART_PARITY_NONE      0
+#define USART_FLOWCONTROL_NONE 0
+#define USART_MODE_TX_RX       3
+
+void usart_enable(u32 usart);
+void usart_disable(u32 usart);
+void usart_set_baudrate(u32 usart, u32 baud);
+void usart_set_databits(u32 usart, u32 bits);
+void usart_set_stopbits(u32 usart, u32 stopbits);
+void usart_set_parity(u32 usart, u32 parity);
+void usart_set_flow_control(u32 usart, u32 flowcontrol);
+void usart_set_mode(u32 usart, u32 mode);
+
+/* Timers. */
+#define TIM_SR_UIF         (1 << 0)
+#define TIM_DIER_UIE       (1 << 0)
+#define TIM_CR1_CKD_CK_INT 0
+#define TIM_CR1_CMS_EDGE   0
+#define TIM_CR1_DIR_UP     0
+
+#define TIM_CNT(t) (*host_tim_cnt(t))
+#define TIM_ARR(t) (*host_tim_arr(t))
+
+u32 *host_tim_cnt(u32 timer_peripheral);
+u32 *host_tim_arr(u32 timer_peripheral);
+void timer_reset(u32 timer_peripheral);
+void timer_set_mode(u32 timer_peripheral, u32 clock_div, u32 alignment,
+                    u32 direction);
+void timer_set_prescaler(u32 timer_peripheral, u32 value);
+void timer_disable_preload(u32 timer_peripheral);
+void timer_set_period(u32 timer_peripheral, u32 period);
+void timer_enable_counter(u32 timer_peripheral);
+void timer_enable_irq(u32 timer_peripheral, u32 irq);
+void timer_clear_flag(u32 timer_peripheral, u32 flag);
+
+/* Flash. */
+#define FLASH_CR_PROGRAM_X32 2
+
+void flash_unlock(void);
+void flash_lock(void);
+void flash_program_byte(u32 address, u8 data);
+void flash_program_word(u32 address, u32 data);
+void flash_erase_sector(u8 sector, u32 program_size);
+
+/** \} */
+
+#endif  /* SWIFTNAV_HOST_OPENCM3_H */
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <string.h>
+
+#include "host/opencm3.h"
+
+/** \addtogroup host
+ * \{ */
+
+/** Size of the Coffee filesystem area, as in the STM32F405xG.ld. The end
+ * symbol _ecoffee_fs_area is defined on the linker command line. */
+#define HOST_COFFEE_SIZE   (512*1024)
+/** First flash sector of the Coffee filesystem area. */
+#define HOST_COFFEE_SECTOR 8
+/** Size of the flash sectors the Coffee area is made of. */
+#define HOST_SECTOR_SIZE   (128*1024)
+
+u32 host_rcc_regs[4] = {
+  /* Report a pin reset so nothing is logged on startup. */
+  [3] = RCC_CSR_PINRSTF,
+};
+
+/** Coffee filesystem area, erased flash reads back as all ones. */
+u32 _coffee_fs_area[HOST_COFFEE_SIZE / sizeof(u32)] = {
+  [0 ... HOST_COFFEE_SIZE / sizeof(u32) - 1] = 0xFFFFFFFF
+};
+
+void rcc_peripheral_enable_clock(volatile u32 *reg, u32 en)
+{
+  *reg |= en;
+}
+
+void gpio_mode_setup(u32 gpioport, u8 mode, u8 pull_up_down, u16 gpios)
+{
+  (void)gpioport; (void)mode; (void)pull_up_down; (void)gpios;
+}
+
+void gpio_set_af(u32 gpioport, u8 alt_func_num, u16 gpios)
+{
+  (void)gpioport; (void)alt_func_num; (void)gpios;
+}
+
+/** Output data registers, inputs read back as whatever was last output. */
+static u16 gpio_odr[3];
+
+void gpio_set(u32 gpioport, u16 gpios)
+{
+  gpio_odr[gpioport] |= gpios;
+}
+
+void gpio_clear(u32 gpioport, u16 gpios)
+{
+  gpio_odr[gpioport] &= ~gpios;
+}
+
+void gpio_toggle(u32 gpioport, u16 gpios)
+{
+  gpio_odr[gpioport] ^= gpios;
+}
+
+u16 gpio_get(u32 gpioport, u16 gpios)
+{
+  return gpio_odr[gpioport] & gpios;
+}
+
+/** Nothing on the SPI buses, reads back as zero. */
+u16 spi_xfer(u32 spi, u16 data)
+{
+  (void)spi; (void)data;
+  return 0;
+}
+
+void usart_enable(u32 usart) { (void)usart; }
+void usart_disable(u32 usart) { (void)usart; }
+void usart_set_baudrate(u32 usart, u32 baud) { (void)usart; (void)baud; }
+void usart_set_databits(u32 usart, u32 bits) { (void)usart; (void)bits; }
+void usart_set_stopbits(u32 usart, u32 stopbits) { (void)usart; (void)stopbits; }
+void usart_set_parity(u32 usart, u32 parity) { (void)usart; (void)parity; }
+void usart_set_flow_control(u32 usart, u32 fc) { (void)usart; (void)fc; }
+void usart_set_mode(u32 usart, u32 mode) { (void)usart; (void)mode; }
+
+void flash_unlock(void) {}
+void flash_lock(void) {}
+
+/** Program a byte of the emulated flash, bits can only be cleared. */
+void flash_program_byte(u32 address, u8 data)
+{
+  *(u8 *)address &= data;
+}
+
+/** Program a word of the emulated flash, bits can only be cleared. */
+void flash_program_word(u32 address, u32 data)
+{
+  *(u32 *)address &= data;
+}
+
+/** Erase a sector of the emulated flash, only the Coffee area exists. */
+void flash_erase_sector(u8 sector, u32 program_size)
+{
+  (void)program_size;
+
+  if (sector < HOST_COFFEE_SECTOR ||
+      (sector - HOST_COFFEE_SECTOR + 1) * HOST_SECTOR_SIZE > HOST_COFFEE_SIZE)
+    return;
+
+  memset((u8 *)_coffee_fs_area +
+         (sector - HOST_COFFEE_SECTOR) * HOST_SECTOR_SIZE,
+         0xFF, HOST_SECTOR_SIZE);
+}
+
+/** \} */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ch.h>
+
+#include "../peripherals/random.h"
+#include "../peripherals/spi.h"
+#include "../peripherals/watchdog.h"
+
+/** \addtogroup host
+ * \{ */
+
+/* SPI, the NAP is emulated and nothing else on the buses is modelled. */
+
+void spi_setup(void) {}
+void spi_deactivate(void) {}
+void spi_slave_select(u8 slave) { (void)slave; }
+void spi_slave_deselect(void) {}
+void spi1_dma_setup(void) {}
+
+void spi1_xfer_dma(u16 n_bytes, u8 data_in[], const u8 data_out[])
+{
+  (void)data_out;
+  if (data_in)
+    memset(data_in, 0, n_bytes);
+}
+
+/* Hardware RNG, from the C library's generator so runs can be repeated. */
+
+static MUTEX_DECL(rng_mutex);
+
+void rng_setup(void)
+{
+}
+
+u32 random_int(void)
+{
+  chMtxLock(&rng_mutex);
+  u32 r = (u32)rand() << 16 ^ (u32)rand();
+  chMtxUnlock();
+  return r;
+}
+
+/* Independent watchdog, a stalled thread is still reported by the system
+ * monitor but nothing resets the host. */
+
+void watchdog_enable(uint32_t period_ms)
+{
+  (void)period_ms;
+}
+
+void watchdog_clear(void)
+{
+}
+
+/** \} */
@@ -0,0 +1,537 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libsbp/edc.h>
+#include <libsbp/navigation.h>
+#include <libsbp/observation.h>
+#include <libsbp/piksi.h>
+#include <libswiftnav/constants.h>
+#include <libswiftnav/ephemeris.h>
+#include <libswiftnav/gpstime.h>
+#include <libswiftnav/logging.h>
+#include <libswiftnav/track.h>
+
+#include <ch.h>
+
+#include "../base_obs.h"
+#include "../board/nap/nap_common.h"
+#include "../ephemeris.h"
+#include "../sbp.h"
+#include "../sbp_utils.h"
+#include "../solution.h"
+#include "replay.h"
+
+/** \addtogroup host
+ * \{ */
+
+/* Replay of a recorded SBP session through the solution code.
+ *
+ * Enabled by setting PIKSI_HOST_REPLAY to the path of a binary SBP capture
+ * taken from a rover. The rover's own observations take the place of the
+ * tracking loops and are passed to solution_process_obs(), everything else
+ * in the capture (base station observations, ephemerides, ...) is dispatched
+ * to the registered SBP callbacks as if it had arrived on a USART. Firmware
+ * output goes to PIKSI_HOST_REPLAY_OUT (stdout if unset) instead of the FTDI
+ * USART.
+ *
+ * Other environment variables:
+ *  - PIKSI_HOST_REPLAY_SPEED: playback speed relative to the capture's GPS
+ *    time, default 1. Zero replays as fast as the time matched filter keeps
+ *    up.
+ *  - PIKSI_HOST_REPLAY_ROVER: sender ID of the rover, by default the sender
+ *    of the first baseline in the capture.
+ *  - PIKSI_HOST_REPLAY_STATS: CSV file to write per epoch statistics to.
+ *
+ * A summary of the per epoch processing time, time to first RTK fix and
+ * output rates is printed to stderr when the capture has been replayed.
+ */
+
+#define SBP_PREAMBLE 0x55
+#define SBP_HEADER_LEN 6
+#define SBP_CRC_LEN 2
+
+/** Base observations relayed by the rover have sender ID zero, which
+ * obs_callback() ignores. They are replayed under this ID instead. */
+#define REPLAY_RELAYED_BASE_SENDER 0xFFFF
+
+/** Time allowed for the last epoch's output to drain before reporting. */
+#define REPLAY_DRAIN_MS 1000
+
+typedef struct {
+  u16 type;
+  u16 sender;
+  u8 len;
+  u8 *payload;
+} replay_msg_t;
+
+static struct {
+  u8 *data;
+  size_t size;
+  size_t pos;
+  int out_fd;
+  FILE *stats_file;
+  double speed;
+  u16 rover;
+  /** False if the capture has no rover, rover is then meaningless. */
+  bool has_rover;
+  /** Base observations only arrive relayed through the rover. */
+  bool base_relayed;
+} replay = {.out_fd = -1};
+
+/** Rover observation set being assembled from the capture. */
+static struct {
+  gps_time_t t;
+  s16 prev_count;
+  u8 n;
+  navigation_measurement_t nm[MAX_CHANNELS];
+} rover_obs;
+
+static struct {
+  u32 epochs;
+  u32 msgs;
+  u32 crc_errors;
+  u64 epoch_cycles;
+  u64 total_cycles;
+  u64 min_cycles;
+  u64 max_cycles;
+  gps_time_t first_t;
+  gps_time_t last_t;
+  bool fixed;
+  gps_time_t fix_t;
+  double fix_wall;
+  u64 start_cycles;
+  u32 n_pos_llh;
+  u32 n_baseline;
+  u32 n_baseline_fixed;
+  u32 epoch_outputs;
+  u64 bytes_out;
+} stats;
+
+/** Output frame being reassembled, see replay_output(). */
+static struct {
+  u8 buff[SBP_HEADER_LEN + SBP_FRAMING_MAX_PAYLOAD_SIZE + SBP_CRC_LEN];
+  u32 n;
+} out_frame;
+
+/** Decode the frame at `p`, `n` bytes of capture remaining.
+ * \return Length of the frame, 0 if it is truncated or fails its CRC.
+ */
+static u32 frame_decode(u8 *p, size_t n, replay_msg_t *m)
+{
+  if (n < SBP_HEADER_LEN + SBP_CRC_LEN || p[0] != SBP_PREAMBLE)
+    return 0;
+
+  u32 len = SBP_HEADER_LEN + p[5] + SBP_CRC_LEN;
+  if (n < len)
+    return 0;
+
+  u16 crc = p[len-2] | (p[len-1] << 8);
+  if (crc16_ccitt(&p[1], SBP_HEADER_LEN - 1 + p[5], 0) != crc)
+    return 0;
+
+  m->type = p[1] | (p[2] << 8);
+  m->sender = p[3] | (p[4] << 8);
+  m->len = p[5];
+  m->payload = &p[SBP_HEADER_LEN];
+  return len;
+}
+
+/** Fetch the next good frame from the capture, resynchronising on the
+ * preamble after anything that doesn't decode.
+ * \return false at the end of the capture.
+ */
+static bool next_msg(replay_msg_t *m)
+{
+  while (replay.pos < replay.size) {
+    u8 *p = &replay.data[replay.pos];
+    u32 len = frame_decode(p, replay.size - replay.pos, m);
+    if (len) {
+      replay.pos += len;
+      stats.msgs++;
+      return true;
+    }
+    if (p[0] == SBP_PREAMBLE &&
+        replay.size - replay.pos >= SBP_HEADER_LEN + SBP_CRC_LEN)
+      stats.crc_errors++;
+    replay.pos++;
+  }
+  return false;
+}
+
+/** Work out which sender is the rover and where the base observations come
+ * from, by looking through the whole capture once. */
+static void scan_senders(void)
+{
+  replay_msg_t m;
+  replay.has_rover = false;
+  const char *rover = getenv("PIKSI_HOST_REPLAY_ROVER");
+  if (rover) {
+    replay.rover = strtol(rover, NULL, 0);
+    replay.has_rover = true;
+  }
+
+  /* The rover is the one producing baselines, failing that the first
+   * sender of observations. */
+  u16 first_obs_sender = 0;
+  bool have_obs_sender = false;
+  while (!replay.has_rover && next_msg(&m)) {
+    if (m.type == SBP_MSG_BASELINE_NED) {
+      replay.rover = m.sender;
+      replay.has_rover = true;
+    } else if (m.type == SBP_MSG_OBS && m.sender != 0 && !have_obs_sender) {
+      first_obs_sender = m.sender;
+      have_obs_sender = true;
+    }
+  }
+  if (!replay.has_rover && have_obs_sender) {
+    replay.rover = first_obs_sender;
+    replay.has_rover = true;
+  }
+
+  /* Observations from any other non-zero sender are the base station's
+   * own, otherwise use those the rover relayed. */
+  replay.base_relayed = true;
+  replay.pos = 0;
+  while (next_msg(&m)) {
+    if (m.type == SBP_MSG_OBS && m.sender != 0 &&
+        !(replay.has_rover && m.sender == replay.rover)) {
+      replay.base_relayed = false;
+      break;
+    }
+  }
+
+  replay.pos = 0;
+  stats.msgs = stats.crc_errors = 0;
+}
+
+/** Add a rover observation message to the set being assembled.
+ * \return true once the set is complete.
+ */
+static bool rover_obs_msg(const replay_msg_t *m)
+{
+  gps_time_t t;
+  u8 total;
+  u8 count;
+
+  unpack_obs_header((observation_header_t *)m->payload, &t, &total, &count);
+
+  if (count == 0) {
+    rover_obs.t = t;
+    rover_obs.n = 0;
+    rover_obs.prev_count = 0;
+  } else if (rover_obs.prev_count < 0 ||
+             rover_obs.t.tow != t.tow || rover_obs.t.wn != t.wn ||
+             rover_obs.prev_count + 1 != count) {
+    rover_obs.prev_count = -1;
+    return false;
+  } else {
+    rover_obs.prev_count = count;
+  }
+
+  u8 obs_in_msg = (m->len - sizeof(observation_header_t)) /
+                  sizeof(packed_obs_content_t);
+  packed_obs_content_t *obs =
+    (packed_obs_content_t *)(m->payload + sizeof(observation_header_t));
+
+  for (u8 i = 0; i < obs_in_msg && rover_obs.n < MAX_CHANNELS; i++) {
+    if (obs[i].sid > 31)
+      continue;
+
+    navigation_measurement_t *nm = &rover_obs.nm[rover_obs.n];
+    memset(nm, 0, sizeof(*nm));
+    unpack_obs_content(&obs[i], &nm->raw_pseudorange, &nm->carrier_phase,
+                       &nm->snr, &nm->lock_counter, &nm->prn);
+
+    /* Unlike the base, the rover's observations go through the PVT solver
+     * so the satellite state is needed at the time of transmission. */
+    gps_time_t tot = t;
+    tot.tow -= nm->raw_pseudorange / GPS_C;
+
+    chMtxLock(&es_mutex);
+    if (ephemeris_good(&es[obs[i].sid], tot)) {
+      double clock_err;
+      double clock_rate_err;
+      calc_sat_state(&es[obs[i].sid], tot, nm->sat_pos, nm->sat_vel,
+                     &clock_err, &clock_rate_err);
+      nm->pseudorange = nm->raw_pseudorange + clock_err * GPS_C;
+      nm->tot = tot;
+      rover_obs.n++;
+    }
+    chMtxUnlock();
+  }
+
+  return count == total - 1;
+}
+
+/** Dispatch a message from the capture.
+ * \return true if it completed a set of rover observations.
+ */
+static bool replay_msg(const replay_msg_t *m)
+{
+  if (replay.has_rover && m->sender == replay.rover) {
+    if (m->type == SBP_MSG_OBS)
+      return rover_obs_msg(m);
+    /* The rover's own output is what's being reproduced, only its
+     * ephemerides are needed. */
+    if (m->type == SBP_MSG_EPHEMERIS)
+      sbp_inject_msg(m->sender, m->type, m->len, m->payload);
+    return false;
+  }
+
+  if (m->type == SBP_MSG_RESET)
+    return false;
+
+  if (m->type == SBP_MSG_OBS && m->sender == 0) {
+    if (replay.base_relayed)
+      sbp_inject_msg(REPLAY_RELAYED_BASE_SENDER, m->type, m->len,
+                     m->payload);
+    return false;
+  }
+
+  sbp_inject_msg(m->sender, m->type, m->len, m->payload);
+  return false;
+}
+
+/** Close off the statistics for the last epoch. */
+static void epoch_end(void)
+{
+  if (stats.epochs == 0)
+    return;
+
+  u64 c = stats.epoch_cycles;
+  stats.total_cycles += c;
+  if (stats.epochs == 1 || c < stats.min_cycles)
+    stats.min_cycles = c;
+  if (c > stats.max_cycles)
+    stats.max_cycles = c;
+
+  if (replay.stats_file)
+    fprintf(replay.stats_file, "%.3f,%u,%.1f,%u\n", rover_obs.t.tow,
+            rover_obs.n, c * 1e6 / HOST_CPU_FREQ, stats.epoch_outputs);
+
+  stats.epoch_cycles = 0;
+  stats.epoch_outputs = 0;
+}
+
+static void report(void)
+{
+  double span = gpsdifftime(stats.last_t, stats.first_t);
+  double wall = (double)(host_cycles() - stats.start_cycles) / HOST_CPU_FREQ;
+
+  fprintf(stderr, "Replayed %u messages (%u CRC errors), %u epochs over "
+          "%.1f s in %.1f s\n",
+          stats.msgs, stats.crc_errors, stats.epochs, span, wall);
+  if (stats.epochs > 0)
+    fprintf(stderr, "Epoch processing time: min %.1f us, mean %.1f us, "
+            "max %.1f us\n",
+            stats.min_cycles * 1e6 / HOST_CPU_FREQ,
+            stats.total_cycles * 1e6 / HOST_CPU_FREQ / stats.epochs,
+            stats.max_cycles * 1e6 / HOST_CPU_FREQ);
+  if (stats.fixed)
+    fprintf(stderr, "First RTK fix after %.1f s of capture (%.1f s wall)\n",
+            gpsdifftime(stats.fix_t, stats.first_t), stats.fix_wall);
+  else
+    fprintf(stderr, "No RTK fix\n");
+  if (span > 0)
+    fprintf(stderr, "Output: %.2f Hz position, %.2f Hz baseline "
+            "(%.2f Hz fixed), %.1f kB/s\n",
+            stats.n_pos_llh / span, stats.n_baseline / span,
+            stats.n_baseline_fixed / span, stats.bytes_out / span / 1000.0);
+}
+
+static WORKING_AREA(wa_replay_thread, 8000);
+static msg_t replay_thread(void *arg)
+{
+  (void)arg;
+  chRegSetThreadName("replay");
+
+  systime_t start_ticks = chTimeNow();
+  stats.start_cycles = host_cycles();
+  replay_msg_t m;
+
+  while (TRUE) {
+    u64 c0 = host_cycles();
+    bool more = next_msg(&m);
+
+    /* Pace on the start of each rover epoch. */
+    if (more && replay.has_rover && m.sender == replay.rover &&
+        m.type == SBP_MSG_OBS) {
+      gps_time_t t;
+      u8 total, count;
+      unpack_obs_header((observation_header_t *)m.payload, &t, &total, &count);
+      if (count == 0) {
+        stats.epoch_cycles += host_cycles() - c0;
+        epoch_end();
+
+        if (stats.epochs == 0)
+          stats.first_t = t;
+        stats.last_t = t;
+        stats.epochs++;
+
+        if (replay.speed > 0) {
+          systime_t wake = start_ticks + (systime_t)
+            (gpsdifftime(t, stats.first_t) / replay.speed * CH_FREQUENCY);
+          if ((s32)(wake - chTimeNow()) > 0)
+            chThdSleepUntil(wake);
+        } else {
+          /* Don't run ahead of the time matched filter, on the target it
+           * gets one set of base observations at a time. */
+          chSysLock();
+          while (!chBSemGetStateI(&base_obs_received))
+            chThdSleepS(1);
+          chSysUnlock();
+        }
+        c0 = host_cycles();
+      }
+    }
+
+    if (!more)
+      break;
+
+    if (replay_msg(&m)) {
+      if (rover_obs.n >= 4)
+        solution_process_obs(rover_obs.n, rover_obs.nm, nap_timing_count());
+      /* Let anything the epoch woke up run before timing it. */
+      chThdYield();
+    }
+    stats.epoch_cycles += host_cycles() - c0;
+  }
+
+  epoch_end();
+  chThdSleepMilliseconds(REPLAY_DRAIN_MS);
+  report();
+  if (replay.stats_file)
+    fclose(replay.stats_file);
+  exit(0);
+
+  return 0;
+}
+
+/** Is a capture being replayed? */
+bool replay_enabled(void)
+{
+  return getenv("PIKSI_HOST_REPLAY") != NULL;
+}
+
+/** Record firmware output sent to the FTDI USART during a replay. */
+void replay_output(const u8 *data, u32 len)
+{
+  u32 n = 0;
+  while (replay.out_fd >= 0 && n < len) {
+    ssize_t ret = write(replay.out_fd, &data[n], len - n);
+    if (ret <= 0)
+      break;
+    n += ret;
+  }
+  stats.bytes_out += len;
+
+  /* Reassemble the frames to count solutions and spot the first fix. */
+  for (u32 i = 0; i < len; i++) {
+    if (out_frame.n == 0 && data[i] != SBP_PREAMBLE)
+      continue;
+    out_frame.buff[out_frame.n++] = data[i];
+    if (out_frame.n < SBP_HEADER_LEN ||
+        out_frame.n < (u32)SBP_HEADER_LEN + out_frame.buff[5] + SBP_CRC_LEN)
+      continue;
+
+    replay_msg_t m;
+    if (frame_decode(out_frame.buff, out_frame.n, &m)) {
+      stats.epoch_outputs++;
+      if (m.type == SBP_MSG_POS_LLH)
+        stats.n_pos_llh++;
+      if (m.type == SBP_MSG_BASELINE_NED) {
+        msg_baseline_ned_t *b = (msg_baseline_ned_t *)m.payload;
+        stats.n_baseline++;
+        if (b->flags & 1) {
+          stats.n_baseline_fixed++;
+          if (!stats.fixed) {
+            stats.fixed = true;
+            /* Baselines only carry the time of week. */
+            stats.fix_t.wn = stats.last_t.wn;
+            stats.fix_t.tow = b->tow / 1000.0;
+            stats.fix_wall = (double)(host_cycles() - stats.start_cycles) /
+                             HOST_CPU_FREQ;
+          }
+        }
+      }
+    }
+    out_frame.n = 0;
+  }
+}
+
+/** Map the capture and start replaying it, if PIKSI_HOST_REPLAY is set.
+ * Called once everything else has been set up.
+ */
+void replay_setup(void)
+{
+  const char *path = getenv("PIKSI_HOST_REPLAY");
+  if (!path)
+    return;
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    exit(1);
+  }
+  replay.size = st.st_size;
+  replay.data = mmap(NULL, replay.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (replay.data == MAP_FAILED) {
+    perror(path);
+    exit(1);
+  }
+  madvise(replay.data, replay.size, MADV_SEQUENTIAL);
+  close(fd);
+
+  const char *out = getenv("PIKSI_HOST_REPLAY_OUT");
+  replay.out_fd = out ? open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+                      : STDOUT_FILENO;
+  if (replay.out_fd < 0) {
+    perror(out);
+    exit(1);
+  }
+
+  const char *stats_path = getenv("PIKSI_HOST_REPLAY_STATS");
+  if (stats_path) {
+    replay.stats_file = fopen(stats_path, "w");
+    if (!replay.stats_file) {
+      perror(stats_path);
+      exit(1);
+    }
+    fprintf(replay.stats_file, "tow,n_obs,cpu_us,n_output\n");
+  }
+
+  const char *speed = getenv("PIKSI_HOST_REPLAY_SPEED");
+  replay.speed = speed ? atof(speed) : 1.0;
+
+  scan_senders();
+  if (replay.has_rover)
+    fprintf(stderr, "Replaying %s, rover 0x%04X, %s base observations\n",
+            path, replay.rover, replay.base_relayed ? "relayed" : "direct");
+  else
+    fprintf(stderr, "Replaying %s, no rover observations found\n", path);
+
+  /* Lowest priority, along with the time matched filter, so everything an
+   * epoch triggers has run before the next one is injected. */
+  chThdCreateStatic(wa_replay_thread, sizeof(wa_replay_thread),
+                    LOWPRIO, replay_thread, NULL);
+}
+
+/** \} */
@@ -0,0 +1,22 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_HOST_REPLAY_H
+#define SWIFTNAV_HOST_REPLAY_H
+
+#include <libswiftnav/common.h>
+
+bool replay_enabled(void);
+void replay_output(const u8 *data, u32 len);
+void replay_setup(void);
+
+#endif  /* SWIFTNAV_HOST_REPLAY_H */
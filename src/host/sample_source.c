@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* The host build is 32 bit, captures are routinely larger than 2 GB. */
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libswiftnav/logging.h>
+
+#include "sample_source.h"
+
+/** \addtogroup host
+ * \{ */
+
+/** \defgroup sample_source IF Sample Source
+ * Raw IF captures read back as a stream of samples.
+ *
+ * At 16.368 MHz a 2-bit capture grows by 4 MB a second, tens of minutes of
+ * samples won't fit in the address space of the 32 bit host build, let alone
+ * in RAM. The file is mapped a window at a time instead and the window moved
+ * along as it is read, the page cache does the rest. Samples are decoded to
+ * signed bytes at their natural amplitude (e.g. +/-1, +/-3) so the
+ * correlators can work on any of the formats.
+ * \{ */
+
+/** Size of the mapped window of the file. */
+#define SAMPLE_SOURCE_WINDOW (64 * 1024 * 1024)
+
+/** Decoded samples for every possible byte, by format. */
+static s8 lut_2bit[256][4];
+static s8 lut_1bit[256][8];
+
+static void lut_init(void)
+{
+  static const s8 sign_mag[4] = {1, 3, -1, -3};
+  for (u32 b = 0; b < 256; b++) {
+    for (u8 i = 0; i < 4; i++)
+      lut_2bit[b][i] = sign_mag[(b >> (6 - 2 * i)) & 3];
+    for (u8 i = 0; i < 8; i++)
+      lut_1bit[b][i] = (b >> (7 - i)) & 1 ? -1 : 1;
+  }
+}
+
+/** Parse a format name as given on the command line or in the environment.
+ * \return 0 on success, -1 if the name isn't recognised.
+ */
+int sample_source_parse_format(const char *name, sample_format_t *format)
+{
+  if (!name || strcmp(name, "2bit") == 0)
+    *format = SAMPLE_FORMAT_SIGN_MAG_2BIT;
+  else if (strcmp(name, "1bit") == 0)
+    *format = SAMPLE_FORMAT_SIGN_1BIT;
+  else if (strcmp(name, "int8") == 0)
+    *format = SAMPLE_FORMAT_INT8;
+  else
+    return -1;
+  return 0;
+}
+
+/** Open a raw IF capture.
+ * \param s      Sample source to initialise.
+ * \param path   Capture file.
+ * \param format Packing of the samples in the file.
+ * \return 0 on success, -1 if the file couldn't be opened.
+ */
+int sample_source_open(sample_source_t *s, const char *path,
+                       sample_format_t format)
+{
+  static bool lut_ready;
+  if (!lut_ready) {
+    lut_init();
+    lut_ready = true;
+  }
+
+  memset(s, 0, sizeof(*s));
+  s->format = format;
+  switch (format) {
+  case SAMPLE_FORMAT_SIGN_MAG_2BIT: s->samples_per_byte = 4; break;
+  case SAMPLE_FORMAT_SIGN_1BIT: s->samples_per_byte = 8; break;
+  default: s->samples_per_byte = 1; break;
+  }
+
+  s->fd = open(path, O_RDONLY);
+  struct stat st;
+  if (s->fd < 0 || fstat(s->fd, &st) < 0) {
+    log_error("sample_source: can't open %s", path);
+    if (s->fd >= 0)
+      close(s->fd);
+    s->fd = -1;
+    return -1;
+  }
+
+  s->file_size = st.st_size;
+  s->n_samples = s->file_size * s->samples_per_byte;
+  return 0;
+}
+
+void sample_source_close(sample_source_t *s)
+{
+  if (s->window)
+    munmap((void *)s->window, s->window_len);
+  if (s->fd >= 0)
+    close(s->fd);
+  s->window = NULL;
+  s->fd = -1;
+}
+
+/** Make sure bytes [offset, offset + len) of the file are mapped.
+ * \return Pointer to the byte at offset, or NULL on failure.
+ */
+static const u8 *window_map(sample_source_t *s, u64 offset, u64 len)
+{
+  if (s->window && offset >= s->window_offset &&
+      offset + len <= s->window_offset + s->window_len)
+    return s->window + (offset - s->window_offset);
+
+  if (s->window)
+    munmap((void *)s->window, s->window_len);
+  s->window = NULL;
+
+  u64 page = sysconf(_SC_PAGESIZE);
+  u64 start = offset - offset % page;
+  u64 end = MIN(s->file_size, MAX(start + SAMPLE_SOURCE_WINDOW, offset + len));
+
+  void *p = mmap(NULL, end - start, PROT_READ, MAP_SHARED, s->fd, start);
+  if (p == MAP_FAILED) {
+    log_error("sample_source: mmap failed at offset %llu",
+              (unsigned long long)start);
+    return NULL;
+  }
+  madvise(p, end - start, MADV_SEQUENTIAL);
+
+  s->window = p;
+  s->window_offset = start;
+  s->window_len = end - start;
+  return s->window + (offset - start);
+}
+
+/** Read and decode a block of samples.
+ * Samples past the end of the capture read as zero, as though the front end
+ * had been switched off, so the correlators see noise-free silence rather than
+ * stale data.
+ *
+ * \param s       Sample source.
+ * \param start   Index of the first sample in the capture.
+ * \param n       Number of samples to read.
+ * \param samples Output buffer of n samples.
+ * \return Number of samples actually read from the capture.
+ */
+u32 sample_source_read(sample_source_t *s, u64 start, u32 n, s8 samples[])
+{
+  u32 n_read = 0;
+  if (start < s->n_samples)
+    n_read = MIN((u64)n, s->n_samples - start);
+  memset(&samples[n_read], 0, n - n_read);
+  if (n_read == 0)
+    return 0;
+
+  u8 spb = s->samples_per_byte;
+  u64 b0 = start / spb;
+  u64 b1 = (start + n_read + spb - 1) / spb;
+  const u8 *p = window_map(s, b0, b1 - b0);
+  if (!p) {
+    memset(samples, 0, n_read);
+    return 0;
+  }
+
+  u32 skip = start % spb;
+  switch (s->format) {
+  case SAMPLE_FORMAT_SIGN_MAG_2BIT:
+    for (u32 i = 0; i < n_read; i++) {
+      u32 k = i + skip;
+      samples[i] = lut_2bit[p[k / 4]][k % 4];
+    }
+    break;
+  case SAMPLE_FORMAT_SIGN_1BIT:
+    for (u32 i = 0; i < n_read; i++) {
+      u32 k = i + skip;
+      samples[i] = lut_1bit[p[k / 8]][k % 8];
+    }
+    break;
+  default:
+    memcpy(samples, p, n_read);
+    break;
+  }
+
+  return n_read;
+}
+
+/** \} */
+
+/** \} */
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_HOST_SAMPLE_SOURCE_H
+#define SWIFTNAV_HOST_SAMPLE_SOURCE_H
+
+#include <libswiftnav/common.h>
+
+/** \addtogroup sample_source
+ * \{ */
+
+/** Packing of the samples in a raw IF capture. */
+typedef enum {
+  /** MAX2769 2-bit sign/magnitude, four samples per byte, first sample in the
+   * most significant bits. Sign then magnitude bit, 00 = +1, 01 = +3,
+   * 10 = -1, 11 = -3. */
+  SAMPLE_FORMAT_SIGN_MAG_2BIT,
+  /** 1-bit sign, eight samples per byte, first sample in the MSB. 0 = +1,
+   * 1 = -1. */
+  SAMPLE_FORMAT_SIGN_1BIT,
+  /** One signed byte per sample. */
+  SAMPLE_FORMAT_INT8,
+} sample_format_t;
+
+/** A raw IF capture file, mapped a window at a time. */
+typedef struct {
+  int fd;
+  sample_format_t format;
+  u8 samples_per_byte;
+  u64 n_samples;      /**< Total samples in the file. */
+  u64 file_size;
+
+  /* Currently mapped window of the file. */
+  const u8 *window;
+  u64 window_offset;  /**< File offset of the window [bytes]. */
+  u64 window_len;     /**< [bytes] */
+} sample_source_t;
+
+/** \} */
+
+int sample_source_open(sample_source_t *s, const char *path,
+                       sample_format_t format);
+void sample_source_close(sample_source_t *s);
+u32 sample_source_read(sample_source_t *s, u64 start, u32 n, s8 samples[]);
+int sample_source_parse_format(const char *name, sample_format_t *format);
+
+#endif  /* SWIFTNAV_HOST_SAMPLE_SOURCE_H */
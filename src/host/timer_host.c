@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <ch.h>
+
+#include "host/opencm3.h"
+
+/** \defgroup host Host
+ * Build of the firmware for the ChibiOS POSIX simulator port.
+ *
+ * The application modules are built unmodified against the simulator kernel
+ * port with the NAP emulator standing in for the FPGA. The board and
+ * peripheral layers are replaced by the host versions in this directory:
+ * SBP is routed through stdin/stdout or a pty, flash is held in RAM and the
+ * timers run off the host's monotonic clock, optionally sped up, see
+ * host_cycles().
+ *
+ * Build with `make host` in src/.
+ * \{ */
+
+/** TIM5 runs at APB1 timer clock, half the CPU clock. */
+#define HOST_TIM5_DIV 2
+
+#define NVIC_TIM5_IRQ 50
+
+/* Defined in solution.c. */
+void Vector108(void);
+
+u32 host_dwt_ctrl;
+u32 host_scs_demcr;
+
+static struct {
+  u64 base;        /**< Host cycle count at which the counter was zero. */
+  u32 cnt;         /**< Counter value as last returned. */
+  u32 cnt_read;    /**< Copy of cnt, differs if cnt was written. */
+  u32 arr;
+  bool enabled;
+  bool irq;
+  bool nvic;
+  bool pending;
+} tim5;
+
+/** Emulated time against the host's, see host_cycles(). */
+static struct {
+  bool init;
+  double scale;    /**< Emulated seconds per host second, 0 to skip idle. */
+  u64 start;       /**< Host cycles when first read. */
+  u64 skipped;     /**< Idle cycles skipped over when scale is 0. */
+} host_time;
+
+static u64 monotonic_cycles(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * HOST_CPU_FREQ +
+         (u64)ts.tv_nsec * HOST_CPU_FREQ / 1000000000ULL;
+}
+
+/** Emulated clock in CPU cycles, the time base of the kernel tick, TIM5 and
+ * the DWT cycle counter.
+ *
+ * Runs with the host's monotonic clock unless `PIKSI_HOST_TIME_SCALE` is set,
+ * e.g. to 10 for ten times faster. Set to 0 it runs at the host's rate while
+ * any thread is busy and jumps ahead to the next tick or TIM5 interrupt
+ * whenever they're all idle, as fast as the host can go. */
+u64 host_cycles(void)
+{
+  if (!host_time.init) {
+    const char *scale = getenv("PIKSI_HOST_TIME_SCALE");
+    host_time.scale = scale ? atof(scale) : 1.0;
+    host_time.start = monotonic_cycles();
+    host_time.init = true;
+  }
+
+  u64 elapsed = monotonic_cycles() - host_time.start;
+  if (host_time.scale > 0 && host_time.scale != 1.0)
+    elapsed *= host_time.scale;
+  return host_time.start + elapsed + host_time.skipped;
+}
+
+/** Current value of the emulated DWT cycle counter.
+ * Writes through the returned pointer are ignored. */
+u32 *host_dwt_cyccnt(void)
+{
+  static u32 cyccnt;
+  cyccnt = host_cycles();
+  return &cyccnt;
+}
+
+/** Bring the TIM5 model up to date, wrapping at the auto-reload value. */
+static void tim5_update(void)
+{
+  u64 now = host_cycles();
+
+  /* Counter written since it was last read, restart it from there. */
+  if (tim5.cnt != tim5.cnt_read)
+    tim5.base = now - (u64)tim5.cnt * HOST_TIM5_DIV;
+
+  if (!tim5.enabled) {
+    tim5.base = now - (u64)tim5.cnt * HOST_TIM5_DIV;
+    tim5.cnt_read = tim5.cnt;
+    return;
+  }
+
+  u64 period = ((u64)tim5.arr + 1) * HOST_TIM5_DIV;
+  u64 elapsed = now - tim5.base;
+  if (elapsed >= period) {
+    tim5.base += elapsed / period * period;
+    tim5.pending = true;
+  }
+  tim5.cnt = (now - tim5.base) / HOST_TIM5_DIV;
+  tim5.cnt_read = tim5.cnt;
+}
+
+u32 *host_tim_cnt(u32 timer_peripheral)
+{
+  (void)timer_peripheral;
+  tim5_update();
+  return &tim5.cnt;
+}
+
+u32 *host_tim_arr(u32 timer_peripheral)
+{
+  (void)timer_peripheral;
+  return &tim5.arr;
+}
+
+void timer_reset(u32 timer_peripheral)
+{
+  (void)timer_peripheral;
+  tim5.cnt = tim5.cnt_read = 0;
+  tim5.arr = 0xFFFFFFFF;
+  tim5.enabled = tim5.irq = tim5.pending = false;
+}
+
+void timer_set_mode(u32 timer_peripheral, u32 clock_div, u32 alignment,
+                    u32 direction)
+{
+  (void)timer_peripheral; (void)clock_div; (void)alignment; (void)direction;
+}
+
+void timer_set_prescaler(u32 timer_peripheral, u32 value)
+{
+  (void)timer_peripheral; (void)value;
+}
+
+void timer_disable_preload(u32 timer_peripheral)
+{
+  (void)timer_peripheral;
+}
+
+void timer_set_period(u32 timer_peripheral, u32 period)
+{
+  (void)timer_peripheral;
+  tim5.arr = period;
+}
+
+void timer_enable_counter(u32 timer_peripheral)
+{
+  (void)timer_peripheral;
+  tim5_update();
+  tim5.enabled = true;
+}
+
+void timer_enable_irq(u32 timer_peripheral, u32 irq)
+{
+  (void)timer_peripheral;
+  tim5.irq = irq & TIM_DIER_UIE;
+}
+
+void timer_clear_flag(u32 timer_peripheral, u32 flag)
+{
+  (void)timer_peripheral;
+  if (flag & TIM_SR_UIF)
+    tim5.pending = false;
+}
+
+void nvicEnableVector(u32 n, u32 prio)
+{
+  (void)prio;
+  if (n == NVIC_TIM5_IRQ)
+    tim5.nvic = true;
+}
+
+/** Run the kernel tick and any pending emulated interrupts.
+ * The simulator port has no asynchronous interrupts, this is called from the
+ * idle thread in their place so the emulated interrupts are only serviced
+ * when no thread is runnable.
+ */
+void ChkIntSources(void)
+{
+  static u64 next_tick_cycles;
+  u64 now = host_cycles();
+  bool irq = false;
+
+  if (next_tick_cycles == 0)
+    next_tick_cycles = now;
+
+  while (now >= next_tick_cycles) {
+    next_tick_cycles += HOST_CPU_FREQ / CH_FREQUENCY;
+    CH_IRQ_PROLOGUE();
+    chSysLockFromIsr();
+    chSysTimerHandlerI();
+    chSysUnlockFromIsr();
+    CH_IRQ_EPILOGUE();
+    irq = true;
+  }
+
+  tim5_update();
+  if (tim5.pending && tim5.irq && tim5.nvic) {
+    Vector108();
+    irq = true;
+  }
+
+  /* Nothing to run until the next interrupt, skip straight to it. */
+  if (!irq && host_time.scale == 0) {
+    u64 next = next_tick_cycles;
+    if (tim5.enabled && tim5.irq && tim5.nvic)
+      next = MIN(next, tim5.base + ((u64)tim5.arr + 1) * HOST_TIM5_DIV);
+    if (next > now)
+      host_time.skipped += next - now;
+  }
+
+  if (irq) {
+    dbg_check_lock();
+    if (chSchIsPreemptionRequired())
+      chSchDoReschedule();
+    dbg_check_unlock();
+  }
+}
+
+/** \} */
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* Convert a trace buffer download, see trace.c, to a Chrome trace event JSON
+ * file which chrome://tracing and https://ui.perfetto.dev can open.
+ *
+ *   trace2json [-f cpu_freq_hz] capture.sbp > trace.json
+ *
+ * The capture is the binary SBP stream from the Piksi after sending it a
+ * SBP_MSG_TRACE_REQ, the last download in it is converted. The timeline has
+ * one row showing which thread is running on the CPU, one for events from
+ * ISRs and one per thread for the work done in it. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libsbp/edc.h>
+
+#include "../sbp_ext.h"
+#include "../trace.h"
+#include "../sched_stats.h"
+
+#define SBP_PREAMBLE 0x55
+#define SBP_HEADER_LEN 6
+#define SBP_CRC_LEN 2
+
+/** Rows of the timeline which aren't threads. */
+#define TID_CPU 0
+#define TID_ISR 1000
+
+static char thread_names[256][sizeof(((msg_trace_thread_t *)0)->name) + 1];
+
+static struct {
+  msg_trace_event_t *events;
+  u32 n;
+  u32 lost;
+  u16 n_seq;
+  u16 next_seq;
+  bool complete;
+} download, last;
+
+static u32 missing_chunks;
+
+static void data_msg(const u8 *payload, u8 len)
+{
+  msg_trace_data_t msg;
+  memset(&msg, 0, sizeof(msg));
+  memcpy(&msg, payload, MIN(len, sizeof(msg)));
+  u32 header = sizeof(msg) - sizeof(msg.events);
+  if (len < header)
+    return;
+  u32 n = (len - header) / sizeof(msg_trace_event_t);
+
+  if (msg.seq == 0) {
+    free(download.events);
+    memset(&download, 0, sizeof(download));
+    download.n_seq = msg.n_seq;
+    download.lost = msg.lost;
+    download.events = malloc(msg.n_seq * TRACE_DATA_MAX_EVENTS
+                             * sizeof(msg_trace_event_t));
+  } else if (!download.events || msg.seq != download.next_seq) {
+    /* Duplicates from retried sends are dropped, gaps are counted. */
+    if (download.events && msg.seq > download.next_seq)
+      missing_chunks += msg.seq - download.next_seq;
+    else
+      return;
+  }
+
+  memcpy(&download.events[download.n], msg.events,
+         n * sizeof(msg_trace_event_t));
+  download.n += n;
+  download.next_seq = msg.seq + 1;
+
+  if (download.next_seq == download.n_seq) {
+    free(last.events);
+    last = download;
+    last.complete = true;
+    memset(&download, 0, sizeof(download));
+  }
+}
+
+static void thread_msg(const u8 *payload, u8 len)
+{
+  msg_trace_thread_t msg;
+  memset(&msg, 0, sizeof(msg));
+  memcpy(&msg, payload, MIN(len, sizeof(msg)));
+  memcpy(thread_names[msg.id], msg.name, sizeof(msg.name));
+}
+
+/** Pick the trace messages out of an SBP capture, resynchronising on the
+ * preamble after anything that doesn't decode. */
+static void parse(const u8 *p, size_t n)
+{
+  size_t pos = 0;
+  while (pos + SBP_HEADER_LEN + SBP_CRC_LEN <= n) {
+    const u8 *f = &p[pos];
+    u32 len = SBP_HEADER_LEN + f[5] + SBP_CRC_LEN;
+    if (f[0] != SBP_PREAMBLE || pos + len > n ||
+        crc16_ccitt(&f[1], SBP_HEADER_LEN - 1 + f[5], 0) !=
+          (f[len-2] | (f[len-1] << 8))) {
+      pos++;
+      continue;
+    }
+
+    u16 type = f[1] | (f[2] << 8);
+    if (type == SBP_MSG_TRACE_DATA)
+      data_msg(&f[SBP_HEADER_LEN], f[5]);
+    else if (type == SBP_MSG_TRACE_THREAD)
+      thread_msg(&f[SBP_HEADER_LEN], f[5]);
+    pos += len;
+  }
+}
+
+static const char *thread_name(u8 id)
+{
+  static char buff[16];
+  if (thread_names[id][0])
+    return thread_names[id];
+  snprintf(buff, sizeof(buff), "thread %u", id);
+  return buff;
+}
+
+static bool first_event = true;
+
+static void emit(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void emit(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  printf("%s\n  ", first_event ? "" : ",");
+  vprintf(fmt, ap);
+  va_end(ap);
+  first_event = false;
+}
+
+static void emit_row(u32 tid, const char *name)
+{
+  emit("{\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"name\":\"thread_name\","
+       "\"args\":{\"name\":\"%s\"}}", tid, name);
+}
+
+static void emit_event(const char *ph, u32 tid, double ts, const char *name)
+{
+  emit("{\"ph\":\"%s\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"name\":\"%s\"%s}",
+       ph, tid, ts, name, ph[0] == 'i' ? ",\"s\":\"t\"" : "");
+}
+
+static void convert(double cpu_freq)
+{
+  double us_per_cycle = 1e6 / cpu_freq;
+
+  printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  emit_row(TID_CPU, "CPU");
+  emit_row(TID_ISR, "ISR");
+  for (u32 i = 1; i < 256; i++)
+    if (thread_names[i][0])
+      emit_row(i, thread_names[i]);
+
+  /* Cycle counts are unwrapped relative to the first event, events recorded
+   * from ISRs may be a few cycles out of order. */
+  s64 cycles = 0;
+  u32 prev = last.n ? last.events[0].cycles : 0;
+  u8 running = 0;
+  double running_since = 0;
+  char name[32];
+
+  for (u32 i = 0; i < last.n; i++) {
+    const msg_trace_event_t *e = &last.events[i];
+    cycles += (s32)(e->cycles - prev);
+    prev = e->cycles;
+    double ts = cycles * us_per_cycle;
+
+    switch (e->type) {
+    case TRACE_EVENT_THREAD:
+      if (running)
+        emit("{\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+             "\"name\":\"%s\"}", TID_CPU, running_since, ts - running_since,
+             thread_name(running));
+      running = e->arg;
+      running_since = ts;
+      break;
+    case TRACE_EVENT_NAP_IRQ:
+      emit_event("i", TID_ISR, ts, "NAP IRQ");
+      break;
+    case TRACE_EVENT_NAP_START:
+      emit_event("B", running, ts, "NAP");
+      break;
+    case TRACE_EVENT_NAP_END:
+      emit_event("E", running, ts, "NAP");
+      break;
+    case TRACE_EVENT_TRACK_START:
+    case TRACE_EVENT_TRACK_END:
+      snprintf(name, sizeof(name), "track ch %u", e->arg);
+      emit_event(e->type == TRACE_EVENT_TRACK_START ? "B" : "E",
+                 running, ts, name);
+      break;
+    case TRACE_EVENT_SOLN_START:
+      emit_event("B", running, ts, "solution");
+      break;
+    case TRACE_EVENT_SOLN_END:
+      emit_event("E", running, ts, "solution");
+      break;
+    case TRACE_EVENT_SBP_TX:
+      snprintf(name, sizeof(name), "SBP 0x%04X", e->arg);
+      emit_event("i", running, ts, name);
+      break;
+    case TRACE_EVENT_USART_TX_DONE:
+      snprintf(name, sizeof(name), "USART TX %u bytes", e->arg);
+      emit_event("i", TID_ISR, ts, name);
+      break;
+    default:
+      break;
+    }
+  }
+
+  printf("\n]}\n");
+}
+
+int main(int argc, char *argv[])
+{
+  double cpu_freq = SCHED_DWT_TICKS_PER_US * 1e6;
+
+  int c;
+  while ((c = getopt(argc, argv, "f:")) != -1) {
+    switch (c) {
+    case 'f':
+      cpu_freq = atof(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-f cpu_freq_hz] capture.sbp\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc || cpu_freq <= 0) {
+    fprintf(stderr, "usage: %s [-f cpu_freq_hz] capture.sbp\n", argv[0]);
+    return 1;
+  }
+
+  FILE *f = fopen(argv[optind], "rb");
+  if (!f) {
+    fprintf(stderr, "Can't open %s\n", argv[optind]);
+    return 1;
+  }
+  size_t size = 0, len = 0;
+  u8 *data = NULL;
+  while (true) {
+    if (size == len) {
+      len = len ? 2 * len : 65536;
+      data = realloc(data, len);
+      if (!data) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+      }
+    }
+    size_t n = fread(&data[size], 1, len - size, f);
+    if (n == 0)
+      break;
+    size += n;
+  }
+  fclose(f);
+
+  parse(data, size);
+  free(data);
+
+  if (!last.complete) {
+    fprintf(stderr, "No complete trace download in %s\n", argv[optind]);
+    return 1;
+  }
+  fprintf(stderr, "%u events, %u lost before the download, %u chunks "
+          "missing\n", last.n, last.lost, missing_chunks);
+
+  convert(cpu_freq);
+  return 0;
+}
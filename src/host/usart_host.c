@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libswiftnav/logging.h>
+
+#include <ch.h>
+
+#include "host/opencm3.h"
+#include "host/replay.h"
+#include "../peripherals/3drradio.h"
+#include "../peripherals/usart.h"
+#include "../settings.h"
+
+/** \addtogroup host
+ * \{ */
+
+/* The FTDI USART is routed through stdin/stdout, or a pty if PIKSI_HOST_PTY
+ * is set in the environment. While a capture is being replayed its output is
+ * recorded by the replay instead, see replay.c, and nothing is received.
+ * UARTA and UARTB are not connected, output is discarded and nothing is ever
+ * received. The DMA buffers and their bookkeeping are kept so the USART state
+ * can be inspected as on the target, but data is moved synchronously. */
+
+/** Unused on the host, only referenced by the target DMA setup code. */
+const u8 dma_irq_lookup[2][8];
+
+static int ftdi_rd_fd = -1;
+static int ftdi_wr_fd = -1;
+static bool ftdi_replay;
+
+/** Number of bytes the "DMA" has written into each RX buffer. */
+static u32 rx_n_written[3];
+
+static int usart_index(u32 usart)
+{
+  switch (usart) {
+  case USART6: return 0;
+  case USART1: return 1;
+  case USART3: return 2;
+  default: return -1;
+  }
+}
+
+static int usart_rd_fd(u32 usart)
+{
+  return usart == USART6 ? ftdi_rd_fd : -1;
+}
+
+static int usart_wr_fd(u32 usart)
+{
+  return usart == USART6 ? ftdi_wr_fd : -1;
+}
+
+/** Open the file descriptors backing the FTDI USART.
+ * Called before anything is logged so a failure can still be reported.
+ */
+void host_usart_setup(void)
+{
+  if (replay_enabled()) {
+    ftdi_replay = true;
+    return;
+  }
+
+  if (getenv("PIKSI_HOST_PTY")) {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+      perror("posix_openpt");
+      exit(1);
+    }
+    fprintf(stderr, "SBP on %s\n", ptsname(fd));
+    ftdi_rd_fd = ftdi_wr_fd = fd;
+  } else {
+    ftdi_rd_fd = STDIN_FILENO;
+    ftdi_wr_fd = STDOUT_FILENO;
+  }
+
+  fcntl(ftdi_rd_fd, F_SETFL, fcntl(ftdi_rd_fd, F_GETFL) | O_NONBLOCK);
+}
+
+void usart_tx_dma_setup(usart_tx_dma_state* s, u32 usart,
+                        u32 dma, u8 stream, u8 channel)
+{
+  s->dma = dma;
+  s->usart = usart;
+  s->stream = stream;
+  s->channel = channel;
+  s->rd = s->wr = s->xfer_len = 0;
+  s->byte_counter = 0;
+  s->last_byte_ticks = chTimeNow();
+}
+
+void usart_tx_dma_disable(usart_tx_dma_state* s)
+{
+  (void)s;
+}
+
+void usart_tx_dma_isr(usart_tx_dma_state* s)
+{
+  (void)s;
+}
+
+/** Writes complete before returning, the buffer is always empty. */
+u32 usart_tx_n_free(usart_tx_dma_state* s)
+{
+  (void)s;
+  return USART_TX_BUFFER_LEN - 1;
+}
+
+/** Write out data over the USART.
+ * As on the target, nothing is written if it wouldn't all fit in the TX
+ * buffer.
+ *
+ * \param s The USART DMA state structure.
+ * \param data A pointer to the data to write out.
+ * \param len  The number of bytes to write.
+ * \return The number of bytes written.
+ */
+u32 usart_write_dma(usart_tx_dma_state* s, const u8 data[], u32 len)
+{
+  if (len == 0 || len > usart_tx_n_free(s))
+    return 0;
+
+  if (s->usart == USART6 && ftdi_replay)
+    replay_output(data, len);
+
+  int fd = usart_wr_fd(s->usart);
+  u32 n = 0;
+  while (fd >= 0 && n < len) {
+    ssize_t ret = write(fd, &data[n], len - n);
+    if (ret < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      break;
+    }
+    n += ret;
+  }
+
+  s->byte_counter += len;
+
+  return len;
+}
+
+float usart_tx_throughput(usart_tx_dma_state* s)
+{
+  systime_t now_ticks = chTimeNow();
+  float elapsed = ((float)((now_ticks - s->last_byte_ticks) /
+    (double)CH_FREQUENCY));
+  float kbps = s->byte_counter / (elapsed * 1000.0);
+
+  s->byte_counter = 0;
+  s->last_byte_ticks = now_ticks;
+
+  return kbps;
+}
+
+void usart_rx_dma_setup(usart_rx_dma_state* s, u32 usart,
+                        u32 dma, u8 stream, u8 channel)
+{
+  s->dma = dma;
+  s->usart = usart;
+  s->stream = stream;
+  s->channel = channel;
+  chBSemInit(&s->ready_sem, TRUE);
+
+  s->byte_counter = 0;
+  s->last_byte_ticks = chTimeNow();
+
+  s->rd = 0;
+  s->rd_wraps = s->wr_wraps = 0;
+  rx_n_written[usart_index(usart)] = 0;
+}
+
+void usart_rx_dma_disable(usart_rx_dma_state* s)
+{
+  (void)s;
+}
+
+void usart_rx_dma_isr(usart_rx_dma_state* s)
+{
+  (void)s;
+}
+
+/** Move whatever the host has received into the RX buffer and return the
+ * number of bytes available.
+ * \param s The USART DMA state structure.
+ */
+u32 usart_n_read_dma(usart_rx_dma_state* s)
+{
+  int fd = usart_rd_fd(s->usart);
+  u32 *n_written = &rx_n_written[usart_index(s->usart)];
+  u32 n_read = s->rd_wraps * USART_RX_BUFFER_LEN + s->rd;
+
+  /* Fill up to, but not over, the unread data. */
+  while (fd >= 0 && *n_written - n_read < USART_RX_BUFFER_LEN) {
+    u32 wr = *n_written % USART_RX_BUFFER_LEN;
+    u32 n_free = USART_RX_BUFFER_LEN - (*n_written - n_read);
+    u32 n_contig = USART_RX_BUFFER_LEN - wr;
+    ssize_t ret = read(fd, &s->buff[wr], MIN(n_free, n_contig));
+    if (ret <= 0)
+      break;
+    *n_written += ret;
+    s->wr_wraps = *n_written / USART_RX_BUFFER_LEN;
+  }
+
+  return *n_written - n_read;
+}
+
+/** Read bytes from the USART RX buffer, polling the host until len bytes
+ * are available or the timeout expires.
+ *
+ * \param s The USART DMA state structure.
+ * \param data Pointer to a buffer where the received data will be stored.
+ * \param len The number of bytes to attempt to read.
+ * \param timeout Return if this time passes with no reception.
+ * \return The number of bytes successfully read from the receive buffer.
+ */
+u32 usart_read_dma_timeout(usart_rx_dma_state* s, u8 data[], u32 len, u32 timeout)
+{
+  systime_t start = chTimeNow();
+  u32 n_available;
+  while ((n_available = usart_n_read_dma(s)) < len &&
+         chTimeNow() - start < timeout)
+    chThdSleepMilliseconds(1);
+
+  u16 n = (len > n_available) ? n_available : len;
+
+  if (s->rd + n < USART_RX_BUFFER_LEN) {
+    memcpy(data, &(s->buff[s->rd]), n);
+    s->rd += n;
+  } else {
+    s->rd_wraps++;
+    memcpy(&data[0], &(s->buff[s->rd]), USART_RX_BUFFER_LEN - s->rd);
+    memcpy(&data[USART_RX_BUFFER_LEN - s->rd],
+           &(s->buff[0]), n - USART_RX_BUFFER_LEN + s->rd);
+    s->rd = n - USART_RX_BUFFER_LEN + s->rd;
+  }
+
+  s->byte_counter += n;
+
+  return n;
+}
+
+u32 usart_read_dma(usart_rx_dma_state* s, u8 data[], u32 len)
+{
+  return usart_read_dma_timeout(s, data, len, 0);
+}
+
+float usart_rx_throughput(usart_rx_dma_state* s)
+{
+  systime_t now_ticks = chTimeNow();
+  float elapsed = ((float)((now_ticks - s->last_byte_ticks) /
+    (double)CH_FREQUENCY*1000.0));
+  float kbps = s->byte_counter / elapsed;
+
+  s->byte_counter = 0;
+  s->last_byte_ticks = now_ticks;
+
+  return kbps;
+}
+
+/* Telemetry radio, the setting is kept so the settings list matches the
+ * target's but there is never a radio to configure. */
+
+static char commandstr[256] = "AT&F,ATS1=115,ATS2=128,ATS5=0,AT&W,ATZ";
+
+void radio_preconfigure_hook(u32 usart, u32 default_baud, char* uart_name)
+{
+  (void)usart; (void)default_baud;
+  log_info("No telemetry radio on %s in the host build", uart_name);
+}
+
+void radio_setup()
+{
+  SETTING("telemetry_radio", "configuration_string", commandstr, TYPE_STRING);
+}
+
+/** \} */
@@ -37,7 +37,11 @@
 #include "simulator.h"
 #include "settings.h"
 #include "sbp_fileio.h"
+#include "obs_log.h"
+#include "cfs/cfs-coffee-arch.h"
 #include "ephemeris.h"
+#include "nav_store.h"
+#include "trace.h"
 
 extern void ext_setup(void);
 
@@ -137,11 +141,13 @@ s8 compare_version(const char *a, const char *b)
 
 int main(void)
 {
+#ifndef PIKSI_HOST
   /* Initialise SysTick timer that will be used as the ChibiOS kernel tick
    * timer. */
   STBase->RVR = SYSTEM_CLOCK / CH_FREQUENCY - 1;
   STBase->CVR = 0;
   STBase->CSR = CLKSOURCE_CORE_BITS | ENABLE_ON_BITS | TICKINT_ENABLED_BITS;
+#endif
 
   /* Kernel initialization, the main() function becomes a thread with
    * priority NORMALPRIO and the RTOS is active. */
@@ -182,12 +188,15 @@ int main(void)
   manage_acq_setup();
   manage_track_setup();
   system_monitor_setup();
+  trace_setup();
   base_obs_setup();
   solution_setup();
 
   simulator_setup();
 
   sbp_fileio_setup();
+  obs_log_setup();
+  coffee_gc_setup();
   ext_setup();
 
   READ_ONLY_PARAMETER("system_info", "serial_number", serial_number, TYPE_INT);
@@ -212,6 +221,7 @@ int main(void)
   READ_ONLY_PARAMETER("system_info", "nap_fft_index_bits", nap_acq_fft_index_bits, TYPE_INT);
 
   ephemeris_setup();
+  nav_store_setup();
 
   /* Send message to inform host we are up and running. */
   u32 startup_flags = 0;
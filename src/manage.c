@@ -31,9 +31,8 @@
 #include "position.h"
 #include "manage.h"
 #include "nmea.h"
+#include "nav_store.h"
 #include "sbp.h"
-#include "cfs/cfs.h"
-#include "cfs/cfs-coffee.h"
 #include "peripherals/random.h"
 #include "./system_monitor.h"
 
@@ -82,6 +81,7 @@ acq_prn_t acq_prn_param[32];
 
 almanac_t almanac[32];
 extern ephemeris_t es[32];
+extern ephemeris_t es_restored[32];
 
 static float track_cn0_use_thres = 31.0; /* dBHz */
 float elevation_mask = 5.0; /* degrees */
@@ -97,21 +97,14 @@ static void almanac_callback(u16 sender_id, u8 len, u8 msg[], void* context)
 
   almanac_t *new_almanac = (almanac_t*)msg;
 
+  if ((new_almanac->prn < 1) || (new_almanac->prn > 32)) {
+    log_warn("Ignoring almanac for invalid PRN %d", new_almanac->prn);
+    return;
+  }
+
   log_info("Received alamanc for PRN %02d", new_almanac->prn);
   memcpy(&almanac[new_almanac->prn-1], new_almanac, sizeof(almanac_t));
-
-  int fd = cfs_open("almanac", CFS_WRITE);
-  if (fd != -1) {
-    cfs_seek(fd, (new_almanac->prn-1)*sizeof(almanac_t), CFS_SEEK_SET);
-    if (cfs_write(fd, new_almanac, sizeof(almanac_t)) != sizeof(almanac_t)) {
-      log_error("Error writing to almanac file");
-    } else {
-      log_info("Saved almanac to flash");
-    }
-    cfs_close(fd);
-  } else {
-    log_error("Error opening almanac file");
-  }
+  nav_store_almanac_updated(new_almanac->prn-1);
 }
 
 static sbp_msg_callbacks_node_t mask_sat_callback_node;
@@ -163,16 +156,9 @@ void manage_acq_setup()
     acq_prn_param[prn].dopp_hint_high = ACQ_FULL_CF_MAX;
   }
 
-  int fd = cfs_open("almanac", CFS_READ);
-  if (fd != -1) {
-    cfs_read(fd, almanac, 32*sizeof(almanac_t));
+  if (nav_store_load_almanac(almanac)) {
     log_info("Loaded almanac from flash");
-    cfs_close(fd);
   } else {
-    log_info("No almanac file present in flash, create an empty one");
-    cfs_coffee_reserve("almanac", 32*sizeof(almanac_t));
-    cfs_coffee_configure_log("almanac", 256, sizeof(almanac_t));
-
     for (u8 prn=0; prn<32; prn++) {
       almanac[prn].valid = 0;
     }
@@ -224,10 +210,14 @@ static u16 manage_warm_start(u8 prn, gps_time_t t,
     double el_d, _, dopp_hint = 0, dopp_uncertainty = DOPP_UNCERT_ALMANAC;
 
     /* Do we have a suitable ephemeris for this sat?  If so, use
-       that in preference to the almanac. */
-    if (ephemeris_good(&es[prn], t)) {
+       that in preference to the almanac. One restored from flash is
+       good enough for a hint, if not yet decoded again. */
+    ephemeris_t *e = &es[prn];
+    if (!ephemeris_good(e, t))
+      e = &es_restored[prn];
+    if (ephemeris_good(e, t)) {
       double sat_pos[3], sat_vel[3], el_d;
-      calc_sat_state(&es[prn], t, sat_pos, sat_vel, &_, &_);
+      calc_sat_state(e, t, sat_pos, sat_vel, &_, &_);
       wgsecef2azel(sat_pos, position_solution.pos_ecef, &_, &el_d);
       el = (float)(el_d) * R2D;
       if (el < elevation_mask)
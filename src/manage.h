@@ -14,6 +14,7 @@
 #define SWIFTNAV_MANAGE_H
 
 #include <ch.h>
+#include <libswiftnav/almanac.h>
 #include <libswiftnav/common.h>
 #include "board/nap/acq_channel.h"
 
@@ -57,6 +58,8 @@
 
 /** \} */
 
+extern almanac_t almanac[32];
+
 void manage_acq_setup(void);
 
 void manage_set_obs_hint(u8 prn);
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_MATRIX_FIXED_H
+#define SWIFTNAV_MATRIX_FIXED_H
+
+#include <math.h>
+
+#include <libswiftnav/common.h>
+
+/** \defgroup matrix_fixed Fixed-size Matrix Kernels
+ * Inline 2x2, 3x3 and 4x4 matrix operations.
+ *
+ * These mirror the generic libswiftnav `linear_algebra` functions but with
+ * the dimensions fixed at compile time. They are plain loops with constant
+ * bounds, which the compiler can unroll and keep in registers when
+ * optimizing, as the firmware's -O2 build does. Whether it does is up to the
+ * compiler, tests/matrix_bench measures the result. Matrices are row-major
+ * arrays of doubles, passed as flat pointers in the same way as
+ * `matrix_multiply()`.
+ * Output arguments must not alias the inputs unless noted.
+ *
+ * Inverse and Cholesky functions return 0 on success and -1 if the matrix is
+ * singular or not positive definite, in which case the output is undefined.
+ * \{ */
+
+#define MATRIX_FIXED_KERNELS(n)                                               \
+static inline void mat##n##_mul(const double *a, const double *b, double *c)  \
+{                                                                             \
+  for (int i = 0; i < n; i++)                                                 \
+    for (int j = 0; j < n; j++) {                                             \
+      double acc = 0;                                                         \
+      for (int k = 0; k < n; k++)                                             \
+        acc += a[n*i + k] * b[n*k + j];                                       \
+      c[n*i + j] = acc;                                                       \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static inline void mat##n##_mul_vec(const double *a, const double *x,         \
+                                    double *y)                                \
+{                                                                             \
+  for (int i = 0; i < n; i++) {                                               \
+    double acc = 0;                                                           \
+    for (int k = 0; k < n; k++)                                               \
+      acc += a[n*i + k] * x[k];                                               \
+    y[i] = acc;                                                               \
+  }                                                                           \
+}                                                                             \
+                                                                              \
+static inline void mat##n##_transpose(const double *a, double *b)             \
+{                                                                             \
+  for (int i = 0; i < n; i++)                                                 \
+    for (int j = 0; j < n; j++)                                               \
+      b[n*j + i] = a[n*i + j];                                                \
+}                                                                             \
+                                                                              \
+static inline s8 mat##n##_cholesky(const double *a, double *l)                \
+{                                                                             \
+  for (int i = 0; i < n; i++)                                                 \
+    for (int j = 0; j < n; j++) {                                             \
+      if (j > i) {                                                            \
+        l[n*i + j] = 0;                                                       \
+        continue;                                                             \
+      }                                                                       \
+      double acc = a[n*i + j];                                                \
+      for (int k = 0; k < j; k++)                                             \
+        acc -= l[n*i + k] * l[n*j + k];                                       \
+      if (i == j) {                                                           \
+        if (acc <= 0)                                                         \
+          return -1;                                                          \
+        l[n*i + i] = sqrt(acc);                                               \
+      } else {                                                                \
+        l[n*i + j] = acc / l[n*j + j];                                        \
+      }                                                                       \
+    }                                                                         \
+  return 0;                                                                   \
+}
+
+MATRIX_FIXED_KERNELS(2)
+MATRIX_FIXED_KERNELS(3)
+MATRIX_FIXED_KERNELS(4)
+
+#undef MATRIX_FIXED_KERNELS
+
+/** Invert a 2x2 matrix using the closed form adjugate. */
+static inline s8 mat2_inv(const double *a, double *b)
+{
+  double det = a[0]*a[3] - a[1]*a[2];
+  if (det == 0)
+    return -1;
+  double idet = 1 / det;
+  b[0] =  a[3] * idet;
+  b[1] = -a[1] * idet;
+  b[2] = -a[2] * idet;
+  b[3] =  a[0] * idet;
+  return 0;
+}
+
+/** Invert a 3x3 matrix using the closed form adjugate. */
+static inline s8 mat3_inv(const double *a, double *b)
+{
+  double c0 = a[4]*a[8] - a[5]*a[7];
+  double c1 = a[5]*a[6] - a[3]*a[8];
+  double c2 = a[3]*a[7] - a[4]*a[6];
+  double det = a[0]*c0 + a[1]*c1 + a[2]*c2;
+  if (det == 0)
+    return -1;
+  double idet = 1 / det;
+  b[0] = c0 * idet;
+  b[1] = (a[2]*a[7] - a[1]*a[8]) * idet;
+  b[2] = (a[1]*a[5] - a[2]*a[4]) * idet;
+  b[3] = c1 * idet;
+  b[4] = (a[0]*a[8] - a[2]*a[6]) * idet;
+  b[5] = (a[2]*a[3] - a[0]*a[5]) * idet;
+  b[6] = c2 * idet;
+  b[7] = (a[1]*a[6] - a[0]*a[7]) * idet;
+  b[8] = (a[0]*a[4] - a[1]*a[3]) * idet;
+  return 0;
+}
+
+/** Invert a 4x4 matrix by Gauss-Jordan elimination with partial pivoting. */
+static inline s8 mat4_inv(const double *a, double *b)
+{
+  double m[4][8];
+  for (int i = 0; i < 4; i++)
+    for (int j = 0; j < 4; j++) {
+      m[i][j] = a[4*i + j];
+      m[i][j+4] = (i == j) ? 1 : 0;
+    }
+
+  for (int c = 0; c < 4; c++) {
+    int p = c;
+    for (int r = c + 1; r < 4; r++)
+      if (fabs(m[r][c]) > fabs(m[p][c]))
+        p = r;
+    if (m[p][c] == 0)
+      return -1;
+    if (p != c)
+      for (int j = 0; j < 8; j++) {
+        double t = m[c][j];
+        m[c][j] = m[p][j];
+        m[p][j] = t;
+      }
+    double ip = 1 / m[c][c];
+    for (int j = 0; j < 8; j++)
+      m[c][j] *= ip;
+    for (int r = 0; r < 4; r++) {
+      if (r == c)
+        continue;
+      double f = m[r][c];
+      for (int j = 0; j < 8; j++)
+        m[r][j] -= f * m[c][j];
+    }
+  }
+
+  for (int i = 0; i < 4; i++)
+    for (int j = 0; j < 4; j++)
+      b[4*i + j] = m[i][j+4];
+  return 0;
+}
+
+/** c = a + b for 3-vectors, c may alias a or b. */
+static inline void vec3_add(const double *a, const double *b, double *c)
+{
+  c[0] = a[0] + b[0];
+  c[1] = a[1] + b[1];
+  c[2] = a[2] + b[2];
+}
+
+/** c = a - b for 3-vectors, c may alias a or b. */
+static inline void vec3_sub(const double *a, const double *b, double *c)
+{
+  c[0] = a[0] - b[0];
+  c[1] = a[1] - b[1];
+  c[2] = a[2] - b[2];
+}
+
+static inline double vec3_norm(const double *a)
+{
+  return sqrt(a[0]*a[0] + a[1]*a[1] + a[2]*a[2]);
+}
+
+/** \} */
+
+#endif  /* SWIFTNAV_MATRIX_FIXED_H */
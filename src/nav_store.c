@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <string.h>
+
+#include <ch.h>
+
+#include <libswiftnav/logging.h>
+
+#include "cfs/cfs.h"
+#include "cfs/cfs-coffee.h"
+#include "ephemeris.h"
+#include "manage.h"
+#include "nav_store.h"
+#include "timing.h"
+
+/** \defgroup nav_store Navigation Data Store
+ * Keep the almanac and ephemerides in flash across resets.
+ *
+ * The almanac and ephemeris files hold one record per PRN. Updates only mark
+ * the PRN as changed, a low priority thread writes all the changed records
+ * out together every \ref NAV_STORE_FLUSH_MS so a burst of updates after
+ * acquiring a constellation costs one open of each file rather than one per
+ * satellite.
+ *
+ * Ephemerides are restored at boot if they are still good at the time
+ * estimate loaded with the last position, so a warm reset can use them for
+ * acquisition hints without waiting to decode the subframes. That estimate is
+ * only a guess, so they are kept apart from the ephemerides used for
+ * solutions, see es_restored.
+ * \{ */
+
+#define NAV_STORE_N_PRNS 32
+
+/** A file of records indexed by PRN. */
+typedef struct {
+  const char *name;
+  const char *desc;
+  /** Records in RAM, written to the file when marked dirty. */
+  void *records;
+  u32 record_size;
+  /** Held while copying a record, if the records have one. */
+  Mutex *mutex;
+  /** PRNs whose records have changed since they were written. */
+  volatile u32 dirty;
+} nav_file_t;
+
+static nav_file_t almanac_file = {
+  .name = "almanac",
+  .desc = "almanacs",
+  .records = almanac,
+  .record_size = sizeof(almanac_t),
+  .mutex = NULL,
+};
+
+static nav_file_t ephemeris_file = {
+  .name = "ephem",
+  .desc = "ephemerides",
+  .records = es,
+  .record_size = sizeof(ephemeris_t),
+  .mutex = &es_mutex,
+};
+
+static WORKING_AREA_CCM(wa_nav_store_thread, 1024);
+
+static void mark_dirty(nav_file_t *f, u32 prns)
+{
+  chSysLock();
+  f->dirty |= prns;
+  chSysUnlock();
+}
+
+/** Read a whole file of records, or create it if it doesn't exist.
+ * \return True if the file was read
+ */
+static bool load(nav_file_t *f, void *records, unsigned log_size)
+{
+  int fd = cfs_open(f->name, CFS_READ);
+  if (fd == -1) {
+    log_info("No %s file present in flash, create an empty one", f->name);
+    cfs_coffee_reserve(f->name, NAV_STORE_N_PRNS * f->record_size);
+    cfs_coffee_configure_log(f->name, log_size, f->record_size);
+    return false;
+  }
+
+  cfs_read(fd, records, NAV_STORE_N_PRNS * f->record_size);
+  cfs_close(fd);
+  return true;
+}
+
+/** Write the records which have changed since the last flush. */
+static void flush(nav_file_t *f)
+{
+  static u8 record[MAX(sizeof(almanac_t), sizeof(ephemeris_t))];
+
+  chSysLock();
+  u32 dirty = f->dirty;
+  f->dirty = 0;
+  chSysUnlock();
+
+  if (dirty == 0)
+    return;
+
+  int fd = cfs_open(f->name, CFS_WRITE);
+  if (fd == -1) {
+    log_error("Error opening %s file", f->name);
+    mark_dirty(f, dirty);
+    return;
+  }
+
+  u32 failed = 0;
+  u8 n = 0;
+  for (u8 prn = 0; prn < NAV_STORE_N_PRNS; prn++) {
+    if (!(dirty & (1u << prn)))
+      continue;
+
+    /* Copy the record out so it isn't held locked while writing flash. */
+    if (f->mutex)
+      chMtxLock(f->mutex);
+    memcpy(record, (u8 *)f->records + prn * f->record_size, f->record_size);
+    if (f->mutex)
+      chMtxUnlock();
+
+    cfs_seek(fd, prn * f->record_size, CFS_SEEK_SET);
+    if (cfs_write(fd, record, f->record_size) != (int)f->record_size) {
+      failed |= 1u << prn;
+    } else {
+      n++;
+    }
+  }
+  cfs_close(fd);
+
+  if (failed) {
+    log_error("Error writing to %s file", f->name);
+    mark_dirty(f, failed);
+  }
+  if (n > 0)
+    log_info("Saved %u %s to flash", n, f->desc);
+}
+
+static msg_t nav_store_thread(void *arg)
+{
+  (void)arg;
+  chRegSetThreadName("nav store");
+
+  while (TRUE) {
+    chThdSleepMilliseconds(NAV_STORE_FLUSH_MS);
+    flush(&almanac_file);
+    flush(&ephemeris_file);
+  }
+  return 0;
+}
+
+/** Load the almanac saved in flash.
+ *
+ * \param alm Almanac for each PRN, left untouched if there isn't one saved
+ * \return True if the almanac was loaded
+ */
+bool nav_store_load_almanac(almanac_t alm[32])
+{
+  return load(&almanac_file, alm, 256);
+}
+
+/** Restore the ephemerides saved in flash which are still good at the time
+ * guess. Must be called after the time estimate has been loaded, see
+ * position_setup(). Without any time estimate nothing is restored as
+ * there is no way to tell how old the ephemerides are.
+ *
+ * \param eph Ephemeris for each PRN, those not restored are cleared
+ * \return Number of ephemerides restored
+ */
+u8 nav_store_load_ephemeris(ephemeris_t eph[32])
+{
+  if (!load(&ephemeris_file, eph,
+            NAV_STORE_EPHEMERIS_LOG_RECORDS * sizeof(ephemeris_t)))
+    return 0;
+
+  gps_time_t t = get_current_time();
+  u8 n = 0;
+  for (u8 prn = 0; prn < NAV_STORE_N_PRNS; prn++) {
+    if ((eph[prn].prn == prn) && (time_quality >= TIME_GUESS) &&
+        ephemeris_good(&eph[prn], t)) {
+      n++;
+    } else {
+      memset(&eph[prn], 0, sizeof(ephemeris_t));
+      eph[prn].prn = prn;
+    }
+  }
+  return n;
+}
+
+/** Save the almanac for a PRN with the next flush. */
+void nav_store_almanac_updated(u8 prn)
+{
+  mark_dirty(&almanac_file, 1u << prn);
+}
+
+/** Save the ephemeris for a PRN with the next flush. */
+void nav_store_ephemeris_updated(u8 prn)
+{
+  mark_dirty(&ephemeris_file, 1u << prn);
+}
+
+void nav_store_setup(void)
+{
+  chThdCreateStatic(wa_nav_store_thread, sizeof(wa_nav_store_thread),
+                    LOWPRIO+3, nav_store_thread, NULL);
+}
+
+/** \} */
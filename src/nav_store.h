@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_NAV_STORE_H
+#define SWIFTNAV_NAV_STORE_H
+
+#include <libswiftnav/almanac.h>
+#include <libswiftnav/common.h>
+#include <libswiftnav/ephemeris.h>
+
+/** \addtogroup nav_store
+ * \{ */
+
+/** Longest an update is held in RAM before being written to flash. */
+#define NAV_STORE_FLUSH_MS 10000
+/** Ephemeris records in the log of the ephemeris file, the file is rewritten
+ * each time the log fills up. */
+#define NAV_STORE_EPHEMERIS_LOG_RECORDS 16
+
+/** \} */
+
+bool nav_store_load_almanac(almanac_t alm[32]);
+u8 nav_store_load_ephemeris(ephemeris_t eph[32]);
+void nav_store_almanac_updated(u8 prn);
+void nav_store_ephemeris_updated(u8 prn);
+void nav_store_setup(void);
+
+#endif  /* SWIFTNAV_NAV_STORE_H */
@@ -76,7 +76,7 @@ static struct nmea_dispatcher *nmea_dispatchers_head;
 static void nmea_output(char *s, size_t size)
 {
   /* Global interrupt disable to avoid concurrency/reentrancy problems. */
-  __asm__("CPSID i;");
+  irq_disable();
 
   if ((ftdi_usart.mode == NMEA) && usart_claim(&ftdi_state, NMEA_MODULE)) {
     usart_write_dma(&ftdi_state.tx, (u8 *)s, size);
@@ -93,7 +93,7 @@ static void nmea_output(char *s, size_t size)
     usart_release(&uartb_state);
   }
 
-  __asm__("CPSIE i;");  /* Re-enable interrupts. */
+  irq_enable();  /* Re-enable interrupts. */
 
   for (struct nmea_dispatcher *d = nmea_dispatchers_head; d; d = d->next)
     d->send(s, size);
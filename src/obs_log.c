@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <ch.h>
+
+#include <libsbp/edc.h>
+#include <libswiftnav/logging.h>
+
+#include "cfs/cfs.h"
+#include "cfs/cfs-coffee.h"
+#include "cfs/cfs-coffee-arch.h"
+#include "obs_log.h"
+#include "sbp.h"
+#include "sbp_ext.h"
+#include "sbp_fileio.h"
+#include "settings.h"
+
+/** \defgroup obs_log Observation Log
+ * Record observations and solutions in flash for post-processing.
+ *
+ * While the `obs_log.enable` setting is set the observations and solutions
+ * output by the solution thread are also written to the CFS filesystem as
+ * complete SBP frames, so the log can be read by any SBP tool. The solution
+ * thread only copies each message into a RAM buffer which a low priority
+ * thread writes out to flash. If the buffer fills up messages are dropped,
+ * and counted, rather than holding up the solution.
+ *
+ * The log is a ring of segment files "obs0", "obs1", ... each reserved at
+ * OBS_LOG_SEGMENT_SIZE when it is started so the log never takes more than
+ * its share of the filesystem. When a segment is full the oldest is replaced
+ * by a new one. Each segment starts with a \ref SBP_MSG_OBS_LOG_SEGMENT giving
+ * its place in the log, the segment being written is closed when logging is
+ * disabled. Segments are downloaded with \ref SBP_MSG_FILEIO_READ_STREAM_REQ.
+ *
+ * Keeping the solution thread off the filesystem only helps at the RTOS
+ * level. The STM32F405 has a single flash bank, so while flash is being
+ * programmed or erased every code fetch waits, the tracking interrupts
+ * included. At the default 10 Hz solution rate with 10 satellites the log
+ * takes about 1.7 kB/s (observations at 5 Hz, two messages of about 95
+ * bytes each, plus POS_LLH and VEL_NED at 10 Hz). That is three to four
+ * OBS_LOG_CHUNK_SIZE writes a second. Each one stalls the CPU for about
+ * 2 ms, or up to 13 ms by the datasheet's worst case word programming
+ * time, so logging costs under 1% of the CPU in short stalls. Segment
+ * rotation frees a 128 kB Coffee sector about every 75 s. Erasing it,
+ * even from the background collector, stalls the CPU for 1-2 s, long
+ * enough for the tracking loops to miss updates and possibly lose lock.
+ * These figures are from the datasheet and haven't been measured on a
+ * receiver.
+ * \{ */
+
+/** Longest the buffer is left before being written out. */
+#define OBS_LOG_FLUSH_MS 500
+/** Bytes written to flash at a time. */
+#define OBS_LOG_CHUNK_SIZE 512
+
+#define SBP_FRAME_PREAMBLE 0x55
+#define SBP_FRAME_HEADER_LEN 6
+#define SBP_FRAME_CRC_LEN 2
+#define SBP_FRAME_MAX_LEN \
+  (SBP_FRAME_HEADER_LEN + SBP_FRAMING_MAX_PAYLOAD_SIZE + SBP_FRAME_CRC_LEN)
+
+bool obs_log_enabled = false;
+
+static struct {
+  u8 data[OBS_LOG_BUFF_SIZE];
+  /** Bytes put in by the solution thread, the next is written at
+   * head % OBS_LOG_BUFF_SIZE. */
+  volatile u32 head;
+  /** Bytes taken out by the log thread. */
+  volatile u32 tail;
+  /** Messages which didn't fit. */
+  volatile u32 dropped;
+} buff _CCM;
+
+static struct {
+  /** Segment files in the ring. */
+  u8 n;
+  /** Sequence number of the open segment, or of the next one. */
+  u32 seq;
+  /** CFS descriptor of the open segment, -1 if there isn't one. */
+  int fd;
+  /** Bytes written to the open segment. */
+  u32 len;
+} segment;
+
+static WORKING_AREA_CCM(wa_obs_log_thread, 2048);
+static BinarySemaphore flush_sem;
+
+/** Frame an SBP message.
+ * \return Length of the frame
+ */
+static u16 sbp_frame(u8 frame[], u16 msg_type, u8 len, const u8 msg[])
+{
+  frame[0] = SBP_FRAME_PREAMBLE;
+  frame[1] = msg_type & 0xFF;
+  frame[2] = msg_type >> 8;
+  frame[3] = my_sender_id & 0xFF;
+  frame[4] = my_sender_id >> 8;
+  frame[5] = len;
+  memcpy(&frame[SBP_FRAME_HEADER_LEN], msg, len);
+  u16 crc = crc16_ccitt(&frame[1], SBP_FRAME_HEADER_LEN - 1 + len, 0);
+  frame[SBP_FRAME_HEADER_LEN + len] = crc & 0xFF;
+  frame[SBP_FRAME_HEADER_LEN + len + 1] = crc >> 8;
+  return SBP_FRAME_HEADER_LEN + len + SBP_FRAME_CRC_LEN;
+}
+
+/** Add a message to the log if logging is enabled.
+ * Only called from the solution thread, never waits for the log thread or
+ * the filesystem.
+ *
+ * \param msg_type SBP message type
+ * \param len      Length of the payload
+ * \param msg      Payload
+ */
+void obs_log_msg(u16 msg_type, u8 len, u8 msg[])
+{
+  if (!obs_log_enabled)
+    return;
+
+  u8 frame[SBP_FRAME_MAX_LEN];
+  u16 n = sbp_frame(frame, msg_type, len, msg);
+
+  u32 head = buff.head;
+  if (OBS_LOG_BUFF_SIZE - (head - buff.tail) < n) {
+    buff.dropped++;
+    return;
+  }
+
+  u32 i = head & (OBS_LOG_BUFF_SIZE - 1);
+  u32 first = MIN(n, OBS_LOG_BUFF_SIZE - i);
+  memcpy(&buff.data[i], frame, first);
+  memcpy(buff.data, &frame[first], n - first);
+  /* Only hand the frame to the log thread once it is in the buffer. */
+  __sync_synchronize();
+  buff.head = head + n;
+
+  if (buff.head - buff.tail >= OBS_LOG_BUFF_SIZE / 2)
+    chBSemSignal(&flush_sem);
+}
+
+static void segment_name(char name[], u32 seq)
+{
+  sprintf(name, "obs%u", (unsigned int)(seq % segment.n));
+}
+
+static void segment_close(void)
+{
+  cfs_close(segment.fd);
+  segment.fd = -1;
+  segment.seq++;
+}
+
+/** Start the next segment in place of the oldest. */
+static bool segment_open(void)
+{
+  char name[8];
+  segment_name(name, segment.seq);
+
+  /* CFS doesn't truncate a file opened for writing. */
+  sbp_fileio_flush(name);
+  cfs_remove(name);
+  if ((cfs_coffee_reserve(name, OBS_LOG_SEGMENT_SIZE) < 0) ||
+      ((segment.fd = cfs_open(name, CFS_WRITE)) < 0)) {
+    log_error("obs_log: Couldn't create %s, logging stopped", name);
+    segment.fd = -1;
+    obs_log_enabled = false;
+    return false;
+  }
+
+  msg_obs_log_segment_t msg = {
+    .seq = segment.seq,
+    .dropped = buff.dropped,
+  };
+  u8 frame[SBP_FRAME_MAX_LEN];
+  u16 n = sbp_frame(frame, SBP_MSG_OBS_LOG_SEGMENT, sizeof(msg), (u8 *)&msg);
+  if (cfs_write(segment.fd, frame, n) != n) {
+    log_error("obs_log: Write failed, logging stopped");
+    segment_close();
+    obs_log_enabled = false;
+    return false;
+  }
+  segment.len = n;
+  return true;
+}
+
+/** Write everything in the buffer to the log, whole frames at a time so a
+ * frame is never split between segments. */
+static void flush(void)
+{
+  static u8 chunk[OBS_LOG_CHUNK_SIZE];
+
+  while (buff.tail != buff.head) {
+    if ((segment.fd == -1) && !segment_open()) {
+      buff.tail = buff.head;
+      return;
+    }
+
+    u32 tail = buff.tail;
+    u32 head = buff.head;
+    u32 room = MIN(OBS_LOG_CHUNK_SIZE, OBS_LOG_SEGMENT_SIZE - segment.len);
+    u32 n = 0;
+    while (tail + n != head) {
+      u8 len = buff.data[(tail + n + 5) & (OBS_LOG_BUFF_SIZE - 1)];
+      u32 frame_len = SBP_FRAME_HEADER_LEN + len + SBP_FRAME_CRC_LEN;
+      if (n + frame_len > room)
+        break;
+      n += frame_len;
+    }
+
+    if (n == 0) {
+      /* The next frame doesn't fit in what's left of the segment. */
+      segment_close();
+      continue;
+    }
+
+    for (u32 i = 0; i < n; i++)
+      chunk[i] = buff.data[(tail + i) & (OBS_LOG_BUFF_SIZE - 1)];
+    buff.tail = tail + n;
+
+    if (cfs_write(segment.fd, chunk, n) != (int)n) {
+      log_error("obs_log: Write failed, starting a new segment");
+      segment_close();
+      continue;
+    }
+    segment.len += n;
+  }
+}
+
+static msg_t obs_log_thread(void *arg)
+{
+  (void)arg;
+  chRegSetThreadName("obs log");
+
+  u32 dropped = 0;
+  while (TRUE) {
+    chBSemWaitTimeout(&flush_sem, MS2ST(OBS_LOG_FLUSH_MS));
+    flush();
+
+    if (buff.dropped != dropped) {
+      log_warn("obs_log: %u messages dropped, flash writes falling behind",
+               (unsigned int)(buff.dropped - dropped));
+      dropped = buff.dropped;
+    }
+
+    /* Leave a complete segment to download once logging stops. */
+    if (!obs_log_enabled && (segment.fd != -1))
+      segment_close();
+  }
+  return 0;
+}
+
+/** Read the sequence number of a segment left by a previous boot. */
+static bool segment_seq(const char *name, u32 *seq)
+{
+  int fd = cfs_open(name, CFS_READ);
+  if (fd < 0)
+    return false;
+
+  u8 frame[SBP_FRAME_HEADER_LEN + sizeof(msg_obs_log_segment_t)];
+  int n = cfs_read(fd, frame, sizeof(frame));
+  cfs_close(fd);
+
+  if ((n != sizeof(frame)) || (frame[0] != SBP_FRAME_PREAMBLE) ||
+      ((frame[1] | (frame[2] << 8)) != SBP_MSG_OBS_LOG_SEGMENT))
+    return false;
+
+  msg_obs_log_segment_t msg;
+  memcpy(&msg, &frame[SBP_FRAME_HEADER_LEN], sizeof(msg));
+  *seq = msg.seq;
+  return true;
+}
+
+void obs_log_setup(void)
+{
+  buff.head = 0;
+  buff.tail = 0;
+  buff.dropped = 0;
+
+  segment.fd = -1;
+  segment.n = MAX(1, MIN(OBS_LOG_MAX_SEGMENTS,
+                         COFFEE_SIZE / 2 / OBS_LOG_SEGMENT_SIZE));
+
+  /* Carry on the log from before the reset in a new segment after the
+   * newest. */
+  segment.seq = 0;
+  for (u8 i = 0; i < segment.n; i++) {
+    char name[8];
+    u32 seq;
+    segment_name(name, i);
+    if (segment_seq(name, &seq))
+      segment.seq = MAX(segment.seq, seq + 1);
+  }
+
+  chBSemInit(&flush_sem, TRUE);
+  chThdCreateStatic(wa_obs_log_thread, sizeof(wa_obs_log_thread),
+                    NORMALPRIO-5, obs_log_thread, NULL);
+
+  /* Flash writes and erases stall the whole CPU, tracking included, see the
+   * module documentation. */
+  SETTING("obs_log", "enable", obs_log_enabled, TYPE_BOOL);
+}
+
+/** \} */
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_OBS_LOG_H
+#define SWIFTNAV_OBS_LOG_H
+
+#include <libswiftnav/common.h>
+
+/** \addtogroup obs_log
+ * \{ */
+
+/** Size reserved for each segment file. */
+#define OBS_LOG_SEGMENT_SIZE (32*1024)
+/** Most segment files kept, fewer if they would take more than half of the
+ * filesystem. */
+#define OBS_LOG_MAX_SEGMENTS 8
+/** RAM buffer between the solution thread and flash. Must be a power of
+ * two. */
+#define OBS_LOG_BUFF_SIZE 4096
+
+/** \} */
+
+extern bool obs_log_enabled;
+
+void obs_log_msg(u16 msg_type, u8 len, u8 msg[]);
+void obs_log_setup(void);
+
+#endif  /* SWIFTNAV_OBS_LOG_H */
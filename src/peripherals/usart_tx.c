@@ -20,6 +20,7 @@
 #include <libopencm3/stm32/f4/usart.h>
 
 #include "../error.h"
+#include "../trace.h"
 #include "usart.h"
 
 /** \addtogroup peripherals
@@ -194,6 +195,7 @@ void usart_tx_dma_isr(usart_tx_dma_state* s)
     dma_clear_interrupt_flags(s->dma, s->stream, DMA_HTIF | DMA_TCIF);
 
     /* Now that the transfer has finished we can increment the read index. */
+    trace_event(TRACE_EVENT_USART_TX_DONE, s->xfer_len);
     s->rd = (s->rd + s->xfer_len) % USART_TX_BUFFER_LEN;
 
     if (s->wr != s->rd)
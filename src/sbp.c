@@ -29,10 +29,12 @@
 #include "error.h"
 #include "peripherals/usart.h"
 #include "sbp.h"
+#include "sbp_ext.h"
 #include "sbp_utils.h"
 #include "settings.h"
 #include "main.h"
 #include "timing.h"
+#include "trace.h"
 #include "error.h"
 
 /** \defgroup io Input/Output
@@ -47,6 +49,10 @@ u16 my_sender_id;
 
 msg_uart_state_t uart_state_msg;
 
+/** Attempts at sending a message with sbp_send_msg_retry(). */
+#define SBP_SEND_RETRIES 50
+#define SBP_SEND_RETRY_MS 10
+
 #define LATENCY_SMOOTHING 0.5
 #define LOG_OBS_LATENCY_WINDOW_DURATION 3.0
 
@@ -58,6 +64,17 @@ sbp_state_t uarta_sbp_state;
 sbp_state_t uartb_sbp_state;
 sbp_state_t ftdi_sbp_state;
 
+#ifdef PIKSI_HOST
+/** SBP state for messages dispatched by sbp_inject_msg(). */
+static sbp_state_t inject_sbp_state;
+/** Single frame buffer between sbp_send_message() and sbp_process(). */
+static struct {
+  u8 buff[SBP_FRAMING_MAX_PAYLOAD_SIZE + 8];
+  u32 wr;
+  u32 rd;
+} inject_frame;
+#endif
+
 static const char SBP_MODULE[] = "sbp";
 
 static WORKING_AREA_CCM(wa_sbp_thread, 6084);
@@ -121,6 +138,9 @@ void sbp_setup(u16 sender_id)
   sbp_state_init(&uarta_sbp_state);
   sbp_state_init(&uartb_sbp_state);
   sbp_state_init(&ftdi_sbp_state);
+#ifdef PIKSI_HOST
+  sbp_state_init(&inject_sbp_state);
+#endif
 
   /* Disable input and output buffering. */
   /*setvbuf(stdin, NULL, _IONBF, 0);*/
@@ -136,7 +156,9 @@ void sbp_register_cbk(u16 msg_type, sbp_msg_callback_t cb,
   sbp_register_callback(&uarta_sbp_state, msg_type, cb, 0, node);
   sbp_register_callback(&uartb_sbp_state, msg_type, cb, 0, node);
   sbp_register_callback(&ftdi_sbp_state , msg_type, cb, 0, node);
-
+#ifdef PIKSI_HOST
+  sbp_register_callback(&inject_sbp_state, msg_type, cb, 0, node);
+#endif
 }
 
 /** Disable the SBP interface.
@@ -189,15 +211,41 @@ u32 sbp_send_msg(u16 msg_type, u8 len, u8 buff[])
   return sbp_send_msg_(msg_type, len, buff, my_sender_id);
 }
 
+/** Send a SBP message, retrying while the USART buffers are full.
+ * For threads streaming out several messages in a row, gives up after
+ * SBP_SEND_RETRIES attempts SBP_SEND_RETRY_MS apart.
+ *
+ * \param msg_type Message ID
+ * \param len      Length of message data
+ * \param buff     Pointer to message data array
+ *
+ * \return         Error code of the last attempt
+ */
+u32 sbp_send_msg_retry(u16 msg_type, u8 len, u8 buff[])
+{
+  u32 ret = 0;
+  for (u32 i = 0; i < SBP_SEND_RETRIES; i++) {
+    ret = sbp_send_msg(msg_type, len, buff);
+    if (ret == 0)
+      break;
+    chThdSleepMilliseconds(SBP_SEND_RETRY_MS);
+  }
+  return ret;
+}
+
 u32 sbp_send_msg_(u16 msg_type, u8 len, u8 buff[], u16 sender_id)
 {
+  trace_event(TRACE_EVENT_SBP_TX, msg_type);
+
   /* Global interrupt disable to avoid concurrency/reentrancy problems. */
-  __asm__("CPSID i;");
+  irq_disable();
 
   u16 ret = 0;
 
-  /* Don't relayed messages (sender_id 0) on the A and B UARTs. (Only FTDI USB) */
-  if (sender_id != 0) {
+  /* Don't relayed messages (sender_id 0) on the A and B UARTs. (Only FTDI USB)
+   * Nor the firmware diagnostic messages, which would use up the radio
+   * links' bandwidth. */
+  if ((sender_id != 0) && !SBP_MSG_IS_EXT(msg_type)) {
 
     if (use_usart(&uarta_usart, msg_type) && usart_claim(&uarta_state, SBP_MODULE)) {
       ret |= sbp_send_message(&uarta_sbp_state, msg_type, sender_id,
@@ -233,11 +281,11 @@ u32 sbp_send_msg_(u16 msg_type, u8 len, u8 buff[], u16 sender_id)
 
   if (ret != 3*len) {
     /* Return error if any sbp_send_message failed. */
-    __asm__("CPSIE i;");  /* Re-enable interrupts */
+    irq_enable();  /* Re-enable interrupts */
     return ret;
   }
 
-  __asm__("CPSIE i;");  // Re-enable interrupts
+  irq_enable();  // Re-enable interrupts
   return 0;
 }
 
@@ -305,6 +353,43 @@ void sbp_process_messages()
   }
 }
 
+#ifdef PIKSI_HOST
+static u32 inject_write(u8 *buff, u32 n, void *context)
+{
+  (void)context;
+  n = MIN(n, sizeof(inject_frame.buff) - inject_frame.wr);
+  memcpy(&inject_frame.buff[inject_frame.wr], buff, n);
+  inject_frame.wr += n;
+  return n;
+}
+
+static u32 inject_read(u8 *buff, u32 n, void *context)
+{
+  (void)context;
+  n = MIN(n, inject_frame.wr - inject_frame.rd);
+  memcpy(buff, &inject_frame.buff[inject_frame.rd], n);
+  inject_frame.rd += n;
+  return n;
+}
+
+/** Dispatch a message to the registered callbacks as though it had been
+ * received on one of the USARTs. The callbacks run in the calling thread.
+ *
+ * \param sender_id Sender ID the message appears to come from
+ * \param msg_type  Message ID
+ * \param len       Length of the payload
+ * \param buff      Payload
+ */
+void sbp_inject_msg(u16 sender_id, u16 msg_type, u8 len, u8 buff[])
+{
+  inject_frame.wr = inject_frame.rd = 0;
+  sbp_send_message(&inject_sbp_state, msg_type, sender_id, len, buff,
+                   &inject_write);
+  while (inject_frame.rd < inject_frame.wr)
+    sbp_process(&inject_sbp_state, &inject_read);
+}
+#endif
+
 /** Directs printf's output to the SBP interface */
 int _write(int file, char *ptr, int len)
 {
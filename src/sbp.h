@@ -27,11 +27,17 @@
 void log_obs_latency(float latency_ms);
 void log_obs_latency_tick();
 
+extern u16 my_sender_id;
+
 void sbp_setup(u16 sender_id);
 void sbp_register_cbk(u16 msg_type, sbp_msg_callback_t cb, sbp_msg_callbacks_node_t *node);
 void sbp_disable(void);
 u32 sbp_send_msg(u16 msg_type, u8 len, u8 buff[]);
+u32 sbp_send_msg_retry(u16 msg_type, u8 len, u8 buff[]);
 u32 sbp_send_msg_(u16 msg_type, u8 len, u8 buff[], u16 sender_id);
 void sbp_process_messages(void);
+#ifdef PIKSI_HOST
+void sbp_inject_msg(u16 sender_id, u16 msg_type, u8 len, u8 buff[]);
+#endif
 
 #endif
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_SBP_EXT_H
+#define SWIFTNAV_SBP_EXT_H
+
+#include <libsbp/common.h>
+
+/** \addtogroup sbp
+ * \{ */
+
+/* Firmware diagnostic messages which have not (yet) been added to libsbp.
+ * IDs are allocated downwards from 0x7FFF so they stay clear of the libsbp
+ * ranges. sbp_message_mask can't keep them off the radio UARTs, any mask
+ * with a bit set in 0x7FFF matches them, so sbp_send_msg() only sends them
+ * on the FTDI USB port, see SBP_MSG_IS_EXT(). */
+
+/** Lowest ID of the firmware diagnostic messages. */
+#define SBP_MSG_EXT_MIN 0x7FF0
+#define SBP_MSG_IS_EXT(msg_type) \
+  (((msg_type) >= SBP_MSG_EXT_MIN) && ((msg_type) <= 0x7FFF))
+
+/** Solution thread scheduling statistics.
+ * Histograms use log2 buckets of microseconds, bucket i counts samples in
+ * [2^i, 2^(i+1)) us with bucket 0 also holding samples under 1 us.
+ */
+#define SBP_MSG_SOLN_SCHED_STATS 0x7FFF
+#define SCHED_STATS_N_BUCKETS 16
+typedef struct __attribute__((packed)) {
+  u32 iterations;       /**< Solution iterations in this window. */
+  u32 missed_total;     /**< Missed deadlines since boot. */
+  u32 missed;           /**< Missed deadlines in this window. */
+  u32 period_us;        /**< Nominal solution period. */
+  u32 jitter_max_us;    /**< Worst wake-up latency after the epoch. */
+  u32 exec_max_us;      /**< Worst iteration execution time. */
+  u32 slack_min_us;     /**< Smallest slack to the next deadline. */
+  u16 jitter[SCHED_STATS_N_BUCKETS]; /**< Wake-up jitter histogram. */
+  u16 exec[SCHED_STATS_N_BUCKETS];   /**< Execution time histogram. */
+  u16 slack[SCHED_STATS_N_BUCKETS];  /**< Deadline slack histogram. */
+} msg_soln_sched_stats_t;
+
+/** NAP timing count cache statistics.
+ * Sent every heartbeat, see nap_timing_count().
+ */
+#define SBP_MSG_NAP_TIMEBASE_STATS 0x7FFE
+typedef struct __attribute__((packed)) {
+  u32 period_ms;    /**< Length of this window. */
+  u32 spi_reads;    /**< Timing count reads over SPI. */
+  u32 spi_saved;    /**< Timing count queries answered without SPI. */
+  u32 residual_max; /**< Worst extrapolation error seen on re-latch [samples]. */
+} msg_nap_timebase_stats_t;
+
+/** NAP SPI bus statistics per client.
+ * Sent every heartbeat, clients are tracking, acquisition, CW and
+ * diagnostics in that order, see nap_xfer_client().
+ */
+#define SBP_MSG_NAP_SPI_STATS 0x7FFD
+#define NAP_SPI_N_CLIENTS 4
+typedef struct __attribute__((packed)) {
+  u32 period_ms;                      /**< Length of this window. */
+  u16 util[NAP_SPI_N_CLIENTS];        /**< Bus utilization [0.01 %]. */
+  u32 xfers[NAP_SPI_N_CLIENTS];       /**< Register transfers. */
+  u32 bytes[NAP_SPI_N_CLIENTS];       /**< Bytes on the bus incl. reg IDs. */
+  u32 wait_max_us[NAP_SPI_N_CLIENTS]; /**< Worst time spent queued. */
+} msg_nap_spi_stats_t;
+
+/** ISR to thread wake-up latency.
+ * Sent every heartbeat along with the NAP error register read at the same
+ * time, see sched_latency_send(). Sources are the NAP IRQ (exti1_isr() to
+ * the NAP ISR thread) and TIM5 (tim5_isr() to the solution thread) in that
+ * order. Histograms use log2 buckets of 16 DWT cycles, bucket i counts
+ * latencies in [2^i, 2^(i+1)) * 16 cycles with bucket 0 also holding
+ * shorter ones and the last bucket anything longer.
+ */
+#define SBP_MSG_ISR_LATENCY 0x7FF9
+#define SCHED_LATENCY_N_SOURCES 2
+typedef struct __attribute__((packed)) {
+  u32 period_ms;    /**< Length of this window. */
+  u32 nap_error;    /**< NAP error register at the end of the window. */
+  u32 wakeups[SCHED_LATENCY_N_SOURCES];    /**< Threads woken. */
+  u32 max_cycles[SCHED_LATENCY_N_SOURCES]; /**< Worst latency [cycles]. */
+  u16 hist[SCHED_LATENCY_N_SOURCES][SCHED_STATS_N_BUCKETS];
+                    /**< Latency histograms. */
+} msg_isr_latency_t;
+
+/** Request the contents of the trace buffer, empty payload.
+ * Answered with a \ref SBP_MSG_TRACE_THREAD for every thread followed by the
+ * buffer in \ref SBP_MSG_TRACE_DATA messages, see trace.c.
+ */
+#define SBP_MSG_TRACE_REQ 0x7FFC
+
+/** Name of the thread with a given trace ID. */
+#define SBP_MSG_TRACE_THREAD 0x7FFB
+typedef struct __attribute__((packed)) {
+  u8 id;          /**< Trace ID, as in TRACE_EVENT_THREAD events. */
+  char name[20];  /**< Thread name, NULL padded. */
+} msg_trace_thread_t;
+
+/** One traced event. */
+typedef struct __attribute__((packed)) {
+  u32 cycles;     /**< DWT cycle count when the event happened. */
+  u8 type;        /**< Event type, see trace_event_type_t. */
+  u8 reserved;
+  u16 arg;        /**< Event argument, see trace_event_type_t. */
+} msg_trace_event_t;
+
+/** A chunk of the trace buffer, oldest events first. */
+#define SBP_MSG_TRACE_DATA 0x7FFA
+#define TRACE_DATA_MAX_EVENTS 30
+typedef struct __attribute__((packed)) {
+  u16 seq;        /**< Index of this chunk. */
+  u16 n_seq;      /**< Number of chunks in this download. */
+  u32 lost;       /**< Events overwritten before this download. */
+  msg_trace_event_t events[TRACE_DATA_MAX_EVENTS];
+                  /**< Events, fewer in the last chunk. */
+} msg_trace_data_t;
+
+/** Request every setting at once, empty payload.
+ * Answered with as few \ref SBP_MSG_SETTINGS_READ_ALL_RESP as the settings
+ * fit in, see settings.c.
+ */
+#define SBP_MSG_SETTINGS_READ_ALL_REQ 0x7FF8
+
+/** Some of the settings, in index order. Each setting is a length byte then
+ * the setting as in SBP_MSG_SETTINGS_READ_BY_INDEX_RESP after its index. */
+#define SBP_MSG_SETTINGS_READ_ALL_RESP 0x7FF7
+typedef struct __attribute__((packed)) {
+  u16 index;      /**< Index of the first setting in this message. */
+  u16 total;      /**< Number of settings. */
+  u8 settings[0]; /**< Length prefixed settings, up to the end of the
+                       message. */
+} msg_settings_read_all_resp_t;
+
+/** Change several settings together. The payload is any number of
+ * NULL terminated section, name and value strings, as in
+ * SBP_MSG_SETTINGS_WRITE. Either every setting is changed or none are.
+ * Answered with \ref SBP_MSG_SETTINGS_WRITE_BATCH_RESP.
+ */
+#define SBP_MSG_SETTINGS_WRITE_BATCH 0x7FF6
+
+#define SBP_MSG_SETTINGS_WRITE_BATCH_RESP 0x7FF5
+#define SETTINGS_WRITE_BATCH_OK         0
+#define SETTINGS_WRITE_BATCH_MALFORMED  1
+#define SETTINGS_WRITE_BATCH_UNKNOWN    2
+#define SETTINGS_WRITE_BATCH_REJECTED   3
+#define SETTINGS_WRITE_BATCH_TOO_LARGE  4
+typedef struct __attribute__((packed)) {
+  u8 status;      /**< SETTINGS_WRITE_BATCH_* result. */
+  u8 index;       /**< Assignment in the batch that failed. */
+} msg_settings_write_batch_resp_t;
+
+/** Read consecutive chunks of a file with one request.
+ * Answered with up to n_chunks SBP_MSG_FILEIO_READ_RESP, the i-th with
+ * sequence number sequence + i holding chunk_size bytes from
+ * offset + i * chunk_size. A chunk shorter than chunk_size is the end of the
+ * file and the last one sent.
+ */
+#define SBP_MSG_FILEIO_READ_STREAM_REQ 0x7FF4
+typedef struct __attribute__((packed)) {
+  u32 sequence;   /**< Sequence number of the first chunk. */
+  u32 offset;     /**< Offset of the first chunk [bytes]. */
+  u8 chunk_size;  /**< Bytes in each chunk. */
+  u8 n_chunks;    /**< Chunks to send. */
+  char filename[0]; /**< Name of the file, up to the end of the message. */
+} msg_fileio_read_stream_req_t;
+
+/** First message of each segment of the observation log, see obs_log.c.
+ * Not sent over the link, only stored in the log files.
+ */
+#define SBP_MSG_OBS_LOG_SEGMENT 0x7FF3
+typedef struct __attribute__((packed)) {
+  u32 seq;        /**< Segments written since the log was created. */
+  u32 dropped;    /**< Messages dropped so far because flash writes fell
+                       behind. */
+} msg_obs_log_segment_t;
+
+/** \} */
+
+#endif  /* SWIFTNAV_SBP_EXT_H */
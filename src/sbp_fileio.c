@@ -14,30 +14,101 @@
 #include <string.h>
 #include <alloca.h>
 
+#include <ch.h>
+
 #include <libsbp/file_io.h>
 #include <libswiftnav/logging.h>
 
 #include "sbp.h"
+#include "sbp_ext.h"
 #include "sbp_fileio.h"
 #include "sbp_utils.h"
 #include "cfs/cfs.h"
 
+/** \defgroup sbp_fileio SBP File IO
+ * Access to the CFS filesystem over SBP.
+ *
+ * Files are kept open between requests in a small cache of CFS descriptors,
+ * so a transfer made of many chunks only looks the file up in the filesystem
+ * once. A descriptor is closed when it is the least recently used one and
+ * another file is accessed, when it hasn't been used for
+ * FILEIO_CACHE_TIMEOUT_MS, at the end of a file being read and when the file
+ * is removed. Consecutive reads and writes don't need a seek. Code elsewhere
+ * in the firmware removing a file, from any thread, must call
+ * sbp_fileio_flush() first, CFS invalidates the descriptors of a removed file
+ * and would hand them out again for other files.
+ *
+ * Streamed reads are sent by a low priority thread rather than from the SBP
+ * callback, so a long transfer doesn't hold up receiving other messages. A
+ * new stream request abandons the one being sent. The same thread closes the
+ * files which have been left open.
+ * \{ */
+
+/** Files kept open, out of the COFFEE_MAX_OPEN_FILES available. */
+#define FILEIO_CACHE_SIZE 3
+/** Longest file name cached, longer names are opened for each request. */
+#define FILEIO_NAME_LEN 32
+#define FILEIO_CACHE_TIMEOUT_MS 1000
+
+static struct {
+  char name[FILEIO_NAME_LEN];
+  int flags;
+  /** CFS descriptor, -1 if the entry is free. */
+  int fd;
+  /** Offset after the last read or write. */
+  u32 pos;
+  systime_t last_used;
+} fd_cache[FILEIO_CACHE_SIZE];
+
+/** Held while using fd_cache, which the SBP and fileio threads share and
+ * other threads flush. Initialized statically as sbp_fileio_flush() may be
+ * called before sbp_fileio_setup(). */
+static MUTEX_DECL(fd_cache_mutex);
+
+/** Streamed read for the fileio thread to send, see read_stream_cb(). */
+static struct {
+  char name[FILEIO_NAME_LEN];
+  u32 sequence;
+  u32 offset;
+  u8 chunk_size;
+  u8 n_chunks;
+  /** Set for a new request, which replaces any being sent. */
+  bool pending;
+} stream;
+
+static BinarySemaphore stream_sem;
+static WORKING_AREA_CCM(wa_fileio_thread, 1024);
+
 static void read_cb(u16 sender_id, u8 len, u8 msg[], void* context);
+static void read_stream_cb(u16 sender_id, u8 len, u8 msg[], void* context);
 static void read_dir_cb(u16 sender_id, u8 len, u8 msg[], void* context);
 static void remove_cb(u16 sender_id, u8 len, u8 msg[], void* context);
 static void write_cb(u16 sender_id, u8 len, u8 msg[], void* context);
+static msg_t fileio_thread(void *arg);
 
 /** Setup file IO
  * Registers relevant SBP callbacks for file IO operations.
  */
 void sbp_fileio_setup(void)
 {
+  for (u8 i = 0; i < FILEIO_CACHE_SIZE; i++)
+    fd_cache[i].fd = -1;
+  chBSemInit(&stream_sem, TRUE);
+  chThdCreateStatic(wa_fileio_thread, sizeof(wa_fileio_thread),
+                    LOWPRIO+10, fileio_thread, NULL);
+
   static sbp_msg_callbacks_node_t read_node;
   sbp_register_cbk(
     SBP_MSG_FILEIO_READ_REQ,
     &read_cb,
     &read_node
   );
+  static sbp_msg_callbacks_node_t read_stream_node;
+  sbp_register_cbk(
+    SBP_MSG_FILEIO_READ_STREAM_REQ,
+    &read_stream_cb,
+    &read_stream_node
+  );
   static sbp_msg_callbacks_node_t read_dir_node;
   sbp_register_cbk(
     SBP_MSG_FILEIO_READ_DIR_REQ,
@@ -58,6 +129,106 @@ void sbp_fileio_setup(void)
   );
 }
 
+static void fd_cache_close(u8 i)
+{
+  cfs_close(fd_cache[i].fd);
+  fd_cache[i].fd = -1;
+}
+
+/** Close the files which haven't been used for FILEIO_CACHE_TIMEOUT_MS. */
+static void fd_cache_expire(void)
+{
+  systime_t now = chTimeNow();
+  for (u8 i = 0; i < FILEIO_CACHE_SIZE; i++)
+    if ((fd_cache[i].fd != -1) &&
+        (now - fd_cache[i].last_used > MS2ST(FILEIO_CACHE_TIMEOUT_MS)))
+      fd_cache_close(i);
+}
+
+/** Close the descriptors held open on a file. */
+static void fd_cache_flush(const char *name)
+{
+  for (u8 i = 0; i < FILEIO_CACHE_SIZE; i++)
+    if ((fd_cache[i].fd != -1) && (strcmp(fd_cache[i].name, name) == 0))
+      fd_cache_close(i);
+}
+
+/** Close any descriptors held open on a file for SBP file transfers.
+ * Can be called from any thread.
+ * \param name File name
+ */
+void sbp_fileio_flush(const char *name)
+{
+  chMtxLock(&fd_cache_mutex);
+  fd_cache_flush(name);
+  chMtxUnlock();
+}
+
+/** Open a file through the descriptor cache.
+ * \param name File name
+ * \param flags CFS_READ or CFS_WRITE
+ * \return Index of the cache entry, or -1 if the file couldn't be opened
+ */
+static s8 fd_cache_open(const char *name, int flags)
+{
+  fd_cache_expire();
+
+  if (strlen(name) >= FILEIO_NAME_LEN)
+    return -1;
+
+  u8 lru = 0;
+  for (u8 i = 0; i < FILEIO_CACHE_SIZE; i++) {
+    if ((fd_cache[i].fd == -1) || (strcmp(fd_cache[i].name, name) != 0))
+      continue;
+    if (fd_cache[i].flags == flags) {
+      fd_cache[i].last_used = chTimeNow();
+      return i;
+    }
+    /* Don't read through one descriptor what was written through another. */
+    fd_cache_close(i);
+  }
+
+  /* Use a free entry, or else the least recently used. */
+  for (u8 i = 0; i < FILEIO_CACHE_SIZE; i++)
+    if ((fd_cache[lru].fd != -1) &&
+        ((fd_cache[i].fd == -1) ||
+         (fd_cache[i].last_used < fd_cache[lru].last_used)))
+      lru = i;
+
+  if (fd_cache[lru].fd != -1)
+    fd_cache_close(lru);
+
+  int fd = cfs_open(name, flags);
+  if (fd == -1)
+    return -1;
+
+  strcpy(fd_cache[lru].name, name);
+  fd_cache[lru].flags = flags;
+  fd_cache[lru].fd = fd;
+  fd_cache[lru].pos = 0;
+  fd_cache[lru].last_used = chTimeNow();
+  return lru;
+}
+
+/** Read from a cached file, closing it at the end of the file.
+ * \return Bytes read
+ */
+static u8 fd_cache_read(s8 i, u32 offset, u8 *buf, u8 len)
+{
+  if (i < 0)
+    return 0;
+
+  if (fd_cache[i].pos != offset)
+    cfs_seek(fd_cache[i].fd, offset, CFS_SEEK_SET);
+  int n = cfs_read(fd_cache[i].fd, buf, len);
+  n = MAX(n, 0);
+  fd_cache[i].pos = offset + n;
+
+  if (n < len)
+    fd_cache_close(i);
+  return n;
+}
+
 /** File read callback.
  * Responds to a SBP_MSG_FILEIO_READ_REQ message.
  *
@@ -87,15 +258,121 @@ static void read_cb(u16 sender_id, u8 len, u8 msg_[], void* context)
   u8 readlen = MIN(msg->chunk_size, SBP_FRAMING_MAX_PAYLOAD_SIZE - sizeof(*reply));
   reply = alloca(sizeof(msg_fileio_read_resp_t) + readlen);
   reply->sequence = msg->sequence;
-  int f = cfs_open(msg->filename, CFS_READ);
-  cfs_seek(f, msg->offset, CFS_SEEK_SET);
-  readlen = cfs_read(f, &reply->contents, readlen);
-  cfs_close(f);
+  chMtxLock(&fd_cache_mutex);
+  s8 i = fd_cache_open(msg->filename, CFS_READ);
+  readlen = fd_cache_read(i, msg->offset, (u8 *)&reply->contents, readlen);
+  chMtxUnlock();
 
   sbp_send_msg(SBP_MSG_FILEIO_READ_RESP,
                sizeof(*reply) + readlen, (u8*)reply);
 }
 
+/** Streamed file read callback.
+ * Responds to a SBP_MSG_FILEIO_READ_STREAM_REQ message.
+ *
+ * Reads up to n_chunks consecutive chunks, sending each in a
+ * SBP_MSG_FILEIO_READ_RESP as it is read so the transfer isn't held up by a
+ * request for every chunk. A short chunk marks the end of the file. The
+ * chunks are sent by the fileio thread, see stream_send().
+ */
+static void read_stream_cb(u16 sender_id, u8 len, u8 msg_[], void* context)
+{
+  (void)context;
+  msg_fileio_read_stream_req_t *msg = (msg_fileio_read_stream_req_t *)msg_;
+
+  if (sender_id != SBP_SENDER_ID) {
+    log_error("Invalid sender!");
+    return;
+  }
+
+  if ((len <= sizeof(*msg)) || (len == SBP_FRAMING_MAX_PAYLOAD_SIZE)) {
+    log_error("Invalid fileio read stream message!");
+    return;
+  }
+
+  /* Add a null termination to filename */
+  msg_[len] = 0;
+
+  if (strlen(msg->filename) >= FILEIO_NAME_LEN) {
+    /* Can't be opened through the cache, answer with an empty chunk. */
+    msg_fileio_read_resp_t reply = {.sequence = msg->sequence};
+    sbp_send_msg(SBP_MSG_FILEIO_READ_RESP, sizeof(reply), (u8 *)&reply);
+    return;
+  }
+
+  chMtxLock(&fd_cache_mutex);
+  strcpy(stream.name, msg->filename);
+  stream.sequence = msg->sequence;
+  stream.offset = msg->offset;
+  stream.chunk_size = MIN(msg->chunk_size, SBP_FRAMING_MAX_PAYLOAD_SIZE -
+                                           sizeof(msg_fileio_read_resp_t));
+  stream.n_chunks = msg->n_chunks;
+  stream.pending = true;
+  chMtxUnlock();
+  chBSemSignal(&stream_sem);
+}
+
+/** Send the chunks of the pending streamed read, if there is one.
+ * The file is looked up in the cache again for each chunk as the cache isn't
+ * held while sending, where the thread may wait for the USART.
+ */
+static void stream_send(void)
+{
+  static u8 buf[SBP_FRAMING_MAX_PAYLOAD_SIZE];
+  static char name[FILEIO_NAME_LEN];
+  msg_fileio_read_resp_t *reply = (msg_fileio_read_resp_t *)buf;
+
+  chMtxLock(&fd_cache_mutex);
+  if (!stream.pending) {
+    chMtxUnlock();
+    return;
+  }
+  strcpy(name, stream.name);
+  u32 sequence = stream.sequence;
+  u32 offset = stream.offset;
+  u8 chunk_size = stream.chunk_size;
+  u8 n_chunks = stream.n_chunks;
+  stream.pending = false;
+  chMtxUnlock();
+
+  for (u8 c = 0; c < n_chunks; c++) {
+    reply->sequence = sequence + c;
+    chMtxLock(&fd_cache_mutex);
+    if (stream.pending) {
+      chMtxUnlock();
+      break;
+    }
+    s8 i = fd_cache_open(name, CFS_READ);
+    u8 readlen = fd_cache_read(i, offset + c * chunk_size,
+                               (u8 *)&reply->contents, chunk_size);
+    chMtxUnlock();
+
+    sbp_send_msg_retry(SBP_MSG_FILEIO_READ_RESP, sizeof(*reply) + readlen,
+                       buf);
+    if (readlen < chunk_size)
+      break;
+  }
+}
+
+static msg_t fileio_thread(void *arg)
+{
+  (void)arg;
+  chRegSetThreadName("fileio");
+
+  while (TRUE) {
+    /* Wakes up at least every FILEIO_CACHE_TIMEOUT_MS to close the files
+     * left open when requests stop. */
+    chBSemWaitTimeout(&stream_sem, MS2ST(FILEIO_CACHE_TIMEOUT_MS));
+
+    chMtxLock(&fd_cache_mutex);
+    fd_cache_expire();
+    chMtxUnlock();
+
+    stream_send();
+  }
+  return 0;
+}
+
 /** Directory listing callback.
  * Responds to a SBP_MSG_FILEIO_READ_DIR_REQ message.
  *
@@ -169,7 +446,10 @@ static void remove_cb(u16 sender_id, u8 len, u8 msg[], void* context)
   /* Add a null termination to filename */
   msg[len] = 0;
 
+  chMtxLock(&fd_cache_mutex);
+  fd_cache_flush((char*)msg);
   cfs_remove((char*)msg);
+  chMtxUnlock();
 }
 
 /* Write to file callback.
@@ -197,11 +477,19 @@ static void write_cb(u16 sender_id, u8 len, u8 msg_[], void* context)
   }
 
   u8 headerlen = sizeof(*msg) + strlen(msg->filename) + 1;
-  int f = cfs_open(msg->filename, CFS_WRITE);
-  cfs_seek(f, msg->offset, CFS_SEEK_SET);
-  cfs_write(f, msg_ + headerlen, len - headerlen);
-  cfs_close(f);
+  chMtxLock(&fd_cache_mutex);
+  s8 i = fd_cache_open(msg->filename, CFS_WRITE);
+  if (i >= 0) {
+    /* Sequential writes carry on from where the last one left off. */
+    if (fd_cache[i].pos != msg->offset)
+      cfs_seek(fd_cache[i].fd, msg->offset, CFS_SEEK_SET);
+    int n = cfs_write(fd_cache[i].fd, msg_ + headerlen, len - headerlen);
+    fd_cache[i].pos = msg->offset + MAX(n, 0);
+  }
+  chMtxUnlock();
 
   msg_fileio_write_resp_t reply = {.sequence = msg->sequence};
   sbp_send_msg(SBP_MSG_FILEIO_WRITE_RESP, sizeof(reply), (u8*)&reply);
 }
+
+/** \} */
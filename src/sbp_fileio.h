@@ -14,6 +14,7 @@
 #define SWIFTNAV_SBP_FILEIO_H
 
 void sbp_fileio_setup(void);
+void sbp_fileio_flush(const char *name);
 
 #endif
 
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <string.h>
+
+#include <ch.h>
+
+#include "sbp.h"
+#include "solution.h"
+#include "sched_stats.h"
+
+/** \defgroup sched_stats Scheduler Statistics
+ * Keep track of how well the TIM5 driven solution thread meets its deadlines.
+ *
+ * TIM5 is reset to zero on every solution epoch so its count when the thread
+ * wakes up is exactly the wake-up jitter. The DWT cycle counter measures how
+ * long each iteration runs for and the remaining TIM5 count at the end of the
+ * iteration gives the slack to the next deadline. The statistics are kept in
+ * log2 histograms which are sent and cleared every \ref SCHED_STATS_WINDOW
+ * heartbeats.
+ *
+ * The latency from the NAP IRQ and TIM5 interrupts to the threads they wake
+ * actually running is measured separately with the DWT cycle counter, see
+ * sched_latency_isr(). Long NAP IRQ latencies are what causes tracking
+ * channels to miss their updates, so these histograms are sent every
+ * heartbeat along with the NAP error register.
+ * \{ */
+
+static struct {
+  sched_hist_t jitter;
+  sched_hist_t exec;
+  sched_hist_t slack;
+  u32 iterations;
+  u32 missed;
+} window;
+
+static u32 missed_total;
+
+static bool iteration_running;
+static u32 iteration_start_cycles;
+
+static struct {
+  sched_hist_t hist;
+  u32 wakeups;
+  u32 max_cycles;
+  /** Cycle count at the first interrupt not yet followed by a wake-up. */
+  u32 isr_cycles;
+  bool pending;
+} latency[SCHED_LATENCY_N_SOURCES];
+
+static systime_t latency_window_start;
+
+static void hist_reset(sched_hist_t *h)
+{
+  memset(h, 0, sizeof(*h));
+  h->min = UINT32_MAX;
+}
+
+static void hist_add(sched_hist_t *h, u32 x)
+{
+  u8 b = (x == 0) ? 0 : 31 - __builtin_clz(x);
+  if (b >= SCHED_STATS_N_BUCKETS)
+    b = SCHED_STATS_N_BUCKETS - 1;
+  h->buckets[b]++;
+  h->max = MAX(h->max, x);
+  h->min = MIN(h->min, x);
+}
+
+static void hist_pack(u16 out[], const sched_hist_t *h)
+{
+  for (u8 i = 0; i < SCHED_STATS_N_BUCKETS; i++)
+    out[i] = MIN(h->buckets[i], UINT16_MAX);
+}
+
+static void window_reset(void)
+{
+  hist_reset(&window.jitter);
+  hist_reset(&window.exec);
+  hist_reset(&window.slack);
+  window.iterations = 0;
+  window.missed = 0;
+}
+
+static void latency_reset(void)
+{
+  for (u8 i = 0; i < SCHED_LATENCY_N_SOURCES; i++) {
+    hist_reset(&latency[i].hist);
+    latency[i].wakeups = 0;
+    latency[i].max_cycles = 0;
+  }
+  latency_window_start = chTimeNow();
+}
+
+void sched_stats_setup(void)
+{
+  window_reset();
+  latency_reset();
+}
+
+/** Record the start of a solution iteration.
+ * Must be called as soon as the solution thread is woken up by TIM5.
+ *
+ * \param tim_cnt TIM5 counter value on wake-up.
+ */
+void sched_stats_iteration_start(u32 tim_cnt)
+{
+  u32 now = DWT_CYCCNT;
+
+  chSysLock();
+  hist_add(&window.jitter, tim_cnt / SCHED_TIM_TICKS_PER_US);
+  chSysUnlock();
+
+  iteration_start_cycles = now;
+  iteration_running = true;
+}
+
+/** Record the end of a solution iteration.
+ * Should be called just before the solution thread waits for the next TIM5
+ * epoch. Does nothing if no iteration has been started.
+ *
+ * \param tim_cnt TIM5 counter value at the end of the iteration.
+ * \param tim_arr TIM5 auto-reload value, i.e. the next deadline.
+ * \param overrun True if the next epoch has already been signalled.
+ */
+void sched_stats_iteration_end(u32 tim_cnt, u32 tim_arr, bool overrun)
+{
+  if (!iteration_running)
+    return;
+  iteration_running = false;
+
+  u32 exec_us = (DWT_CYCCNT - iteration_start_cycles) / SCHED_DWT_TICKS_PER_US;
+  u32 slack_us = 0;
+  if (!overrun && tim_arr > tim_cnt)
+    slack_us = (tim_arr - tim_cnt) / SCHED_TIM_TICKS_PER_US;
+
+  chSysLock();
+  hist_add(&window.exec, exec_us);
+  hist_add(&window.slack, slack_us);
+  window.iterations++;
+  if (overrun) {
+    window.missed++;
+    missed_total++;
+  }
+  chSysUnlock();
+}
+
+/** Number of solution deadlines missed since boot. */
+u32 sched_stats_missed_deadlines(void)
+{
+  return missed_total;
+}
+
+/** Send the statistics for the current window and start a new one. */
+void sched_stats_send(void)
+{
+  msg_soln_sched_stats_t msg;
+
+  chSysLock();
+  msg.iterations = window.iterations;
+  msg.missed = window.missed;
+  msg.missed_total = missed_total;
+  msg.jitter_max_us = window.jitter.max;
+  msg.exec_max_us = window.exec.max;
+  msg.slack_min_us = (window.iterations > 0) ? window.slack.min : 0;
+  hist_pack(msg.jitter, &window.jitter);
+  hist_pack(msg.exec, &window.exec);
+  hist_pack(msg.slack, &window.slack);
+  window_reset();
+  chSysUnlock();
+
+  msg.period_us = 1e6 / soln_freq;
+
+  sbp_send_msg(SBP_MSG_SOLN_SCHED_STATS, sizeof(msg), (u8 *)&msg);
+}
+
+/** Record an interrupt which wakes up a thread.
+ * Must be called from the ISR with the kernel locked. If the interrupt fires
+ * again before the thread runs the latency is measured from the first.
+ *
+ * \param src Interrupt source.
+ */
+void sched_latency_isr(sched_latency_source_t src)
+{
+  if (!latency[src].pending) {
+    latency[src].isr_cycles = DWT_CYCCNT;
+    latency[src].pending = true;
+  }
+}
+
+/** Record a thread waking up after an interrupt.
+ * Should be called as soon as the thread returns from waiting on the
+ * interrupt. Does nothing if the interrupt hasn't been recorded.
+ *
+ * \param src Interrupt source which woke the thread.
+ */
+void sched_latency_wake(sched_latency_source_t src)
+{
+  u32 now = DWT_CYCCNT;
+
+  chSysLock();
+  if (latency[src].pending) {
+    u32 cycles = now - latency[src].isr_cycles;
+    hist_add(&latency[src].hist, cycles >> SCHED_LATENCY_SHIFT);
+    latency[src].max_cycles = MAX(latency[src].max_cycles, cycles);
+    latency[src].wakeups++;
+    latency[src].pending = false;
+  }
+  chSysUnlock();
+}
+
+/** Discard a recorded interrupt which the thread is servicing without
+ * having waited for it, so the next wake-up doesn't count the service time
+ * as latency.
+ *
+ * \param src Interrupt source.
+ */
+void sched_latency_discard(sched_latency_source_t src)
+{
+  chSysLock();
+  latency[src].pending = false;
+  chSysUnlock();
+}
+
+/** Worst latency in the current window.
+ *
+ * \param src Interrupt source.
+ * \return Latency in us.
+ */
+u32 sched_latency_max_us(sched_latency_source_t src)
+{
+  return latency[src].max_cycles / SCHED_DWT_TICKS_PER_US;
+}
+
+/** Send the latency histograms for the current window and start a new one.
+ *
+ * \param nap_error NAP error register read at the end of the window, see
+ *                  nap_error_rd_blocking().
+ */
+void sched_latency_send(u32 nap_error)
+{
+  msg_isr_latency_t msg;
+
+  chSysLock();
+  systime_t now = chTimeNow();
+  msg.period_ms = (now - latency_window_start) * 1000 / CH_FREQUENCY;
+  for (u8 i = 0; i < SCHED_LATENCY_N_SOURCES; i++) {
+    msg.wakeups[i] = latency[i].wakeups;
+    msg.max_cycles[i] = latency[i].max_cycles;
+    hist_pack(msg.hist[i], &latency[i].hist);
+  }
+  latency_reset();
+  chSysUnlock();
+
+  msg.nap_error = nap_error;
+
+  sbp_send_msg(SBP_MSG_ISR_LATENCY, sizeof(msg), (u8 *)&msg);
+}
+
+/** \} */
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_SCHED_STATS_H
+#define SWIFTNAV_SCHED_STATS_H
+
+#include <libswiftnav/common.h>
+
+#include "sbp_ext.h"
+
+/** \addtogroup sched_stats
+ * \{ */
+
+/** TIM5 counts at the APB1 timer clock, i.e. 2 * 32.736 MHz. */
+#define SCHED_TIM_TICKS_PER_US 65.472
+/** DWT cycle counter runs at the core clock. */
+#define SCHED_DWT_TICKS_PER_US 130.944
+
+/** Number of heartbeat periods covered by each statistics message. */
+#define SCHED_STATS_WINDOW 10
+
+/** ISR to thread latencies are bucketed in units of 2^SCHED_LATENCY_SHIFT
+ * DWT cycles. */
+#define SCHED_LATENCY_SHIFT 4
+
+/** Interrupts whose thread wake-up latency is measured. */
+typedef enum {
+  SCHED_LATENCY_NAP_EXTI,
+  SCHED_LATENCY_TIM5,
+} sched_latency_source_t;
+
+/** Rolling log2 histogram. */
+typedef struct {
+  u32 buckets[SCHED_STATS_N_BUCKETS];
+  u32 max;
+  u32 min;
+} sched_hist_t;
+
+/** \} */
+
+void sched_stats_setup(void);
+void sched_stats_iteration_start(u32 tim_cnt);
+void sched_stats_iteration_end(u32 tim_cnt, u32 tim_arr, bool overrun);
+u32 sched_stats_missed_deadlines(void);
+void sched_stats_send(void);
+void sched_latency_isr(sched_latency_source_t src);
+void sched_latency_wake(sched_latency_source_t src);
+void sched_latency_discard(sched_latency_source_t src);
+u32 sched_latency_max_us(sched_latency_source_t src);
+void sched_latency_send(u32 nap_error);
+
+#endif  /* SWIFTNAV_SCHED_STATS_H */
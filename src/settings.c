@@ -10,20 +10,45 @@
  * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#include <stdio.h>
 #include <string.h>
 
+#include <ch.h>
+
 #include <libsbp/settings.h>
 #include <libswiftnav/logging.h>
 
 #include "peripherals/usart.h"
-#include "minIni/minIni.h"
 #include "sbp.h"
+#include "sbp_ext.h"
 #include "settings.h"
-
-#define SETTINGS_FILE "config"
-
-
-static struct setting *settings_head;
+#include "settings_file.h"
+
+/** Most settings that can be registered. The firmware registers about 70,
+ * builds registering more (e.g. tests/settings_bench) can raise it. */
+#ifndef SETTINGS_MAX
+#define SETTINGS_MAX 128
+#endif
+/** Buckets in the settings hash table, a power of two. */
+#define SETTINGS_HASH_BUCKETS 128
+
+/** Most assignments in a SBP_MSG_SETTINGS_WRITE_BATCH. */
+#define SETTINGS_BATCH_MAX 32
+/** Bytes for the previous values of a batch's settings, kept to put them back
+ * if one of the assignments is rejected. */
+#define SETTINGS_BATCH_UNDO_SIZE 512
+/** Largest setting whose value can be checked before a batch is applied. */
+#define SETTINGS_BATCH_CHECK_SIZE 128
+
+/** Registered settings. Lookups by section and name go through a hash table
+ * with the buckets chained through struct setting, the settings are also kept
+ * in index order for SBP_MSG_SETTINGS_READ_BY_INDEX_REQ. */
+static struct {
+  /** Settings grouped by section, in the order they were registered. */
+  struct setting *by_index[SETTINGS_MAX];
+  u16 n;
+  struct setting *buckets[SETTINGS_HASH_BUCKETS];
+} registry;
 
 static const char const * bool_enum[] = {"False", "True", NULL};
 static struct setting_type bool_settings_type;
@@ -113,7 +138,7 @@ static int enum_to_string(const void *priv, char *str, int slen, const void *blo
 {
   const char * const *enumnames = priv;
   if (blen != sizeof(u8))
-    asm("bkpt");
+    breakpoint();
   int index = *(u8*)blob;
   strncpy(str, enumnames[index], slen);
   return strlen(str);
@@ -125,7 +150,7 @@ static bool enum_from_string(const void *priv, void *blob, int blen, const char
   int i;
 
   if (blen != sizeof(u8))
-    asm("bkpt");
+    breakpoint();
 
   for (i = 0; enumnames[i] && (strcmp(str, enumnames[i]) != 0); i++)
     ;
@@ -164,6 +189,8 @@ static void settings_save_callback(u16 sender_id, u8 len, u8 msg[], void* contex
 static void settings_write_callback(u16 sender_id, u8 len, u8 msg[], void* context);
 static void settings_read_callback(u16 sender_id, u8 len, u8 msg[], void* context);
 static void settings_read_by_index_callback(u16 sender_id, u8 len, u8 msg[], void* context);
+static void settings_read_all_callback(u16 sender_id, u8 len, u8 msg[], void* context);
+static void settings_write_batch_callback(u16 sender_id, u8 len, u8 msg[], void* context);
 
 int settings_type_register_enum(const char * const enumnames[], struct setting_type *type)
 {
@@ -182,6 +209,8 @@ int settings_type_register_enum(const char * const enumnames[], struct setting_t
 
 void settings_setup(void)
 {
+  settings_file_load();
+
   TYPE_BOOL = settings_type_register_enum(bool_enum, &bool_settings_type);
 
   static sbp_msg_callbacks_node_t settings_save_node;
@@ -208,11 +237,35 @@ void settings_setup(void)
     &settings_read_by_index_callback,
     &settings_read_by_index_node
   );
+  static sbp_msg_callbacks_node_t settings_read_all_node;
+  sbp_register_cbk(
+    SBP_MSG_SETTINGS_READ_ALL_REQ,
+    &settings_read_all_callback,
+    &settings_read_all_node
+  );
+  static sbp_msg_callbacks_node_t settings_write_batch_node;
+  sbp_register_cbk(
+    SBP_MSG_SETTINGS_WRITE_BATCH,
+    &settings_write_batch_callback,
+    &settings_write_batch_node
+  );
+}
+
+/** FNV-1a hash of a setting's section and name. */
+static u32 settings_hash(const char *section, const char *name)
+{
+  u32 h = 2166136261u;
+  for (const char *c = section; *c; c++)
+    h = (h ^ (u8)*c) * 16777619u;
+  /* Separator so "ab"/"c" and "a"/"bc" differ. */
+  h *= 16777619u;
+  for (const char *c = name; *c; c++)
+    h = (h ^ (u8)*c) * 16777619u;
+  return h & (SETTINGS_HASH_BUCKETS - 1);
 }
 
 void settings_register(struct setting *setting, enum setting_types type)
 {
-  struct setting *s;
   const struct setting_type *t = &type_int;
 
   for (int i = 0; t && (i < type); i++, t = t->next)
@@ -220,32 +273,43 @@ void settings_register(struct setting *setting, enum setting_types type)
   /* FIXME Abort if type is NULL */
   setting->type = t;
 
-  if (!settings_head) {
-    settings_head = setting;
-  } else {
-    for (s = settings_head; s->next; s = s->next) {
-      if ((strcmp(s->section, setting->section) == 0) &&
-          (strcmp(s->next->section, setting->section) != 0))
-        break;
+  if (registry.n == SETTINGS_MAX) {
+    log_error("Too many settings, %s.%s not registered",
+              setting->section, setting->name);
+    return;
+  }
+
+  /* Insert after the last setting in the same section, or at the end. */
+  u16 i = registry.n;
+  for (u16 j = registry.n; j > 0; j--) {
+    if (strcmp(registry.by_index[j-1]->section, setting->section) == 0) {
+      i = j;
+      break;
     }
-    setting->next = s->next;
-    s->next = setting;
   }
+  memmove(&registry.by_index[i + 1], &registry.by_index[i],
+          (registry.n - i) * sizeof(registry.by_index[0]));
+  registry.by_index[i] = setting;
+  registry.n++;
+
+  u32 h = settings_hash(setting->section, setting->name);
+  setting->next = registry.buckets[h];
+  registry.buckets[h] = setting;
+
   char buf[128];
-  ini_gets(setting->section, setting->name, "", buf, sizeof(buf), SETTINGS_FILE);
-  if (buf[0] == 0) {
+  if (!settings_file_get(setting->section, setting->name, buf, sizeof(buf))) {
     setting->type->to_string(setting->type->priv, buf, sizeof(buf),
                              setting->addr, setting->len);
     setting->notify(setting, buf);
   } else {
-    *strchr(buf, '\n') = '\0';
     setting->dirty = setting->notify(setting, buf);
   }
 }
 
 static struct setting *settings_lookup(const char *section, const char *setting)
 {
-  for (struct setting *s = settings_head; s; s = s->next)
+  for (struct setting *s = registry.buckets[settings_hash(section, setting)];
+       s; s = s->next)
     if ((strcmp(s->section, section)  == 0) &&
         (strcmp(s->name, setting) == 0))
       return s;
@@ -414,7 +478,6 @@ static void settings_read_by_index_callback(u16 sender_id, u8 len, u8 msg[], voi
     return;
   }
 
-  struct setting *s = settings_head;
   char buf[256];
   u8 buflen = 0;
 
@@ -424,13 +487,11 @@ static void settings_read_by_index_callback(u16 sender_id, u8 len, u8 msg[], voi
   }
   u16 index = (msg[1] << 8) | msg[0];
 
-  for (int i = 0; (i < index) && s; i++, s = s->next)
-    ;
-
-  if (s == NULL) {
+  if (index >= registry.n) {
     sbp_send_msg(SBP_MSG_SETTINGS_READ_BY_INDEX_DONE, 0, NULL);
     return;
   }
+  struct setting *s = registry.by_index[index];
 
   /* build and send reply */
   buf[buflen++] = msg[0];
@@ -439,44 +500,169 @@ static void settings_read_by_index_callback(u16 sender_id, u8 len, u8 msg[], voi
   sbp_send_msg(SBP_MSG_SETTINGS_READ_BY_INDEX_RESP, buflen, (void*)buf);
 }
 
-static void settings_save_callback(u16 sender_id, u8 len, u8 msg[], void* context)
+static void settings_read_all_callback(u16 sender_id, u8 len, u8 msg[], void* context)
 {
-  int f = cfs_open(SETTINGS_FILE, CFS_WRITE);
-  const char *sec = NULL;
-  char buf[128];
-  int i;
+  (void)len; (void)msg; (void)context;
 
-  (void)sender_id; (void) context; (void)len; (void)msg;
+  if (sender_id != SBP_SENDER_ID) {
+    log_error("Invalid sender");
+    return;
+  }
 
-  if (f == -1) {
-    log_error("Error opening config file!");
+  u8 buf[SBP_FRAMING_MAX_PAYLOAD_SIZE];
+  msg_settings_read_all_resp_t *resp = (msg_settings_read_all_resp_t *)buf;
+  u8 buflen = sizeof(*resp);
+  resp->index = 0;
+  resp->total = registry.n;
+
+  /* Largest setting that fits in a message on its own. */
+  char setting[sizeof(buf) - sizeof(*resp) - 1];
+
+  for (u16 i = 0; i < registry.n; i++) {
+    int slen = settings_format_setting(registry.by_index[i],
+                                       setting, sizeof(setting));
+    slen = MIN(slen, (int)sizeof(setting));
+
+    if (buflen + 1 + slen > (int)sizeof(buf)) {
+      sbp_send_msg_retry(SBP_MSG_SETTINGS_READ_ALL_RESP, buflen, buf);
+      resp->index = i;
+      buflen = sizeof(*resp);
+    }
+    buf[buflen++] = slen;
+    memcpy(&buf[buflen], setting, slen);
+    buflen += slen;
+  }
+  sbp_send_msg_retry(SBP_MSG_SETTINGS_READ_ALL_RESP, buflen, buf);
+}
+
+static void settings_write_batch_reply(u8 status, u8 index)
+{
+  msg_settings_write_batch_resp_t resp = {status, index};
+  sbp_send_msg(SBP_MSG_SETTINGS_WRITE_BATCH_RESP, sizeof(resp), (u8 *)&resp);
+}
+
+/** Apply a batch of assignments, all or none of them.
+ * Every value is parsed into a scratch copy of its setting before any is
+ * assigned, so a malformed value rejects the batch with nothing changed. Each
+ * setting's notify function is then called once. A notify function can still
+ * reject a value its type accepts, the assignments already made are then put
+ * back by notifying their previous values.
+ */
+static void settings_write_batch_callback(u16 sender_id, u8 len, u8 msg[], void* context)
+{
+  (void)context;
+
+  if (sender_id != SBP_SENDER_ID) {
+    log_error("Invalid sender");
     return;
   }
 
-  for (struct setting *s = settings_head; s; s = s->next) {
-    /* Skip unchanged parameters */
-    if (!s->dirty)
-      continue;
+  static struct {
+    struct setting *s;
+    const char *value;
+    const char *prev;
+  } batch[SETTINGS_BATCH_MAX];
+  static char undo[SETTINGS_BATCH_UNDO_SIZE];
+  static u64 check[SETTINGS_BATCH_CHECK_SIZE / sizeof(u64)];
+  u8 n = 0;
+
+  if ((len == 0) || (msg[len-1] != '\0')) {
+    settings_write_batch_reply(SETTINGS_WRITE_BATCH_MALFORMED, 0);
+    return;
+  }
 
-    if ((sec == NULL) || (strcmp(s->section, sec) != 0)) {
-      /* New section, write section header */
-      sec = s->section;
-      i = snprintf(buf, sizeof(buf), "[%s]\n", sec);
-      if (cfs_write(f, buf, i) != i) {
-        log_error("Error writing to config file!");
-      }
+  /* Find every setting before changing any of them. */
+  const char *p = (const char *)msg, *end = (const char *)&msg[len];
+  while (p < end) {
+    const char *section = p;
+    const char *setting = section + strlen(section) + 1;
+    const char *value = (setting < end) ? setting + strlen(setting) + 1 : end;
+    if ((value >= end) || (n == SETTINGS_BATCH_MAX)) {
+      settings_write_batch_reply(SETTINGS_WRITE_BATCH_MALFORMED, n);
+      return;
+    }
+    batch[n].s = settings_lookup(section, setting);
+    if (batch[n].s == NULL) {
+      settings_write_batch_reply(SETTINGS_WRITE_BATCH_UNKNOWN, n);
+      return;
+    }
+    batch[n].value = value;
+    p = value + strlen(value) + 1;
+    n++;
+  }
+
+  for (u8 i = 0; i < n; i++) {
+    struct setting *s = batch[i].s;
+    if (s->len > (int)sizeof(check)) {
+      settings_write_batch_reply(SETTINGS_WRITE_BATCH_TOO_LARGE, i);
+      return;
+    }
+    if (!s->type->from_string(s->type->priv, check, s->len, batch[i].value)) {
+      settings_write_batch_reply(SETTINGS_WRITE_BATCH_REJECTED, i);
+      return;
+    }
+  }
+
+  /* Keep the current values to restore if an assignment is rejected. */
+  u16 undo_len = 0;
+  for (u8 i = 0; i < n; i++) {
+    struct setting *s = batch[i].s;
+    int l = s->type->to_string(s->type->priv, &undo[undo_len],
+                               sizeof(undo) - undo_len, s->addr, s->len);
+    if ((l < 0) || (undo_len + l + 1 > (int)sizeof(undo))) {
+      settings_write_batch_reply(SETTINGS_WRITE_BATCH_TOO_LARGE, i);
+      return;
     }
+    undo[undo_len + l] = '\0';
+    batch[i].prev = &undo[undo_len];
+    undo_len += l + 1;
+  }
 
-    /* Write setting */
-    i = snprintf(buf, sizeof(buf), "%s=", s->name);
-    i += s->type->to_string(s->type->priv, &buf[i], sizeof(buf) - i - 1, s->addr, s->len);
-    buf[i++] = '\n';
-    if (cfs_write(f, buf, i) != i) {
-      log_error("Error writing to config file!");
+  for (u8 i = 0; i < n; i++) {
+    if (!batch[i].s->notify(batch[i].s, batch[i].value)) {
+      /* Put back the ones already changed, newest first. */
+      for (u8 j = i; j > 0; j--)
+        batch[j-1].s->notify(batch[j-1].s, batch[j-1].prev);
+      settings_write_batch_reply(SETTINGS_WRITE_BATCH_REJECTED, i);
+      return;
     }
   }
 
-  cfs_close(f);
-  log_info("Wrote settings to config file.");
+  for (u8 i = 0; i < n; i++)
+    batch[i].s->dirty = true;
+  settings_write_batch_reply(SETTINGS_WRITE_BATCH_OK, n);
 }
 
+static void settings_save_callback(u16 sender_id, u8 len, u8 msg[], void* context)
+{
+  char buf[128];
+  u16 n_saved = 0;
+  bool ok = true;
+
+  (void)sender_id; (void) context; (void)len; (void)msg;
+
+  for (u16 j = 0; j < registry.n; j++) {
+    struct setting *s = registry.by_index[j];
+    /* Skip unchanged parameters */
+    if (!s->dirty)
+      continue;
+
+    int i = s->type->to_string(s->type->priv, buf, sizeof(buf) - 1,
+                               s->addr, s->len);
+    buf[MIN(MAX(i, 0), (int)sizeof(buf) - 1)] = '\0';
+    s8 ret = settings_file_update(s->section, s->name, buf);
+    if (ret < 0)
+      ok = false;
+    else
+      n_saved += ret;
+  }
+
+  if (!settings_file_sync())
+    ok = false;
+
+  if (!ok) {
+    log_error("Error writing to config file!");
+    return;
+  }
+  log_info("Wrote %u changed settings to config file.", n_saved);
+}
@@ -37,6 +37,7 @@ struct setting {
   void *addr;
   int len;
   bool (*notify)(struct setting *setting, const char *val);
+  /** Next setting in the same hash bucket. */
   struct setting *next;
   const struct setting_type *type;
   bool dirty;
@@ -0,0 +1,636 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <libswiftnav/logging.h>
+
+#include "cfs/cfs.h"
+#include "cfs/cfs-coffee-arch.h"
+#include "sbp_fileio.h"
+#include "settings_file.h"
+
+/** \defgroup settings_file Settings File
+ * Saved settings in the CFS filesystem.
+ *
+ * The saved values are kept in two files, a snapshot in INI format and a log
+ * of the changes saved since the snapshot was written. Saving appends just the
+ * settings that changed to the log. Once the log grows past CONFIG_LOG_MAX it
+ * is compacted into a new snapshot.
+ *
+ * The snapshot alternates between two files. A snapshot starts with a
+ * `; gen N` line and is only used if it is complete, ending with a matching
+ * `; end N` line. At boot the newest complete snapshot is loaded, so losing
+ * power while one is being written leaves the previous one in use. The log
+ * starts with the generation of the snapshot it follows and is ignored if
+ * that isn't the snapshot loaded. A change cut off by losing power while it
+ * was being appended is an unterminated last line and is ignored too, the
+ * next save then compacts the log rather than appending after it.
+ *
+ * Settings saved by older firmware in the single "config" file are loaded if
+ * there is no snapshot yet, and moved into one on the next save.
+ *
+ * Everything saved is read into RAM at boot in a single pass through the
+ * files, see settings_file_load(), and kept up to date as settings are
+ * saved. Looking up a setting doesn't read the filesystem.
+ * \{ */
+
+#define CONFIG_FILE_LEGACY "config"
+#define CONFIG_FILE_LOG "cfglog"
+#define CONFIG_FILE_SNAPSHOT_0 "cfg0"
+#define CONFIG_FILE_SNAPSHOT_1 "cfg1"
+
+/* Coffee silently truncates longer names, which would make the files
+ * collide. */
+_Static_assert(sizeof(CONFIG_FILE_LOG) <= COFFEE_NAME_LENGTH,
+               "Config log file name too long");
+_Static_assert(sizeof(CONFIG_FILE_SNAPSHOT_0) <= COFFEE_NAME_LENGTH,
+               "Config snapshot file name too long");
+_Static_assert(sizeof(CONFIG_FILE_SNAPSHOT_1) <= COFFEE_NAME_LENGTH,
+               "Config snapshot file name too long");
+
+/** Bytes of RAM holding the saved settings, see settings_file_load(). Values
+ * beyond this fall back to searching the files. */
+#define CONFIG_INDEX_SIZE 2048
+/** Longest line of a config file that is parsed. */
+#define CONFIG_LINE_LEN 128
+/** Size of the log [bytes] above which it is compacted into a new
+ * snapshot. */
+#define CONFIG_LOG_MAX 1024
+
+static const char * const snapshot_files[2] = {
+  CONFIG_FILE_SNAPSHOT_0, CONFIG_FILE_SNAPSHOT_1
+};
+
+/** Marks the start of a section's name in the index. */
+#define CONFIG_INDEX_SECTION '\x01'
+
+/** Saved values, as consecutive NULL terminated strings. Each section is
+ * stored once, as its name after CONFIG_INDEX_SECTION, followed by the name
+ * and value of each of its settings. Each setting appears at most once. */
+static struct {
+  char buf[CONFIG_INDEX_SIZE];
+  u16 len;
+  /** Some values didn't fit and are only in the files. */
+  bool overflow;
+} config_index;
+
+static struct {
+  /** Generation of the snapshot in use, zero if there isn't one. */
+  u32 gen;
+  /** File the values were loaded from. */
+  const char *file;
+  /** The log exists and follows the snapshot in use. */
+  bool log_valid;
+  /** The log ends in a change cut off part way, nothing may be appended
+   * until it is compacted. */
+  bool log_partial;
+  /** Size of the log [bytes]. */
+  u32 log_len;
+  /** Saved values which are only in RAM so far. */
+  bool unsynced;
+} store;
+
+/** State while parsing a config file. */
+typedef struct {
+  char section[CONFIG_LINE_LEN];
+  /** Only add the values if the file starts with `; gen want_gen`. */
+  bool check_gen;
+  u32 want_gen;
+  bool has_gen;
+  u32 gen;
+  /** Seen `; end gen`. */
+  bool end;
+  /** The file ends in a line with no newline. */
+  bool partial;
+  /** If set, look for this setting's value instead of adding the values to
+   * the index. The last one in the file is copied into found. */
+  const char *find_section;
+  const char *find_name;
+  char *found;
+  int found_len;
+  bool has_found;
+} config_parse_t;
+
+/** Remove leading and trailing whitespace and control characters in place,
+ * as minIni does. */
+static char *strip(char *str)
+{
+  while ((*str != '\0') && (*str <= ' '))
+    str++;
+  char *end = str + strlen(str);
+  while ((end > str) && (end[-1] <= ' '))
+    end--;
+  *end = '\0';
+  return str;
+}
+
+/** Clean up a value as minIni's ini_gets() does, dropping a trailing comment
+ * and the quotes around a quoted value. */
+static char *clean_value(char *value)
+{
+  bool quoted = false;
+  char *p;
+  for (p = value; (*p != '\0') && (((*p != ';') && (*p != '#')) || quoted);
+       p++) {
+    if (*p == '"') {
+      if (p[1] == '"')
+        p++;
+      else
+        quoted = !quoted;
+    } else if ((*p == '\\') && (p[1] == '"')) {
+      p++;
+    }
+  }
+  *p = '\0';
+  value = strip(value);
+
+  char *end = value + strlen(value);
+  if ((*value != '"') || (end[-1] != '"'))
+    return value;
+
+  *--end = '\0';
+  value++;
+  char *d = value;
+  for (p = value; *p != '\0'; p++, d++) {
+    if (((*p == '"') || (*p == '\\')) && (p[1] == '"'))
+      p++;
+    *d = *p;
+  }
+  *d = '\0';
+  return value;
+}
+
+/** Format a setting's line, quoting the value as minIni's ini_puts() does
+ * if it wouldn't read back as it is.
+ * \return False if the line doesn't fit in len
+ */
+static bool format_setting(char *buf, u16 len, const char *name,
+                           const char *value)
+{
+  u16 l_value = strlen(value);
+  bool quote = (value[strcspn(value, "\";#")] != '\0') ||
+               ((l_value > 0) && (value[l_value - 1] == ' '));
+  int n = snprintf(buf, len, quote ? "%s=\"" : "%s=", name);
+  if ((n < 0) || (n >= len))
+    return false;
+  for (const char *p = value; *p != '\0'; p++) {
+    if (quote && (*p == '"'))
+      buf[n++] = '\\';
+    if (n >= len - 3)
+      return false;
+    buf[n++] = *p;
+  }
+  if (quote)
+    buf[n++] = '"';
+  buf[n++] = '\n';
+  buf[n] = '\0';
+  return true;
+}
+
+/** Entry after the one at p. */
+static char *config_index_next(char *p)
+{
+  return p + strlen(p) + 1;
+}
+
+/** End of the block of settings of the section whose name is at p. */
+static char *config_index_section_end(char *p)
+{
+  char *end = &config_index.buf[config_index.len];
+  p = config_index_next(p);
+  while ((p < end) && (*p != CONFIG_INDEX_SECTION))
+    p = config_index_next(config_index_next(p));
+  return p;
+}
+
+/** Find a section's name in the index. Names are compared ignoring case, as
+ * minIni does. */
+static char *config_index_section(const char *section)
+{
+  char *end = &config_index.buf[config_index.len];
+  for (char *p = config_index.buf; p < end;
+       p = config_index_section_end(p))
+    if (strcasecmp(p + 1, section) == 0)
+      return p;
+  return NULL;
+}
+
+/** Find a setting's name in the index. */
+static char *config_index_find(const char *section, const char *name)
+{
+  char *p = config_index_section(section);
+  if (p == NULL)
+    return NULL;
+
+  char *end = config_index_section_end(p);
+  for (p = config_index_next(p); p < end;
+       p = config_index_next(config_index_next(p)))
+    if (strcasecmp(p, name) == 0)
+      return p;
+  return NULL;
+}
+
+static void config_index_reset(void)
+{
+  config_index.len = 0;
+  config_index.overflow = false;
+}
+
+/** Set a setting's saved value in the index, replacing any previous one. */
+static bool config_index_set(const char *section, const char *name,
+                             const char *value)
+{
+  char *end = &config_index.buf[config_index.len];
+  char *p = config_index_find(section, name);
+  if (p) {
+    char *next = config_index_next(config_index_next(p));
+    memmove(p, next, end - next);
+    config_index.len -= next - p;
+  }
+
+  u16 l_section = 0;
+  u16 l_name = strlen(name) + 1;
+  u16 l_value = strlen(value) + 1;
+  char *s = config_index_section(section);
+  if (s) {
+    p = config_index_section_end(s);
+  } else {
+    p = &config_index.buf[config_index.len];
+    l_section = strlen(section) + 2;
+  }
+  if ((u32)(config_index.len + l_section + l_name + l_value) >
+      sizeof(config_index.buf)) {
+    config_index.overflow = true;
+    return false;
+  }
+
+  end = &config_index.buf[config_index.len];
+  memmove(p + l_section + l_name + l_value, p, end - p);
+  if (l_section) {
+    p[0] = CONFIG_INDEX_SECTION;
+    memcpy(p + 1, section, l_section - 1);
+  }
+  memcpy(p + l_section, name, l_name);
+  memcpy(p + l_section + l_name, value, l_value);
+  config_index.len += l_section + l_name + l_value;
+  return true;
+}
+
+/** Parse one line of a config file into the index. */
+static void config_parse_line(char *line, config_parse_t *state)
+{
+  char *p = strip(line);
+  unsigned long gen;
+
+  if ((*p == ';') || (*p == '#')) {
+    if (sscanf(p, "; gen %lu", &gen) == 1) {
+      state->has_gen = true;
+      state->gen = gen;
+    } else if (state->has_gen && (sscanf(p, "; end %lu", &gen) == 1) &&
+               (gen == state->gen)) {
+      state->end = true;
+    }
+    return;
+  }
+  if (*p == '\0')
+    return;
+
+  char *end = strchr(p, ']');
+  if ((*p == '[') && end) {
+    *end = '\0';
+    strncpy(state->section, strip(p + 1), sizeof(state->section) - 1);
+    state->section[sizeof(state->section) - 1] = '\0';
+    return;
+  }
+
+  char *eq = strchr(p, '=');
+  if (eq == NULL)
+    eq = strchr(p, ':');
+  if (eq == NULL)
+    return;
+  *eq = '\0';
+
+  if (state->check_gen &&
+      !(state->has_gen && (state->gen == state->want_gen)))
+    return;
+
+  if (state->find_name == NULL) {
+    config_index_set(state->section, strip(p), clean_value(eq + 1));
+    return;
+  }
+
+  if ((strcasecmp(state->section, state->find_section) == 0) &&
+      (strcasecmp(strip(p), state->find_name) == 0)) {
+    strncpy(state->found, clean_value(eq + 1), state->found_len - 1);
+    state->found[state->found_len - 1] = '\0';
+    state->has_found = true;
+  }
+}
+
+/** Read a whole config file into the index in a single pass.
+ *
+ * \param name File name
+ * \param state Parser state
+ * \param partial Also parse a last line with no newline
+ * \return Size of the file [bytes], or -1 if it couldn't be opened
+ */
+static s32 config_read(const char *name, config_parse_t *state, bool partial)
+{
+  int f = cfs_open(name, CFS_READ);
+  if (f == -1)
+    return -1;
+
+  char line[CONFIG_LINE_LEN];
+  char chunk[64];
+  u16 line_len = 0;
+  bool truncated = false;
+  s32 size = 0;
+  int n;
+
+  while ((n = cfs_read(f, chunk, sizeof(chunk))) > 0) {
+    size += n;
+    for (int i = 0; i < n; i++) {
+      if (chunk[i] == '\n') {
+        line[line_len] = '\0';
+        if (!truncated)
+          config_parse_line(line, state);
+        else
+          config_index.overflow = true;
+        line_len = 0;
+        truncated = false;
+      } else if (line_len < sizeof(line) - 1) {
+        line[line_len++] = chunk[i];
+      } else {
+        truncated = true;
+      }
+    }
+  }
+  line[line_len] = '\0';
+  state->partial = (line_len > 0) || truncated;
+  if (partial && !truncated)
+    config_parse_line(line, state);
+
+  cfs_close(f);
+  return size;
+}
+
+/** Generation in the first line of a snapshot, zero if there isn't one. */
+static u32 snapshot_gen(const char *name)
+{
+  int f = cfs_open(name, CFS_READ);
+  if (f == -1)
+    return 0;
+
+  char line[CONFIG_LINE_LEN];
+  int n = cfs_read(f, line, sizeof(line) - 1);
+  cfs_close(f);
+
+  unsigned long gen;
+  line[MAX(n, 0)] = '\0';
+  if (sscanf(line, "; gen %lu", &gen) != 1)
+    return 0;
+  return gen;
+}
+
+/** Load the saved settings into RAM, called once at boot before any setting
+ * is registered. */
+void settings_file_load(void)
+{
+  u32 gens[2] = {snapshot_gen(snapshot_files[0]),
+                 snapshot_gen(snapshot_files[1])};
+  u8 newest = (gens[1] > gens[0]) ? 1 : 0;
+
+  for (u8 i = 0; i < 2; i++) {
+    u8 s = newest ^ i;
+    if (gens[s] == 0)
+      continue;
+    config_parse_t state = {.section = ""};
+    config_index_reset();
+    config_read(snapshot_files[s], &state, false);
+    if (state.has_gen && state.end && (state.gen == gens[s])) {
+      store.gen = state.gen;
+      store.file = snapshot_files[s];
+      break;
+    }
+  }
+
+  if (store.gen == 0) {
+    config_parse_t state = {.section = ""};
+    config_index_reset();
+    config_read(CONFIG_FILE_LEGACY, &state, true);
+    store.file = CONFIG_FILE_LEGACY;
+    return;
+  }
+
+  config_parse_t state = {
+    .section = "", .check_gen = true, .want_gen = store.gen
+  };
+  s32 size = config_read(CONFIG_FILE_LOG, &state, false);
+  if ((size >= 0) && state.has_gen && (state.gen == store.gen)) {
+    store.log_valid = true;
+    store.log_len = size;
+    if (state.partial) {
+      log_warn("Saved settings end in a partial change, ignoring it");
+      store.log_partial = true;
+    }
+  }
+}
+
+/** Find a setting's saved value.
+ *
+ * \param section Section name
+ * \param name Setting name
+ * \param buf Buffer the value is copied into
+ * \param len Length of buf
+ * \return True if there is a saved value for the setting
+ */
+bool settings_file_get(const char *section, const char *name,
+                       char *buf, int len)
+{
+  char *p = config_index_find(section, name);
+  if (p) {
+    strncpy(buf, config_index_next(p), len - 1);
+    buf[len - 1] = '\0';
+    return buf[0] != '\0';
+  }
+
+  if (!config_index.overflow || !store.file)
+    return false;
+
+  /* Changes in the log override the snapshot. */
+  config_parse_t state = {
+    .section = "", .find_section = section, .find_name = name,
+    .found = buf, .found_len = len
+  };
+  if (store.log_valid) {
+    state.check_gen = true;
+    state.want_gen = store.gen;
+    config_read(CONFIG_FILE_LOG, &state, false);
+  }
+  if (!state.has_found) {
+    state = (config_parse_t) {
+      .section = "", .find_section = section, .find_name = name,
+      .found = buf, .found_len = len
+    };
+    config_read(store.file, &state, store.gen == 0);
+  }
+  return state.has_found && (buf[0] != '\0');
+}
+
+static bool config_printf(int f, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+static bool config_printf(int f, const char *fmt, ...)
+{
+  char buf[2 * CONFIG_LINE_LEN];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if ((n < 0) || (n >= (int)sizeof(buf)))
+    return false;
+  return cfs_write(f, buf, n) == n;
+}
+
+/** Remove a file, closing it first if it is open for an SBP file transfer. */
+static void config_remove(const char *name)
+{
+  sbp_fileio_flush(name);
+  cfs_remove(name);
+}
+
+/** Save a setting's value if it differs from the saved one. The change is
+ * appended to the log, see settings_file_sync().
+ *
+ * \return 1 if the value was saved, 0 if it was already and -1 on error
+ */
+s8 settings_file_update(const char *section, const char *name,
+                        const char *value)
+{
+  char prev[CONFIG_LINE_LEN];
+  if (settings_file_get(section, name, prev, sizeof(prev)) &&
+      (strcmp(prev, value) == 0))
+    return 0;
+
+  /* Checked here as longer lines are skipped when the file is read back. */
+  char line[CONFIG_LINE_LEN];
+  if (!format_setting(line, sizeof(line), name, value)) {
+    log_error("Setting %s.%s too long to save", section, name);
+    return -1;
+  }
+
+  config_index_set(section, name, value);
+
+  /* Until there is a snapshot, or while the log ends in a partial change
+   * that an append would run into, the next sync writes one with
+   * everything. */
+  if ((store.gen == 0) || store.log_partial) {
+    store.unsynced = true;
+    return 1;
+  }
+
+  int f;
+  bool ok;
+  if (!store.log_valid) {
+    config_remove(CONFIG_FILE_LOG);
+    f = cfs_open(CONFIG_FILE_LOG, CFS_WRITE);
+    if (f == -1)
+      return -1;
+    ok = config_printf(f, "; gen %lu\n", (unsigned long)store.gen);
+    store.log_len = 0;
+  } else {
+    f = cfs_open(CONFIG_FILE_LOG, CFS_WRITE | CFS_APPEND);
+    if (f == -1)
+      return -1;
+    ok = true;
+  }
+  ok = ok && config_printf(f, "[%s]\n%s", section, line);
+  store.log_len = cfs_seek(f, 0, CFS_SEEK_END);
+  cfs_close(f);
+
+  /* On error the next sync writes a new snapshot instead. */
+  store.log_valid = ok;
+  store.unsynced |= !ok;
+  return ok ? 1 : -1;
+}
+
+/** Write every saved value to a new snapshot and start an empty log. */
+static bool config_compact(void)
+{
+  u32 gen = store.gen + 1;
+  const char *name = snapshot_files[gen & 1];
+
+  /* CFS doesn't truncate a file opened for writing. */
+  config_remove(name);
+  int f = cfs_open(name, CFS_WRITE);
+  if (f == -1)
+    return false;
+
+  bool ok = config_printf(f, "; gen %lu\n", (unsigned long)gen);
+  char *end = &config_index.buf[config_index.len];
+  char *p = config_index.buf;
+  while (ok && (p < end)) {
+    if (*p == CONFIG_INDEX_SECTION) {
+      ok = config_printf(f, "[%s]\n", p + 1);
+      p = config_index_next(p);
+      continue;
+    }
+    char *value = config_index_next(p);
+    char line[CONFIG_LINE_LEN];
+    ok = format_setting(line, sizeof(line), p, value) &&
+         config_printf(f, "%s", line);
+    p = config_index_next(value);
+  }
+  ok = ok && config_printf(f, "; end %lu\n", (unsigned long)gen);
+  cfs_close(f);
+
+  if (!ok) {
+    /* The previous snapshot and log are still complete. */
+    config_remove(name);
+    return false;
+  }
+
+  store.gen = gen;
+  store.file = name;
+  store.log_valid = false;
+  store.log_partial = false;
+  store.log_len = 0;
+  store.unsynced = false;
+  config_remove(CONFIG_FILE_LOG);
+  config_remove(CONFIG_FILE_LEGACY);
+  return true;
+}
+
+/** Finish saving settings, writing a new snapshot if the log has grown too
+ * long or there are changes which aren't in the log.
+ *
+ * \return False if the settings couldn't all be saved
+ */
+bool settings_file_sync(void)
+{
+  if (!store.unsynced && (store.log_len <= CONFIG_LOG_MAX))
+    return true;
+
+  if (config_index.overflow) {
+    /* A snapshot would lose the values that didn't fit in RAM, keep
+     * appending to the log instead. */
+    log_warn("Too many saved settings to compact the config file");
+    return !store.unsynced;
+  }
+
+  return config_compact();
+}
+
+/** \} */
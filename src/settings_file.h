@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_SETTINGS_FILE_H
+#define SWIFTNAV_SETTINGS_FILE_H
+
+#include <libswiftnav/common.h>
+
+void settings_file_load(void);
+bool settings_file_get(const char *section, const char *name,
+                       char *buf, int len);
+s8 settings_file_update(const char *section, const char *name,
+                        const char *value);
+bool settings_file_sync(void);
+
+#endif  /* SWIFTNAV_SETTINGS_FILE_H */
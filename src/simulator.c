@@ -20,13 +20,15 @@
 #include <libswiftnav/linear_algebra.h>
 #include <libswiftnav/track.h>
 #include <libswiftnav/almanac.h>
-#include <ch.h>
+#include <libswiftnav/gpstime.h>
+#include <libsbp/tracking.h>
 #include <track.h>
 
 #include "settings.h"
 
 #include "simulator.h"
 #include "solution.h"
+#include "matrix_fixed.h"
 #include "board/leds.h"
 #include "sbp.h"
 
@@ -35,7 +37,18 @@
 /** \simulator
  * \{ */
 
+/** Rough distance to a GPS satellite to start the light time iteration. */
+#define SIM_NOMINAL_RANGE 22e6
+/** Receiver clock random walk, bias [s^2/s] and drift [(s/s)^2/s]. */
+#define SIM_CLOCK_BIAS_NOISE  1e-19
+#define SIM_CLOCK_DRIFT_NOISE 4e-19
+/** Spread of the receiver clock drift at startup [s/s]. */
+#define SIM_CLOCK_DRIFT_SIGMA 1e-7
+/** Noise on each simulated correlation, see send_correlations(). */
+#define SIM_CORR_NOISE_SIGMA  100.0
+
 u8 sim_enabled;
+u32 sim_seed = SIMULATION_DEFAULT_SEED;
 
 simulation_settings_t sim_settings = {
   .base_ecef = {
@@ -50,23 +63,29 @@ simulation_settings_t sim_settings = {
   .cn0_sigma = 0.3,
   .pseudorange_sigma = 4,
   .phase_sigma = 3e-2,
-  .num_sats = 9,
+  .num_sats = 12,
   .mode_mask =
     SIMULATION_MODE_PVT |
     SIMULATION_MODE_TRACKING |
     SIMULATION_MODE_FLOAT |
-    SIMULATION_MODE_RTK
+    SIMULATION_MODE_RTK,
+  .elevation_mask = 10.0,
 };
 
 /* Internal Simulation State Definition */
 struct {
 
-  u32            last_update_ticks;       /**< The last simulation update happened at this CPU tick count. */
   float          angle;                   /**< Current simulation angle in radians */
   double         pos[3];                  /**< Current simulated position with no noise, in ECEF coordinates. */
+  double         vel[3];                  /**< Current simulated velocity with no noise, in ECEF coordinates. */
   double         baseline[3];             /**< Current simulated baseline with no noise, in ECEF coordinates.*/
 
+  sim_clock_t    clock;                   /**< Rover receiver clock. */
+  sim_clock_t    base_clock;              /**< Base receiver clock. */
+
   u8             num_sats_selected;
+  s8             channel_sat[MAX_CHANNELS]; /**< Almanac index tracked by each channel, -1 if none. */
+  u16            lock_counter[SIM_MAX_ALMANACS]; /**< Bumped each time a satellite is reacquired. */
 
   tracking_channel_state_t  tracking_channel[MAX_CHANNELS];
   navigation_measurement_t  nav_meas[MAX_CHANNELS];
@@ -76,7 +95,6 @@ struct {
 
 } sim_state = {
 
-  .last_update_ticks = 0,
   .angle = 0.0,
   .pos = {
     0.0,
@@ -106,35 +124,51 @@ struct {
 };
 
 
+/* Simulator random number generator, separate from the C library's so that
+ * nothing else drawing from rand() changes the simulation. */
+static struct {
+  u64 state;
+  bool hasSpare;
+  double rand1, rand2;
+} sim_rng;
+
+/** xorshift64* uniform in [0, 1]. */
+static double rand_uniform(void)
+{
+  sim_rng.state ^= sim_rng.state >> 12;
+  sim_rng.state ^= sim_rng.state << 25;
+  sim_rng.state ^= sim_rng.state >> 27;
+  return ((sim_rng.state * 2685821657736338717ULL) >> 11)
+         * (1.0 / 9007199254740991.0);
+}
+
 /** Generates a sample from the normal distribution
 * with given variance.
 *
 * Uses the Box-Muller transform which is insensitive
 * to the long tail of gaussians.
 *
-* Performs a square-root, a sin, a log, and a rand call.
+* Performs a square-root, a sin, a log, and two uniform draws from the
+* simulator's seeded generator.
 *
 * \param variance The variance of a zero-mean gaussian to draw a sample from.
 */
 double rand_gaussian(const double variance)
 {
-  static bool hasSpare = false;
-  static double rand1, rand2;
-
-  if(hasSpare)
+  if(sim_rng.hasSpare)
   {
-    hasSpare = false;
-    return sqrt(variance * rand1) * sin(rand2);
+    sim_rng.hasSpare = false;
+    return sqrt(variance * sim_rng.rand1) * sin(sim_rng.rand2);
   }
 
-  hasSpare = true;
+  sim_rng.hasSpare = true;
 
-  rand1 = rand() / ((double) RAND_MAX);
-  if(rand1 < 1e-100) rand1 = 1e-100;
-  rand1 = -2 * log(rand1);
-  rand2 = (rand() / ((double) RAND_MAX)) * (M_PI*2.0);
+  sim_rng.rand1 = rand_uniform();
+  if(sim_rng.rand1 < 1e-100) sim_rng.rand1 = 1e-100;
+  sim_rng.rand1 = -2 * log(sim_rng.rand1);
+  sim_rng.rand2 = rand_uniform() * (M_PI*2.0);
 
-  return sqrt(variance * rand1) * cos(rand2);
+  return sqrt(variance * sim_rng.rand1) * cos(sim_rng.rand2);
 }
 
 /** Performs a 1D linear interpolation from a point on the line segment
@@ -158,6 +192,10 @@ double lerp(double t, double u, double v, double x, double y) {
 /** Performs a timestep of the simulation that flies in a circle around a point.
 * Updates the sim_state and sim_state.noisy_solution structs.
 *
+* The simulation runs on its own clock, advanced only by dt here, and draws
+* its noise from a generator seeded by simulation_seed(). The same seed and
+* sequence of steps always gives the same output however fast it is stepped.
+*
 * This simulator models a system moving in a perfect circle. We use this fact to
 * write a simple but smart numerically stable simulator.
 *
@@ -177,22 +215,15 @@ double lerp(double t, double u, double v, double x, double y) {
 * This function makes a small angle approximation, so the
 * elapsed time (dt) between calls must be such that the (speed * dt) is much less than the radius.
 *
+* \param dt Simulated time to advance by, in seconds.
 */
-void simulation_step(void)
+void simulation_step(double dt)
 {
-
-  //First we propagate the current fake PVT solution
-  systime_t now_ticks = chTimeNow();
-
-  double elapsed = (now_ticks - sim_state.last_update_ticks)/(double)CH_FREQUENCY;
-  sim_state.last_update_ticks = now_ticks;
-
   /* Update the time */
-  sim_state.noisy_solution.time.tow += elapsed;
-
-  simulation_step_position_in_circle(elapsed);
-  simulation_step_tracking_and_observations(elapsed);
+  sim_state.noisy_solution.time.tow += dt;
 
+  simulation_step_position_in_circle(dt);
+  simulation_step_tracking_and_observations(dt);
 }
 
 /**
@@ -206,7 +237,7 @@ void simulation_step_position_in_circle(double elapsed)
   /* Update the angle, making a small angle approximation. */
   sim_state.angle += (sim_settings.speed * elapsed) / sim_settings.radius;
   if (sim_state.angle > 2*M_PI) {
-    sim_state.angle = 0;
+    sim_state.angle -= 2*M_PI;
   }
 
   double pos_ned[3] = {
@@ -220,6 +251,13 @@ void simulation_step_position_in_circle(double elapsed)
     sim_settings.base_ecef,
     sim_state.pos);
 
+  double vel_ned[3] = {
+    sim_settings.speed * cos(sim_state.angle),
+    sim_settings.speed * -1.0 * sin(sim_state.angle),
+    0
+  };
+  wgsned2ecef(vel_ned, sim_state.pos, sim_state.vel);
+
   /* Calculate an accurate baseline for simulating RTK */
   vector_subtract(3,
     sim_state.pos,
@@ -249,101 +287,278 @@ void simulation_step_position_in_circle(double elapsed)
     sim_state.noisy_solution.vel_ecef);
 }
 
-/** Simulates real observations for the current position and the satellite almanac and week
-* given in simulator_data.
+/** Advance a receiver clock by dt seconds.
+* Bias and drift follow a two state random walk typical of a TCXO.
+*/
+static void clock_step(sim_clock_t *clock, double dt)
+{
+  clock->bias += clock->drift * dt + rand_gaussian(SIM_CLOCK_BIAS_NOISE * dt);
+  clock->drift += rand_gaussian(SIM_CLOCK_DRIFT_NOISE * dt);
+}
+
+/** Satellite geometry seen from a receiver whose clock reads t.
+*
+* The satellite is propagated from the almanac to the time of transmission,
+* and the range includes the earth's rotation while the signal is in flight
+* as calc_PVT() models it, so simulated measurements solve exactly.
+*
+* \param almanac_i Index into simulation_almanacs.
+* \param t         Time of week by the receiver's clock.
+* \param pos       Receiver position in ECEF.
+* \param vel       Receiver velocity in ECEF.
+* \param clock     Receiver clock.
+* \param sig       Filled out with the geometry.
+*/
+void simulation_signal(int almanac_i, double t, const double pos[3],
+                       const double vel[3], const sim_clock_t *clock,
+                       sim_signal_t *sig)
+{
+  const almanac_t *alm = &simulation_almanacs[almanac_i];
+  double t_rx = t - clock->bias;
+  double tau = SIM_NOMINAL_RANGE / GPS_C;
+  double los[3];
+
+  /* Light time converges to well under a millimetre in a few iterations. */
+  for (u8 k = 0; k < 3; k++) {
+    calc_sat_state_almanac(alm, t_rx - tau, -1, sig->sat_pos, sig->sat_vel);
+
+    double wEtau = GPS_OMEGAE_DOT * tau;
+    double rot_pos[3] = {
+      cos(wEtau) * sig->sat_pos[0] + sin(wEtau) * sig->sat_pos[1],
+      -sin(wEtau) * sig->sat_pos[0] + cos(wEtau) * sig->sat_pos[1],
+      sig->sat_pos[2]
+    };
+    vector_subtract(3, rot_pos, pos, los);
+    sig->range = vector_norm(3, los);
+    tau = sig->range / GPS_C;
+  }
+  sig->tot = t_rx - tau;
+
+  vector_normalize(3, los);
+  double rel_vel[3];
+  vector_subtract(3, sig->sat_vel, vel, rel_vel);
+  sig->range_rate = vector_dot(3, los, rel_vel);
+
+  sig->sat_clock = alm->af0 + alm->af1 * (sig->tot - alm->toa);
+  sig->sat_clock_rate = alm->af1;
+
+  wgsecef2ned(los, pos, sig->los_ned);
+  sig->el = asin(-sig->los_ned[2]);
+}
+
+/** Recompute the simulated DOPs from the geometry of the tracked satellites.
+* Left unchanged with fewer than four satellites.
+*/
+static void update_dops(u8 n, const double los_ned[][3])
+{
+  if (n < 4)
+    return;
+
+  double gtg[16] = {0};
+  for (u8 i = 0; i < n; i++) {
+    double g[4] = {los_ned[i][0], los_ned[i][1], los_ned[i][2], 1};
+    for (u8 r = 0; r < 4; r++)
+      for (u8 c = 0; c < 4; c++)
+        gtg[4*r + c] += g[r] * g[c];
+  }
+
+  double q[16];
+  if (mat4_inv(gtg, q) < 0)
+    return;
+
+  sim_state.dops.pdop = sqrt(q[0] + q[5] + q[10]);
+  sim_state.dops.gdop = sqrt(q[0] + q[5] + q[10] + q[15]);
+  sim_state.dops.tdop = sqrt(q[15]);
+  sim_state.dops.hdop = sqrt(q[0] + q[5]);
+  sim_state.dops.vdop = sqrt(q[10]);
+}
+
+/** Send prompt, early and late correlations for a simulated channel, as the
+* tracking loop does when IQ output is enabled for it. Unit variance noise
+* scaled by SIM_CORR_NOISE_SIGMA over a 1 ms integration, the carrier is in
+* phase and the early and late correlators half a chip either side.
+*/
+static void send_correlations(u8 channel, const tracking_channel_state_t *ch)
+{
+  double amplitude = SIM_CORR_NOISE_SIGMA *
+                     sqrt(2 * pow(10, ch->cn0 / 10) * 1e-3);
+  static const double code_corr[3] = {0.5, 1.0, 0.5};
+
+  msg_tracking_iq_t msg = {
+    .channel = channel,
+    .sid = ch->sid,
+  };
+  for (u8 i = 0; i < 3; i++) {
+    msg.corrs[i].I = round(amplitude * code_corr[i] +
+                           rand_gaussian(SIM_CORR_NOISE_SIGMA *
+                                         SIM_CORR_NOISE_SIGMA));
+    msg.corrs[i].Q = round(rand_gaussian(SIM_CORR_NOISE_SIGMA *
+                                         SIM_CORR_NOISE_SIGMA));
+  }
+  sbp_send_msg(SBP_MSG_TRACKING_IQ, sizeof(msg), (u8*)&msg);
+}
+
+/** Simulates real observations for the current position from the almanac
+* constellation given in simulator_data.
 *
 * NOTES:
 *
-* - This simulates the pseudorange as the true distance to the satellite + noise.
-* - This simulates the carrier phase as the true distance in wavelengths + bais + noise.
-* - The bias is an integer multiple of 10 for easy debugging.
+* - Every satellite in the almanac is propagated, those above the elevation
+*   mask are tracked, up to sim_settings.num_sats of them.
+* - A satellite keeps its tracking channel until it sets below the mask, a
+*   rising satellite takes the first free channel and its lock counter is
+*   bumped as its carrier phase ambiguity is new.
+* - The rover and base each have their own receiver clock, the satellite
+*   clocks come from the almanac. Pseudorange, carrier phase and Doppler all
+*   see the same clocks and geometry, see populate_nav_meas().
 * - The satellite SNR/CN0 is proportional to the elevation of the satellite.
+* - The DOPs follow the geometry of the tracked satellites.
 *
 * USES:
 * - Pipe observations into internals for testing
 * - For integration testing with other devices that has to carry the radio signal.
+* - Load testing calc_PVT(), DGNSS and the observation messages with
+*   realistic satellite churn.
 *
 * \param elapsed Number of seconds elapsed since last simulation step.
 */
 void simulation_step_tracking_and_observations(double elapsed)
 {
-  (void)elapsed;
-
-  u8 week = -1;
   double t = sim_state.noisy_solution.time.tow;
+  double mask = sim_settings.elevation_mask * D2R;
+  u8 max_sats = MIN(sim_settings.num_sats, MAX_CHANNELS);
+  static double zero_vel[3];
+
+  clock_step(&sim_state.clock, elapsed);
+  clock_step(&sim_state.base_clock, elapsed);
 
   /* First we calculate all the current sat positions, velocities */
+  static sim_signal_t sigs[SIM_MAX_ALMANACS];
+  bool tracked[SIM_MAX_ALMANACS] = {false};
   for (u8 i=0; i<simulation_num_almanacs; i++) {
-    calc_sat_state_almanac(&simulation_almanacs[i], t, week,
-      simulation_sats_pos[i], simulation_sats_vel[i]);
+    simulation_signal(i, t, sim_state.pos, sim_state.vel, &sim_state.clock,
+                      &sigs[i]);
+    memcpy(simulation_sats_pos[i], sigs[i].sat_pos, sizeof(sigs[i].sat_pos));
+    memcpy(simulation_sats_vel[i], sigs[i].sat_vel, sizeof(sigs[i].sat_vel));
   }
 
+  /* Drop satellites that have set, or channels beyond num_sats. */
+  for (u8 c=0; c<MAX_CHANNELS; c++) {
+    s8 i = sim_state.channel_sat[c];
+    if (i < 0)
+      continue;
+    if (sigs[i].el < mask || c >= max_sats)
+      sim_state.channel_sat[c] = -1;
+    else
+      tracked[i] = true;
+  }
 
-  /* Calculate the first sim_settings.num_sats amount of visible sats */
-  u8 num_sats_selected = 0;
-  double az, el;
+  /* Rising satellites take the free channels. */
   for (u8 i=0; i<simulation_num_almanacs; i++) {
-    calc_sat_az_el_almanac(&simulation_almanacs[i], t, week,
-                            sim_state.pos, &az, &el);
-
-    if (el > 0 &&
-        num_sats_selected < sim_settings.num_sats &&
-        num_sats_selected < MAX_CHANNELS) {
-
-      /* Generate a code measurement which is just the pseudorange: */
-      double points_to_sat[3];
-      double base_points_to_sat[3];
-
-      vector_subtract(3, simulation_sats_pos[i], sim_state.pos, points_to_sat);
-      vector_subtract(3, simulation_sats_pos[i], sim_settings.base_ecef, base_points_to_sat);
-
-      double distance_to_sat = vector_norm(3, points_to_sat);
-      double base_distance_to_sat = vector_norm(3, base_points_to_sat);
+    if (tracked[i] || sigs[i].el < mask)
+      continue;
+    for (u8 c=0; c<max_sats; c++) {
+      if (sim_state.channel_sat[c] < 0) {
+        sim_state.channel_sat[c] = i;
+        sim_state.lock_counter[i]++;
+        tracked[i] = true;
+        break;
+      }
+    }
+  }
 
-      /* Fill out the observation details into the NAV_MEAS structure for this satellite, */
-      /* We simulate the pseudorange as a noisy range measurement, and */
-      /* the carrier phase as a noisy range in wavelengths + an integer offset. */
+  /* Observations in PRN order, as the DGNSS filters expect. */
+  u8 num_sats_selected = 0;
+  double los_ned[MAX_CHANNELS][3];
+  double cn0[SIM_MAX_ALMANACS];
+  for (u8 i=0; i<simulation_num_almanacs; i++) {
+    if (!tracked[i])
+      continue;
 
-      populate_nav_meas(&sim_state.nav_meas[num_sats_selected],
-        distance_to_sat, el, i);
+    sim_signal_t base_sig;
+    simulation_signal(i, t, sim_settings.base_ecef, zero_vel,
+                      &sim_state.base_clock, &base_sig);
 
-      populate_nav_meas(&sim_state.base_nav_meas[num_sats_selected],
-        base_distance_to_sat, el, i);
+    populate_nav_meas(&sim_state.nav_meas[num_sats_selected],
+      &sigs[i], &sim_state.clock, i);
+    populate_nav_meas(&sim_state.base_nav_meas[num_sats_selected],
+      &base_sig, &sim_state.base_clock, i);
 
-      /* As for tracking, we just set each sat consecutively in each channel. */
-      /* This will cause weird jumps when a satellite rises or sets. */
-      sim_state.tracking_channel[num_sats_selected].state = TRACKING_RUNNING;
-      sim_state.tracking_channel[num_sats_selected].sid = simulation_almanacs[i].prn  + SIM_PRN_OFFSET;
-      sim_state.tracking_channel[num_sats_selected].cn0 = sim_state.nav_meas[num_sats_selected].snr;
+    memcpy(los_ned[num_sats_selected], sigs[i].los_ned, sizeof(los_ned[0]));
+    cn0[i] = sim_state.nav_meas[num_sats_selected].snr;
+    num_sats_selected++;
+  }
 
-      num_sats_selected++;
+  for (u8 c=0; c<MAX_CHANNELS; c++) {
+    tracking_channel_state_t *ch = &sim_state.tracking_channel[c];
+    s8 i = sim_state.channel_sat[c];
+    if (i < 0) {
+      ch->state = TRACKING_DISABLED;
+      ch->sid = 0;
+      ch->cn0 = -1;
+      continue;
     }
+    ch->state = TRACKING_RUNNING;
+    ch->sid = simulation_almanacs[i].prn + SIM_PRN_OFFSET;
+    ch->cn0 = cn0[i];
+    if (simulation_enabled_for(SIMULATION_MODE_CORRELATORS))
+      send_correlations(c, ch);
   }
 
-  sim_state.noisy_solution.n_used = num_sats_selected;
+  update_dops(num_sats_selected, los_ned);
 
+  sim_state.num_sats_selected = num_sats_selected;
+  sim_state.noisy_solution.n_used = num_sats_selected;
 }
 
 /** Populate a navigation_measurement_t structure with simulated data for
-* the almanac_i satellite, currently dist away from simulated point at given elevation.
+* the almanac_i satellite as seen by a receiver.
 *
+* Follows the firmware's sign conventions, the carrier phase decreases and
+* the Doppler is positive as the satellite approaches. The pseudorange and
+* Doppler are also given corrected for the satellite clock, as
+* calc_navigation_measurement() does.
+*
+* \param nav_meas  Measurement to fill out.
+* \param sig       Satellite geometry from simulation_signal().
+* \param clock     The receiver's clock.
+* \param almanac_i Index into simulation_almanacs.
 */
-void populate_nav_meas(navigation_measurement_t *nav_meas, double dist, double elevation, int almanac_i)
+void populate_nav_meas(navigation_measurement_t *nav_meas,
+                       const sim_signal_t *sig, const sim_clock_t *clock,
+                       int almanac_i)
 {
+  double lambda = GPS_C / GPS_L1_HZ;
+  double clock_range = GPS_C * (clock->bias - sig->sat_clock);
+  double clock_range_rate = GPS_C * (clock->drift - sig->sat_clock_rate);
+
   nav_meas->prn             =  simulation_almanacs[almanac_i].prn + SIM_PRN_OFFSET;
 
-  nav_meas->raw_pseudorange =  dist;
+  nav_meas->raw_pseudorange =  sig->range + clock_range;
   nav_meas->raw_pseudorange += rand_gaussian(sim_settings.pseudorange_sigma *
                                              sim_settings.pseudorange_sigma);
+  nav_meas->pseudorange     =  nav_meas->raw_pseudorange +
+                               GPS_C * sig->sat_clock;
 
-  nav_meas->carrier_phase =    dist / (GPS_C / GPS_L1_HZ);
+  nav_meas->carrier_phase =    -(sig->range + clock_range) / lambda;
   nav_meas->carrier_phase +=   simulation_fake_carrier_bias[almanac_i];
   nav_meas->carrier_phase +=   rand_gaussian(sim_settings.phase_sigma *
                                              sim_settings.phase_sigma);
 
-  nav_meas->snr             =  lerp(elevation, 0, M_PI/2, 35, 45) +
+  nav_meas->raw_doppler     =  -(sig->range_rate + clock_range_rate) / lambda;
+  nav_meas->doppler         =  nav_meas->raw_doppler -
+                               sig->sat_clock_rate * GPS_L1_HZ;
+
+  memcpy(nav_meas->sat_pos, sig->sat_pos, sizeof(nav_meas->sat_pos));
+  memcpy(nav_meas->sat_vel, sig->sat_vel, sizeof(nav_meas->sat_vel));
+  nav_meas->tot.wn          =  simulation_week_number;
+  nav_meas->tot.tow         =  sig->tot;
+  nav_meas->tot             =  normalize_gps_time(nav_meas->tot);
+
+  nav_meas->snr             =  lerp(sig->el, 0, M_PI/2, 35, 45) +
                                rand_gaussian(sim_settings.cn0_sigma *
                                              sim_settings.cn0_sigma);
+  nav_meas->lock_counter    =  sim_state.lock_counter[almanac_i];
 }
 
 /** Returns true if the simulation is at all enabled
@@ -402,14 +617,20 @@ u8 simulation_current_num_sats(void)
 }
 
 /** Returns the current simulated tracking loops state simulated.
-* This contains only noise, no interesting simulation information.
+* Satellites keep their channel while they are above the elevation mask,
+* free channels are disabled.
 *
 * \param channel The simulated tracking channel.
 */
 tracking_channel_state_t simulation_current_tracking_state(u8 channel)
 {
-  if (channel >= simulation_current_num_sats()) {
-    channel = simulation_current_num_sats() - 1;
+  if (channel >= MAX_CHANNELS) {
+    tracking_channel_state_t disabled = {
+      .state = TRACKING_DISABLED,
+      .sid = 0,
+      .cn0 = -1,
+    };
+    return disabled;
   }
   return sim_state.tracking_channel[channel];
 }
@@ -436,19 +657,53 @@ navigation_measurement_t* simulation_current_base_navigation_measurements(void)
 void simulator_setup_almanacs(void)
 {
   for (u8 i = 0; i < simulation_num_almanacs; i++) {
-    simulation_fake_carrier_bias[i] = (rand() % 1000) * 10;
+    simulation_fake_carrier_bias[i] = (u32)(rand_uniform() * 999.999) * 10;
+    sim_state.lock_counter[i] = rand_uniform() * 65535;
   }
 }
 
-/** Must be called from main() or equivalent function before simulator runs
+/** Restart the simulation from the beginning of the simulation week with
+* the random number generator seeded.
+*
+* \param seed Seed, 0 selects SIMULATION_DEFAULT_SEED.
 */
-void simulator_setup(void)
+void simulation_seed(u32 seed)
 {
+  memset(&sim_rng, 0, sizeof(sim_rng));
+  sim_rng.state = seed ? seed : SIMULATION_DEFAULT_SEED;
+
+  sim_state.angle = 0;
   sim_state.noisy_solution.time.wn = simulation_week_number;
   sim_state.noisy_solution.time.tow = 0;
 
   simulator_setup_almanacs();
 
+  sim_state.clock.bias = 0;
+  sim_state.clock.drift = rand_gaussian(SIM_CLOCK_DRIFT_SIGMA *
+                                        SIM_CLOCK_DRIFT_SIGMA);
+  sim_state.base_clock.bias = 0;
+  sim_state.base_clock.drift = rand_gaussian(SIM_CLOCK_DRIFT_SIGMA *
+                                             SIM_CLOCK_DRIFT_SIGMA);
+  for (u8 c = 0; c < MAX_CHANNELS; c++)
+    sim_state.channel_sat[c] = -1;
+  sim_state.num_sats_selected = 0;
+}
+
+static bool seed_notify(struct setting *s, const char *val)
+{
+  if (s->type->from_string(s->type->priv, s->addr, s->len, val)) {
+    simulation_seed(sim_seed);
+    return true;
+  }
+  return false;
+}
+
+/** Must be called from main() or equivalent function before simulator runs
+*/
+void simulator_setup(void)
+{
+  simulation_seed(sim_seed);
+
   SETTING("simulator", "enabled",           sim_enabled,                    TYPE_BOOL);
   SETTING("simulator", "base_ecef_x",       sim_settings.base_ecef[0],      TYPE_FLOAT);
   SETTING("simulator", "base_ecef_y",       sim_settings.base_ecef[1],      TYPE_FLOAT);
@@ -461,7 +716,10 @@ void simulator_setup(void)
   SETTING("simulator", "pseudorange_sigma", sim_settings.pseudorange_sigma, TYPE_FLOAT);
   SETTING("simulator", "phase_sigma",       sim_settings.phase_sigma,       TYPE_FLOAT);
   SETTING("simulator", "num_sats",          sim_settings.num_sats,          TYPE_INT);
+  SETTING("simulator", "elevation_mask",    sim_settings.elevation_mask,    TYPE_FLOAT);
   SETTING("simulator", "mode_mask",         sim_settings.mode_mask,         TYPE_INT);
+  SETTING_NOTIFY("simulator", "seed",       sim_seed,                       TYPE_INT,
+                 seed_notify);
 }
 
 /** \} */
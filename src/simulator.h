@@ -35,13 +35,17 @@
 
 #define SIM_PRN_OFFSET 200
 
+/** Seed used when none is set, see simulation_seed(). */
+#define SIMULATION_DEFAULT_SEED 0x5EED
+
 typedef uint8_t simulation_mode_t; /* Force uint8_t size for simulation_mode */
 
 typedef enum {
   SIMULATION_MODE_PVT      = (1<<0),
   SIMULATION_MODE_TRACKING = (1<<1),
   SIMULATION_MODE_FLOAT    = (1<<2),
-  SIMULATION_MODE_RTK      = (1<<3)
+  SIMULATION_MODE_RTK      = (1<<3),
+  SIMULATION_MODE_CORRELATORS = (1<<4)
 } simulation_modes_t;
 
 /* User-configurable GPS Simulator Settings
@@ -56,10 +60,33 @@ typedef struct __attribute__((packed)) {
   float             cn0_sigma; /**< variance in signal-to-noise ratio of tracking channels */
   float             pseudorange_sigma;  /**< variance in each sat's simulated pseudorange */
   float             phase_sigma;/**< variance in each sat's simulated carrier phase */
-  u8                num_sats;              /**< number of simulated satellites to report */
+  u8                num_sats;              /**< most simulated satellites to report, of those above the elevation mask */
   u8                mode_mask;             /** < Current mode of the simulator */
+  float             elevation_mask;        /**< satellites below this elevation are not tracked, in degrees */
 } simulation_settings_t;
 
+/** Most almanacs the simulator can propagate. */
+#define SIM_MAX_ALMANACS 32
+
+/** Simulated receiver clock. */
+typedef struct {
+  double bias;   /**< Clock error, in seconds */
+  double drift;  /**< Clock error rate, in seconds per second */
+} sim_clock_t;
+
+/** A satellite's signal as seen by a simulated receiver. */
+typedef struct {
+  double sat_pos[3];      /**< Satellite position at transmission, in ECEF coordinates */
+  double sat_vel[3];      /**< Satellite velocity at transmission, in ECEF coordinates */
+  double tot;             /**< Time of transmission, GPS time of week */
+  double range;           /**< Geometric range, in meters */
+  double range_rate;      /**< in meters per second */
+  double sat_clock;       /**< Satellite clock error from the almanac, in seconds */
+  double sat_clock_rate;  /**< in seconds per second */
+  double los_ned[3];      /**< Unit vector to the satellite in local NED */
+  double el;              /**< Elevation, in radians */
+} sim_signal_t;
+
 /** \} */
 
 //Math Helpers:
@@ -67,14 +94,20 @@ double rand_gaussian(const double variance);
 double lerp(double t, double u, double v, double x, double y);
 
 //Running the Simulation:
-void simulation_step(void);
+void simulation_seed(u32 seed);
+void simulation_step(double dt);
 bool simulation_enabled();
 bool simulation_enabled_for(simulation_modes_t mode_mask);
 
 //Internals of the simulator
 void simulation_step_position_in_circle(double);
 void simulation_step_tracking_and_observations(double);
-void populate_nav_meas(navigation_measurement_t *, double, double, int);
+void simulation_signal(int almanac_i, double t, const double pos[3],
+                       const double vel[3], const sim_clock_t *clock,
+                       sim_signal_t *sig);
+void populate_nav_meas(navigation_measurement_t *nav_meas,
+                       const sim_signal_t *sig, const sim_clock_t *clock,
+                       int almanac_i);
 
 //Sending simulation settings to the outside world
 void sbp_send_simulation_enabled(void);
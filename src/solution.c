@@ -21,14 +21,15 @@
 #include <libswiftnav/observation.h>
 #include <libswiftnav/dgnss_management.h>
 #include <libswiftnav/baseline.h>
-#include <libswiftnav/linear_algebra.h>
 
 #include <libopencm3/stm32/f4/timer.h>
 #include <libopencm3/stm32/f4/rcc.h>
 
 #include "board/leds.h"
 #include "position.h"
+#include "matrix_fixed.h"
 #include "nmea.h"
+#include "obs_log.h"
 #include "sbp.h"
 #include "sbp_utils.h"
 #include "solution.h"
@@ -38,6 +39,8 @@
 #include "timing.h"
 #include "base_obs.h"
 #include "ephemeris.h"
+#include "sched_stats.h"
+#include "trace.h"
 #include "./system_monitor.h"
 
 MemoryPool obs_buff_pool;
@@ -75,6 +78,7 @@ void solution_send_sbp(gnss_solution *soln, dops_t *dops)
     msg_pos_llh_t pos_llh;
     sbp_make_pos_llh(&pos_llh, soln, 0);
     sbp_send_msg(SBP_MSG_POS_LLH, sizeof(pos_llh), (u8 *) &pos_llh);
+    obs_log_msg(SBP_MSG_POS_LLH, sizeof(pos_llh), (u8 *) &pos_llh);
 
     /* Position in ECEF. */
     msg_pos_ecef_t pos_ecef;
@@ -85,6 +89,7 @@ void solution_send_sbp(gnss_solution *soln, dops_t *dops)
     msg_vel_ned_t vel_ned;
     sbp_make_vel_ned(&vel_ned, soln, 0);
     sbp_send_msg(SBP_MSG_VEL_NED, sizeof(vel_ned), (u8 *) &vel_ned);
+    obs_log_msg(SBP_MSG_VEL_NED, sizeof(vel_ned), (u8 *) &vel_ned);
 
     /* Velocity in ECEF. */
     msg_vel_ecef_t vel_ecef;
@@ -159,7 +164,7 @@ void solution_send_baseline(const gps_time_t *t, u8 n_sats, double b_ecef[3],
       base_station_pos = base_pos_ecef;
     }
 
-    vector_add(3, base_station_pos, b_ecef, pseudo_absolute_ecef);
+    vec3_add(base_station_pos, b_ecef, pseudo_absolute_ecef);
     wgsecef2llh(pseudo_absolute_ecef, pseudo_absolute_llh);
     u8 fix_mode = (flags & 1) ? NMEA_GGA_FIX_RTK : NMEA_GGA_FIX_FLOAT;
     /* TODO: Don't fake DOP!! */
@@ -264,6 +269,9 @@ void send_observations(u8 n, gps_time_t *t, navigation_measurement_t *m)
     sbp_send_msg(SBP_MSG_OBS,
       sizeof(observation_header_t) + curr_n*sizeof(packed_obs_content_t),
       buff);
+    obs_log_msg(SBP_MSG_OBS,
+      sizeof(observation_header_t) + curr_n*sizeof(packed_obs_content_t),
+      buff);
 
   }
 }
@@ -277,6 +285,7 @@ void tim5_isr()
   chSysLockFromIsr();
 
   /* Wake up processing thread */
+  sched_latency_isr(SCHED_LATENCY_TIM5);
   chBSemSignalI(&solution_wakeup_sem);
 
   timer_clear_flag(TIM5, TIM_SR_UIF);
@@ -287,7 +296,7 @@ void tim5_isr()
 
 static void timer_set_period_check(uint32_t timer_peripheral, uint32_t period)
 {
-  __asm__("CPSID i;");
+  irq_disable();
   TIM_ARR(timer_peripheral) = period;
   uint32_t tmp = TIM_CNT(timer_peripheral);
   if (tmp > period) {
@@ -295,7 +304,7 @@ static void timer_set_period_check(uint32_t timer_peripheral, uint32_t period)
     log_warn("Solution thread missed deadline, "
              "TIM counter = %lu, period = %lu", tmp, period);
   }
-  __asm__("CPSIE i;");
+  irq_enable();
 }
 
 static void solution_simulation()
@@ -303,11 +312,11 @@ static void solution_simulation()
   /* Set the timer period appropriately. */
   timer_set_period_check(TIM5, round(65472000 * (1.0/soln_freq)));
 
-  simulation_step();
+  /* One solution period of simulated time per epoch, whenever TIM5 actually
+   * fires, so the output only depends on the simulator's seed. */
+  simulation_step(1.0 / soln_freq);
 
-  /* TODO: The simulator's handling of time is a bit crazy. This is a hack
-   * for now but the simulator should be refactored so that it can give the
-   * exact correct solution time output without this nonsense. */
+  /* Keep the accumulated time of week on the solution epochs. */
   gnss_solution *soln = simulation_current_gnss_solution();
   double expected_tow = \
     round(soln->time.tow * soln_freq) / soln_freq;
@@ -362,6 +371,169 @@ static void update_sat_elevations(const navigation_measurement_t nav_meas[],
   }
 }
 
+/** Compute and output a solution from one epoch of local observations.
+ * Outputs the PVT solution and, if there are recent base station
+ * observations, the low-latency baseline. Observations aligned with an
+ * output epoch are sent and queued for the time matched filter.
+ *
+ * \param n_ready_tdcp Number of observations
+ * \param nav_meas_tdcp Observations, propagated in place to the epoch
+ * \param nav_tc NAP timing count the observations were taken at
+ * \return Time in seconds until the next solution epoch, or a negative value
+ *         if no solution could be computed.
+ */
+double solution_process_obs(u8 n_ready_tdcp,
+                            navigation_measurement_t nav_meas_tdcp[],
+                            u64 nav_tc)
+{
+  dops_t dops;
+  s8 ret;
+  /* disable_raim controlled by external setting. Defaults to false. */
+  if ((ret = calc_PVT(n_ready_tdcp, nav_meas_tdcp, disable_raim,
+                      &position_solution, &dops)) >= 0) {
+
+    if (ret == 1)
+      log_warn("calc_PVT: RAIM repair");
+
+    /* Update global position solution state. */
+    position_updated();
+    set_time_fine(nav_tc, position_solution.time);
+
+    static bool first_pvt = true;
+    if (first_pvt) {
+      /* Startup time, the system tick starts just after reset. */
+      log_info("First PVT %u ms after boot",
+               (unsigned int)(chTimeNow() * 1000 / CH_FREQUENCY));
+      first_pvt = false;
+    }
+
+    /* Save elevation angles every so often */
+    DO_EVERY((u32)soln_freq,
+             update_sat_elevations(nav_meas_tdcp, n_ready_tdcp,
+                                   position_solution.pos_ecef));
+
+    if (!simulation_enabled()) {
+      /* Output solution. */
+      solution_send_sbp(&position_solution, &dops);
+      solution_send_nmea(&position_solution, &dops,
+                         n_ready_tdcp, nav_meas_tdcp,
+                         NMEA_GGA_FIX_GPS);
+    }
+
+    /* If we have a recent set of observations from the base station, do a
+     * differential solution. */
+    double pdt;
+    chMtxLock(&base_obs_lock);
+    if (base_obss.n > 0 && !simulation_enabled()) {
+      if ((pdt = gpsdifftime(position_solution.time, base_obss.t))
+            < MAX_AGE_OF_DIFFERENTIAL) {
+
+        /* Propagate base station observations to the current time and
+         * process a low-latency differential solution. */
+
+        /* Hook in low-latency filter here. */
+        if (dgnss_soln_mode == SOLN_MODE_LOW_LATENCY &&
+            base_obss.has_pos) {
+          chMtxLock(&es_mutex);
+          sdiff_t sdiffs[MAX(base_obss.n, n_ready_tdcp)];
+          u8 num_sdiffs = make_propagated_sdiffs(n_ready_tdcp, nav_meas_tdcp,
+                                  base_obss.n, base_obss.nm,
+                                  base_obss.sat_dists, base_obss.pos_ecef,
+                                  es, position_solution.time,
+                                  sdiffs);
+          chMtxUnlock();
+          if (num_sdiffs >= 4) {
+            output_baseline(num_sdiffs, sdiffs, &position_solution.time);
+          }
+        }
+
+      }
+    }
+    chMtxUnlock();
+
+    /* Calculate the time of the nearest solution epoch, were we expected
+     * to be and calculate how far we were away from it. */
+    double expected_tow = round(position_solution.time.tow*soln_freq)
+                            / soln_freq;
+    double t_err = expected_tow - position_solution.time.tow;
+
+    /* Only send observations that are closely aligned with the desired
+     * solution epochs to ensure they haven't been propagated too far. */
+    /* Output obervations only every obs_output_divisor times, taking
+     * care to ensure that the observations are aligned. */
+    double t_check = expected_tow * (soln_freq / obs_output_divisor);
+    if (fabs(t_err) < OBS_PROPAGATION_LIMIT &&
+        fabs(t_check - (u32)t_check) < TIME_MATCH_THRESHOLD) {
+      /* Propagate observation to desired time. */
+      for (u8 i=0; i<n_ready_tdcp; i++) {
+        nav_meas_tdcp[i].pseudorange -= t_err * nav_meas_tdcp[i].doppler *
+          (GPS_C / GPS_L1_HZ);
+        nav_meas_tdcp[i].carrier_phase += t_err * nav_meas_tdcp[i].doppler;
+      }
+
+      /* Update observation time. */
+      gps_time_t new_obs_time;
+      new_obs_time.wn = position_solution.time.wn;
+      new_obs_time.tow = expected_tow;
+
+      if (!simulation_enabled()) {
+        send_observations(n_ready_tdcp, &new_obs_time, nav_meas_tdcp);
+      }
+
+      /* TODO: use a buffer from the pool from the start instead of
+       * allocating nav_meas_tdcp as well. Downside, if we don't end up
+       * pushing the message into the mailbox then we just wasted an
+       * observation from the mailbox for no good reason. */
+
+      obss_t *obs = chPoolAlloc(&obs_buff_pool);
+      msg_t ret;
+      if (obs == NULL) {
+        /* Pool is empty, grab a buffer from the mailbox instead, i.e.
+         * overwrite the oldest item in the queue. */
+        ret = chMBFetch(&obs_mailbox, (msg_t *)&obs, TIME_IMMEDIATE);
+        if (ret != RDY_OK) {
+          log_error("Pool full and mailbox empty!");
+        }
+      }
+      obs->t = new_obs_time;
+      obs->n = n_ready_tdcp;
+      memcpy(obs->nm, nav_meas_tdcp, obs->n * sizeof(navigation_measurement_t));
+      ret = chMBPost(&obs_mailbox, (msg_t)obs, TIME_IMMEDIATE);
+      if (ret != RDY_OK) {
+        /* We could grab another item from the mailbox, discard it and then
+         * post our obs again but if the size of the mailbox and the pool
+         * are equal then we should have already handled the case where the
+         * mailbox is full when we handled the case that the pool was full.
+         * */
+        log_error("Mailbox should have space!");
+      }
+    }
+
+    /* Calculate time till the next desired solution epoch. */
+    double dt = expected_tow + (1.0/soln_freq) - position_solution.time.tow;
+
+    /* Limit dt to 2 seconds maximum to prevent hang if dt calculated
+     * incorrectly. */
+    if (dt > 2)
+      dt = 2;
+
+    return dt;
+
+  } else {
+    /* An error occurred with calc_PVT! */
+    /* TODO: Make this based on time since last error instead of a simple
+     * count. */
+    /* pvt_err_msg defined in libswiftnav/pvt.c */
+    DO_EVERY((u32)soln_freq,
+      log_warn("PVT solver: %s (code %d)", pvt_err_msg[-ret-1], ret);
+    );
+
+    /* Send just the DOPs */
+    solution_send_sbp(0, &dops);
+    return -1;
+  }
+}
+
 static WORKING_AREA_CCM(wa_solution_thread, 8000);
 static msg_t solution_thread(void *arg)
 {
@@ -371,8 +543,19 @@ static msg_t solution_thread(void *arg)
   static navigation_measurement_t nav_meas_old[MAX_CHANNELS];
 
   while (TRUE) {
+    /* Record how the last iteration fared against its deadline. If the
+     * semaphore has already been signalled we overran into the next epoch. */
+    chSysLock();
+    bool overrun = !chBSemGetStateI(&solution_wakeup_sem);
+    chSysUnlock();
+    sched_stats_iteration_end(TIM_CNT(TIM5), TIM_ARR(TIM5), overrun);
+    trace_event(TRACE_EVENT_SOLN_END, 0);
+
     /* Waiting for the timer IRQ fire.*/
     chBSemWait(&solution_wakeup_sem);
+    sched_latency_wake(SCHED_LATENCY_TIM5);
+    sched_stats_iteration_start(TIM_CNT(TIM5));
+    trace_event(TRACE_EVENT_SOLN_START, 0);
 
     watchdog_notify(WD_NOTIFY_SOLUTION);
 
@@ -385,9 +568,9 @@ static msg_t solution_thread(void *arg)
     channel_measurement_t meas[MAX_CHANNELS];
     for (u8 i=0; i<nap_track_n_channels; i++) {
       if (use_tracking_channel(i)) {
-        __asm__("CPSID i;");
+        irq_disable();
         tracking_update_measurement(i, &meas[n_ready]);
-        __asm__("CPSIE i;");
+        irq_enable();
         n_ready++;
       }
     }
@@ -402,7 +585,9 @@ static msg_t solution_thread(void *arg)
      * more intelligent with the solution time.
      */
     static u8 n_ready_old = 0;
-    u64 nav_tc = nap_timing_count();
+    /* Read over SPI rather than extrapolated, this is the time
+     * set_time_fine() is given. */
+    u64 nav_tc = nap_timing_count_read();
     static navigation_measurement_t nav_meas[MAX_CHANNELS];
     chMtxLock(&es_mutex);
     calc_navigation_measurement(n_ready, meas, nav_meas,
@@ -423,144 +608,11 @@ static msg_t solution_thread(void *arg)
       continue;
     }
 
-    dops_t dops;
-    s8 ret;
-    /* disable_raim controlled by external setting. Defaults to false. */
-    if ((ret = calc_PVT(n_ready_tdcp, nav_meas_tdcp, disable_raim,
-                        &position_solution, &dops)) >= 0) {
-
-      if (ret == 1)
-        log_warn("calc_PVT: RAIM repair");
-
-      /* Update global position solution state. */
-      position_updated();
-      set_time_fine(nav_tc, position_solution.time);
-
-      /* Save elevation angles every so often */
-      DO_EVERY((u32)soln_freq,
-               update_sat_elevations(nav_meas_tdcp, n_ready_tdcp,
-                                     position_solution.pos_ecef));
-
-      if (!simulation_enabled()) {
-        /* Output solution. */
-        solution_send_sbp(&position_solution, &dops);
-        solution_send_nmea(&position_solution, &dops,
-                           n_ready_tdcp, nav_meas_tdcp,
-                           NMEA_GGA_FIX_GPS);
-      }
-
-      /* If we have a recent set of observations from the base station, do a
-       * differential solution. */
-      double pdt;
-      chMtxLock(&base_obs_lock);
-      if (base_obss.n > 0 && !simulation_enabled()) {
-        if ((pdt = gpsdifftime(position_solution.time, base_obss.t))
-              < MAX_AGE_OF_DIFFERENTIAL) {
-
-          /* Propagate base station observations to the current time and
-           * process a low-latency differential solution. */
-
-          /* Hook in low-latency filter here. */
-          if (dgnss_soln_mode == SOLN_MODE_LOW_LATENCY &&
-              base_obss.has_pos) {
-            chMtxLock(&es_mutex);
-            sdiff_t sdiffs[MAX(base_obss.n, n_ready_tdcp)];
-            u8 num_sdiffs = make_propagated_sdiffs(n_ready_tdcp, nav_meas_tdcp,
-                                    base_obss.n, base_obss.nm,
-                                    base_obss.sat_dists, base_obss.pos_ecef,
-                                    es, position_solution.time,
-                                    sdiffs);
-            chMtxUnlock();
-            if (num_sdiffs >= 4) {
-              output_baseline(num_sdiffs, sdiffs, &position_solution.time);
-            }
-          }
-
-        }
-      }
-      chMtxUnlock();
-
-      /* Calculate the time of the nearest solution epoch, were we expected
-       * to be and calculate how far we were away from it. */
-      double expected_tow = round(position_solution.time.tow*soln_freq)
-                              / soln_freq;
-      double t_err = expected_tow - position_solution.time.tow;
-
-      /* Only send observations that are closely aligned with the desired
-       * solution epochs to ensure they haven't been propagated too far. */
-      /* Output obervations only every obs_output_divisor times, taking
-       * care to ensure that the observations are aligned. */
-      double t_check = expected_tow * (soln_freq / obs_output_divisor);
-      if (fabs(t_err) < OBS_PROPAGATION_LIMIT &&
-          fabs(t_check - (u32)t_check) < TIME_MATCH_THRESHOLD) {
-        /* Propagate observation to desired time. */
-        for (u8 i=0; i<n_ready_tdcp; i++) {
-          nav_meas_tdcp[i].pseudorange -= t_err * nav_meas_tdcp[i].doppler *
-            (GPS_C / GPS_L1_HZ);
-          nav_meas_tdcp[i].carrier_phase += t_err * nav_meas_tdcp[i].doppler;
-        }
-
-        /* Update observation time. */
-        gps_time_t new_obs_time;
-        new_obs_time.wn = position_solution.time.wn;
-        new_obs_time.tow = expected_tow;
-
-        if (!simulation_enabled()) {
-          send_observations(n_ready_tdcp, &new_obs_time, nav_meas_tdcp);
-        }
-
-        /* TODO: use a buffer from the pool from the start instead of
-         * allocating nav_meas_tdcp as well. Downside, if we don't end up
-         * pushing the message into the mailbox then we just wasted an
-         * observation from the mailbox for no good reason. */
-
-        obss_t *obs = chPoolAlloc(&obs_buff_pool);
-        msg_t ret;
-        if (obs == NULL) {
-          /* Pool is empty, grab a buffer from the mailbox instead, i.e.
-           * overwrite the oldest item in the queue. */
-          ret = chMBFetch(&obs_mailbox, (msg_t *)&obs, TIME_IMMEDIATE);
-          if (ret != RDY_OK) {
-            log_error("Pool full and mailbox empty!");
-          }
-        }
-        obs->t = new_obs_time;
-        obs->n = n_ready_tdcp;
-        memcpy(obs->nm, nav_meas_tdcp, obs->n * sizeof(navigation_measurement_t));
-        ret = chMBPost(&obs_mailbox, (msg_t)obs, TIME_IMMEDIATE);
-        if (ret != RDY_OK) {
-          /* We could grab another item from the mailbox, discard it and then
-           * post our obs again but if the size of the mailbox and the pool
-           * are equal then we should have already handled the case where the
-           * mailbox is full when we handled the case that the pool was full.
-           * */
-          log_error("Mailbox should have space!");
-        }
-      }
-
-      /* Calculate time till the next desired solution epoch. */
-      double dt = expected_tow + (1.0/soln_freq) - position_solution.time.tow;
-
-      /* Limit dt to 2 seconds maximum to prevent hang if dt calculated
-       * incorrectly. */
-      if (dt > 2)
-        dt = 2;
-
+    double dt = solution_process_obs(n_ready_tdcp, nav_meas_tdcp, nav_tc);
+    if (dt > 0) {
       /* Reset timer period with the count that we will estimate will being
        * us up to the next solution time. */
       timer_set_period_check(TIM5, round(65472000 * dt));
-
-    } else {
-      /* An error occurred with calc_PVT! */
-      /* TODO: Make this based on time since last error instead of a simple
-       * count. */
-      /* pvt_err_msg defined in libswiftnav/pvt.c */
-      DO_EVERY((u32)soln_freq,
-        log_warn("PVT solver: %s (code %d)", pvt_err_msg[-ret-1], ret);
-      );
-
-      /* Send just the DOPs */
-      solution_send_sbp(0, &dops);
     }
   }
   return 0;
@@ -781,6 +833,8 @@ void solution_setup()
 
   chMtxInit(&amb_state_lock);
 
+  sched_stats_setup();
+
   /* Initialise solution thread wakeup semaphore */
   chBSemInit(&solution_wakeup_sem, TRUE);
   /* Start solution thread */
@@ -49,6 +49,9 @@ void solution_send_nmea(gnss_solution *soln, dops_t *dops,
                         u8 fix_type);
 void solution_send_baseline(const gps_time_t *t, u8 n_sats, double b_ecef[3],
                             double ref_ecef[3], u8 flags);
+double solution_process_obs(u8 n_ready_tdcp,
+                            navigation_measurement_t nav_meas_tdcp[],
+                            u64 nav_tc);
 void solution_setup(void);
 
 #endif
@@ -22,6 +22,7 @@
 #include <libswiftnav/coord_system.h>
 
 #include "board/nap/nap_common.h"
+#include "board/nap/nap_xfer.h"
 #include "board/max2769.h"
 #include "board/leds.h"
 #include "peripherals/watchdog.h"
@@ -31,6 +32,7 @@
 #include "simulator.h"
 #include "system_monitor.h"
 #include "position.h"
+#include "sched_stats.h"
 
 #define WATCHDOG_HARDWARE_PERIOD_MS 30000  /* Actual period may vary +88% -32% */
 #define WATCHDOG_THREAD_PERIOD_MS 15000
@@ -197,10 +199,18 @@ static msg_t system_monitor_thread(void *arg)
 
     send_thread_states();
 
+    DO_EVERY(SCHED_STATS_WINDOW, sched_stats_send());
+
+    nap_timing_count_stats_send();
+    nap_xfer_stats_send();
+
     u32 err = nap_error_rd_blocking();
     if (err) {
-      log_error("SwiftNAP Error: 0x%08X", (unsigned int)err);
+      log_error("SwiftNAP Error: 0x%08X, worst NAP IRQ latency %u us",
+                (unsigned int)err,
+                (unsigned int)sched_latency_max_us(SCHED_LATENCY_NAP_EXTI));
     }
+    sched_latency_send(err);
 
     sleep_until(&time, MS2ST(heartbeat_period_milliseconds));
   }
@@ -272,10 +282,8 @@ static msg_t watchdog_thread(void *arg)
 
 void system_monitor_setup()
 {
-  /* Setup cycle counter for measuring thread CPU time. */
-  SCS_DEMCR |= 0x01000000;
-  DWT_CYCCNT = 0; /* Reset the counter. */
-  DWT_CTRL |= 1 ; /* Enable the counter. */
+  /* The cycle counter used for measuring thread CPU time is enabled in
+   * nap_setup(). */
 
   SETTING("system_monitor", "heartbeat_period_milliseconds", heartbeat_period_milliseconds, TYPE_INT);
   SETTING("system_monitor", "watchdog", use_wdt, TYPE_BOOL);
@@ -16,10 +16,10 @@
 
 #include <libsbp/sbp.h>
 #include <libswiftnav/logging.h>
-#include <libswiftnav/linear_algebra.h>
 
 #include "board/nap/nap_common.h"
 #include "main.h"
+#include "matrix_fixed.h"
 #include "sbp.h"
 #include "timing.h"
 
@@ -105,7 +105,7 @@ void clock_est_update(clock_est_state_t *s, gps_time_t meas_gpst,
 
   double phi_t_0[2][2] = {{1, localt}, {0, 1}};
   double phi_t_0_tr[2][2];
-  matrix_transpose(2, 2, (const double *)phi_t_0, (double *)phi_t_0_tr);
+  mat2_transpose((const double *)phi_t_0, (double *)phi_t_0_tr);
 
   double P_[2][2];
   memcpy(P_, s->P, sizeof(P_));
@@ -119,29 +119,29 @@ void clock_est_update(clock_est_state_t *s, gps_time_t meas_gpst,
   y[1] = meas_clock_period - s->clock_period;
 
   double S[2][2];
-  matrix_multiply(2, 2, 2, (const double *)phi_t_0, (const double *)P_, (double *)temp);
-  matrix_multiply(2, 2, 2, (const double *)temp, (const double *)phi_t_0_tr, (double *)S);
+  mat2_mul((const double *)phi_t_0, (const double *)P_, (double *)temp);
+  mat2_mul((const double *)temp, (const double *)phi_t_0_tr, (double *)S);
   S[0][0] += r_gpst;
   S[1][1] += r_clock_period;
   double Sinv[2][2];
-  matrix_inverse(2, (const double *)S, (double *)Sinv);
+  mat2_inv((const double *)S, (double *)Sinv);
 
   double K[2][2];
-  matrix_multiply(2, 2, 2, (const double *)P_, (const double *)phi_t_0_tr, (double *)temp);
-  matrix_multiply(2, 2, 2, (const double *)temp, (const double *)Sinv, (double *)K);
+  mat2_mul((const double *)P_, (const double *)phi_t_0_tr, (double *)temp);
+  mat2_mul((const double *)temp, (const double *)Sinv, (double *)K);
 
   double dx[2];
-  matrix_multiply(2, 2, 1, (const double *)K, (const double *)y, (double *)dx);
+  mat2_mul_vec((const double *)K, y, dx);
   s->t0_gps.tow += dx[0];
   s->t0_gps = normalize_gps_time(s->t0_gps);
   s->clock_period += dx[1];
 
-  matrix_multiply(2, 2, 2, (const double *)K, (const double *)phi_t_0, (double *)temp);
+  mat2_mul((const double *)K, (const double *)phi_t_0, (double *)temp);
   temp[0][0] = 1 - temp[0][0];
   temp[0][1] = -temp[0][1];
   temp[1][1] = 1 - temp[1][1];
   temp[1][0] = -temp[1][0];
-  matrix_multiply(2, 2, 2, (const double *)temp, (const double *)P_, (double *)s->P);
+  mat2_mul((const double *)temp, (const double *)P_, (double *)s->P);
 
 }
 
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <string.h>
+
+#include <ch.h>
+
+#include <libswiftnav/logging.h>
+
+#include "sbp.h"
+#include "sbp_ext.h"
+#include "settings.h"
+#include "trace.h"
+
+/** \defgroup trace Event Trace
+ * Record a timeline of what the firmware is doing for offline analysis.
+ *
+ * Events are timestamped with the DWT cycle counter and written into a ring
+ * buffer in RAM, overwriting the oldest, whenever the `trace.enable` setting
+ * is set. Thread switches are recorded from the kernel's context switch hook,
+ * the other events are marked at their source with trace_event(), see
+ * trace_event_type_t.
+ *
+ * Sending \ref SBP_MSG_TRACE_REQ stops recording and streams the buffer out,
+ * recording starts again afresh once it has been sent. The `trace2json` host
+ * tool, see host/trace2json.c, turns the messages in an SBP capture into a
+ * Chrome trace / Perfetto timeline.
+ * \{ */
+
+bool trace_enabled = false;
+
+static struct {
+  msg_trace_event_t events[TRACE_BUFFER_LEN];
+  /** Events recorded since the buffer was reset, the next is written at
+   * count % TRACE_BUFFER_LEN. */
+  u32 count;
+} trace;
+
+static u8 thread_id_next;
+
+static WORKING_AREA_CCM(wa_trace_thread, 1024);
+static BinarySemaphore download_sem;
+
+/** Record an event, see trace_event(). */
+void trace_record(trace_event_type_t type, u16 arg)
+{
+  /* Claim a slot atomically so ISRs and the context switch hook can
+   * interleave with threads without a lock. */
+  u32 i = __sync_fetch_and_add(&trace.count, 1) & (TRACE_BUFFER_LEN - 1);
+  msg_trace_event_t *e = &trace.events[i];
+  e->cycles = DWT_CYCCNT;
+  e->type = type;
+  e->arg = arg;
+}
+
+/** Allocate an ID for a new thread's TRACE_EVENT_THREAD events. Called from
+ * the kernel's thread initialisation hook. */
+u8 trace_thread_id(void)
+{
+  return ++thread_id_next;
+}
+
+static void send_threads(void)
+{
+  Thread *tp = chRegFirstThread();
+  while (tp) {
+    msg_trace_thread_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.id = tp->p_trace_id;
+    if (chRegGetThreadName(tp))
+      strncpy(msg.name, chRegGetThreadName(tp), sizeof(msg.name));
+    sbp_send_msg_retry(SBP_MSG_TRACE_THREAD, sizeof(msg), (u8 *)&msg);
+    tp = chRegNextThread(tp);
+  }
+}
+
+static void send_events(void)
+{
+  u32 count = trace.count;
+  u32 n = MIN(count, TRACE_BUFFER_LEN);
+  u32 first = count - n;
+
+  msg_trace_data_t msg;
+  msg.n_seq = (n + TRACE_DATA_MAX_EVENTS - 1) / TRACE_DATA_MAX_EVENTS;
+  msg.lost = first;
+
+  for (msg.seq = 0; msg.seq < msg.n_seq; msg.seq++) {
+    u32 start = msg.seq * TRACE_DATA_MAX_EVENTS;
+    u32 len = MIN(n - start, TRACE_DATA_MAX_EVENTS);
+    for (u32 i = 0; i < len; i++)
+      msg.events[i] = trace.events[(first + start + i) & (TRACE_BUFFER_LEN - 1)];
+    sbp_send_msg_retry(SBP_MSG_TRACE_DATA,
+               sizeof(msg) - sizeof(msg.events)
+                 + len * sizeof(msg_trace_event_t),
+               (u8 *)&msg);
+  }
+}
+
+static msg_t trace_thread(void *arg)
+{
+  (void)arg;
+  chRegSetThreadName("trace");
+
+  while (TRUE) {
+    chBSemWait(&download_sem);
+
+    bool was_enabled = trace_enabled;
+    trace_enabled = false;
+    /* Let any event being recorded by a preempted thread land. */
+    chThdSleepMilliseconds(1);
+
+    send_threads();
+    send_events();
+
+    trace.count = 0;
+    trace_enabled = was_enabled;
+  }
+  return 0;
+}
+
+static void trace_req_callback(u16 sender_id, u8 len, u8 msg[], void *context)
+{
+  (void)len; (void)msg; (void)context;
+
+  if (sender_id != SBP_SENDER_ID) {
+    log_error("Invalid sender!");
+    return;
+  }
+
+  chBSemSignal(&download_sem);
+}
+
+static bool trace_enable_notify(struct setting *s, const char *val)
+{
+  bool was_enabled = trace_enabled;
+  if (!s->type->from_string(s->type->priv, s->addr, s->len, val))
+    return false;
+  /* Start each recording with an empty buffer. */
+  if (trace_enabled && !was_enabled)
+    trace.count = 0;
+  return true;
+}
+
+void trace_setup(void)
+{
+  SETTING_NOTIFY("trace", "enable", trace_enabled, TYPE_BOOL,
+                 trace_enable_notify);
+
+  chBSemInit(&download_sem, TRUE);
+
+  static sbp_msg_callbacks_node_t trace_req_node;
+  sbp_register_cbk(SBP_MSG_TRACE_REQ, &trace_req_callback, &trace_req_node);
+
+  chThdCreateStatic(wa_trace_thread, sizeof(wa_trace_thread),
+                    LOWPRIO+5, trace_thread, NULL);
+}
+
+/** \} */
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef SWIFTNAV_TRACE_H
+#define SWIFTNAV_TRACE_H
+
+/* Included from chconf.h for the context switch hook, can't use any ChibiOS
+ * types here. */
+
+#include <libswiftnav/common.h>
+
+/** \addtogroup trace
+ * \{ */
+
+/** Events in the trace buffer, the meaning of each event's argument is given
+ * after it. */
+typedef enum {
+  TRACE_EVENT_NONE = 0,
+  TRACE_EVENT_THREAD,       /**< Switched to thread, trace ID of the thread. */
+  TRACE_EVENT_NAP_IRQ,      /**< NAP IRQ line rose, none. */
+  TRACE_EVENT_NAP_START,    /**< NAP ISR thread servicing the NAP, none. */
+  TRACE_EVENT_NAP_END,      /**< NAP ISR thread done, tracking IRQ bits. */
+  TRACE_EVENT_TRACK_START,  /**< Tracking channel update, channel. */
+  TRACE_EVENT_TRACK_END,    /**< Tracking channel update done, channel. */
+  TRACE_EVENT_SOLN_START,   /**< Solution iteration, none. */
+  TRACE_EVENT_SOLN_END,     /**< Solution iteration done, none. */
+  TRACE_EVENT_SBP_TX,       /**< SBP message queued, message type. */
+  TRACE_EVENT_USART_TX_DONE,/**< USART TX DMA transfer done, bytes. */
+  TRACE_EVENT_N
+} trace_event_type_t;
+
+/** Events kept, the oldest are overwritten. Must be a power of two. */
+#define TRACE_BUFFER_LEN 1024
+
+/** \} */
+
+extern bool trace_enabled;
+
+void trace_record(trace_event_type_t type, u16 arg);
+u8 trace_thread_id(void);
+void trace_setup(void);
+
+/** Add an event to the trace buffer if tracing is enabled. Safe to call from
+ * any thread or ISR, and from the kernel's context switch hook. */
+static inline void trace_event(trace_event_type_t type, u16 arg)
+{
+  if (trace_enabled)
+    trace_record(type, arg);
+}
+
+#endif  /* SWIFTNAV_TRACE_H */
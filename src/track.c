@@ -24,42 +24,13 @@
 #include <libswiftnav/constants.h>
 #include <libswiftnav/logging.h>
 
-/*  code: nbw zeta k carr_to_code
- carrier:                    nbw  zeta k fll_aid */
-#define LOOP_PARAMS_SLOW \
-  "(1 ms, (1, 0.7, 1, 1540), (10, 0.7, 1, 5))," \
- "(20 ms, (1, 0.7, 1, 1540), (12, 0.7, 1, 0))"
-
-#define LOOP_PARAMS_MED \
-  "(1 ms, (1, 0.7, 1, 1540), (10, 0.7, 1, 5))," \
-  "(5 ms, (1, 0.7, 1, 1540), (50, 0.7, 1, 0))"
-
-#define LOOP_PARAMS_FAST \
-  "(1 ms, (1, 0.7, 1, 1540), (40, 0.7, 1, 5))," \
-  "(4 ms, (1, 0.7, 1, 1540), (62, 0.7, 1, 0))"
-
-#define LOOP_PARAMS_EXTRAFAST \
-  "(1 ms, (1, 0.7, 1, 1540), (50, 0.7, 1, 5))," \
-  "(2 ms, (1, 0.7, 1, 1540), (100, 0.7, 1, 0))"
-
-
-/*                          k1,   k2,  lp,  lo */
-#define LD_PARAMS_PESS     "0.10, 1.4, 200, 50"
-#define LD_PARAMS_NORMAL   "0.05, 1.4, 150, 50"
-#define LD_PARAMS_OPT      "0.02, 1.1, 150, 50"
-#define LD_PARAMS_EXTRAOPT "0.02, 0.8, 150, 50"
-
 char loop_params_string[120] = LOOP_PARAMS_MED;
 char lock_detect_params_string[24] = LD_PARAMS_NORMAL;
 bool use_alias_detection = true;
 
 #define CN0_EST_LPF_CUTOFF 0.3
 
-static struct loop_params {
-  float code_bw, code_zeta, code_k, carr_to_code;
-  float carr_bw, carr_zeta, carr_k, carr_fll_aid_gain;
-  u8 coherent_ms;
-} loop_params_stage[2];
+static loop_params_t loop_params_stage[2];
 
 static struct lock_detect_params {
   float k1, k2;
@@ -169,7 +140,7 @@ void tracking_channel_init(u8 channel, u8 prn, float carrier_freq,
   /* Calculate code phase rate with carrier aiding. */
   float code_phase_rate = (1 + carrier_freq/GPS_L1_HZ) * GPS_CA_CHIPPING_RATE;
 
-  const struct loop_params *l = &loop_params_stage[0];
+  const loop_params_t *l = &loop_params_stage[0];
   aided_tl_init(&(chan->tl_state), 1e3 / l->coherent_ms,
                 code_phase_rate - GPS_CA_CHIPPING_RATE,
                 l->code_bw, l->code_zeta, l->code_k,
@@ -424,7 +395,7 @@ void tracking_channel_update(u8 channel)
         log_info("PRN %d synced @ %u ms, %.1f dBHz",
                  chan->prn+1, (unsigned int)chan->update_count, chan->cn0);
         chan->stage = 1;
-        struct loop_params *l = &loop_params_stage[1];
+        loop_params_t *l = &loop_params_stage[1];
         chan->int_ms = l->coherent_ms;
         chan->short_cycle = true;
 
@@ -530,17 +501,9 @@ void tracking_send_state()
 
   if (simulation_enabled_for(SIMULATION_MODE_TRACKING)) {
 
-    u8 num_sats = simulation_current_num_sats();
-    for (u8 i=0; i < num_sats; i++) {
+    for (u8 i=0; i < nap_track_n_channels; i++) {
       states[i] = simulation_current_tracking_state(i);
     }
-    if (num_sats < nap_track_n_channels) {
-      for (u8 i = num_sats; i < nap_track_n_channels; i++) {
-        states[i].state = TRACKING_DISABLED;
-        states[i].sid   = 0;
-        states[i].cn0   = -1;
-      }
-    }
 
   } else {
 
@@ -559,47 +522,72 @@ void tracking_send_state()
 
 }
 
-/** Parse a string describing the tracking loop filter parameters into
-    the loop_params_stage structs. */
-static bool parse_loop_params(struct setting *s, const char *val)
+/** Parse a string describing the tracking loop filter parameters, see
+ * LOOP_PARAMS_MED.
+ *
+ * \param val String of loop parameters for one or two stages
+ * \param l   Parameters of the first and second stages
+ * \return True if the string is well formed and the integration lengths are
+ *         supported
+ */
+bool tracking_parse_loop_params(const char *val, loop_params_t l[2])
 {
   /** The string contains loop parameters for either one or two
       stages.  If the second is omitted, we'll use the same parameters
       as the first stage.*/
 
-  struct loop_params loop_params_parse[2];
-
   const char *str = val;
   for (int stage = 0; stage < 2; stage++) {
-    struct loop_params *l = &loop_params_parse[stage];
+    loop_params_t *p = &l[stage];
 
     int n_chars_read = 0;
     unsigned int tmp; /* newlib's sscanf doesn't support hh size modifier */
     
     if (sscanf(str, "( %u ms , ( %f , %f , %f , %f ) , ( %f , %f , %f , %f ) ) , %n",
                &tmp,
-               &l->code_bw, &l->code_zeta, &l->code_k, &l->carr_to_code,
-               &l->carr_bw, &l->carr_zeta, &l->carr_k, &l->carr_fll_aid_gain,
+               &p->code_bw, &p->code_zeta, &p->code_k, &p->carr_to_code,
+               &p->carr_bw, &p->carr_zeta, &p->carr_k, &p->carr_fll_aid_gain,
                &n_chars_read) < 9) {
       log_error("Ill-formatted tracking loop param string.");
       return false;
     }
-    l->coherent_ms = tmp;
+    p->coherent_ms = tmp;
     /* If string omits second-stage parameters, then after the first
        stage has been parsed, n_chars_read == 0 because of missing
-       comma and we'll parse the string again into loop_params_parse[1]. */
+       comma and we'll parse the string again into l[1]. */
     str += n_chars_read;
 
-    if ((l->coherent_ms == 0)
-        || ((20 % l->coherent_ms) != 0) /* i.e. not 1, 2, 4, 5, 10 or 20 */
-        || (stage == 0 && l->coherent_ms != 1)) {
+    if ((p->coherent_ms == 0)
+        || ((20 % p->coherent_ms) != 0) /* i.e. not 1, 2, 4, 5, 10 or 20 */
+        || (stage == 0 && p->coherent_ms != 1)) {
       log_error("Invalid coherent integration length.");
       return false;
     }
   }
+  return true;
+}
+
+/** Use new tracking loop filter parameters for the channels initialised
+ * from now on.
+ * \param l Parameters of the first and second stages
+ */
+void tracking_set_loop_params(const loop_params_t l[2])
+{
+  memcpy(loop_params_stage, l, sizeof(loop_params_stage));
+}
+
+/** Parse a string describing the tracking loop filter parameters into
+    the loop_params_stage structs. */
+static bool parse_loop_params(struct setting *s, const char *val)
+{
+  loop_params_t loop_params_parse[2];
+
+  if (!tracking_parse_loop_params(val, loop_params_parse))
+    return false;
+
   /* Successfully parsed both stages.  Save to memory. */
   strncpy(s->addr, val, s->len);
-  memcpy(loop_params_stage, loop_params_parse, sizeof(loop_params_stage));
+  tracking_set_loop_params(loop_params_parse);
   return true;
 }
 
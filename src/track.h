@@ -29,6 +29,37 @@
 #define TRACKING_ELEVATION_UNKNOWN 100 /* Ensure it will be above elev. mask */
 extern u8 n_rollovers;
 
+/*  code: nbw zeta k carr_to_code
+ carrier:                    nbw  zeta k fll_aid */
+#define LOOP_PARAMS_SLOW \
+  "(1 ms, (1, 0.7, 1, 1540), (10, 0.7, 1, 5))," \
+ "(20 ms, (1, 0.7, 1, 1540), (12, 0.7, 1, 0))"
+
+#define LOOP_PARAMS_MED \
+  "(1 ms, (1, 0.7, 1, 1540), (10, 0.7, 1, 5))," \
+  "(5 ms, (1, 0.7, 1, 1540), (50, 0.7, 1, 0))"
+
+#define LOOP_PARAMS_FAST \
+  "(1 ms, (1, 0.7, 1, 1540), (40, 0.7, 1, 5))," \
+  "(4 ms, (1, 0.7, 1, 1540), (62, 0.7, 1, 0))"
+
+#define LOOP_PARAMS_EXTRAFAST \
+  "(1 ms, (1, 0.7, 1, 1540), (50, 0.7, 1, 5))," \
+  "(2 ms, (1, 0.7, 1, 1540), (100, 0.7, 1, 0))"
+
+/** Tracking loop filter parameters of one stage, see LOOP_PARAMS_MED. */
+typedef struct {
+  float code_bw, code_zeta, code_k, carr_to_code;
+  float carr_bw, carr_zeta, carr_k, carr_fll_aid_gain;
+  u8 coherent_ms;
+} loop_params_t;
+
+/*                          k1,   k2,  lp,  lo */
+#define LD_PARAMS_PESS     "0.10, 1.4, 200, 50"
+#define LD_PARAMS_NORMAL   "0.05, 1.4, 150, 50"
+#define LD_PARAMS_OPT      "0.02, 1.1, 150, 50"
+#define LD_PARAMS_EXTRAOPT "0.02, 0.8, 150, 50"
+
 /** Tracking channel parameters as of end of last correlation period. */
 typedef struct {
   u8 state;                    /**< Tracking channel state. */
@@ -92,6 +123,8 @@ void tracking_channel_ambiguity_unknown(u8 channel);
 void tracking_update_measurement(u8 channel, channel_measurement_t *meas);
 void tracking_send_state(void);
 void tracking_setup(void);
+bool tracking_parse_loop_params(const char *val, loop_params_t l[2]);
+void tracking_set_loop_params(const loop_params_t l[2]);
 void tracking_drop_satellite(u8 prn);
 
 #endif
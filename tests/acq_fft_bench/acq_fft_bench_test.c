@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* Throughput of the host FFT acquisition engine with increasing numbers of
+ * threads, in PRN-carrier frequency bins searched per second of wall time.
+ * A full cold start search is every PRN over +-7 kHz, 32 x 17 bins once
+ * rounded out to whole FFT bins. The search is first checked to find a
+ * synthetic signal. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libswiftnav/prns.h>
+
+#include "main.h"
+#include "host/acq_fft.h"
+#include "host/correlator.h"
+
+#define BENCH_PRNS      32
+#define BENCH_CF_MIN    -7000
+#define BENCH_CF_MAX    7000
+#define BENCH_CF_WIDTH  1000
+#define BENCH_REPEATS   2
+
+#define IF_FREQ 4.092e6
+
+#define SIGNAL_PRN      12
+#define SIGNAL_CP       511.5
+#define SIGNAL_DOPPLER  3000.0
+
+static s8 samples[ACQ_FFT_N_SAMPLES];
+static acq_fft_load_t load;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** 2 bit samples of one PRN at SIGNAL_CP and SIGNAL_DOPPLER in noise. */
+static void synthesise(void)
+{
+  static const s8 levels[4] = {-3, -1, 1, 3};
+  const u8 *code = ca_code(SIGNAL_PRN);
+  srand(1);
+  for (u32 i = 0; i < ACQ_FFT_N_SAMPLES; i++) {
+    double t = i / (double)SAMPLE_FREQ;
+    /* The code phase reported is that of the first sample. */
+    u16 chip = (u16)fmod(SIGNAL_CP + t * 1.023e6, 1023);
+    s8 c = (code[chip / 8] >> (7 - chip % 8)) & 1 ? -1 : 1;
+    double x = 0.5 * c * cos(2 * M_PI * (IF_FREQ + SIGNAL_DOPPLER) * t)
+               + 2.0 * (rand() / (double)RAND_MAX - 0.5);
+    samples[i] = levels[MIN(MAX((s32)floor(x + 2), 0), 3)];
+  }
+}
+
+static bool check(void)
+{
+  float cp, cf, cn0;
+  acq_fft_search(&load, SIGNAL_PRN, BENCH_CF_MIN, BENCH_CF_MAX, BENCH_CF_WIDTH,
+                 &cp, &cf, &cn0);
+  printf("PRN %u found at %.2f chips, %.0f Hz, %.1f dBHz\n",
+         SIGNAL_PRN + 1, cp, cf, cn0);
+  return fabs(cp - SIGNAL_CP) < 0.5
+         && fabs(cf - SIGNAL_DOPPLER) < BENCH_CF_WIDTH;
+}
+
+/** Carrier frequencies searched by acq_fft_search(). */
+static u32 search_bins(void)
+{
+  s32 step = MAX(BENCH_CF_WIDTH * ACQ_FFT_CARRIER_FREQ_UNITS_PER_HZ, 1);
+  s32 first = step * floor(BENCH_CF_MIN * ACQ_FFT_CARRIER_FREQ_UNITS_PER_HZ /
+                           (float)step);
+  s32 last = step * ceil(BENCH_CF_MAX * ACQ_FFT_CARRIER_FREQ_UNITS_PER_HZ /
+                         (float)step);
+  return (last - first) / step + 1;
+}
+
+static double bench(void)
+{
+  float cp, cf, cn0;
+  u32 n_bins = 0;
+  double t0 = now();
+  for (u32 r = 0; r < BENCH_REPEATS; r++) {
+    for (u8 prn = 0; prn < BENCH_PRNS; prn++) {
+      acq_fft_search(&load, prn, BENCH_CF_MIN, BENCH_CF_MAX, BENCH_CF_WIDTH,
+                     &cp, &cf, &cn0);
+      n_bins += search_bins();
+    }
+  }
+  return n_bins / (now() - t0);
+}
+
+int main(void)
+{
+  printf("--- FFT ACQUISITION BENCHMARK ---\n");
+
+  synthesise();
+  correlator_setup();
+  acq_fft_setup(IF_FREQ, 1);
+
+  double t0 = now();
+  acq_fft_load(&load, samples);
+  printf("load     %8.2f ms\n", (now() - t0) * 1e3);
+
+  if (!check())
+    return 1;
+
+  u8 n_cpus = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1), ACQ_FFT_MAX_THREADS);
+  for (u8 n_threads = 1; n_threads <= n_cpus; n_threads *= 2) {
+    acq_fft_setup(IF_FREQ, n_threads);
+    printf("%2u threads %8.1f PRN-bins/s\n", n_threads, bench());
+  }
+
+  return 0;
+}
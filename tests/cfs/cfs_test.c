@@ -13,13 +13,118 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <ch.h>
+
 #include "init.h"
 #include "main.h"
+#include "sched_stats.h"
+#include "board/nap/nap_common.h"
 #include "cfs/cfs.h"
 #include "cfs/cfs-coffee.h"
 #include "cfs/cfs-coffee-arch.h"
 #define COFFEE_SECTOR_COUNT	(unsigned)(COFFEE_SIZE / COFFEE_SECTOR_SIZE)
 
+/* Throughput of reading and writing a file in chunks the size of an SBP file
+ * transfer. The file is reserved up front so the writes don't include Coffee
+ * growing it. */
+#define BENCH_FILE_SIZE (32*1024)
+#define BENCH_CHUNK 255
+
+static float kb_per_s(u32 bytes, u32 cycles)
+{
+  return bytes / 1024.0 / (cycles / (SCHED_DWT_TICKS_PER_US * 1e6));
+}
+
+static void bench(void)
+{
+  static u8 chunk[BENCH_CHUNK], check[BENCH_CHUNK];
+  for (u32 i = 0; i < BENCH_CHUNK; i++)
+    chunk[i] = i;
+
+  if (cfs_coffee_reserve("bench", BENCH_FILE_SIZE) < 0) {
+    printf("Can't reserve benchmark file\n");
+    return;
+  }
+
+  int fd = cfs_open("bench", CFS_WRITE);
+  u32 written = 0;
+  u32 t0 = DWT_CYCCNT;
+  while (written + BENCH_CHUNK <= BENCH_FILE_SIZE) {
+    if (cfs_write(fd, chunk, BENCH_CHUNK) != BENCH_CHUNK)
+      break;
+    written += BENCH_CHUNK;
+  }
+  u32 write_cycles = DWT_CYCCNT - t0;
+  cfs_close(fd);
+
+  fd = cfs_open("bench", CFS_READ);
+  u32 read = 0;
+  t0 = DWT_CYCCNT;
+  while (read < written) {
+    if (cfs_read(fd, check, BENCH_CHUNK) != BENCH_CHUNK)
+      break;
+    read += BENCH_CHUNK;
+  }
+  u32 read_cycles = DWT_CYCCNT - t0;
+  cfs_close(fd);
+
+  if (memcmp(chunk, check, BENCH_CHUNK) != 0)
+    printf("Benchmark file read back wrong\n");
+
+  printf("Write %u bytes: %.1f KB/s\n", (unsigned int)written,
+         kb_per_s(written, write_cycles));
+  printf("Read %u bytes: %.1f KB/s\n", (unsigned int)read,
+         kb_per_s(read, read_cycles));
+  cfs_remove("bench");
+}
+
+/* Latency of opening a file, with 1, 16 and 64 files on the filesystem. Each
+ * file is opened and closed once. */
+#define BENCH_OPEN_FILES 64
+#define BENCH_OPEN_FILE_SIZE 64
+
+static void bench_open(void)
+{
+  static const u32 n_files[] = {1, 16, BENCH_OPEN_FILES};
+  char name[8];
+  u32 created = 0;
+
+  for (u32 k = 0; k < sizeof(n_files) / sizeof(n_files[0]); k++) {
+    for (; created < n_files[k]; created++) {
+      sprintf(name, "o%u", (unsigned int)created);
+      if (cfs_coffee_reserve(name, BENCH_OPEN_FILE_SIZE) < 0) {
+        printf("Can't reserve benchmark file %s\n", name);
+        return;
+      }
+    }
+
+    u32 total = 0, max = 0;
+    for (u32 i = 0; i < created; i++) {
+      sprintf(name, "o%u", (unsigned int)i);
+      u32 t0 = DWT_CYCCNT;
+      int fd = cfs_open(name, CFS_READ);
+      u32 cycles = DWT_CYCCNT - t0;
+      if (fd < 0) {
+        printf("Can't open benchmark file %s\n", name);
+        return;
+      }
+      cfs_close(fd);
+      total += cycles;
+      max = MAX(max, cycles);
+    }
+
+    printf("Open with %u files: mean %u us, max %u us\n",
+           (unsigned int)created,
+           (unsigned int)(total / created / SCHED_DWT_TICKS_PER_US),
+           (unsigned int)(max / SCHED_DWT_TICKS_PER_US));
+  }
+
+  for (u32 i = 0; i < created; i++) {
+    sprintf(name, "o%u", (unsigned int)i);
+    cfs_remove(name);
+  }
+}
+
 int main()
 {
   init();
@@ -59,6 +164,10 @@ int main()
     if (ret < 0) while(1);
   }
 
+  printf("--- COFFEE BENCHMARK ---\n");
+  bench();
+  bench_open();
+
   while (1);
 
 	return 0;
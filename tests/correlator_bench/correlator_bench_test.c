@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* Throughput of the host software correlator with each instruction set the
+ * CPU supports, in channel-seconds of samples correlated per second of wall
+ * time. Anything over the number of tracking channels keeps up with the
+ * front end. Each instruction set is first checked against the per sample
+ * reference correlator. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "main.h"
+#include "host/correlator.h"
+
+#define BENCH_SECONDS    2
+#define BENCH_CHANNELS   12
+#define BENCH_PERIOD     (SAMPLE_FREQ / 1000)
+#define BENCH_N_SAMPLES  (BENCH_SECONDS * SAMPLE_FREQ)
+/** Periods per channel checked against the reference correlator. */
+#define CHECK_PERIODS    20
+
+#define IF_FREQ 4.092e6
+
+static s8 samples[BENCH_N_SAMPLES];
+static correlator_code_t codes[BENCH_CHANNELS];
+
+/* Keep the compiler from dropping the correlations. */
+static volatile s32 sink;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** NCO of channel ch for 1 ms period p, each channel at its own Doppler. */
+static correlator_nco_t channel_nco(u8 ch, u32 p)
+{
+  double doppler = -4000 + 700 * ch;
+  double code_rate = (1 + doppler / 1575.42e6) / 16;
+  double carr_rate = (IF_FREQ + doppler) / SAMPLE_FREQ;
+  u64 k = (u64)p * BENCH_PERIOD;
+
+  correlator_nco_t nco = {
+    .n_samples = BENCH_PERIOD,
+    .code_phase = (u64)((97.3 * ch + k * code_rate) * 4294967296.0),
+    .code_phase_rate = (u32)(code_rate * 4294967296.0),
+    .carrier_phase = (u32)(u64)(k * carr_rate * 4294967296.0),
+    .carrier_phase_rate = (u32)(carr_rate * 4294967296.0),
+  };
+  return nco;
+}
+
+static bool check(void)
+{
+  for (u8 ch = 0; ch < BENCH_CHANNELS; ch++) {
+    for (u32 p = 0; p < CHECK_PERIODS; p++) {
+      correlator_nco_t nco = channel_nco(ch, p);
+      /* Odd lengths exercise the vector tails. */
+      nco.n_samples -= p;
+      corr_t a[3], b[3];
+      correlator_track(&samples[p * BENCH_PERIOD], &codes[ch], &nco, a);
+      correlator_track_ref(&samples[p * BENCH_PERIOD], &codes[ch], &nco, b);
+      if (memcmp(a, b, sizeof(a)) != 0) {
+        printf("MISMATCH channel %u period %u: %d,%d %d,%d %d,%d vs "
+               "%d,%d %d,%d %d,%d\n", ch, p,
+               a[0].I, a[0].Q, a[1].I, a[1].Q, a[2].I, a[2].Q,
+               b[0].I, b[0].Q, b[1].I, b[1].Q, b[2].I, b[2].Q);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static double bench(void (*track)(const s8 [], const correlator_code_t *,
+                                  const correlator_nco_t *, corr_t [3]),
+                    u32 n_periods)
+{
+  double t0 = now();
+  for (u32 p = 0; p < n_periods; p++) {
+    for (u8 ch = 0; ch < BENCH_CHANNELS; ch++) {
+      correlator_nco_t nco = channel_nco(ch, p);
+      corr_t corrs[3];
+      track(&samples[p * BENCH_PERIOD], &codes[ch], &nco, corrs);
+      sink = corrs[1].I;
+    }
+  }
+  double elapsed = now() - t0;
+  return BENCH_CHANNELS * n_periods * 1e-3 / elapsed;
+}
+
+int main(void)
+{
+  printf("--- CORRELATOR BENCHMARK ---\n");
+
+  /* Noise only, the correlations don't matter for throughput. */
+  static const s8 levels[4] = {1, 3, -1, -3};
+  srand(1);
+  for (u32 i = 0; i < BENCH_N_SAMPLES; i++)
+    samples[i] = levels[rand() & 3];
+
+  correlator_setup();
+  correlator_isa_t best = correlator_isa();
+  for (u8 ch = 0; ch < BENCH_CHANNELS; ch++)
+    correlator_code(2 * ch + 1, &codes[ch]);
+
+  u32 n_periods = BENCH_SECONDS * 1000 - 1;
+  printf("%-8s %8.2f channel-s/s\n", "ref",
+         bench(correlator_track_ref, n_periods / 10));
+
+  bool ok = true;
+  for (u8 isa = 0; isa <= best; isa++) {
+    if (!correlator_isa_set(isa))
+      continue;
+    if (!check()) {
+      ok = false;
+      continue;
+    }
+    printf("%-8s %8.2f channel-s/s\n", correlator_isa_name(isa),
+           bench(correlator_track, n_periods));
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* Compare the fixed-size kernels in matrix_fixed.h against the generic
+ * libswiftnav linear algebra routines they replace. On target the timings are
+ * in DWT cycles, on the host (built with `make host`) they are in ns. */
+
+#include <stdio.h>
+#include <math.h>
+
+#include <libswiftnav/linear_algebra.h>
+
+#include "matrix_fixed.h"
+
+#ifdef MATRIX_BENCH_HOST
+
+#include <time.h>
+
+#define BENCH_ITERATIONS 1000000
+#define BENCH_UNITS "ns"
+
+static u32 bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#else
+
+#include <ch.h>
+
+#include "init.h"
+#include "main.h"
+#include "board/leds.h"
+#include "board/nap/nap_common.h"
+
+#define BENCH_ITERATIONS 1000
+#define BENCH_UNITS "cycles"
+
+static u32 bench_now(void)
+{
+  return DWT_CYCCNT;
+}
+
+#endif
+
+/* Keep the compiler from hoisting the kernels out of the timing loops. */
+static volatile double sink;
+
+#define BENCH(name, expr) ({                                  \
+  u32 t0 = bench_now();                                       \
+  for (u32 _i = 0; _i < BENCH_ITERATIONS; _i++) {             \
+    expr;                                                     \
+    __asm__ volatile("" ::: "memory");                        \
+  }                                                           \
+  (float)(bench_now() - t0) / BENCH_ITERATIONS;               \
+})
+
+static void report(const char *name, float generic, float fixed)
+{
+  if (generic > 0)
+    printf("%-16s generic %8.1f  fixed %8.1f  " BENCH_UNITS "  (x%.1f)\n\r",
+           name, generic, fixed, generic / fixed);
+  else
+    printf("%-16s                  fixed %8.1f  " BENCH_UNITS "\n\r",
+           name, fixed);
+}
+
+static double max_diff(u32 n, const double *a, const double *b)
+{
+  double d = 0;
+  for (u32 i = 0; i < n; i++)
+    d = MAX(d, fabs(a[i] - b[i]));
+  return d;
+}
+
+static void check(const char *name, u32 n, const double *a, const double *b)
+{
+  double d = max_diff(n, a, b);
+  if (d > 1e-9)
+    printf("MISMATCH %s: max diff %g\n\r", name, d);
+}
+
+/* Symmetric positive definite test matrices. */
+static double A2[4] = {4, 1,
+                       1, 3};
+static double A3[9] = {6, 2, 1,
+                       2, 5, 2,
+                       1, 2, 4};
+static double A4[16] = {8, 1, 2, 0,
+                        1, 7, 1, 2,
+                        2, 1, 6, 1,
+                        0, 2, 1, 5};
+
+#define BENCH_DIM(n, A)                                                       \
+  do {                                                                        \
+    double B[n*n], C[n*n], D[n*n];                                            \
+                                                                              \
+    matrix_multiply(n, n, n, A, A, C);                                        \
+    mat##n##_mul(A, A, D);                                                    \
+    check("mul" #n, n*n, C, D);                                               \
+    report("mul " #n "x" #n,                                                  \
+           BENCH("", matrix_multiply(n, n, n, A, A, B)),                      \
+           BENCH("", mat##n##_mul(A, A, B)));                                 \
+                                                                              \
+    matrix_transpose(n, n, A, C);                                             \
+    mat##n##_transpose(A, D);                                                 \
+    check("transpose" #n, n*n, C, D);                                         \
+    report("transpose " #n "x" #n,                                            \
+           BENCH("", matrix_transpose(n, n, A, B)),                           \
+           BENCH("", mat##n##_transpose(A, B)));                              \
+                                                                              \
+    matrix_inverse(n, A, C);                                                  \
+    mat##n##_inv(A, D);                                                       \
+    check("inverse" #n, n*n, C, D);                                           \
+    report("inverse " #n "x" #n,                                              \
+           BENCH("", matrix_inverse(n, A, B)),                                \
+           BENCH("", mat##n##_inv(A, B)));                                    \
+                                                                              \
+    mat##n##_cholesky(A, D);                                                  \
+    mat##n##_transpose(D, B);                                                 \
+    mat##n##_mul(D, B, C);                                                    \
+    check("cholesky" #n, n*n, A, C);                                          \
+    report("cholesky " #n "x" #n, 0,                                          \
+           BENCH("", mat##n##_cholesky(A, B)));                               \
+                                                                              \
+    sink = B[0];                                                              \
+  } while (0)
+
+int main(void)
+{
+#ifndef MATRIX_BENCH_HOST
+  init();
+
+  printf("\n\nFirmware info - git: " GIT_VERSION ", built: " __DATE__ " " __TIME__ "\n\r");
+#endif
+  printf("--- MATRIX KERNEL BENCHMARK ---\n\r");
+
+  BENCH_DIM(2, A2);
+  BENCH_DIM(3, A3);
+  BENCH_DIM(4, A4);
+
+#ifndef MATRIX_BENCH_HOST
+  led_off(LED_RED);
+  led_on(LED_GREEN);
+
+  while(1);
+#endif
+
+  return 0;
+}
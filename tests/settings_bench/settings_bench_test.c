@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* Device side cost of a console reading every setting, as the console does on
+ * connecting: one SBP_MSG_SETTINGS_READ_BY_INDEX_REQ per setting until
+ * SBP_MSG_SETTINGS_READ_BY_INDEX_DONE, followed by a SBP_MSG_SETTINGS_READ_REQ
+ * of each setting by name, and then the same with a single
+ * SBP_MSG_SETTINGS_READ_ALL_REQ. Timed in DWT cycles from the request being
+ * dispatched to the responses being queued for the USARTs, with about as many
+ * settings as the firmware registers and then four times as many.
+ *
+ * The time on the wire at 115200 baud is also given for the benchmark's own
+ * settings, a radio link adds its latency to every request on top. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <ch.h>
+
+#include <libsbp/settings.h>
+
+#include "init.h"
+#include "main.h"
+#include "sbp.h"
+#include "sbp_ext.h"
+#include "settings.h"
+#include "board/leds.h"
+#include "board/nap/nap_common.h"
+
+/** About the number of settings registered by the firmware. */
+#define BENCH_N_SETTINGS 70
+#define BENCH_SCALE 4
+#define BENCH_N_SECTIONS 10
+/** Time for each response to drain from the USART buffers [ms]. */
+#define BENCH_DRAIN_MS 2
+#define BENCH_BAUD 115200
+/** Preamble, type, sender, length and CRC around each SBP payload. */
+#define SBP_FRAME_OVERHEAD 8
+
+extern sbp_state_t uarta_sbp_state;
+
+static struct setting settings[BENCH_N_SETTINGS * BENCH_SCALE];
+static s32 values[BENCH_N_SETTINGS * BENCH_SCALE];
+static char sections[BENCH_N_SECTIONS][12];
+static char names[BENCH_N_SETTINGS * BENCH_SCALE][12];
+static u32 n_settings;
+
+static void register_settings(u32 n)
+{
+  for (; n_settings < n; n_settings++) {
+    struct setting *s = &settings[n_settings];
+    snprintf(names[n_settings], sizeof(names[0]), "value%u",
+             (unsigned int)n_settings);
+    s->section = sections[n_settings % BENCH_N_SECTIONS];
+    s->name = names[n_settings];
+    s->addr = &values[n_settings];
+    s->len = sizeof(values[0]);
+    s->notify = settings_default_notify;
+    settings_register(s, TYPE_INT);
+  }
+}
+
+/** Length of one of the benchmark's settings in a settings response. */
+static u32 setting_len(u32 i)
+{
+  char value[12];
+  snprintf(value, sizeof(value), "%ld", (long)values[i]);
+  return strlen(settings[i].section) + strlen(settings[i].name)
+         + strlen(value) + 3;
+}
+
+/** Bytes on the wire to read the benchmark's settings one at a time and all
+ * at once. */
+static void wire_bytes(u32 *by_index, u32 *all)
+{
+  u32 frame = sizeof(msg_settings_read_all_resp_t);
+  *by_index = 0;
+  *all = SBP_FRAME_OVERHEAD;
+  for (u32 i = 0; i < n_settings; i++) {
+    u32 len = setting_len(i);
+    *by_index += (SBP_FRAME_OVERHEAD + 2) + (SBP_FRAME_OVERHEAD + 2 + len);
+    if (frame + 1 + len > SBP_FRAMING_MAX_PAYLOAD_SIZE) {
+      *all += SBP_FRAME_OVERHEAD + frame;
+      frame = sizeof(msg_settings_read_all_resp_t);
+    }
+    frame += 1 + len;
+  }
+  *all += SBP_FRAME_OVERHEAD + frame;
+}
+
+/** Dispatch a request and return the cycles taken to handle it. */
+static u32 request(sbp_msg_callbacks_node_t *node, u8 len, u8 msg[])
+{
+  chThdSleepMilliseconds(BENCH_DRAIN_MS);
+  u32 t0 = DWT_CYCCNT;
+  node->cb(SBP_SENDER_ID, len, msg, node->context);
+  return DWT_CYCCNT - t0;
+}
+
+static void bench(void)
+{
+  sbp_msg_callbacks_node_t *by_index =
+    sbp_find_callback(&uarta_sbp_state, SBP_MSG_SETTINGS_READ_BY_INDEX_REQ);
+  sbp_msg_callbacks_node_t *by_name =
+    sbp_find_callback(&uarta_sbp_state, SBP_MSG_SETTINGS_READ_REQ);
+  sbp_msg_callbacks_node_t *all =
+    sbp_find_callback(&uarta_sbp_state, SBP_MSG_SETTINGS_READ_ALL_REQ);
+
+  u32 total = 0, first = 0, last = 0;
+  /* Settings registered by init() come first, then the bench's, and one more
+   * request to get SBP_MSG_SETTINGS_READ_BY_INDEX_DONE. */
+  for (u16 i = 0; i <= n_settings; i++) {
+    u8 msg[2] = {i & 0xFF, i >> 8};
+    u32 t = request(by_index, sizeof(msg), msg);
+    total += t;
+    if (i == 0)
+      first = t;
+    if (i == n_settings - 1)
+      last = t;
+  }
+  printf("%4u settings, read by index %8u cycles, "
+         "first %5u last %5u\n\r",
+         (unsigned int)n_settings, (unsigned int)total,
+         (unsigned int)first, (unsigned int)last);
+
+  total = 0;
+  for (u32 i = 0; i < n_settings; i++) {
+    u8 msg[64];
+    u8 len = snprintf((char *)msg, sizeof(msg), "%s%c%s",
+                      settings[i].section, '\0', settings[i].name) + 1;
+    total += request(by_name, len, msg);
+  }
+  printf("%4u settings, read by name  %8u cycles\n\r",
+         (unsigned int)n_settings, (unsigned int)total);
+
+  /* Includes waiting for the USART buffers to drain when the responses don't
+   * all fit in them. */
+  total = request(all, 0, NULL);
+  printf("%4u settings, read all      %8u cycles\n\r",
+         (unsigned int)n_settings, (unsigned int)total);
+
+  u32 by_index_bytes, all_bytes;
+  wire_bytes(&by_index_bytes, &all_bytes);
+  printf("%4u settings on the wire, by index %u requests %u bytes %u ms, "
+         "all 1 request %u bytes %u ms\n\r",
+         (unsigned int)n_settings, (unsigned int)n_settings + 1,
+         (unsigned int)by_index_bytes,
+         (unsigned int)(by_index_bytes * 10 * 1000 / BENCH_BAUD),
+         (unsigned int)all_bytes,
+         (unsigned int)(all_bytes * 10 * 1000 / BENCH_BAUD));
+}
+
+int main(void)
+{
+  init();
+  settings_setup();
+
+  printf("\n\nFirmware info - git: " GIT_VERSION ", built: " __DATE__ " " __TIME__ "\n\r");
+  printf("--- SETTINGS ENUMERATION BENCHMARK ---\n\r");
+
+  for (u32 i = 0; i < BENCH_N_SECTIONS; i++)
+    snprintf(sections[i], sizeof(sections[0]), "bench%u", (unsigned int)i);
+
+  register_settings(BENCH_N_SETTINGS);
+  bench();
+  register_settings(BENCH_N_SETTINGS * BENCH_SCALE);
+  bench();
+
+  led_off(LED_RED);
+  led_on(LED_GREEN);
+
+  while(1);
+
+  return 0;
+}
@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ * Contact: Fergus Noble <fergus@swift-nav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* Cost of the per channel tracking loop work done in tracking_channel_update()
+ * for each of the LOOP_PARAMS_* presets, in their first (1 ms) and second
+ * (coherent) stages. The kernels are run over a trace of 1 ms early, prompt
+ * and late correlations, accumulated to each stage's integration length as
+ * the NAP does, and each kernel is timed over the whole trace. The load is
+ * that of every tracking channel updating at the stage's rate.
+ *
+ * When built with the NAP emulator tracking_channel_update() itself is also
+ * timed, with every channel tracking an emulated satellite. The emulator is
+ * stepped by hand and the channels serviced as the NAP ISR thread does, so
+ * the time includes the emulated NAP register writes in place of SPI
+ * transfers.
+ *
+ * On target (built with `make NAP_EMULATOR=1` for the emulated channels) the
+ * timings are in DWT cycles and the load is of the STM32. On the host (built
+ * against the host firmware with `make host`, see the Makefile) they are in
+ * ns and the load is of one host core, and a trace file given on the command
+ * line, with one line of `I_E Q_E I_P Q_P I_L Q_L` per ms, replaces the
+ * synthetic one. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ch.h>
+
+#include <libswiftnav/constants.h>
+#include <libswiftnav/nav_msg.h>
+#include <libswiftnav/track.h>
+
+#include "init.h"
+#include "main.h"
+#include "settings.h"
+#include "track.h"
+#include "board/leds.h"
+#include "board/nap/nap_common.h"
+#include "board/nap/nap_emu.h"
+#include "board/nap/nap_exti.h"
+
+#ifdef PIKSI_HOST
+
+#include <time.h>
+
+#define BENCH_REPEATS 100
+#define BENCH_UNITS "ns"
+#define BENCH_UNITS_PER_S 1e9
+
+static u32 bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#else
+
+#include "sched_stats.h"
+
+#define BENCH_REPEATS 1
+#define BENCH_UNITS "cycles"
+#define BENCH_UNITS_PER_S (SCHED_DWT_TICKS_PER_US * 1e6)
+
+static u32 bench_now(void)
+{
+  return DWT_CYCCNT;
+}
+
+#endif
+
+/** Channels updated together, as on the NAP. */
+#define BENCH_CHANNELS NAP_MAX_N_TRACK_CHANNELS
+/** Length of the synthetic trace [ms], a whole number of nav bits. */
+#define TRACE_MS 1000
+/** Synthetic prompt amplitude and noise in 1 ms, about 45 dBHz. */
+#define TRACE_AMPLITUDE 600.0
+#define TRACE_NOISE 100.0
+
+#define CN0_EST_LPF_CUTOFF 0.3
+
+/** Emulated time the channels track each preset for [ms], long enough to bit
+ * sync and spend most of it in the second stage. */
+#define EMU_RUN_MS 5000
+/** Emulated sample clock step, short enough for no channel to end two
+ * integration periods in one step. */
+#define EMU_STEP_SAMPLES (SAMPLE_FREQ / 4000)
+#define EMU_CN0 45
+
+static const struct {
+  const char *name;
+  const char *params;
+} presets[] = {
+  {"slow", LOOP_PARAMS_SLOW},
+  {"med", LOOP_PARAMS_MED},
+  {"fast", LOOP_PARAMS_FAST},
+  {"extrafast", LOOP_PARAMS_EXTRAFAST},
+};
+
+/** Kernels timed, in the order tracking_channel_update() runs them. */
+enum {
+  K_NAV_MSG,
+  K_CN0,
+  K_LOCK_DETECT,
+  K_TL,
+  K_ALIAS_FIRST,
+  K_ALIAS_SECOND,
+  K_N
+};
+
+static const char *kernel_names[K_N] = {
+  "nav_msg_update",
+  "cn0_est",
+  "lock_detect_update",
+  "aided_tl_update",
+  "alias_detect_first",
+  "alias_detect_second",
+};
+
+static struct {
+  u32 time;
+  u32 calls;
+} kernels[K_N];
+
+static corr_t (*trace)[3];
+static u32 trace_ms;
+
+/* Keep the compiler from dropping the kernels' results. */
+static volatile float sink;
+
+/** Gaussian noise by the Box-Muller method. */
+static double noise(void)
+{
+  double u1 = (rand() + 1.0) / (RAND_MAX + 1.0);
+  double u2 = rand() / (double)RAND_MAX;
+  return TRACE_NOISE * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/** A locked channel: the prompt carries random nav bits, early and late see
+ * half the amplitude and there is a small residual phase error. */
+static void synthesise(void)
+{
+  static corr_t synthetic[TRACE_MS][3];
+  srand(1);
+  s32 bit = 1;
+  for (u32 i = 0; i < TRACE_MS; i++) {
+    if (i % 20 == 0)
+      bit = (rand() & 1) ? 1 : -1;
+    double phase = 0.1 * sin(2 * M_PI * i / 500.0);
+    for (u32 j = 0; j < 3; j++) {
+      double a = bit * TRACE_AMPLITUDE * (j == 1 ? 1.0 : 0.5);
+      synthetic[i][j].I = a * cos(phase) + noise();
+      synthetic[i][j].Q = a * sin(phase) + noise();
+    }
+  }
+  trace = synthetic;
+  trace_ms = TRACE_MS;
+}
+
+#ifdef PIKSI_HOST
+/** Load a trace of 1 ms correlations, one `I_E Q_E I_P Q_P I_L Q_L` per
+ * line. */
+static bool load(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+
+  u32 n = 0, len = 0;
+  corr_t (*t)[3] = NULL;
+  long c[6];
+  while (fscanf(f, "%ld %ld %ld %ld %ld %ld",
+                &c[0], &c[1], &c[2], &c[3], &c[4], &c[5]) == 6) {
+    if (n == len) {
+      len = len ? 2 * len : 4096;
+      t = realloc(t, len * sizeof(*t));
+      if (!t) {
+        fclose(f);
+        return false;
+      }
+    }
+    for (u32 j = 0; j < 3; j++) {
+      t[n][j].I = c[2*j];
+      t[n][j].Q = c[2*j + 1];
+    }
+    n++;
+  }
+  fclose(f);
+
+  if (n < 20) {
+    free(t);
+    return false;
+  }
+  trace = t;
+  trace_ms = n;
+  return true;
+}
+#endif
+
+/** One integration period, as read by tracking_channel_get_corrs(). */
+typedef struct {
+  corr_t first;  /**< Prompt of the short 1 ms cycle. */
+  corr_t cs[3];  /**< Early, prompt and late over the whole period. */
+} period_t;
+
+static period_t *periods;
+static u32 n_periods;
+
+/** Accumulate the trace to the stage's integration length as the NAP does,
+ * a short 1 ms cycle followed by the long cycle. */
+static void accumulate(u8 int_ms)
+{
+  n_periods = 0;
+  for (u32 ms = 0; ms + int_ms <= trace_ms; ms += int_ms) {
+    period_t *p = &periods[n_periods++];
+    p->first = trace[ms][1];
+    memset(p->cs, 0, sizeof(p->cs));
+    for (u32 i = 0; i < int_ms; i++) {
+      for (u32 j = 0; j < 3; j++) {
+        p->cs[j].I += trace[ms + i][j].I;
+        p->cs[j].Q += trace[ms + i][j].Q;
+      }
+    }
+  }
+}
+
+/** Time `call` over every period, `init` resetting the kernel's state before
+ * each repeat. The kernels only depend on their own state and the
+ * correlations so each is timed on its own, with one pair of timer reads
+ * around the whole run. */
+#define BENCH_KERNEL(k, init, call) do {                      \
+    kernels[k].time = 0;                                      \
+    for (u32 _r = 0; _r < BENCH_REPEATS; _r++) {              \
+      init;                                                   \
+      u32 _t0 = bench_now();                                  \
+      for (u32 _n = 0; _n < n_periods; _n++) {                \
+        const period_t *p = &periods[_n];                     \
+        (void)p;                                              \
+        call;                                                 \
+        __asm__ volatile("" ::: "memory");                    \
+      }                                                       \
+      kernels[k].time += bench_now() - _t0;                   \
+    }                                                         \
+    kernels[k].calls = n_periods * BENCH_REPEATS;             \
+  } while (0)
+
+/** Run one stage's kernels over the trace as tracking_channel_update()
+ * would. */
+static void run_stage(const loop_params_t *l, const loop_params_t *l1)
+{
+  aided_tl_state_t tl;
+  cn0_est_state_t cn0_est_state;
+  lock_detect_t ld;
+  alias_detect_t alias;
+  static nav_msg_t nav_msg;
+
+  u8 int_ms = l->coherent_ms;
+  float loop_freq = 1e3 / int_ms;
+
+  float k1, k2;
+  unsigned int lp, lo;
+  sscanf(LD_PARAMS_NORMAL, "%f , %f , %u , %u", &k1, &k2, &lp, &lo);
+
+  accumulate(int_ms);
+  memset(kernels, 0, sizeof(kernels));
+
+  BENCH_KERNEL(K_NAV_MSG, nav_msg_init(&nav_msg),
+               sink = nav_msg_update(&nav_msg, p->cs[1].I, int_ms));
+
+  BENCH_KERNEL(K_CN0,
+               cn0_est_init(&cn0_est_state, loop_freq, 45,
+                            CN0_EST_LPF_CUTOFF, loop_freq),
+               sink = cn0_est(&cn0_est_state, p->cs[1].I / int_ms,
+                              p->cs[1].Q / int_ms));
+
+  BENCH_KERNEL(K_LOCK_DETECT, lock_detect_init(&ld, k1 * int_ms, k2, lp, lo),
+               lock_detect_update(&ld, p->cs[1].I, p->cs[1].Q, int_ms));
+
+  BENCH_KERNEL(K_TL,
+               aided_tl_init(&tl, loop_freq, 0,
+                             l->code_bw, l->code_zeta, l->code_k,
+                             l->carr_to_code, 0,
+                             l->carr_bw, l->carr_zeta, l->carr_k,
+                             l->carr_fll_aid_gain),
+               ({
+                 /* Swapped to late, prompt, early as in track.c. */
+                 correlation_t cs2[3];
+                 for (u32 i = 0; i < 3; i++) {
+                   cs2[i].I = p->cs[2-i].I;
+                   cs2[i].Q = p->cs[2-i].Q;
+                 }
+                 aided_tl_update(&tl, cs2);
+                 sink = tl.carr_freq;
+               }));
+
+  /* Alias detection compares the short cycle against the rest of the long
+   * cycle, so only runs with longer integrations. */
+  if (int_ms == 1)
+    return;
+
+  BENCH_KERNEL(K_ALIAS_FIRST,
+               alias_detect_init(&alias, 500 / l1->coherent_ms,
+                                 (l1->coherent_ms - 1) * 1e-3),
+               alias_detect_first(&alias, p->first.I, p->first.Q));
+
+  BENCH_KERNEL(K_ALIAS_SECOND,
+               alias_detect_init(&alias, 500 / l1->coherent_ms,
+                                 (l1->coherent_ms - 1) * 1e-3),
+               ({
+                 alias.first_I = p->first.I;
+                 alias.first_Q = p->first.Q;
+                 s32 I = (p->cs[1].I - p->first.I) / (int_ms - 1);
+                 s32 Q = (p->cs[1].Q - p->first.Q) / (int_ms - 1);
+                 sink = alias_detect_second(&alias, I, Q);
+               }));
+}
+
+#ifdef NAP_EMULATOR
+
+/** tracking_channel_update() time in each stage, and the emulated samples
+ * tracked by the channels while in it. */
+static struct {
+  u32 time;
+  u32 calls;
+  u64 samples;
+} updates[2];
+
+/** Track an emulated satellite on every channel with the loop parameters l,
+ * timing tracking_channel_update(). */
+static void run_emulated(const loop_params_t l[2])
+{
+  memset(updates, 0, sizeof(updates));
+  tracking_set_loop_params(l);
+
+  /* Start the channels on a code epoch of their satellites. */
+  u32 ms = SAMPLE_FREQ / 1000;
+  u32 start = (nap_emu_sample_count() / ms + 2) * ms;
+  for (u8 ch = 0; ch < BENCH_CHANNELS; ch++) {
+    nap_emu_sat_t sat = {
+      .prn = ch,
+      .visible = true,
+      .cn0 = EMU_CN0,
+      .doppler = -3000 + 500 * ch,
+      .carr_phase = 0,
+    };
+    double rate = GPS_CA_CHIPPING_RATE * (1 + sat.doppler / GPS_L1_HZ);
+    sat.code_phase = 1023.0 - fmod((double)start / SAMPLE_FREQ * rate, 1023.0);
+    nap_emu_sat_set(&sat);
+    tracking_channel_init(ch, sat.prn, sat.doppler, start, EMU_CN0,
+                          TRACKING_ELEVATION_UNKNOWN);
+  }
+
+  for (u32 n = 0; n < (u64)EMU_RUN_MS * ms / EMU_STEP_SAMPLES; n++) {
+    nap_emu_advance(EMU_STEP_SAMPLES);
+
+    u32 irq = nap_read_u32(NAP_REG_IRQ) & NAP_IRQ_TRACK_MASK;
+    for (u8 ch = 0; ch < BENCH_CHANNELS; ch++) {
+      u8 stage = tracking_channel[ch].stage;
+      updates[stage].samples += EMU_STEP_SAMPLES;
+      if (!(irq & (1 << ch)))
+        continue;
+
+      tracking_channel_get_corrs(ch);
+      u32 t0 = bench_now();
+      tracking_channel_update(ch);
+      updates[stage].time += bench_now() - t0;
+      updates[stage].calls++;
+    }
+  }
+
+  /* Leave no channel's IRQ raised for the next preset. */
+  nap_emu_advance(20 * ms);
+  u32 irq = nap_read_u32(NAP_REG_IRQ) & NAP_IRQ_TRACK_MASK;
+  for (u8 ch = 0; ch < BENCH_CHANNELS; ch++)
+    if (irq & (1 << ch))
+      tracking_channel_get_corrs(ch);
+}
+
+#endif
+
+static void report(const char *name, u8 stage, u8 int_ms)
+{
+  printf("%s, stage %u (%u ms)\n\r", name, stage, int_ms);
+
+  float update = 0;
+  for (u32 k = 0; k < K_N; k++) {
+    if (kernels[k].calls == 0)
+      continue;
+    float per_call = (float)kernels[k].time / kernels[k].calls;
+    update += per_call;
+    printf("  %-20s %8.1f " BENCH_UNITS "\n\r", kernel_names[k], per_call);
+  }
+
+  float load = update * (1e3 / int_ms) * BENCH_CHANNELS / BENCH_UNITS_PER_S;
+  printf("  %-20s %8.1f " BENCH_UNITS ", %u channels %.2f%% CPU\n\r",
+         "kernels", update, BENCH_CHANNELS, 100 * load);
+
+#ifdef NAP_EMULATOR
+  if (updates[stage].calls == 0) {
+    printf("  %-20s no channels reached this stage\n\r",
+           "tracking_channel_update");
+    return;
+  }
+  /* Short cycles are cheap so go by the time per second tracked rather than
+   * per call. */
+  load = updates[stage].time * ((double)SAMPLE_FREQ / updates[stage].samples)
+         * BENCH_CHANNELS / BENCH_UNITS_PER_S;
+  printf("  %-20s %8.1f " BENCH_UNITS ", %u channels %.2f%% CPU\n\r",
+         "tracking_channel_update",
+         (float)updates[stage].time / updates[stage].calls,
+         BENCH_CHANNELS, 100 * load);
+#endif
+}
+
+#ifdef PIKSI_HOST
+int main(int argc, char *argv[])
+{
+  /* As in main(), init() starts threads. */
+  chSysInit();
+  init();
+
+  if (argc > 1 && !load(argv[1])) {
+    printf("Can't read trace %s\n", argv[1]);
+    return 1;
+  }
+#else
+int main(void)
+{
+  /* As in main(), init() starts threads. */
+  chSysInit();
+  init();
+
+  printf("\n\nFirmware info - git: " GIT_VERSION ", built: " __DATE__ " " __TIME__ "\n\r");
+#endif
+  printf("--- TRACKING LOOP BENCHMARK ---\n\r");
+
+#ifdef NAP_EMULATOR
+  /* Lock detector parameters for tracking_channel_init(). */
+  settings_setup();
+  tracking_setup();
+
+  /* Step the emulator here, and keep the NAP ISR thread from servicing the
+   * channels. */
+  nap_emu_free_run(false);
+  chThdSetPriority(HIGHPRIO);
+#endif
+
+  if (!trace)
+    synthesise();
+
+  periods = malloc(trace_ms * sizeof(period_t));
+  if (!periods) {
+    printf("Out of memory\n\r");
+    return 1;
+  }
+  printf("trace %u ms\n\r", (unsigned int)trace_ms);
+
+  for (u32 p = 0; p < sizeof(presets) / sizeof(presets[0]); p++) {
+    loop_params_t l[2];
+    if (!tracking_parse_loop_params(presets[p].params, l)) {
+      printf("Can't parse %s loop params\n\r", presets[p].name);
+      continue;
+    }
+#ifdef NAP_EMULATOR
+    run_emulated(l);
+#endif
+    for (u8 stage = 0; stage < 2; stage++) {
+      run_stage(&l[stage], &l[1]);
+      report(presets[p].name, stage, l[stage].coherent_ms);
+    }
+  }
+
+#ifndef PIKSI_HOST
+  led_off(LED_RED);
+  led_on(LED_GREEN);
+
+  while(1);
+#endif
+
+  return 0;
+}